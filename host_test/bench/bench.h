@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Helpers for the host benchmarks. Under ctest BENCH_QUICK is set and every loop runs a thousandth of
+ * its iterations, so the benchmarks only prove they still build and run; time a Release build without
+ * sanitizers for numbers.
+ */
+
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline long bench_iterations(long full)
+{
+    if (getenv("BENCH_QUICK") == NULL) {
+        return full;
+    }
+    return full / 1000 > 0 ? full / 1000 : 1;
+}
+
+static int bench_compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Sorts samples in place and returns the p-th percentile (0..100). */
+static inline uint64_t bench_percentile(uint64_t *samples, size_t count, double p)
+{
+    if (count == 0) {
+        return 0;
+    }
+    qsort(samples, count, sizeof(samples[0]), bench_compare_u64);
+    size_t index = (size_t)(p / 100.0 * (double)(count - 1) + 0.5);
+    return samples[index < count ? index : count - 1];
+}
+
+/* Keeps results observable so the optimizer cannot drop the timed work. */
+extern volatile uint64_t bench_sink;
+
+#define BENCH_DEFINE_GLOBALS volatile uint64_t bench_sink = 0
+
+/* Heap calls so far; only counted in benchmarks linked through bench_count_allocations(). */
+extern unsigned long bench_allocations;
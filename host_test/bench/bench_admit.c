@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_server.h"
+#include "chat/frame.h"
+#include "chat/sessions.h"
+#include "chat_config.h"
+#include "esp_timer.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * The session work of one inbound text frame with CLIENTS joined slots, frames round-robin: the
+ * chat_sessions_ensure_slot() with the slot hint and chat_sessions_admit_frame() that
+ * chat_ws_handler() does now, against the separate scans it replaced (ensure_slot, take_token,
+ * is_joined, identity_matches and update_time_sample, copied below except the last, which still
+ * exists). client_mutex acquisitions are counted through -Wl,--wrap=xSemaphoreTake.
+ */
+#define CLIENTS 10
+
+static unsigned long s_client_takes;
+
+BaseType_t __real_xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks);
+
+BaseType_t __wrap_xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks)
+{
+    s_client_takes += mutex == g_app_context.client_mutex;
+    return __real_xSemaphoreTake(mutex, ticks);
+}
+
+static bool scan_ensure_slot(app_context_t *ctx, int fd)
+{
+    bool ready = false;
+    xSemaphoreTake(ctx->client_mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (ctx->client_slots[i].active && ctx->client_slots[i].fd == fd) {
+            ctx->client_slots[i].is_alive = true;
+            ready = true;
+            break;
+        }
+    }
+    xSemaphoreGive(ctx->client_mutex);
+    return ready;
+}
+
+static bool scan_take_token(app_context_t *ctx, int fd, bool *notify)
+{
+    bool allowed = true;
+    *notify = false;
+    xSemaphoreTake(ctx->client_mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (!ctx->client_slots[i].active || ctx->client_slots[i].fd != fd) {
+            continue;
+        }
+        chat_token_bucket_t *bucket = &ctx->client_slots[i].buckets[CHAT_RATE_CHAT];
+        int64_t now_ms = esp_timer_get_time() / 1000;
+        uint64_t tokens = bucket->milli_tokens + (uint64_t)(now_ms - bucket->refill_ms) * RATE_CHAT_PER_S;
+        bucket->milli_tokens = tokens > RATE_CHAT_BURST * 1000 ? RATE_CHAT_BURST * 1000 : (uint32_t)tokens;
+        bucket->refill_ms = now_ms;
+        if (bucket->milli_tokens >= 1000) {
+            bucket->milli_tokens -= 1000;
+            bucket->limited = false;
+        } else {
+            allowed = false;
+            *notify = !bucket->limited;
+            bucket->limited = true;
+        }
+        break;
+    }
+    xSemaphoreGive(ctx->client_mutex);
+    return allowed;
+}
+
+static bool scan_is_joined(app_context_t *ctx, int fd)
+{
+    bool joined = false;
+    xSemaphoreTake(ctx->client_mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (ctx->client_slots[i].active && ctx->client_slots[i].fd == fd) {
+            joined = ctx->client_slots[i].joined && ctx->client_slots[i].user_id[0] != '\0';
+            break;
+        }
+    }
+    xSemaphoreGive(ctx->client_mutex);
+    return joined;
+}
+
+static bool scan_identity_matches(app_context_t *ctx, int fd, const char *user_id)
+{
+    bool matches = false;
+    xSemaphoreTake(ctx->client_mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (ctx->client_slots[i].active && ctx->client_slots[i].fd == fd) {
+            matches = ctx->client_slots[i].joined && ctx->client_slots[i].user_id[0] != '\0' &&
+                strcmp(ctx->client_slots[i].user_id, user_id) == 0;
+            break;
+        }
+    }
+    xSemaphoreGive(ctx->client_mutex);
+    return matches;
+}
+
+int main(void)
+{
+    static bench_conn_t conns[CLIENTS];
+    static char texts[CLIENTS][512];
+    static chat_frame_t frames[CLIENTS];
+    static char from[CLIENTS][MAX_USER_ID_LEN + 1];
+    static client_slot_t *hints[CLIENTS];
+    app_context_t *ctx = &g_app_context;
+
+    bench_server_start(false);
+    /* A still clock keeps the timestamp offsets, so no frame refreshes the consensus. */
+    host_clock_set_manual(true);
+    for (int c = 0; c < CLIENTS; c++) {
+        bench_connect(&conns[c], c);
+        bench_join(&conns[c], NULL);
+        size_t len = (size_t)snprintf(texts[c], sizeof(texts[c]), "{\"type\":\"text\",\"from\":\"%s\","
+                                      "\"to\":{\"all\":true,\"users\":[]},\"name\":\"%s\",\"data\":\"ok\","
+                                      "\"timestamp\":%lld}", bench_client_id(c), bench_client_name(c),
+                                      (long long)(1735689600 + esp_timer_get_time() / 1000000));
+        if (!chat_frame_parse(texts[c], len, &frames[c])) {
+            fprintf(stderr, "client %d: the text frame does not scan\n", c);
+            return EXIT_FAILURE;
+        }
+        chat_field_copy(from[c], sizeof(from[c]), &frames[c].from);
+    }
+
+    long rounds = bench_iterations(2000000);
+    unsigned long takes = s_client_takes;
+    uint64_t start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        int c = (int)(r % CLIENTS);
+        int fd = conns[c].fd;
+        bool notify = false;
+        bool admitted = scan_ensure_slot(ctx, fd) && scan_take_token(ctx, fd, &notify) && scan_is_joined(ctx, fd) &&
+            scan_identity_matches(ctx, fd, from[c]);
+        if (admitted) {
+            chat_sessions_update_time_sample(ctx, fd, &frames[c].timestamp);
+        }
+        bench_sink += admitted;
+    }
+    double scan_ns = (double)(bench_now_ns() - start) / rounds;
+    double scan_takes = (double)(s_client_takes - takes) / rounds;
+
+    takes = s_client_takes;
+    start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        int c = (int)(r % CLIENTS);
+        chat_session_t session;
+        chat_admission_t admission;
+        chat_sessions_ensure_slot(ctx, conns[c].fd, hints[c], &session);
+        hints[c] = session.slot;
+        chat_sessions_admit_frame(ctx, &session, &frames[c], CHAT_RATE_CHAT, &admission);
+        bench_sink += admission.allowed && admission.identity_ok;
+    }
+    double admit_ns = (double)(bench_now_ns() - start) / rounds;
+    double admit_takes = (double)(s_client_takes - takes) / rounds;
+
+    if (bench_sink != 2 * (uint64_t)rounds) {
+        fprintf(stderr, "not every frame was admitted\n");
+        return EXIT_FAILURE;
+    }
+    printf("%d joined slots, %ld frames\n", CLIENTS, rounds);
+    printf("  separate scans  %.0f client_mutex takes, %5.1f ns per frame\n", scan_takes, scan_ns);
+    printf("  admit_frame     %.0f client_mutex takes, %5.1f ns per frame\n", admit_takes, admit_ns);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+#include <stddef.h>
+
+#include "bench.h"
+
+/*
+ * Heap call counter for benchmarks set up with bench_count_allocations(): the linker routes every
+ * malloc, calloc and realloc in the benchmark's own objects here. The C library's internal
+ * allocations are not counted.
+ */
+unsigned long bench_allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    bench_allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    bench_allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    bench_allocations++;
+    return __real_realloc(ptr, size);
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "chat/compress.h"
+
+BENCH_DEFINE_GLOBALS;
+
+#define BUF_BYTES 4096
+
+/* Representative stored frames: a broadcast, a direct message, a group invite and a CJK broadcast. */
+static const char *const s_samples[] = {
+    "{\"type\":\"text\",\"from\":\"3f2504e0-4f89-41d3-9a0c-0305e82c3301\","
+    "\"to\":{\"all\":true,\"users\":[]},\"name\":\"Alice\",\"data\":\"hello everyone, lunch at noon?\","
+    "\"id\":1042,\"timestamp\":1735689600}",
+    "{\"type\":\"text\",\"from\":\"3f2504e0-4f89-41d3-9a0c-0305e82c3301\","
+    "\"to\":{\"all\":false,\"users\":[\"8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90\"]},\"name\":\"Alice\","
+    "\"data\":\"see you at 6\",\"id\":1043,\"timestamp\":1735689601}",
+    "{\"type\":\"newGroup\",\"from\":\"8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90\","
+    "\"to\":{\"all\":false,\"users\":[\"3f2504e0-4f89-41d3-9a0c-0305e82c3301\","
+    "\"d3b07384-d9a0-4c9b-8f3e-6a1b2c3d4e5f\"]},\"name\":\"Bob\","
+    "\"groupId\":\"6ba7b810-9dad-11d1-80b4-00c04fd430c8\",\"groupName\":\"Ops\",\"id\":1044,\"timestamp\":1735689602}",
+    "{\"type\":\"text\",\"from\":\"d3b07384-d9a0-4c9b-8f3e-6a1b2c3d4e5f\",\"to\":{\"all\":true,\"users\":[]},"
+    "\"name\":\"小明\",\"data\":\"大家好，今晚的会议改到七点。\",\"id\":1045,\"timestamp\":1735689603}",
+};
+
+#define SAMPLE_COUNT (sizeof(s_samples) / sizeof(s_samples[0]))
+
+int main(void)
+{
+    static uint8_t packed[SAMPLE_COUNT][BUF_BYTES];
+    static char plain[BUF_BYTES];
+    size_t packed_len[SAMPLE_COUNT];
+    size_t raw_total = 0;
+    size_t packed_total = 0;
+
+    for (size_t i = 0; i < SAMPLE_COUNT; i++) {
+        size_t len = strlen(s_samples[i]);
+        packed_len[i] = chat_compress(s_samples[i], len, packed[i], BUF_BYTES);
+        if (packed_len[i] == 0 || chat_decompress(packed[i], packed_len[i], plain, sizeof(plain)) != len ||
+            memcmp(plain, s_samples[i], len) != 0) {
+            fprintf(stderr, "sample %zu does not round-trip\n", i);
+            return EXIT_FAILURE;
+        }
+        printf("sample %zu: %zu -> %zu bytes (%.2fx)\n", i, len, packed_len[i], (double)len / packed_len[i]);
+        raw_total += len;
+        packed_total += packed_len[i];
+    }
+    printf("all samples: %zu -> %zu bytes (%.2fx)\n", raw_total, packed_total, (double)raw_total / packed_total);
+
+    long rounds = bench_iterations(200000);
+    uint64_t start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        const char *src = s_samples[r % SAMPLE_COUNT];
+        bench_sink += chat_compress(src, strlen(src), packed[r % SAMPLE_COUNT], BUF_BYTES);
+    }
+    uint64_t compress_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        size_t i = (size_t)r % SAMPLE_COUNT;
+        bench_sink += chat_decompress(packed[i], packed_len[i], plain, sizeof(plain));
+    }
+    uint64_t decompress_ns = bench_now_ns() - start;
+
+    double plain_bytes = (double)raw_total * rounds / SAMPLE_COUNT;
+    printf("compress:   %.0f ns/message, %.0f MB/s of plain text\n", (double)compress_ns / rounds,
+           plain_bytes / 1e6 / (compress_ns / 1e9));
+    printf("decompress: %.0f ns/message, %.0f MB/s of plain text\n", (double)decompress_ns / rounds,
+           plain_bytes / 1e6 / (decompress_ns / 1e9));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_server.h"
+#include "cJSON.h"
+#include "chat/history.h"
+#include "chat/payload.h"
+#include "chat/sessions.h"
+#include "chat_config.h"
+#include "common/utils.h"
+#include "server/websocket_server.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Server control messages with MAX_CLIENTS clients joined, sent to one of them: error frames,
+ * historyInfo and onlineUsers from the json_writer templates and payload caches, against the
+ * cJSON builders they replaced. Cached payloads are timed both as served and rebuilt.
+ */
+
+static esp_err_t send_printed(app_context_t *ctx, int fd, cJSON *root)
+{
+    char *payload = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (payload == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t ret = chat_ws_send_text(ctx, fd, payload);
+    free(payload);
+    return ret;
+}
+
+static void cjson_error(app_context_t *ctx, int fd)
+{
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "type", "error");
+    cJSON_AddStringToObject(root, "from", "server");
+    cJSON_AddStringToObject(root, "code", "bad_target");
+    cJSON_AddStringToObject(root, "data", "Sender is not a member of the target group");
+    cJSON_AddNumberToObject(root, "timestamp", current_timestamp_s(ctx));
+    send_printed(ctx, fd, root);
+}
+
+static void writer_error(app_context_t *ctx, int fd)
+{
+    chat_ws_send_error(ctx, fd, "bad_target", "Sender is not a member of the target group");
+}
+
+static void cjson_history_info(app_context_t *ctx, int fd)
+{
+    history_bounds_t bounds;
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "type", "historyInfo");
+    cJSON_AddStringToObject(root, "from", "server");
+    cJSON_AddNumberToObject(root, "timestamp", current_timestamp_s(ctx));
+    cJSON *to = cJSON_AddObjectToObject(root, "to");
+    cJSON_AddArrayToObject(to, "users");
+    cJSON_AddBoolToObject(to, "all", true);
+
+    xSemaphoreTake(ctx->message_mutex, portMAX_DELAY);
+    chat_history_fill_bounds_locked(ctx, &bounds);
+    xSemaphoreGive(ctx->message_mutex);
+
+    cJSON_AddNumberToObject(root, "boot_start_id", (double)bounds.boot_start_id);
+    cJSON_AddNumberToObject(root, "current_id", (double)bounds.current_id);
+    cJSON_AddNumberToObject(root, "earliest_id", (double)bounds.earliest_id);
+    cJSON_AddNumberToObject(root, "latest_id", (double)bounds.latest_id);
+    cJSON_AddNumberToObject(root, "restore_before_id", (double)bounds.restore_before_id);
+    cJSON_AddNumberToObject(root, "count", bounds.count);
+    cJSON_AddNumberToObject(root, "capacity", bounds.capacity);
+    cJSON_AddBoolToObject(root, "has_more_before", bounds.has_more_before);
+    cJSON_AddNumberToObject(root, "bytes_capacity", (double)bounds.bytes_capacity);
+    cJSON_AddNumberToObject(root, "bytes_used", (double)bounds.bytes_used);
+    cJSON_AddNumberToObject(root, "bytes_wasted", (double)(bounds.bytes_used - bounds.bytes_live + bounds.bytes_gap));
+    cJSON_AddNumberToObject(root, "heap_fallbacks", bounds.heap_fallbacks);
+    cJSON_AddNumberToObject(root, "log_commits", bounds.log_commits);
+    cJSON_AddNumberToObject(root, "log_dropped", bounds.log_dropped);
+    send_printed(ctx, fd, root);
+}
+
+static void cached_history_info(app_context_t *ctx, int fd)
+{
+    chat_history_send_info_to_client(ctx, fd);
+}
+
+/* The cache compares bounds, so clearing the saved ones forces the rebuild a new message causes. */
+static void rebuilt_history_info(app_context_t *ctx, int fd)
+{
+    xSemaphoreTake(ctx->message_mutex, portMAX_DELAY);
+    memset(&ctx->history_info_bounds, 0, sizeof(ctx->history_info_bounds));
+    xSemaphoreGive(ctx->message_mutex);
+    chat_history_send_info_to_client(ctx, fd);
+}
+
+static void cjson_online_users(app_context_t *ctx, int fd)
+{
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddStringToObject(root, "type", "onlineUsers");
+    cJSON_AddStringToObject(root, "from", "server");
+    cJSON_AddNumberToObject(root, "timestamp", current_timestamp_s(ctx));
+    cJSON *to = cJSON_AddObjectToObject(root, "to");
+    cJSON *users = cJSON_AddArrayToObject(to, "users");
+    cJSON *data = cJSON_AddArrayToObject(root, "data");
+    cJSON_AddBoolToObject(to, "all", true);
+
+    xSemaphoreTake(ctx->client_mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        const client_slot_t *slot = &ctx->client_slots[i];
+        if (!slot->active || !slot->joined || slot->user_id[0] == '\0') {
+            continue;
+        }
+        cJSON_AddItemToArray(users, cJSON_CreateString(slot->user_id));
+        cJSON *entry = cJSON_CreateObject();
+        cJSON_AddStringToObject(entry, "id", slot->user_id);
+        cJSON_AddStringToObject(entry, "name", slot->name[0] ? slot->name : "New User");
+        cJSON_AddItemToArray(data, entry);
+    }
+    xSemaphoreGive(ctx->client_mutex);
+    send_printed(ctx, fd, root);
+}
+
+static void cached_online_users(app_context_t *ctx, int fd)
+{
+    chat_payload_t *payload = chat_sessions_online_users_payload(ctx);
+    chat_ws_send_payload(ctx, fd, payload);
+    chat_payload_release(payload);
+}
+
+/* As a change of the joined set leaves it. */
+static void rebuilt_online_users(app_context_t *ctx, int fd)
+{
+    xSemaphoreTake(ctx->client_mutex, portMAX_DELAY);
+    chat_payload_release(ctx->online_users_payload);
+    ctx->online_users_payload = NULL;
+    xSemaphoreGive(ctx->client_mutex);
+    cached_online_users(ctx, fd);
+}
+
+static void run(const char *label, void (*send)(app_context_t *, int))
+{
+    long rounds = bench_iterations(1000000);
+    bench_traffic_reset();
+    unsigned long allocations = bench_allocations;
+    uint64_t start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        send(&g_app_context, HOST_WS_FIRST_FD);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    printf("  %-22s %6.0f ns  %5.1f allocations  %4.0f bytes\n", label, (double)elapsed / rounds,
+           (double)(bench_allocations - allocations) / rounds, (double)bench_traffic[0].bytes / rounds);
+}
+
+int main(void)
+{
+    static bench_conn_t conns[MAX_CLIENTS];
+    bench_server_start(false);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        bench_connect(&conns[i], i);
+        bench_join(&conns[i], NULL);
+    }
+    for (uint64_t seed = 1; seed <= MAX_MESSAGES; seed++) {
+        bench_store_message(seed);
+    }
+
+    printf("error\n");
+    run("cJSON", cjson_error);
+    run("writer", writer_error);
+    printf("historyInfo\n");
+    run("cJSON", cjson_history_info);
+    run("writer, rebuilt", rebuilt_history_info);
+    run("writer, cached", cached_history_info);
+    printf("onlineUsers, %d users\n", MAX_CLIENTS);
+    run("cJSON", cjson_online_users);
+    run("writer, rebuilt", rebuilt_online_users);
+    run("writer, cached", cached_online_users);
+    return EXIT_SUCCESS;
+}
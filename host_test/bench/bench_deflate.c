@@ -0,0 +1,146 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_messages.h"
+#include "chat_config.h"
+#include "common/deflate.h"
+
+#ifdef BENCH_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Replays 300 stored text messages the way a join does, once packed into historyBatch frames as
+ * chat/history.c builds them and once one message per frame, and deflates every frame that
+ * websocket_server.c would compress. With zlib available each output is inflated and compared.
+ */
+#define REPLAY_MESSAGES   300
+#define MESSAGE_BYTES     512
+#define BATCH_PREFIX      "{\"type\":\"historyBatch\",\"from\":\"server\",\"messages\":["
+#define BATCH_SUFFIX      "]}"
+
+typedef struct {
+    char text[HISTORY_BATCH_MAX_BYTES];
+    size_t len;
+} frame_t;
+
+static frame_t s_frames[REPLAY_MESSAGES];
+static int s_frame_count;
+
+static void add_frame(const char *text, size_t len)
+{
+    memcpy(s_frames[s_frame_count].text, text, len);
+    s_frames[s_frame_count].len = len;
+    s_frame_count++;
+}
+
+static void build_frames(bool batched)
+{
+    char message[MESSAGE_BYTES];
+    char batch[HISTORY_BATCH_MAX_BYTES];
+    size_t len = 0;
+    int pending = 0;
+
+    s_frame_count = 0;
+    for (uint64_t id = 1; id <= REPLAY_MESSAGES; id++) {
+        size_t need = bench_text_message(message, sizeof(message), id);
+        if (!batched) {
+            add_frame(message, need);
+            continue;
+        }
+        if (pending > 0 && len + need + 1 + sizeof(BATCH_SUFFIX) > sizeof(batch)) {
+            memcpy(batch + len, BATCH_SUFFIX, sizeof(BATCH_SUFFIX) - 1);
+            add_frame(batch, len + sizeof(BATCH_SUFFIX) - 1);
+            pending = 0;
+        }
+        if (pending == 0) {
+            memcpy(batch, BATCH_PREFIX, sizeof(BATCH_PREFIX) - 1);
+            len = sizeof(BATCH_PREFIX) - 1;
+        } else {
+            batch[len++] = ',';
+        }
+        memcpy(batch + len, message, need);
+        len += need;
+        pending++;
+    }
+    if (pending > 0) {
+        memcpy(batch + len, BATCH_SUFFIX, sizeof(BATCH_SUFFIX) - 1);
+        add_frame(batch, len + sizeof(BATCH_SUFFIX) - 1);
+    }
+}
+
+static bool inflates_to(const uint8_t *packed, size_t packed_len, const frame_t *frame)
+{
+#ifdef BENCH_HAVE_ZLIB
+    static uint8_t plain[HISTORY_BATCH_MAX_BYTES];
+    z_stream stream = { 0 };
+    if (inflateInit2(&stream, -15) != Z_OK) {
+        return false;
+    }
+    stream.next_in = (Bytef *)packed;
+    stream.avail_in = (uInt)packed_len;
+    stream.next_out = plain;
+    stream.avail_out = sizeof(plain);
+    int ret = inflate(&stream, Z_FINISH);
+    size_t out_len = stream.total_out;
+    inflateEnd(&stream);
+    return ret == Z_STREAM_END && out_len == frame->len && memcmp(plain, frame->text, out_len) == 0;
+#else
+    return true;
+#endif
+}
+
+static bool run(const char *label, int window_bits)
+{
+    static uint8_t packed[HISTORY_BATCH_MAX_BYTES];
+    size_t raw_total = 0;
+    size_t sent_total = 0;
+
+    for (int i = 0; i < s_frame_count; i++) {
+        const frame_t *frame = &s_frames[i];
+        raw_total += frame->len;
+        size_t packed_len = 0;
+        if (frame->len >= WS_DEFLATE_MIN_BYTES) {
+            packed_len = deflate_raw((const uint8_t *)frame->text, frame->len, packed, frame->len - 2, window_bits);
+        }
+        if (packed_len > 0 && !inflates_to(packed, packed_len, frame)) {
+            fprintf(stderr, "%s frame %d does not inflate back at %d bits\n", label, i, window_bits);
+            return false;
+        }
+        /* As in websocket_server.c: the tag byte plus the stream, or the text when that is not smaller. */
+        sent_total += packed_len > 0 ? packed_len + 1 : frame->len;
+    }
+
+    long rounds = bench_iterations(2000);
+    uint64_t start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        const frame_t *frame = &s_frames[r % s_frame_count];
+        bench_sink += deflate_raw((const uint8_t *)frame->text, frame->len, packed, sizeof(packed), window_bits);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+
+    printf("%-9s %2d bits: %4d frames, %6zu -> %6zu bytes (%3.0f%%), %6.1f us/frame\n", label, window_bits,
+           s_frame_count, raw_total, sent_total, 100.0 * sent_total / raw_total, elapsed / 1e3 / rounds);
+    return true;
+}
+
+int main(void)
+{
+#ifndef BENCH_HAVE_ZLIB
+    printf("zlib not found: outputs are not inflated back\n");
+#endif
+    bool ok = true;
+    build_frames(true);
+    for (int bits = DEFLATE_MIN_WINDOW_BITS; bits <= DEFLATE_MAX_WINDOW_BITS; bits++) {
+        ok = run("batched", bits) && ok;
+    }
+    build_frames(false);
+    for (int bits = DEFLATE_MIN_WINDOW_BITS; bits <= DEFLATE_MAX_WINDOW_BITS; bits++) {
+        ok = run("per-frame", bits) && ok;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
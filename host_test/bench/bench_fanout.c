@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_server.h"
+#include "cJSON.h"
+#include "chat/frame.h"
+#include "chat/groups.h"
+#include "chat/sessions.h"
+#include "chat_config.h"
+#include "common/utils.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Resolving the sessions a targeted message goes to, with MAX_CLIENTS clients joined and
+ * a GROUP_SIZE group, built as bench_fanout_<clients>: the other members as a to.users list through
+ * chat_sessions_user_fds(), against the per-slot string search over the cJSON array it replaced,
+ * and a registered group through chat_sessions_group_fds().
+ */
+#define GROUP_SIZE 10
+
+/* relay_payload_to_targets() before interning: every joined slot searched the whole list. */
+static int scan_user_fds(app_context_t *ctx, cJSON *users, int *fds)
+{
+    int count = 0;
+    xSemaphoreTake(ctx->client_mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        const client_slot_t *slot = &ctx->client_slots[i];
+        if (slot->active && slot->joined && json_array_contains_string(users, slot->user_id)) {
+            fds[count++] = slot->fd;
+        }
+    }
+    xSemaphoreGive(ctx->client_mutex);
+    return count;
+}
+
+/* Client 0 and GROUP_SIZE - 1 others spread over the slots. */
+static size_t write_group_frame(char *buf, size_t cap)
+{
+    int len = snprintf(buf, cap, "{\"type\":\"newGroup\",\"from\":\"%s\",\"name\":\"%s\","
+                       "\"groupId\":\"6ba7b810-9dad-11d1-80b4-00c04fd430c8\",\"groupName\":\"Ops\","
+                       "\"to\":{\"all\":false,\"users\":[", bench_client_id(0), bench_client_name(0));
+    for (int m = 0; m < GROUP_SIZE - 1; m++) {
+        int index = 1 + m * (MAX_CLIENTS - 1) / (GROUP_SIZE - 1);
+        len += snprintf(buf + len, cap - (size_t)len, "%s\"%s\"", m ? "," : "", bench_client_id(index));
+    }
+    len += snprintf(buf + len, cap - (size_t)len, "]},\"data\":\"Ops\",\"timestamp\":1735689600}");
+    return (size_t)len;
+}
+
+int main(void)
+{
+    static bench_conn_t conns[MAX_CLIENTS];
+    static char text[2048];
+    app_context_t *ctx = &g_app_context;
+    int fds[MAX_CLIENTS];
+
+    bench_server_start(false);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        bench_connect(&conns[i], i);
+        bench_join(&conns[i], NULL);
+    }
+
+    size_t len = write_group_frame(text, sizeof(text));
+    chat_frame_t frame;
+    cJSON *root = cJSON_ParseWithLength(text, len);
+    cJSON *users = cJSON_GetObjectItem(cJSON_GetObjectItem(root, "to"), "users");
+    if (!chat_frame_parse(text, len, &frame) || users == NULL ||
+        chat_groups_register(ctx, &frame.group_id, &frame, false) != ESP_OK) {
+        fprintf(stderr, "the group frame was not accepted\n");
+        return EXIT_FAILURE;
+    }
+    chat_group_t *group = chat_groups_find(&ctx->groups, frame.group_id.str, frame.group_id.len);
+
+    int expected = scan_user_fds(ctx, users, fds);
+    if (chat_sessions_user_fds(ctx, frame.users, frame.user_count, fds) != expected ||
+        chat_sessions_group_fds(ctx, group, fds) != expected + 1) {
+        fprintf(stderr, "the lookups disagree on the recipients\n");
+        return EXIT_FAILURE;
+    }
+
+    long rounds = bench_iterations(2000000);
+    uint64_t start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        bench_sink += scan_user_fds(ctx, users, fds);
+    }
+    double scan_ns = (double)(bench_now_ns() - start) / rounds;
+
+    start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        bench_sink += chat_sessions_user_fds(ctx, frame.users, frame.user_count, fds);
+    }
+    double users_ns = (double)(bench_now_ns() - start) / rounds;
+
+    start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        bench_sink += chat_sessions_group_fds(ctx, group, fds);
+    }
+    double group_ns = (double)(bench_now_ns() - start) / rounds;
+
+    printf("%2d clients, %2d-member group: string scan %5.0f ns, to.users %5.0f ns, group %5.0f ns\n", MAX_CLIENTS,
+           GROUP_SIZE, scan_ns, users_ns, group_ns);
+    cJSON_Delete(root);
+    return EXIT_SUCCESS;
+}
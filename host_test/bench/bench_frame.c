@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "cJSON.h"
+#include "chat/frame.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Parse and field extraction for the inbound frames the browser sends most, through
+ * chat_frame_parse() and through the cJSON path protocol.c falls back to: a tree from
+ * cJSON_ParseWithLength() read by chat_frame_from_json().
+ */
+static const char *const s_frames[] = {
+    "{\"type\":\"text\",\"from\":\"3f2504e0-4f89-41d3-9a0c-0305e82c3301\",\"to\":{\"all\":true,\"users\":[]},"
+    "\"name\":\"Alice\",\"data\":\"hello everyone, lunch at noon?\",\"timestamp\":1735689600}",
+    "{\"type\":\"text\",\"from\":\"3f2504e0-4f89-41d3-9a0c-0305e82c3301\","
+    "\"to\":{\"all\":false,\"users\":[\"8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90\"]},\"name\":\"Alice\","
+    "\"data\":\"see you at 6\",\"timestamp\":1735689601}",
+    "{\"type\":\"pong\",\"from\":\"8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90\",\"timestamp\":1735689602}",
+    "{\"type\":\"join\",\"from\":\"8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90\",\"name\":\"Bob\",\"timestamp\":1735689603,"
+    "\"since_id\":1042,\"history_batch\":true,\"history_ranges\":[[1,1042]],\"replay_limit\":200,"
+    "\"encoding\":\"msgpack\",\"compression\":\"deflate\"}",
+    "{\"type\":\"newGroup\",\"from\":\"8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90\",\"name\":\"Bob\","
+    "\"groupId\":\"6ba7b810-9dad-11d1-80b4-00c04fd430c8\",\"groupName\":\"Ops\","
+    "\"to\":{\"all\":false,\"users\":[\"3f2504e0-4f89-41d3-9a0c-0305e82c3301\","
+    "\"d3b07384-d9a0-4c9b-8f3e-6a1b2c3d4e5f\"]},\"data\":\"Bob created Ops\",\"timestamp\":1735689604}",
+    "{\"type\":\"historyRequest\",\"from\":\"8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90\",\"name\":\"Bob\","
+    "\"timestamp\":1735689605,\"requestId\":\"hist-1b4e28ba-2fa1-41d2-883f-0016d3cca427\",\"restore_before_id\":943}",
+};
+
+static const char *const s_labels[] = { "text (all)", "text (direct)", "pong", "join", "newGroup", "historyRequest" };
+
+#define FRAME_COUNT (sizeof(s_frames) / sizeof(s_frames[0]))
+
+static bool parse_scanner(const char *src, size_t len, chat_frame_t *frame)
+{
+    return chat_frame_parse(src, len, frame);
+}
+
+static bool parse_cjson(const char *src, size_t len, chat_frame_t *frame)
+{
+    cJSON *root = cJSON_ParseWithLength(src, len);
+    if (!cJSON_IsObject(root)) {
+        cJSON_Delete(root);
+        return false;
+    }
+    chat_frame_from_json(root, frame);
+    bench_sink += frame->type.len + frame->user_count;
+    cJSON_Delete(root);
+    return true;
+}
+
+static void run(size_t i, const char *path, bool (*parse)(const char *, size_t, chat_frame_t *))
+{
+    static chat_frame_t frame;
+    size_t len = strlen(s_frames[i]);
+    long rounds = bench_iterations(1000000);
+
+    unsigned long allocations = bench_allocations;
+    if (!parse(s_frames[i], len, &frame)) {
+        printf("  %-15s %-8s falls back\n", s_labels[i], path);
+        return;
+    }
+    allocations = bench_allocations - allocations;
+
+    uint64_t start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        bench_sink += parse(s_frames[i], len, &frame);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    printf("  %-15s %-8s %7.0f ns  %3lu allocations\n", s_labels[i], path, (double)elapsed / rounds, allocations);
+}
+
+int main(void)
+{
+    for (size_t i = 0; i < FRAME_COUNT; i++) {
+        run(i, "scanner", parse_scanner);
+        run(i, "cJSON", parse_cjson);
+    }
+    return EXIT_SUCCESS;
+}
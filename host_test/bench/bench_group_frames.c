@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_messages.h"
+#include "bench_server.h"
+#include "chat_config.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Group text messages with MAX_CLIENTS clients joined and every one of them in the group, sent
+ * as script.js sends them: once listing the members in to.users as before the registry, and once
+ * addressed by to.group. Reports the bytes received, stored and sent out per message and the
+ * server time through chat_ws_handler().
+ */
+#define GROUP_ID "6ba7b810-9dad-11d1-80b4-00c04fd430c8"
+
+static bench_traffic_t s_relayed;
+
+/* Only the relayed texts; every stored message also broadcasts historyInfo. */
+static void count_text(int index, httpd_ws_type_t type, const uint8_t *data, size_t len, void *arg)
+{
+    static const char text_prefix[] = "{\"type\":\"text\"";
+    if (len >= sizeof(text_prefix) - 1 && memcmp(data, text_prefix, sizeof(text_prefix) - 1) == 0) {
+        s_relayed.frames++;
+        s_relayed.bytes += len;
+    }
+}
+
+static size_t write_target(char *buf, size_t cap, bool by_group)
+{
+    if (by_group) {
+        return (size_t)snprintf(buf, cap, "{\"group\":\"" GROUP_ID "\"}");
+    }
+    int len = snprintf(buf, cap, "{\"all\":false,\"users\":[");
+    for (int i = 1; i < MAX_CLIENTS; i++) {
+        len += snprintf(buf + len, cap - (size_t)len, "%s\"%s\"", i > 1 ? "," : "", bench_client_id(i));
+    }
+    len += snprintf(buf + len, cap - (size_t)len, "]}");
+    return (size_t)len;
+}
+
+static size_t write_text(char *buf, size_t cap, uint64_t seed, bool by_group)
+{
+    char target[1024];
+    char data[256];
+    write_target(target, sizeof(target), by_group);
+    bench_message_data(data, sizeof(data), seed);
+    return (size_t)snprintf(buf, cap,
+                            "{\"type\":\"text\",\"from\":\"%s\",\"to\":%s,\"name\":\"%s\",\"data\":\"%s\","
+                            "\"timestamp\":%llu,\"groupId\":\"" GROUP_ID "\",\"groupName\":\"Ops\"}",
+                            bench_client_id(0), target, bench_client_name(0), data,
+                            1735689600ull + seed * 7);
+}
+
+static bool run(const char *label, bench_conn_t *sender, bool by_group, uint64_t *seed)
+{
+    static char text[MAX_WS_PAYLOAD_BYTES + 1];
+    app_context_t *ctx = &g_app_context;
+    long messages = bench_iterations(100000);
+    uint64_t received = 0;
+    uint64_t stored = 0;
+    uint64_t elapsed = 0;
+
+    memset(&s_relayed, 0, sizeof(s_relayed));
+    for (long m = 0; m < messages; m++) {
+        size_t len = write_text(text, sizeof(text), ++*seed, by_group);
+        uint64_t count = ctx->message_id_counter;
+        uint64_t start = bench_now_ns();
+        bench_send(sender, text);
+        elapsed += bench_now_ns() - start;
+        if (ctx->message_id_counter != count + 1) {
+            fprintf(stderr, "%s: message %ld was not stored\n", label, m);
+            return false;
+        }
+        received += len;
+        stored += ctx->message_buffer[(ctx->message_buffer_head + MAX_MESSAGES - 1) % MAX_MESSAGES].payload->len;
+    }
+    printf("%-9s received %4.0f bytes, stored %4.0f bytes, relayed %2.0f x %4.0f bytes, %5.1f us\n", label,
+           (double)received / messages, (double)stored / messages, (double)s_relayed.frames / messages,
+           (double)s_relayed.bytes / (s_relayed.frames ? s_relayed.frames : 1), elapsed / 1e3 / messages);
+    return true;
+}
+
+int main(void)
+{
+    static bench_conn_t conns[MAX_CLIENTS];
+    static char frame[2048];
+    char target[1024];
+    uint64_t seed = 0;
+
+    bench_server_start(false);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        bench_connect(&conns[i], i);
+        bench_join(&conns[i], NULL);
+    }
+
+    write_target(target, sizeof(target), false);
+    snprintf(frame, sizeof(frame),
+             "{\"type\":\"newGroup\",\"from\":\"%s\",\"name\":\"%s\",\"groupId\":\"" GROUP_ID "\","
+             "\"groupName\":\"Ops\",\"to\":%s,\"data\":\"%s created Ops\",\"timestamp\":1735689600}",
+             bench_client_id(0), bench_client_name(0), target, bench_client_name(0));
+    bench_send(&conns[0], frame);
+    bench_set_frame_hook(count_text, NULL);
+
+    bool ok = run("to.users", &conns[0], false, &seed);
+    ok = run("to.group", &conns[0], true, &seed) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_messages.h"
+#include "bench_server.h"
+#include "cJSON.h"
+#include "chat_config.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * PEERS peers answer one recovery of LOST_MESSAGES broadcasts the server lost, their frames 60 ms
+ * apart and interleaved at the server: once with one historyResponse per message, once packed as
+ * handleHistoryRequest() in script.js packs them. The peers join without history_ranges, so all of
+ * them are asked. Every frame a peer sends was relayed before the seen-set; the server now relays
+ * only what the requester has not had yet.
+ */
+#define PEERS               5
+#define LOST_MESSAGES       300
+#define MESSAGE_BYTES       512
+#define RESPONSE_SPACING_US 60000
+#define REQUESTER           0
+
+typedef struct {
+    bool recovered[LOST_MESSAGES + 1];
+    uint64_t frames;
+    uint64_t bytes;
+} relayed_t;
+
+static bench_conn_t s_conns[PEERS + 1];
+static char s_messages[LOST_MESSAGES + 1][MESSAGE_BYTES];
+static uint32_t s_seed = 1;
+
+static uint32_t next_random(void)
+{
+    s_seed = s_seed * 1103515245u + 12345u;
+    return s_seed >> 8;
+}
+
+static void mark_recovered(relayed_t *relayed, cJSON *message)
+{
+    cJSON *id = cJSON_GetObjectItem(message, "id");
+    if (cJSON_IsNumber(id) && id->valuedouble >= 1 && id->valuedouble <= LOST_MESSAGES) {
+        relayed->recovered[(int)id->valuedouble] = true;
+    }
+}
+
+static void observe_frame(int index, httpd_ws_type_t type, const uint8_t *data, size_t len, void *arg)
+{
+    relayed_t *relayed = arg;
+    static const char response[] = "{\"type\":\"historyResponse\"";
+
+    if (index != REQUESTER || type != HTTPD_WS_TYPE_TEXT || len < sizeof(response) - 1 ||
+        memcmp(data, response, sizeof(response) - 1) != 0) {
+        return;
+    }
+    relayed->frames++;
+    relayed->bytes += len;
+
+    cJSON *root = cJSON_ParseWithLength((const char *)data, len);
+    cJSON *item = NULL;
+    cJSON_ArrayForEach(item, cJSON_GetObjectItem(root, "messages")) {
+        mark_recovered(relayed, item);
+    }
+    mark_recovered(relayed, cJSON_GetObjectItem(root, "message"));
+    cJSON_Delete(root);
+}
+
+/* The frame peer sends for the held ids in ids[0..count), one "message" or a "messages" array. */
+static size_t write_response(char *buf, size_t cap, int peer, const char *request_id, const int *ids, int count,
+                             bool batched)
+{
+    int len = snprintf(buf, cap, "{\"type\":\"historyResponse\",\"from\":\"%s\",\"name\":\"%s\",\"timestamp\":1735689600,"
+                       "\"requestId\":\"%s\",\"to\":{\"all\":false,\"users\":[\"%s\"]},\"%s\":%s",
+                       bench_client_id(peer), bench_client_name(peer), request_id, bench_client_id(REQUESTER),
+                       batched ? "messages" : "message", batched ? "[" : "");
+    for (int i = 0; i < count; i++) {
+        len += snprintf(buf + len, cap - (size_t)len, "%s%s", i ? "," : "", s_messages[ids[i]]);
+    }
+    len += snprintf(buf + len, cap - (size_t)len, "%s}", batched ? "]" : "");
+    return len > 0 && (size_t)len < cap ? (size_t)len : cap;
+}
+
+/* Up to HISTORY_RESPONSE_MAX_MESSAGES ids from *next on, as many as fit under CONFIG_CHAT_MAX_WS_PAYLOAD_BYTES. */
+static int next_batch(const bool *held, int *next, int peer, const char *request_id, bool batched, int *ids,
+                      char *frame, size_t cap)
+{
+    int count = 0;
+    for (; *next <= LOST_MESSAGES; (*next)++) {
+        if (!held[*next]) {
+            continue;
+        }
+        ids[count] = *next;
+        if (count > 0 && write_response(frame, cap, peer, request_id, ids, count + 1, batched) >
+                         CONFIG_CHAT_MAX_WS_PAYLOAD_BYTES) {
+            break;
+        }
+        count++;
+        if (!batched || count == HISTORY_RESPONSE_MAX_MESSAGES) {
+            (*next)++;
+            break;
+        }
+    }
+    return count;
+}
+
+static bool run(const char *label, bool held[PEERS + 1][LOST_MESSAGES + 1], bool batched, uint64_t serial)
+{
+    static char frame[4096];
+    static relayed_t relayed;
+    char request_id[40];
+    uint64_t sent_frames = 0;
+    uint64_t sent_bytes = 0;
+
+    memset(&relayed, 0, sizeof(relayed));
+    snprintf(request_id, sizeof(request_id), "hist-%llu", (unsigned long long)serial);
+    snprintf(frame, sizeof(frame), "{\"type\":\"historyRequest\",\"from\":\"%s\",\"name\":\"%s\",\"timestamp\":1735689600,"
+             "\"requestId\":\"%s\",\"restore_before_id\":%d}", bench_client_id(REQUESTER), bench_client_name(REQUESTER),
+             request_id, LOST_MESSAGES + 1);
+    host_clock_advance_us(2000000);
+    bench_send(&s_conns[REQUESTER], frame);
+    bench_set_frame_hook(observe_frame, &relayed);
+
+    int next[PEERS + 1];
+    for (int p = 1; p <= PEERS; p++) {
+        next[p] = 1;
+    }
+    for (bool sent = true; sent;) {
+        sent = false;
+        for (int p = 1; p <= PEERS; p++) {
+            int ids[HISTORY_RESPONSE_MAX_MESSAGES];
+            int count = next_batch(held[p], &next[p], p, request_id, batched, ids, frame, sizeof(frame));
+            if (count == 0) {
+                continue;
+            }
+            size_t len = write_response(frame, sizeof(frame), p, request_id, ids, count, batched);
+            bench_send_frame(&s_conns[p], HTTPD_WS_TYPE_TEXT, frame, len);
+            sent_frames++;
+            sent_bytes += len;
+            sent = true;
+        }
+        host_clock_advance_us(RESPONSE_SPACING_US);
+    }
+    bench_set_frame_hook(NULL, NULL);
+
+    int offered = 0;
+    int recovered = 0;
+    for (int id = 1; id <= LOST_MESSAGES; id++) {
+        bool any = false;
+        for (int p = 1; p <= PEERS && !any; p++) {
+            any = held[p][id];
+        }
+        offered += any;
+        recovered += relayed.recovered[id];
+    }
+    printf("  %-11s sent %4llu frames / %6llu B, relayed %4llu frames / %6llu B, %3d of %3d ids\n", label,
+           (unsigned long long)sent_frames, (unsigned long long)sent_bytes, (unsigned long long)relayed.frames,
+           (unsigned long long)relayed.bytes, recovered, offered);
+    if (recovered != offered) {
+        fprintf(stderr, "%s: ids a peer held were not recovered\n", label);
+        return false;
+    }
+    return true;
+}
+
+int main(void)
+{
+    static bool held[PEERS + 1][LOST_MESSAGES + 1];
+    static char data[256];
+
+    for (uint64_t id = 1; id <= LOST_MESSAGES; id++) {
+        int from = bench_message_sender(id);
+        bench_message_data(data, sizeof(data), id);
+        snprintf(s_messages[id], MESSAGE_BYTES, "{\"type\":\"text\",\"from\":\"%s\",\"to\":{\"all\":true,\"users\":[]},"
+                 "\"name\":\"%s\",\"data\":\"%s\",\"id\":%llu,\"timestamp\":%llu}", bench_user_ids[from],
+                 bench_user_names[from], data, (unsigned long long)id, 1735689600ull + id * 7);
+    }
+
+    bench_server_start(false);
+    host_clock_set_manual(true);
+    /* As after a reboot that lost the ring: the server history starts at LOST_MESSAGES + 1. */
+    g_app_context.boot_start_id = LOST_MESSAGES + 1;
+    g_app_context.message_id_counter = LOST_MESSAGES;
+    for (int c = 0; c <= PEERS; c++) {
+        bench_connect(&s_conns[c], c);
+        bench_join(&s_conns[c], NULL);
+    }
+
+    bool ok = true;
+    uint64_t serial = 0;
+    for (int p = 1; p <= PEERS; p++) {
+        for (int id = 1; id <= LOST_MESSAGES; id++) {
+            held[p][id] = true;
+        }
+    }
+    printf("%d peers hold all %d messages\n", PEERS, LOST_MESSAGES);
+    ok = run("per-message", held, false, ++serial) && ok;
+    ok = run("batched", held, true, ++serial) && ok;
+
+    for (int p = 1; p <= PEERS; p++) {
+        for (int id = 1; id <= LOST_MESSAGES; id++) {
+            held[p][id] = next_random() % 5 < 3;
+        }
+    }
+    printf("%d peers hold a random 60%% each\n", PEERS);
+    ok = run("per-message", held, false, ++serial) && ok;
+    ok = run("batched", held, true, ++serial) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_messages.h"
+#include "bench_server.h"
+#include "chat/history.h"
+#include "chat/payload.h"
+#include "chat_config.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * The history work the server does per chat message and per rejoin, with a full ring of
+ * MAX_MESSAGES. Built as bench_history_bounds_<size> for several history sizes; the costs should
+ * not grow with the size, unlike the full-ring scan the bounds replaced.
+ */
+#define REJOIN_MISSED 10
+
+/* What chat_history_fill_bounds_locked() did before: visit every slot for the oldest and newest id. */
+static void scan_bounds_locked(const app_context_t *ctx, uint64_t *earliest, uint64_t *latest)
+{
+    *earliest = 0;
+    *latest = 0;
+    for (int i = 0; i < MAX_MESSAGES; i++) {
+        uint64_t id = ctx->message_buffer[i].id;
+        if (id == 0) {
+            continue;
+        }
+        if (*earliest == 0 || id < *earliest) {
+            *earliest = id;
+        }
+        if (id > *latest) {
+            *latest = id;
+        }
+    }
+}
+
+int main(void)
+{
+    app_context_t *ctx = &g_app_context;
+    bench_server_start(false);
+
+    /* Twice around the ring so the oldest slot is not slot 0. */
+    uint64_t seed = 0;
+    while (seed < 2 * MAX_MESSAGES) {
+        if (!bench_store_message(++seed)) {
+            fprintf(stderr, "message %lu was not stored\n", (unsigned long)seed);
+            return EXIT_FAILURE;
+        }
+    }
+
+    long rounds = bench_iterations(1000000);
+    history_bounds_t bounds;
+    uint64_t start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        xSemaphoreTake(ctx->message_mutex, portMAX_DELAY);
+        chat_history_fill_bounds_locked(ctx, &bounds);
+        xSemaphoreGive(ctx->message_mutex);
+        bench_sink += bounds.latest_id;
+    }
+    double bounds_ns = (double)(bench_now_ns() - start) / rounds;
+
+    start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        uint64_t earliest = 0;
+        uint64_t latest = 0;
+        xSemaphoreTake(ctx->message_mutex, portMAX_DELAY);
+        scan_bounds_locked(ctx, &earliest, &latest);
+        xSemaphoreGive(ctx->message_mutex);
+        bench_sink += earliest + latest;
+    }
+    double scan_ns = (double)(bench_now_ns() - start) / rounds;
+
+    /* A stored message followed by the historyInfo rebuild it causes. */
+    long messages = bench_iterations(100000);
+    start = bench_now_ns();
+    for (long m = 0; m < messages; m++) {
+        if (!bench_store_message(++seed)) {
+            fprintf(stderr, "message %lu was not stored\n", (unsigned long)seed);
+            return EXIT_FAILURE;
+        }
+        chat_payload_t *info = chat_history_info_payload(ctx);
+        bench_sink += info->len;
+        chat_payload_release(info);
+    }
+    double store_ns = (double)(bench_now_ns() - start) / messages;
+
+    /* A client that missed the last few messages rejoins with since_id. */
+    history_replay_t replay = {
+        .user_id = bench_user_ids[0],
+        .since_id = ctx->message_id_counter - REJOIN_MISSED,
+        .batched = true,
+    };
+    long rejoins = bench_iterations(200000);
+    start = bench_now_ns();
+    for (long r = 0; r < rejoins; r++) {
+        chat_history_send_to_client(ctx, HOST_WS_FIRST_FD, &replay);
+    }
+    double rejoin_ns = (double)(bench_now_ns() - start) / rejoins;
+
+    xSemaphoreTake(ctx->message_mutex, portMAX_DELAY);
+    chat_history_fill_bounds_locked(ctx, &bounds);
+    xSemaphoreGive(ctx->message_mutex);
+    printf("history %4d (%4d held): bounds %5.0f ns (scan %5.0f ns), store+historyInfo %5.0f ns, "
+           "rejoin missing %d %5.0f ns\n",
+           MAX_MESSAGES, bounds.count, bounds_ns, scan_ns, store_ns, REJOIN_MISSED, rejoin_ns);
+    return bounds.count == MAX_MESSAGES ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_messages.h"
+#include "bench_server.h"
+#include "cJSON.h"
+#include "chat_config.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Peer history recovery after the server lost messages 1..LOST_MESSAGES: CLIENTS clients hold
+ * random partial windows of them with gaps, and each in turn sends a historyRequest. The peers the
+ * server asks answer as script.js does, one historyResponse per message, 60 ms apart and
+ * interleaved at the server. Once every client joins without history_ranges, so every peer is
+ * asked, and once with the ranges script.js advertises, so the server picks a cover.
+ */
+#define CLIENTS             10
+#define LOST_MESSAGES       300
+#define MESSAGE_BYTES       512
+#define RANGE_LIMIT         8
+#define RESPONSE_SPACING_US 60000
+
+typedef struct {
+    bool held[CLIENTS][LOST_MESSAGES + 1];
+} holdings_t;
+
+typedef struct {
+    int requester;
+    bool asked[CLIENTS];
+    bool recovered[LOST_MESSAGES + 1];
+    uint64_t request_frames;
+} recovery_t;
+
+typedef struct {
+    uint64_t recoveries;
+    uint64_t request_frames;
+    uint64_t response_frames;
+    uint64_t offered;
+    uint64_t recovered;
+} totals_t;
+
+static bench_conn_t s_conns[CLIENTS];
+static char s_messages[LOST_MESSAGES + 1][MESSAGE_BYTES];
+static uint32_t s_seed = 1;
+
+static uint32_t next_random(void)
+{
+    s_seed = s_seed * 1103515245u + 12345u;
+    return s_seed >> 8;
+}
+
+/* What isMessageVisibleToUser() lets a client see and hand to another. */
+static bool visible_to(uint64_t id, int client)
+{
+    return strstr(s_messages[id], "\"all\":true") != NULL || strstr(s_messages[id], bench_client_id(client)) != NULL;
+}
+
+/* A window of the lost messages, the whole of it for one client in five, with up to three gaps. */
+static void draw_holdings(holdings_t *holdings)
+{
+    memset(holdings, 0, sizeof(*holdings));
+    for (int c = 0; c < CLIENTS; c++) {
+        int first = 1;
+        int last = LOST_MESSAGES;
+        if (next_random() % 5 != 0) {
+            first = 1 + (int)(next_random() % (LOST_MESSAGES / 2));
+            last = first + (int)(next_random() % (LOST_MESSAGES - first + 1));
+        }
+        for (int id = first; id <= last; id++) {
+            holdings->held[c][id] = visible_to((uint64_t)id, c);
+        }
+        for (int gaps = (int)(next_random() % 4); gaps > 0; gaps--) {
+            int start = first + (int)(next_random() % (uint32_t)(last - first + 1));
+            int end = start + 5 + (int)(next_random() % 26);
+            for (int id = start; id <= last && id < end; id++) {
+                holdings->held[c][id] = false;
+            }
+        }
+    }
+}
+
+/* historyRanges() of script.js: runs of held ids, the narrowest gaps bridged beyond RANGE_LIMIT runs. */
+static void write_ranges(const bool *held, char *buf, size_t cap)
+{
+    int runs[LOST_MESSAGES][2];
+    int count = 0;
+    for (int id = 1; id <= LOST_MESSAGES; id++) {
+        if (!held[id]) {
+            continue;
+        }
+        if (count > 0 && id == runs[count - 1][1] + 1) {
+            runs[count - 1][1] = id;
+        } else {
+            runs[count][0] = id;
+            runs[count][1] = id;
+            count++;
+        }
+    }
+    while (count > RANGE_LIMIT) {
+        int narrowest = 0;
+        for (int i = 1; i < count - 1; i++) {
+            if (runs[i + 1][0] - runs[i][1] < runs[narrowest + 1][0] - runs[narrowest][1]) {
+                narrowest = i;
+            }
+        }
+        runs[narrowest][1] = runs[narrowest + 1][1];
+        memmove(&runs[narrowest + 1], &runs[narrowest + 2], (size_t)(count - narrowest - 2) * sizeof(runs[0]));
+        count--;
+    }
+
+    int len = snprintf(buf, cap, "\"history_ranges\":\"");
+    for (int i = 0; i < count; i++) {
+        len += runs[i][0] == runs[i][1]
+            ? snprintf(buf + len, cap - (size_t)len, "%s%d", i ? "," : "", runs[i][0])
+            : snprintf(buf + len, cap - (size_t)len, "%s%d-%d", i ? "," : "", runs[i][0], runs[i][1]);
+    }
+    snprintf(buf + len, cap - (size_t)len, "\"");
+}
+
+static void observe_frame(int index, httpd_ws_type_t type, const uint8_t *data, size_t len, void *arg)
+{
+    recovery_t *recovery = arg;
+    static const char request[] = "{\"type\":\"historyRequest\"";
+    static const char response[] = "{\"type\":\"historyResponse\"";
+
+    if (type != HTTPD_WS_TYPE_TEXT || index >= CLIENTS) {
+        return;
+    }
+    if (len >= sizeof(request) - 1 && memcmp(data, request, sizeof(request) - 1) == 0) {
+        recovery->request_frames++;
+        recovery->asked[index] = true;
+        return;
+    }
+    if (index != recovery->requester || len < sizeof(response) - 1 || memcmp(data, response, sizeof(response) - 1) != 0) {
+        return;
+    }
+
+    cJSON *root = cJSON_ParseWithLength((const char *)data, len);
+    cJSON *message = cJSON_GetObjectItem(root, "message");
+    cJSON *id = cJSON_GetObjectItem(message, "id");
+    if (cJSON_IsNumber(id) && id->valuedouble >= 1 && id->valuedouble <= LOST_MESSAGES) {
+        recovery->recovered[(int)id->valuedouble] = true;
+    }
+    cJSON_Delete(root);
+}
+
+/* One recovery by requester. */
+static void recover(const holdings_t *holdings, int requester, uint64_t serial, totals_t *totals)
+{
+    static char frame[2048];
+    static recovery_t recovery;
+    char request_id[40];
+
+    memset(&recovery, 0, sizeof(recovery));
+    recovery.requester = requester;
+    snprintf(request_id, sizeof(request_id), "hist-%llu", (unsigned long long)serial);
+    bench_set_frame_hook(observe_frame, &recovery);
+
+    snprintf(frame, sizeof(frame), "{\"type\":\"historyRequest\",\"from\":\"%s\",\"name\":\"%s\",\"timestamp\":1735689600,"
+             "\"requestId\":\"%s\",\"restore_before_id\":%d}", bench_client_id(requester), bench_client_name(requester),
+             request_id, LOST_MESSAGES + 1);
+    bench_send(&s_conns[requester], frame);
+
+    int next_id[CLIENTS];
+    for (int c = 0; c < CLIENTS; c++) {
+        next_id[c] = 1;
+    }
+    for (bool sent = true; sent;) {
+        sent = false;
+        for (int c = 0; c < CLIENTS; c++) {
+            if (c == requester || !recovery.asked[c]) {
+                continue;
+            }
+            while (next_id[c] <= LOST_MESSAGES && !(holdings->held[c][next_id[c]] && visible_to((uint64_t)next_id[c], requester))) {
+                next_id[c]++;
+            }
+            if (next_id[c] > LOST_MESSAGES) {
+                continue;
+            }
+            snprintf(frame, sizeof(frame), "{\"type\":\"historyResponse\",\"from\":\"%s\",\"name\":\"%s\","
+                     "\"timestamp\":1735689600,\"requestId\":\"%s\",\"to\":{\"all\":false,\"users\":[\"%s\"]},"
+                     "\"message\":%s}", bench_client_id(c), bench_client_name(c), request_id, bench_client_id(requester),
+                     s_messages[next_id[c]]);
+            bench_send(&s_conns[c], frame);
+            totals->response_frames++;
+            next_id[c]++;
+            sent = true;
+        }
+        host_clock_advance_us(RESPONSE_SPACING_US);
+    }
+    bench_set_frame_hook(NULL, NULL);
+
+    int offered_count = 0;
+    int recovered = 0;
+    for (int id = 1; id <= LOST_MESSAGES; id++) {
+        if (holdings->held[requester][id] || !visible_to((uint64_t)id, requester)) {
+            continue;
+        }
+        bool offered = false;
+        for (int c = 0; c < CLIENTS && !offered; c++) {
+            offered = c != requester && holdings->held[c][id];
+        }
+        offered_count += offered;
+        recovered += recovery.recovered[id];
+    }
+    totals->recoveries++;
+    totals->request_frames += recovery.request_frames;
+    totals->offered += (uint64_t)offered_count;
+    totals->recovered += (uint64_t)recovered;
+}
+
+static bool run(const char *label, bool advertise, long trials)
+{
+    char ranges[256];
+    holdings_t holdings;
+    totals_t totals = { 0 };
+    uint64_t serial = 0;
+
+    s_seed = 1;
+    for (long t = 0; t < trials; t++) {
+        draw_holdings(&holdings);
+        host_clock_advance_us(2000000);
+        for (int c = 0; c < CLIENTS; c++) {
+            bench_connect(&s_conns[c], c);
+            write_ranges(holdings.held[c], ranges, sizeof(ranges));
+            bench_join(&s_conns[c], advertise ? ranges : NULL);
+        }
+        for (int c = 0; c < CLIENTS; c++) {
+            recover(&holdings, c, ++serial, &totals);
+        }
+        for (int c = 0; c < CLIENTS; c++) {
+            bench_disconnect(&s_conns[c]);
+        }
+    }
+
+    double n = (double)totals.recoveries;
+    printf("%-10s %4.1f request + %6.1f response frames per recovery, %5.1f of %5.1f missing ids recovered\n", label,
+           totals.request_frames / n, totals.response_frames / n, totals.recovered / n, totals.offered / n);
+    /* Asking every peer must bring back everything; a cover may miss what bridged ranges overstate. */
+    if (!advertise && totals.recovered != totals.offered) {
+        fprintf(stderr, "%s: ids a peer held were not recovered\n", label);
+        return false;
+    }
+    return true;
+}
+
+int main(void)
+{
+    for (uint64_t id = 1; id <= LOST_MESSAGES; id++) {
+        bench_text_message(s_messages[id], MESSAGE_BYTES, id);
+    }
+
+    bench_server_start(false);
+    host_clock_set_manual(true);
+    /* As after a reboot that lost the ring: the server history starts at LOST_MESSAGES + 1. */
+    g_app_context.boot_start_id = LOST_MESSAGES + 1;
+    g_app_context.message_id_counter = LOST_MESSAGES;
+
+    long trials = bench_iterations(100);
+    printf("%d clients, %d lost messages, %ld random holdings\n", CLIENTS, LOST_MESSAGES, trials);
+    bool ok = run("broadcast", false, trials);
+    ok = run("targeted", true, trials) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
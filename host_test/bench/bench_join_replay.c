@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_server.h"
+#include "chat_config.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * CLIENT_COUNT clients join at once against a full history of MAX_MESSAGES and replay all of it,
+ * one frame per message and packed into historyBatch frames. The HTTPD task handles joins one
+ * at a time, so the last client waits for every replay before it; rendering is the browser's and
+ * is not part of this.
+ */
+#define CLIENT_COUNT 10
+
+typedef struct {
+    uint64_t frames;
+    uint64_t bytes;
+    uint64_t join_ns;
+    uint64_t last_done_ns;
+} join_result_t;
+
+static join_result_t join_all(const char *extra)
+{
+    static bench_conn_t conns[CLIENT_COUNT];
+    join_result_t result = { 0 };
+
+    bench_traffic_reset();
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < CLIENT_COUNT; i++) {
+        bench_connect(&conns[i], i);
+        uint64_t join_start = bench_now_ns();
+        bench_join(&conns[i], extra);
+        result.join_ns += bench_now_ns() - join_start;
+    }
+    result.last_done_ns = bench_now_ns() - start;
+    bench_traffic_t total = bench_traffic_total();
+    result.frames = total.frames;
+    result.bytes = total.bytes;
+
+    for (int i = 0; i < CLIENT_COUNT; i++) {
+        bench_disconnect(&conns[i]);
+    }
+    return result;
+}
+
+static void run(const char *label, const char *extra)
+{
+    long rounds = bench_iterations(2000);
+    join_result_t sum = { 0 };
+    for (long r = 0; r < rounds; r++) {
+        join_result_t result = join_all(extra);
+        sum.frames += result.frames;
+        sum.bytes += result.bytes;
+        sum.join_ns += result.join_ns;
+        sum.last_done_ns += result.last_done_ns;
+    }
+    printf("%-9s %5.0f frames, %7.0f bytes per join; %6.1f us per join, last of %d done after %6.1f us\n", label,
+           (double)sum.frames / rounds / CLIENT_COUNT, (double)sum.bytes / rounds / CLIENT_COUNT,
+           sum.join_ns / 1e3 / rounds / CLIENT_COUNT, CLIENT_COUNT, sum.last_done_ns / 1e3 / rounds);
+}
+
+int main(void)
+{
+    bench_server_start(false);
+    for (uint64_t seed = 1; seed <= MAX_MESSAGES; seed++) {
+        if (!bench_store_message(seed)) {
+            fprintf(stderr, "message %lu was not stored\n", (unsigned long)seed);
+            return EXIT_FAILURE;
+        }
+    }
+
+    run("per-frame", NULL);
+    run("batched", "\"history_batch\":true");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_messages.h"
+#include "bench_server.h"
+#include "chat/frame.h"
+#include "chat/history.h"
+#include "chat/payload.h"
+#include "chat_config.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Stores chat messages through chat_history_finalize_and_store_message() against an NVS whose
+ * commit takes as long as a flash write. Built once with the default lease and once as
+ * bench_message_ids_lease1, where every id is reserved on its own as before leases.
+ */
+#define NVS_COMMIT_US  2000
+#define FRAME_COUNT    64
+#define FRAME_BYTES    512
+
+static char s_frames[FRAME_COUNT][FRAME_BYTES];
+static size_t s_frame_len[FRAME_COUNT];
+static chat_frame_t s_parsed[FRAME_COUNT];
+
+int main(void)
+{
+    for (int i = 0; i < FRAME_COUNT; i++) {
+        s_frame_len[i] = bench_client_text(s_frames[i], FRAME_BYTES, (uint64_t)i + 1);
+        if (!chat_frame_parse(s_frames[i], s_frame_len[i], &s_parsed[i])) {
+            fprintf(stderr, "frame %d does not parse\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    host_nvs_set_commit_delay_us(NVS_COMMIT_US);
+    bench_server_start(false);
+    uint64_t boot_commits = host_nvs_commits();
+
+    long messages = bench_iterations(2000);
+    uint64_t start = bench_now_ns();
+    for (long m = 0; m < messages; m++) {
+        int i = (int)(m % FRAME_COUNT);
+        chat_payload_t *payload = NULL;
+        if (chat_history_finalize_and_store_message(&g_app_context, &s_parsed[i], s_frames[i], s_frame_len[i],
+                                                    &payload) != ESP_OK) {
+            fprintf(stderr, "message %ld was not stored\n", m);
+            return EXIT_FAILURE;
+        }
+        bench_sink += payload->len;
+        chat_payload_release(payload);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+
+    printf("lease %4d, %u us per NVS commit: %ld messages, %8.0f messages/s, %4lu commits\n",
+           MESSAGE_ID_LEASE_SIZE, NVS_COMMIT_US, messages, messages / (elapsed / 1e9),
+           (unsigned long)(host_nvs_commits() - boot_commits));
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+#include "bench_messages.h"
+
+#include <stdio.h>
+
+const char *const bench_user_ids[BENCH_USER_COUNT] = {
+    "3f2504e0-4f89-41d3-9a0c-0305e82c3301",
+    "8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90",
+    "d3b07384-d9a0-4c9b-8f3e-6a1b2c3d4e5f",
+    "6ba7b810-9dad-11d1-80b4-00c04fd430c8",
+    "1b4e28ba-2fa1-41d2-883f-0016d3cca427",
+};
+
+const char *const bench_user_names[BENCH_USER_COUNT] = { "Alice", "Bob", "Carol", "Dave", "小明" };
+
+static const char *const s_words[] = {
+    "ok", "sure", "lunch", "meeting", "at", "the", "room", "is", "free", "now", "see", "you", "later",
+    "thanks", "who", "has", "the", "charger", "running", "late", "10", "minutes", "battery", "low",
+    "on", "my", "way", "where", "are", "you", "好的", "收到", "马上到",
+};
+
+#define WORD_COUNT (sizeof(s_words) / sizeof(s_words[0]))
+
+static uint32_t mix(uint64_t id, uint32_t salt)
+{
+    uint64_t x = id * 0x9e3779b97f4a7c15ull + salt;
+    x ^= x >> 31;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    return (uint32_t)x;
+}
+
+size_t bench_message_data(char *buf, size_t cap, uint64_t id)
+{
+    int words = 2 + (int)(mix(id, 4) % 9);
+    int len = 0;
+    for (int i = 0; i < words && len >= 0 && (size_t)len < cap; i++) {
+        len += snprintf(buf + len, cap - (size_t)len, "%s%s", i ? " " : "", s_words[mix(id, 5 + i) % WORD_COUNT]);
+    }
+    return len > 0 && (size_t)len < cap ? (size_t)len : 0;
+}
+
+int bench_message_sender(uint64_t id)
+{
+    return (int)(mix(id, 1) % BENCH_USER_COUNT);
+}
+
+static size_t write_body(char *buf, size_t cap, uint64_t id)
+{
+    int from = bench_message_sender(id);
+    int len;
+    if (mix(id, 2) % 4 == 0) {
+        int to = (from + 1 + (int)(mix(id, 3) % (BENCH_USER_COUNT - 1))) % BENCH_USER_COUNT;
+        len = snprintf(buf, cap, "{\"type\":\"text\",\"from\":\"%s\",\"to\":{\"all\":false,\"users\":[\"%s\"]},"
+                       "\"name\":\"%s\",\"data\":\"", bench_user_ids[from], bench_user_ids[to], bench_user_names[from]);
+    } else {
+        len = snprintf(buf, cap, "{\"type\":\"text\",\"from\":\"%s\",\"to\":{\"all\":true,\"users\":[]},"
+                       "\"name\":\"%s\",\"data\":\"", bench_user_ids[from], bench_user_names[from]);
+    }
+    if (len <= 0 || (size_t)len >= cap) {
+        return 0;
+    }
+    size_t data_len = bench_message_data(buf + len, cap - (size_t)len, id);
+    return data_len > 0 ? (size_t)len + data_len : 0;
+}
+
+size_t bench_text_message(char *buf, size_t cap, uint64_t id)
+{
+    size_t len = write_body(buf, cap, id);
+    if (len == 0) {
+        return 0;
+    }
+    int tail = snprintf(buf + len, cap - len, "\",\"id\":%llu,\"timestamp\":%llu}", (unsigned long long)id,
+                        1735689600ull + id * 7);
+    return tail > 0 && len + (size_t)tail < cap ? len + (size_t)tail : 0;
+}
+
+size_t bench_client_text(char *buf, size_t cap, uint64_t id)
+{
+    size_t len = write_body(buf, cap, id);
+    if (len == 0) {
+        return 0;
+    }
+    int tail = snprintf(buf + len, cap - len, "\",\"timestamp\":%llu}", 1735689600ull + id * 7);
+    return tail > 0 && len + (size_t)tail < cap ? len + (size_t)tail : 0;
+}
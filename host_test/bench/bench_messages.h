@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Deterministic chat traffic for the benchmarks: BENCH_USER_COUNT users with UUID ids, mostly
+ * broadcasts and some direct messages, with short texts drawn from a fixed word list.
+ */
+#define BENCH_USER_COUNT 5
+
+extern const char *const bench_user_ids[BENCH_USER_COUNT];
+extern const char *const bench_user_names[BENCH_USER_COUNT];
+
+/* The "data" text of message id: 2 to 10 words, NUL-terminated. */
+size_t bench_message_data(char *buf, size_t cap, uint64_t id);
+
+/* The index into bench_user_ids of the user who sends message id. */
+int bench_message_sender(uint64_t id);
+
+/* Writes the stored form of message id, as the server relays it, and returns its length. */
+size_t bench_text_message(char *buf, size_t cap, uint64_t id);
+
+/* The text frame a client sends for message id, before the server assigns the id. */
+size_t bench_client_text(char *buf, size_t cap, uint64_t id);
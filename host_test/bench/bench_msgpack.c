@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "common/msgpack.h"
+
+BENCH_DEFINE_GLOBALS;
+
+#define BUF_BYTES 2048
+
+/* Frames as the server sends them: a stored broadcast, a direct message, a join and a history info reply. */
+static const char *const s_samples[] = {
+    "{\"type\":\"text\",\"from\":\"3f2504e0-4f89-41d3-9a0c-0305e82c3301\",\"to\":{\"all\":true,\"users\":[]},"
+    "\"name\":\"Alice\",\"data\":\"hello everyone\",\"id\":1042,\"timestamp\":1735689600}",
+    "{\"type\":\"text\",\"from\":\"3f2504e0-4f89-41d3-9a0c-0305e82c3301\","
+    "\"to\":{\"all\":false,\"users\":[\"8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90\"]},\"name\":\"Alice\","
+    "\"data\":\"see you at 6\",\"id\":1043,\"timestamp\":1735689601}",
+    "{\"type\":\"join\",\"from\":\"8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90\",\"name\":\"Bob\",\"timestamp\":1735689602,"
+    "\"encoding\":\"msgpack\"}",
+    "{\"type\":\"historyInfo\",\"from\":\"server\",\"timestamp\":1735689603,\"to\":{\"users\":[],\"all\":true},"
+    "\"boot_start_id\":769,\"current_id\":1043,\"earliest_id\":944,\"latest_id\":1043,\"restore_before_id\":944,"
+    "\"count\":100,\"capacity\":100,\"has_more_before\":true}",
+};
+
+#define SAMPLE_COUNT (sizeof(s_samples) / sizeof(s_samples[0]))
+
+int main(void)
+{
+    static uint8_t packed[SAMPLE_COUNT][BUF_BYTES];
+    static char json[BUF_BYTES];
+    size_t packed_len[SAMPLE_COUNT];
+    size_t json_total = 0;
+    size_t packed_total = 0;
+
+    for (size_t i = 0; i < SAMPLE_COUNT; i++) {
+        size_t len = strlen(s_samples[i]);
+        packed_len[i] = msgpack_from_json(s_samples[i], len, packed[i], BUF_BYTES);
+        json_writer_t writer;
+        json_writer_init(&writer, json, sizeof(json));
+        if (packed_len[i] == 0 || !msgpack_to_json(packed[i], packed_len[i], &writer) ||
+            !json_writer_finish(&writer) || strcmp(json, s_samples[i]) != 0) {
+            fprintf(stderr, "sample %zu does not round-trip\n", i);
+            return EXIT_FAILURE;
+        }
+        printf("sample %zu: JSON %zu -> MessagePack %zu bytes (%.0f%% smaller)\n", i, len, packed_len[i],
+               100.0 * (1.0 - (double)packed_len[i] / len));
+        json_total += len;
+        packed_total += packed_len[i];
+    }
+    printf("all samples: JSON %zu -> MessagePack %zu bytes (%.0f%% smaller)\n", json_total, packed_total,
+           100.0 * (1.0 - (double)packed_total / json_total));
+
+    long rounds = bench_iterations(1000000);
+    uint64_t start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        size_t i = (size_t)r % SAMPLE_COUNT;
+        bench_sink += msgpack_from_json(s_samples[i], strlen(s_samples[i]), packed[i], BUF_BYTES);
+    }
+    uint64_t encode_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        size_t i = (size_t)r % SAMPLE_COUNT;
+        json_writer_t writer;
+        json_writer_init(&writer, json, sizeof(json));
+        bench_sink += msgpack_to_json(packed[i], packed_len[i], &writer) ? writer.len : 0;
+    }
+    uint64_t decode_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        size_t i = (size_t)r % SAMPLE_COUNT;
+        const char *type;
+        size_t type_len;
+        bench_sink += msgpack_map_string(packed[i], packed_len[i], "type", &type, &type_len) ? type_len : 0;
+    }
+    uint64_t peek_ns = bench_now_ns() - start;
+
+    printf("JSON -> MessagePack: %.0f ns/frame\n", (double)encode_ns / rounds);
+    printf("MessagePack -> JSON: %.0f ns/frame\n", (double)decode_ns / rounds);
+    printf("type lookup:         %.0f ns/frame\n", (double)peek_ns / rounds);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "bench_messages.h"
+#include "bench_server.h"
+#include "chat_config.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Send-to-broadcast latency of chat messages with a message log on flash that takes FLUSH_US per
+ * flush, through chat_ws_handler() with CLIENT_COUNT clients joined. The default build runs the
+ * records written inline on the HTTPD task, then through the storage task; bench_persist_ack_commit
+ * is built with ACK_AFTER_COMMIT and only runs the storage task.
+ */
+#define CLIENT_COUNT    10
+#define MESSAGE_COUNT   300
+#define FLUSH_US        10000
+#define SEND_GAP_US     2000
+
+static uint64_t s_last_text_ns;
+static _Atomic unsigned long s_flushes;
+
+int __real_fflush(FILE *stream);
+
+/* The log's fflush() stands in for the flash write; the benchmark's own output is not slowed. */
+int __wrap_fflush(FILE *stream)
+{
+    if (stream != NULL && stream != stdout && stream != stderr) {
+        usleep(FLUSH_US);
+        s_flushes++;
+    }
+    return __real_fflush(stream);
+}
+
+static void note_text(int index, httpd_ws_type_t type, const uint8_t *data, size_t len, void *arg)
+{
+    static const char text_prefix[] = "{\"type\":\"text\"";
+    if (len >= sizeof(text_prefix) - 1 && memcmp(data, text_prefix, sizeof(text_prefix) - 1) == 0) {
+        s_last_text_ns = bench_now_ns();
+    }
+}
+
+static bool run(const char *label, bench_conn_t *conns, uint64_t *seed)
+{
+    static uint64_t latency[MESSAGE_COUNT];
+    long messages = bench_iterations(MESSAGE_COUNT);
+    unsigned long flushes = s_flushes;
+
+    for (long m = 0; m < messages; m++) {
+        char text[512];
+        uint64_t id = ++*seed;
+        bench_client_text(text, sizeof(text), id);
+        s_last_text_ns = 0;
+        uint64_t start = bench_now_ns();
+        if (bench_send(&conns[bench_message_sender(id)], text) != ESP_OK || s_last_text_ns == 0) {
+            fprintf(stderr, "%s: message %lu was not broadcast\n", label, (unsigned long)id);
+            return false;
+        }
+        latency[m] = s_last_text_ns - start;
+        usleep(SEND_GAP_US);
+    }
+
+    /* Let the storage task finish the last group before counting flushes. */
+    usleep(2 * MESSAGE_LOG_COMMIT_MS * 1000 + FLUSH_US);
+    flushes = s_flushes - flushes;
+    uint64_t p50 = bench_percentile(latency, (size_t)messages, 50);
+    uint64_t p99 = bench_percentile(latency, (size_t)messages, 99);
+    /* bench_percentile() sorted the samples, so the last one is the slowest. */
+    printf("%-24s p50 %8.1f us  p99 %8.1f us  max %8.1f us  %3ld messages, %3lu flushes\n", label, p50 / 1e3,
+           p99 / 1e3, latency[messages - 1] / 1e3, messages, flushes);
+    return true;
+}
+
+int main(void)
+{
+    static bench_conn_t conns[CLIENT_COUNT];
+    uint64_t seed = 0;
+
+    bench_server_start(true);
+    bench_set_frame_hook(note_text, NULL);
+    for (int i = 0; i < CLIENT_COUNT; i++) {
+        bench_connect(&conns[i], i);
+        bench_join(&conns[i], NULL);
+    }
+
+    bool ok = true;
+    if (!MESSAGE_LOG_ACK_AFTER_COMMIT) {
+        ok = run("inline", conns, &seed);
+    }
+    bench_server_start_persist();
+    ok = run(MESSAGE_LOG_ACK_AFTER_COMMIT ? "task, ack after commit" : "task, ack after enqueue", conns, &seed) && ok;
+
+    bench_server_stop();
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,265 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "bench_server.h"
+#include "cJSON.h"
+#include "chat/sessions.h"
+#include "chat_config.h"
+#include "esp_timer.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * A reconnect storm against the presence task, in real time: CLIENTS joined clients drop
+ * DROP_GAP_MS apart and rejoin on a new connection RECONNECT_MS after their drop, as script.js does,
+ * sending the presence version they know. Once the server sees the closes and once it does not, and
+ * the rejoin takes over the stale slot. The simulated clients apply onlineUsers and presence frames
+ * as updateOnlineUsers() does and must end on the server's version and joined set. The bytes
+ * reaching clients are set against what the full onlineUsers broadcasts would have sent for the
+ * same events: the join reply, a broadcast to every joined session and the getOnlineUser reply
+ * on each join, and a broadcast on each leave.
+ */
+#define CLIENTS         10
+#define DROP_GAP_MS     20
+#define RECONNECT_MS    1000
+
+typedef struct {
+    bool known;
+    uint32_t version;
+    uint32_t users;         /* bit per client index */
+    bool wants_snapshot;
+} client_view_t;
+
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static client_view_t s_views[CLIENTS];
+static uint64_t s_frames;
+static uint64_t s_bytes;
+static bench_conn_t s_conns[2 * CLIENTS];
+
+static const char *member_string(cJSON *object, const char *key)
+{
+    cJSON *item = cJSON_GetObjectItem(object, key);
+    return cJSON_IsString(item) ? item->valuestring : "";
+}
+
+static bool member_equals(cJSON *object, const char *key, uint32_t value)
+{
+    cJSON *item = cJSON_GetObjectItem(object, key);
+    return cJSON_IsNumber(item) && item->valuedouble == (double)value;
+}
+
+static int client_of_id(const char *id)
+{
+    for (int c = 0; c < CLIENTS; c++) {
+        if (strcmp(bench_client_id(c), id) == 0) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+static void set_user(client_view_t *view, cJSON *user, bool present)
+{
+    int c = client_of_id(member_string(user, "id"));
+    if (c >= 0) {
+        view->users = present ? view->users | 1u << c : view->users & ~(1u << c);
+    }
+}
+
+/* updateOnlineUsers() of script.js. */
+static void apply_frame(client_view_t *view, int self, cJSON *root)
+{
+    cJSON *version = cJSON_GetObjectItem(root, "version");
+    cJSON *item = NULL;
+    if (strcmp(member_string(root, "type"), "presence") == 0) {
+        if (view->known && member_equals(root, "version", view->version)) {
+            return;
+        }
+        if (!view->known || !member_equals(root, "base", view->version)) {
+            view->known = false;
+            view->wants_snapshot = true;
+            return;
+        }
+        cJSON_ArrayForEach(item, cJSON_GetObjectItem(root, "events")) {
+            set_user(view, item, strcmp(member_string(item, "type"), "userLeft") != 0);
+        }
+    } else {
+        view->users = 0;
+        cJSON_ArrayForEach(item, cJSON_GetObjectItem(root, "data")) {
+            set_user(view, item, true);
+        }
+    }
+    view->known = cJSON_IsNumber(version);
+    view->version = view->known ? (uint32_t)version->valuedouble : 0;
+    view->users |= 1u << self;
+}
+
+/* Runs on the httpd caller and on the presence task. */
+static void observe_frame(int index, httpd_ws_type_t type, const uint8_t *data, size_t len, void *arg)
+{
+    static const char online_users[] = "{\"type\":\"onlineUsers\"";
+    static const char presence[] = "{\"type\":\"presence\"";
+
+    if (type != HTTPD_WS_TYPE_TEXT ||
+        !((len >= sizeof(online_users) - 1 && memcmp(data, online_users, sizeof(online_users) - 1) == 0) ||
+          (len >= sizeof(presence) - 1 && memcmp(data, presence, sizeof(presence) - 1) == 0))) {
+        return;
+    }
+    cJSON *root = cJSON_ParseWithLength((const char *)data, len);
+    pthread_mutex_lock(&s_lock);
+    s_frames++;
+    s_bytes += len;
+    if (root != NULL) {
+        apply_frame(&s_views[index % CLIENTS], index % CLIENTS, root);
+    }
+    pthread_mutex_unlock(&s_lock);
+    cJSON_Delete(root);
+}
+
+/* The onlineUsers frame before versions, for joined: what every change used to broadcast. */
+static size_t old_list_bytes(uint32_t joined)
+{
+    char ids[1024] = "";
+    char data[2048] = "";
+    int ids_len = 0;
+    int data_len = 0;
+    for (int c = 0; c < CLIENTS; c++) {
+        if (joined & 1u << c) {
+            ids_len += snprintf(ids + ids_len, sizeof(ids) - (size_t)ids_len, "%s\"%s\"", ids_len ? "," : "",
+                                bench_client_id(c));
+            data_len += snprintf(data + data_len, sizeof(data) - (size_t)data_len, "%s{\"id\":\"%s\",\"name\":\"%s\"}",
+                                 data_len ? "," : "", bench_client_id(c), bench_client_name(c));
+        }
+    }
+    char frame[4096];
+    return (size_t)snprintf(frame, sizeof(frame), "{\"type\":\"onlineUsers\",\"from\":\"server\",\"timestamp\":1735689600,"
+                            "\"to\":{\"users\":[%s],\"all\":true},\"data\":[%s]}", ids, data);
+}
+
+/* The join of client slot % CLIENTS on connection slot, with the presence version the client holds. */
+static void join(int slot)
+{
+    int c = slot % CLIENTS;
+    char version[32] = "";
+    pthread_mutex_lock(&s_lock);
+    if (s_views[c].known) {
+        snprintf(version, sizeof(version), ",\"presence_version\":%lu", (unsigned long)s_views[c].version);
+    }
+    pthread_mutex_unlock(&s_lock);
+    char frame[256];
+    snprintf(frame, sizeof(frame), "{\"type\":\"join\",\"from\":\"%s\",\"name\":\"%s\",\"timestamp\":%lld%s}",
+             bench_client_id(c), bench_client_name(c), (long long)(1735689600 + esp_timer_get_time() / 1000000),
+             version);
+    bench_send(&s_conns[slot], frame);
+}
+
+static void sleep_until_ms(int64_t start_us, int64_t at_ms)
+{
+    int64_t wait_us = start_us + at_ms * 1000 - esp_timer_get_time();
+    if (wait_us > 0) {
+        usleep((useconds_t)wait_us);
+    }
+}
+
+/* Lets the presence task flush, then has every client that saw a gap ask for a snapshot. */
+static void settle(int base)
+{
+    usleep(2 * PRESENCE_DEBOUNCE_MS * 1000);
+    for (int c = 0; c < CLIENTS; c++) {
+        pthread_mutex_lock(&s_lock);
+        bool wants = s_views[c].wants_snapshot;
+        s_views[c].wants_snapshot = false;
+        pthread_mutex_unlock(&s_lock);
+        if (wants) {
+            char request[128];
+            snprintf(request, sizeof(request), "{\"type\":\"getOnlineUser\",\"from\":\"%s\",\"timestamp\":1735689600}",
+                     bench_client_id(c));
+            bench_send(&s_conns[base + c], request);
+        }
+    }
+}
+
+static bool run(const char *label, bool server_sees_closes)
+{
+    app_context_t *ctx = &g_app_context;
+    uint32_t joined = (1u << CLIENTS) - 1;
+    uint64_t old_frames = 0;
+    uint64_t old_bytes = 0;
+
+    pthread_mutex_lock(&s_lock);
+    s_frames = 0;
+    s_bytes = 0;
+    pthread_mutex_unlock(&s_lock);
+
+    int64_t start_us = esp_timer_get_time();
+    for (int step = 0; step < 2 * CLIENTS; step++) {
+        int c = step % CLIENTS;
+        if (step < CLIENTS) {
+            sleep_until_ms(start_us, c * DROP_GAP_MS);
+            if (server_sees_closes) {
+                bench_disconnect(&s_conns[c]);
+                joined &= ~(1u << c);
+                old_frames += (uint64_t)__builtin_popcount(joined);
+                old_bytes += __builtin_popcount(joined) * old_list_bytes(joined);
+            }
+            continue;
+        }
+        sleep_until_ms(start_us, c * DROP_GAP_MS + RECONNECT_MS);
+        bench_connect(&s_conns[CLIENTS + c], CLIENTS + c);
+        join(CLIENTS + c);
+        joined |= 1u << c;
+        old_frames += 2 + (uint64_t)__builtin_popcount(joined);
+        old_bytes += (2 + __builtin_popcount(joined)) * old_list_bytes(joined);
+    }
+    settle(CLIENTS);
+    usleep(100000);
+
+    bool consistent = true;
+    xSemaphoreTake(ctx->client_mutex, portMAX_DELAY);
+    uint32_t version = ctx->presence_version;
+    xSemaphoreGive(ctx->client_mutex);
+    pthread_mutex_lock(&s_lock);
+    for (int c = 0; c < CLIENTS; c++) {
+        consistent = consistent && s_views[c].known && s_views[c].version == version && s_views[c].users == joined;
+    }
+    printf("  %-22s onlineUsers broadcasts %6llu B / %3llu frames, presence %6llu B / %3llu frames\n", label,
+           (unsigned long long)old_bytes, (unsigned long long)old_frames, (unsigned long long)s_bytes,
+           (unsigned long long)s_frames);
+    pthread_mutex_unlock(&s_lock);
+    if (!consistent) {
+        fprintf(stderr, "%s: a client does not hold the server's version and list\n", label);
+    }
+    return consistent;
+}
+
+int main(void)
+{
+    bench_server_start(false);
+    if (chat_sessions_start_presence(&g_app_context) != ESP_OK) {
+        fprintf(stderr, "the presence task did not start\n");
+        return EXIT_FAILURE;
+    }
+    bench_set_frame_hook(observe_frame, NULL);
+
+    printf("%d clients drop %d ms apart and rejoin after %d ms\n", CLIENTS, DROP_GAP_MS, RECONNECT_MS);
+    bool ok = true;
+    const bool sees_closes[] = { true, false };
+    const char *const labels[] = { "server sees the closes", "server misses them" };
+    for (int r = 0; r < 2; r++) {
+        memset(s_views, 0, sizeof(s_views));
+        for (int c = 0; c < CLIENTS; c++) {
+            bench_connect(&s_conns[c], c);
+            join(c);
+        }
+        settle(0);
+        ok = run(labels[r], sees_closes[r]) && ok;
+        for (int c = 0; c < CLIENTS; c++) {
+            bench_disconnect(&s_conns[CLIENTS + c]);
+        }
+        usleep(2 * PRESENCE_DEBOUNCE_MS * 1000);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
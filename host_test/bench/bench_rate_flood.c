@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_messages.h"
+#include "bench_server.h"
+#include "chat_config.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Text latency of ordinary clients while one client floods, on a simulated clock. The single httpd
+ * task serves ready sockets round-robin; every frame goes through chat_ws_handler(), which decides
+ * whether it is stored and broadcast, and the clock then moves on by the modelled firmware cost:
+ * TEXT_US for a stored text, SCAN_US for a dropped one. CLIENTS - 1 clients send every 0.5 to 4 s
+ * and the last sends back to back. bench_rate_flood_unlimited raises the chat burst out of reach.
+ */
+#define CLIENTS         10
+#define FLOODER         (CLIENTS - 1)
+#define TEXT_US         2400
+#define SCAN_US         40
+#define QUEUE_DEPTH     64
+#define MAX_SAMPLES     8192
+
+typedef struct {
+    int64_t arrivals[QUEUE_DEPTH];
+    int head;
+    int count;
+    int64_t next_send_us;
+} client_t;
+
+static bench_conn_t s_conns[CLIENTS];
+static int64_t s_clock_us;
+static uint32_t s_seed = 1;
+
+static uint32_t next_random(void)
+{
+    s_seed = s_seed * 1103515245u + 12345u;
+    return s_seed >> 8;
+}
+
+static int64_t send_gap_us(void)
+{
+    return 500000 + (int64_t)(next_random() % 3500000);
+}
+
+/* Serves one text from client c at now_us on the manual clock; returns whether the server stored it. */
+static bool serve(int c, int64_t now_us, uint64_t seq)
+{
+    char data[256];
+    char text[512];
+    bench_message_data(data, sizeof(data), seq);
+    snprintf(text, sizeof(text), "{\"type\":\"text\",\"from\":\"%s\",\"to\":{\"all\":true,\"users\":[]},\"name\":\"%s\","
+             "\"data\":\"%s\",\"timestamp\":%lld}", bench_client_id(c), bench_client_name(c), data,
+             (long long)(1735689600 + now_us / 1000000));
+    host_clock_advance_us(now_us - s_clock_us);
+    s_clock_us = now_us;
+
+    uint64_t before = g_app_context.message_id_counter;
+    bench_send(&s_conns[c], text);
+    return g_app_context.message_id_counter != before;
+}
+
+static void run(const char *label, bool flood, int64_t duration_us)
+{
+    static uint64_t latency[MAX_SAMPLES];
+    static client_t clients[CLIENTS];
+    size_t samples = 0;
+    uint64_t flood_stored = 0;
+    uint64_t seq = 0;
+    int64_t base_us = s_clock_us;
+    int next = 0;
+
+    /* The same arrivals in every run. */
+    s_seed = 1;
+    memset(clients, 0, sizeof(clients));
+    for (int c = 0; c < FLOODER; c++) {
+        clients[c].next_send_us = send_gap_us();
+    }
+
+    for (int64_t t = 0; t < duration_us;) {
+        int64_t wake = duration_us;
+        for (int c = 0; c < FLOODER; c++) {
+            client_t *client = &clients[c];
+            while (client->next_send_us <= t) {
+                if (client->count < QUEUE_DEPTH) {
+                    client->arrivals[(client->head + client->count++) % QUEUE_DEPTH] = client->next_send_us;
+                }
+                client->next_send_us += send_gap_us();
+            }
+            wake = client->next_send_us < wake ? client->next_send_us : wake;
+        }
+
+        int c = -1;
+        for (int step = 0; step < CLIENTS && c < 0; step++) {
+            int candidate = (next + step) % CLIENTS;
+            if (candidate == FLOODER ? flood : clients[candidate].count > 0) {
+                c = candidate;
+            }
+        }
+        if (c < 0) {
+            t = wake;
+            continue;
+        }
+        next = (c + 1) % CLIENTS;
+
+        bool stored = serve(c, base_us + t, ++seq);
+        t += stored ? TEXT_US : SCAN_US;
+        if (c == FLOODER) {
+            flood_stored += stored;
+            continue;
+        }
+        client_t *client = &clients[c];
+        if (samples < MAX_SAMPLES) {
+            latency[samples++] = (uint64_t)(t - client->arrivals[client->head]);
+        }
+        client->head = (client->head + 1) % QUEUE_DEPTH;
+        client->count--;
+    }
+
+    uint64_t p50 = bench_percentile(latency, samples, 50);
+    uint64_t p99 = bench_percentile(latency, samples, 99);
+    printf("  %-10s p50 %5.2f ms  p99 %5.2f ms  %5zu texts", label, p50 / 1e3, p99 / 1e3, samples);
+    if (flood) {
+        printf(", %llu flood texts stored and broadcast", (unsigned long long)flood_stored);
+    }
+    printf("\n");
+}
+
+int main(void)
+{
+    bench_server_start(false);
+    host_clock_set_manual(true);
+
+    int64_t duration_us = bench_iterations(120) * 1000000;
+    printf("%d clients, %lld s, chat burst %d at %d/s\n", CLIENTS, (long long)(duration_us / 1000000),
+           RATE_CHAT_BURST, RATE_CHAT_PER_S);
+    const char *const labels[] = { "no flood", "flood" };
+    for (int flood = 0; flood <= 1; flood++) {
+        /* Fresh sessions, so the flooder starts with a full bucket. */
+        for (int c = 0; c < CLIENTS; c++) {
+            bench_connect(&s_conns[c], c);
+            bench_join(&s_conns[c], NULL);
+        }
+        run(labels[flood], flood, duration_us);
+        for (int c = 0; c < CLIENTS; c++) {
+            bench_disconnect(&s_conns[c]);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,150 @@
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_server.h"
+#include "chat/history.h"
+#include "chat/recipients.h"
+#include "chat_config.h"
+#include "server/websocket_server.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Peak heap while CLIENT_COUNT clients rejoin one after another against a full history of
+ * MAX_MESSAGES: chat_history_send_to_client(), which takes a reference to each stored payload,
+ * against a copy of the replay it replaced, which malloc'd and memcpy'd every payload under
+ * message_mutex before sending any. Both replay the same visible messages one frame each. Live
+ * bytes are tracked through -Wl,--wrap of the heap calls and malloc_usable_size().
+ */
+#define CLIENT_COUNT 10
+
+static atomic_long s_live_bytes;
+static long s_peak_bytes;
+static unsigned long s_heap_calls;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static void *track(void *ptr)
+{
+    if (ptr != NULL) {
+        long live = atomic_fetch_add(&s_live_bytes, (long)malloc_usable_size(ptr)) + (long)malloc_usable_size(ptr);
+        s_peak_bytes = live > s_peak_bytes ? live : s_peak_bytes;
+        s_heap_calls++;
+    }
+    return ptr;
+}
+
+static void untrack(void *ptr)
+{
+    if (ptr != NULL) {
+        atomic_fetch_sub(&s_live_bytes, (long)malloc_usable_size(ptr));
+    }
+}
+
+void *__wrap_malloc(size_t size)
+{
+    return track(__real_malloc(size));
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    return track(__real_calloc(count, size));
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    untrack(ptr);
+    return track(__real_realloc(ptr, size));
+}
+
+void __wrap_free(void *ptr)
+{
+    untrack(ptr);
+    __real_free(ptr);
+}
+
+/* history.c before reference counting: every replayed payload copied before the first send. */
+static void copy_replay(app_context_t *ctx, int fd, const char *user_id)
+{
+    char **payloads = calloc(MAX_MESSAGES, sizeof(char *));
+    int count = 0;
+
+    if (payloads == NULL) {
+        return;
+    }
+    xSemaphoreTake(ctx->message_mutex, portMAX_DELAY);
+    int handle = chat_user_table_find(&ctx->message_users, user_id);
+    int oldest = (ctx->message_buffer_head + MAX_MESSAGES - ctx->message_count) % MAX_MESSAGES;
+    for (int i = 0; i < ctx->message_count; i++) {
+        const message_t *message = &ctx->message_buffer[(oldest + i) % MAX_MESSAGES];
+        if (!chat_recipients_visible(&ctx->groups, &message->recipients, handle, message->payload, user_id)) {
+            continue;
+        }
+        payloads[count] = malloc(message->payload->len + 1);
+        if (payloads[count] == NULL) {
+            break;
+        }
+        memcpy(payloads[count++], message->payload->data, message->payload->len + 1);
+    }
+    xSemaphoreGive(ctx->message_mutex);
+
+    for (int i = 0; i < count; i++) {
+        chat_ws_send_text(ctx, fd, payloads[i]);
+        free(payloads[i]);
+    }
+    free(payloads);
+}
+
+static void run(const char *label, bool copy)
+{
+    static bench_conn_t conns[CLIENT_COUNT];
+    app_context_t *ctx = &g_app_context;
+
+    for (int i = 0; i < CLIENT_COUNT; i++) {
+        bench_connect(&conns[i], i);
+        bench_join(&conns[i], "\"replay_limit\":1");
+    }
+    bench_traffic_reset();
+    long base = atomic_load(&s_live_bytes);
+    s_peak_bytes = base;
+    unsigned long calls = s_heap_calls;
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < CLIENT_COUNT; i++) {
+        if (copy) {
+            copy_replay(ctx, conns[i].fd, bench_client_id(i));
+        } else {
+            history_replay_t replay = { .user_id = bench_client_id(i) };
+            chat_history_send_to_client(ctx, conns[i].fd, &replay);
+        }
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    bench_traffic_t total = bench_traffic_total();
+    printf("  %-10s %4llu frames, peak %6ld B above idle, %5lu heap calls, %7.1f us\n", label,
+           (unsigned long long)total.frames, s_peak_bytes - base, s_heap_calls - calls, elapsed / 1e3);
+
+    for (int i = 0; i < CLIENT_COUNT; i++) {
+        bench_disconnect(&conns[i]);
+    }
+}
+
+int main(void)
+{
+    bench_server_start(false);
+    for (uint64_t seed = 1; seed <= MAX_MESSAGES; seed++) {
+        if (!bench_store_message(seed)) {
+            fprintf(stderr, "message %lu was not stored\n", (unsigned long)seed);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%d clients rejoin against %d stored messages\n", CLIENT_COUNT, MAX_MESSAGES);
+    run("copy", true);
+    run("reference", false);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_messages.h"
+#include "bench_server.h"
+#include "chat_config.h"
+#include "esp_timer.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * History replay bytes per join with a realistic mix of private traffic: CLIENTS clients in GROUPS
+ * overlapping groups of four fill the history with MAX_MESSAGES texts, 30% broadcasts, 40% direct
+ * messages and 30% group messages. Each client then rejoins on a new connection. Before the
+ * recipient descriptors every stored message was replayed to every joiner; now only what
+ * isMessageForMe() in script.js would accept is sent, and the replay must match that exactly.
+ */
+#define CLIENTS         10
+#define GROUPS          3
+#define GROUP_MEMBERS   4
+
+typedef struct {
+    uint64_t frames;
+    uint64_t bytes;
+} replayed_t;
+
+static bench_conn_t s_conns[2 * CLIENTS];
+static char s_group_ids[GROUPS][40];
+static uint32_t s_seed = 1;
+
+static uint32_t next_random(void)
+{
+    s_seed = s_seed * 1103515245u + 12345u;
+    return s_seed >> 8;
+}
+
+static bool in_group(int client, int group)
+{
+    return client >= group * 3 && client < group * 3 + GROUP_MEMBERS;
+}
+
+static long long now_s(void)
+{
+    return 1735689600 + esp_timer_get_time() / 1000000;
+}
+
+static void count_replay(int index, httpd_ws_type_t type, const uint8_t *data, size_t len, void *arg)
+{
+    static const char text[] = "{\"type\":\"text\"";
+    static const char new_group[] = "{\"type\":\"newGroup\"";
+    replayed_t *replayed = arg;
+
+    if (index >= CLIENTS && type == HTTPD_WS_TYPE_TEXT &&
+        ((len >= sizeof(text) - 1 && memcmp(data, text, sizeof(text) - 1) == 0) ||
+         (len >= sizeof(new_group) - 1 && memcmp(data, new_group, sizeof(new_group) - 1) == 0))) {
+        replayed->frames++;
+        replayed->bytes += len;
+    }
+}
+
+/* Announces group from its first member to the other three, as script.js does. */
+static void create_group(int group)
+{
+    char users[512];
+    char frame[1024];
+    int creator = group * 3;
+    int len = 0;
+
+    snprintf(s_group_ids[group], sizeof(s_group_ids[group]), "6ba7b810-9dad-11d1-80b4-00c04fd430%02d", group);
+    for (int c = creator + 1; c < creator + GROUP_MEMBERS; c++) {
+        len += snprintf(users + len, sizeof(users) - (size_t)len, "%s\"%s\"", len ? "," : "", bench_client_id(c));
+    }
+    snprintf(frame, sizeof(frame),
+             "{\"type\":\"newGroup\",\"from\":\"%s\",\"name\":\"%s\",\"groupId\":\"%s\",\"groupName\":\"Group %d\","
+             "\"to\":{\"all\":false,\"users\":[%s]},\"data\":\"%s created Group %d\",\"timestamp\":%lld}",
+             bench_client_id(creator), bench_client_name(creator), s_group_ids[group], group, users,
+             bench_client_name(creator), group, now_s());
+    bench_send(&s_conns[creator], frame);
+}
+
+/* Sends message seed from a random client; marks in visible[] the clients that should see it. */
+static void send_message(uint64_t seed, bool visible[CLIENTS])
+{
+    char data[256];
+    char to[160];
+    char frame[1024];
+    uint32_t kind = next_random() % 10;
+    int from = (int)(next_random() % CLIENTS);
+    const char *group_fields = "";
+    char group_buf[128];
+
+    memset(visible, 0, CLIENTS * sizeof(bool));
+    if (kind < 3) {
+        snprintf(to, sizeof(to), "{\"all\":true,\"users\":[]}");
+        memset(visible, 1, CLIENTS * sizeof(bool));
+    } else if (kind < 7) {
+        int peer = (from + 1 + (int)(next_random() % (CLIENTS - 1))) % CLIENTS;
+        snprintf(to, sizeof(to), "{\"all\":false,\"users\":[\"%s\"]}", bench_client_id(peer));
+        visible[from] = true;
+        visible[peer] = true;
+    } else {
+        int group = (int)(next_random() % GROUPS);
+        from = group * 3 + (int)(next_random() % GROUP_MEMBERS);
+        snprintf(to, sizeof(to), "{\"group\":\"%s\"}", s_group_ids[group]);
+        snprintf(group_buf, sizeof(group_buf), ",\"groupId\":\"%s\",\"groupName\":\"Group %d\"", s_group_ids[group],
+                 group);
+        group_fields = group_buf;
+        for (int c = 0; c < CLIENTS; c++) {
+            visible[c] = in_group(c, group);
+        }
+    }
+    bench_message_data(data, sizeof(data), seed);
+    snprintf(frame, sizeof(frame), "{\"type\":\"text\",\"from\":\"%s\",\"to\":%s,\"name\":\"%s\",\"data\":\"%s\","
+             "\"timestamp\":%lld%s}", bench_client_id(from), to, bench_client_name(from), data, now_s(), group_fields);
+    bench_send(&s_conns[from], frame);
+}
+
+int main(void)
+{
+    static bool visible[MAX_MESSAGES][CLIENTS];
+    app_context_t *ctx = &g_app_context;
+
+    bench_server_start(false);
+    for (int c = 0; c < CLIENTS; c++) {
+        bench_connect(&s_conns[c], c);
+        bench_join(&s_conns[c], NULL);
+    }
+
+    /* The newGroup announcements are stored too and take the first GROUPS slots. */
+    for (int g = 0; g < GROUPS; g++) {
+        create_group(g);
+        for (int c = 0; c < CLIENTS; c++) {
+            visible[g][c] = in_group(c, g);
+        }
+    }
+    for (int m = GROUPS; m < MAX_MESSAGES; m++) {
+        uint64_t count = ctx->message_id_counter;
+        send_message((uint64_t)m, visible[m]);
+        if (ctx->message_id_counter != count + 1) {
+            fprintf(stderr, "message %d was not stored\n", m);
+            return EXIT_FAILURE;
+        }
+    }
+
+    uint64_t stored_bytes = 0;
+    for (int i = 0; i < ctx->message_count; i++) {
+        stored_bytes += ctx->message_buffer[i].payload->len;
+    }
+
+    bool ok = true;
+    replayed_t total = { 0 };
+    for (int c = 0; c < CLIENTS; c++) {
+        char join[256];
+        replayed_t replayed = { 0 };
+        int expected = 0;
+        for (int m = 0; m < MAX_MESSAGES; m++) {
+            expected += visible[m][c];
+        }
+
+        bench_disconnect(&s_conns[c]);
+        bench_connect(&s_conns[CLIENTS + c], CLIENTS + c);
+        snprintf(join, sizeof(join), "{\"type\":\"join\",\"from\":\"%s\",\"name\":\"%s\",\"timestamp\":%lld}",
+                 bench_client_id(c), bench_client_name(c), now_s());
+        bench_set_frame_hook(count_replay, &replayed);
+        bench_send(&s_conns[CLIENTS + c], join);
+        bench_set_frame_hook(NULL, NULL);
+        if (replayed.frames != (uint64_t)expected) {
+            fprintf(stderr, "client %d: %llu messages replayed, %d visible\n", c,
+                    (unsigned long long)replayed.frames, expected);
+            ok = false;
+        }
+        total.frames += replayed.frames;
+        total.bytes += replayed.bytes;
+    }
+
+    printf("%d clients, %d groups of %d, %d stored messages (30%% broadcast, 40%% direct, 30%% group)\n", CLIENTS,
+           GROUPS, GROUP_MEMBERS, ctx->message_count);
+    printf("  every message  %5.1f frames, %6.0f bytes per join\n", (double)ctx->message_count,
+           (double)stored_bytes);
+    printf("  visible only   %5.1f frames, %6.0f bytes per join\n", (double)total.frames / CLIENTS,
+           (double)total.bytes / CLIENTS);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,100 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_messages.h"
+#include "cJSON.h"
+#include "chat/frame.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Turning a client text frame into its stored form: chat_frame_rewrite() as
+ * chat_history_finalize_and_store_message() calls it, against the cJSON reprint it replaced
+ * (parse, drop the client id and timestamp, add the server ones, print). Both must produce the
+ * same bytes.
+ */
+#define FRAME_COUNT 64
+#define FRAME_BYTES 512
+
+static char s_frames[FRAME_COUNT][FRAME_BYTES];
+static size_t s_frame_len[FRAME_COUNT];
+
+static char *rewrite_splice(const char *src, size_t len, uint64_t id, int64_t timestamp, size_t *len_out)
+{
+    static const char *const server_fields[] = { "id", "timestamp", NULL };
+    char stamp[64];
+    snprintf(stamp, sizeof(stamp), "\"id\":%" PRIu64 ",\"timestamp\":%" PRId64, id, timestamp);
+    chat_frame_rewrite_t rewrite = {
+        .strip = server_fields,
+        .fill_to = true,
+        .append = stamp,
+    };
+    return chat_frame_rewrite(src, len, &rewrite, len_out);
+}
+
+static char *rewrite_reprint(const char *src, size_t len, uint64_t id, int64_t timestamp, size_t *len_out)
+{
+    cJSON *root = cJSON_ParseWithLength(src, len);
+    if (root == NULL) {
+        return NULL;
+    }
+    cJSON_DeleteItemFromObjectCaseSensitive(root, "id");
+    cJSON_DeleteItemFromObjectCaseSensitive(root, "timestamp");
+    char *printed = NULL;
+    if (cJSON_AddNumberToObject(root, "id", (double)id) != NULL &&
+        cJSON_AddNumberToObject(root, "timestamp", (double)timestamp) != NULL) {
+        printed = cJSON_PrintUnformatted(root);
+    }
+    cJSON_Delete(root);
+    if (printed != NULL) {
+        *len_out = strlen(printed);
+    }
+    return printed;
+}
+
+static bool run(const char *label, char *(*rewrite)(const char *, size_t, uint64_t, int64_t, size_t *))
+{
+    long rounds = bench_iterations(1000000);
+    unsigned long allocations = bench_allocations;
+    uint64_t start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        int i = (int)(r % FRAME_COUNT);
+        size_t len = 0;
+        char *out = rewrite(s_frames[i], s_frame_len[i], (uint64_t)r + 1, 1735689600 + r, &len);
+        if (out == NULL) {
+            fprintf(stderr, "%s failed on frame %d\n", label, i);
+            return false;
+        }
+        bench_sink += len;
+        free(out);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    printf("%-8s %6.0f ns/frame  %5.1f allocations/frame\n", label, (double)elapsed / rounds,
+           (double)(bench_allocations - allocations) / rounds);
+    return true;
+}
+
+int main(void)
+{
+    for (int i = 0; i < FRAME_COUNT; i++) {
+        s_frame_len[i] = bench_client_text(s_frames[i], FRAME_BYTES, (uint64_t)i + 1);
+        size_t splice_len = 0;
+        size_t reprint_len = 0;
+        char *splice = rewrite_splice(s_frames[i], s_frame_len[i], 1000 + i, 1735689600 + i, &splice_len);
+        char *reprint = rewrite_reprint(s_frames[i], s_frame_len[i], 1000 + i, 1735689600 + i, &reprint_len);
+        bool same = splice != NULL && reprint != NULL && splice_len == reprint_len &&
+                    memcmp(splice, reprint, splice_len) == 0;
+        free(splice);
+        free(reprint);
+        if (!same) {
+            fprintf(stderr, "frame %d: the rewrite and the reprint differ\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+
+    bool ok = run("rewrite", rewrite_splice);
+    ok = run("reprint", rewrite_reprint) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,262 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "bench_messages.h"
+#include "chat/search.h"
+#include "chat_config.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Indexes 10k messages and times queries against a scan over the same texts, then replays the
+ * 10k messages through the firmware-sized index with the history ring evicting behind them.
+ * Last, CHECK_INSERTS messages go through the firmware-sized index while every query's full hit
+ * list is compared, every CHECK_EVERY inserts, with a term-by-term scan of the live ring.
+ */
+#define MESSAGE_COUNT 10000
+#define DATA_BYTES    128
+#define LARGE_BUDGET  (2u * 1024 * 1024)
+#define CHECK_INSERTS 100000
+#define CHECK_EVERY   97
+#define TERM_BYTES    48
+#define MAX_TERMS     64
+
+static char s_texts[MESSAGE_COUNT][DATA_BYTES];
+static size_t s_text_len[MESSAGE_COUNT];
+
+static const char *const s_queries[] = { "charger", "meeting room", "battery low", "收到", "lunch at the" };
+
+#define QUERY_COUNT (sizeof(s_queries) / sizeof(s_queries[0]))
+
+typedef struct {
+    int hits;
+} collect_t;
+
+/* Stops at SEARCH_MAX_RESULTS like the search request in chat/history.c. */
+static bool collect_hit(uint64_t id, void *arg)
+{
+    collect_t *collect = arg;
+    bench_sink += id;
+    return ++collect->hits < SEARCH_MAX_RESULTS;
+}
+
+/* The alternative to the index: check the texts from oldest on for every query word, newest first. */
+static int scan_texts(const char *query, int oldest)
+{
+    char words[SEARCH_MAX_QUERY_TERMS][32];
+    int word_count = 0;
+    char copy[128];
+    snprintf(copy, sizeof(copy), "%s", query);
+    for (char *save = NULL, *word = strtok_r(copy, " ", &save); word != NULL && word_count < SEARCH_MAX_QUERY_TERMS;
+         word = strtok_r(NULL, " ", &save)) {
+        snprintf(words[word_count++], sizeof(words[0]), "%s", word);
+    }
+
+    int hits = 0;
+    for (int i = MESSAGE_COUNT - 1; i >= oldest && hits < SEARCH_MAX_RESULTS; i--) {
+        bool all = true;
+        for (int w = 0; w < word_count && all; w++) {
+            all = strcasestr(s_texts[i], words[w]) != NULL;
+        }
+        hits += all;
+    }
+    return hits;
+}
+
+typedef struct {
+    uint64_t ids[MAX_MESSAGES];
+    int count;
+} hit_list_t;
+
+static bool list_hit(uint64_t id, void *arg)
+{
+    hit_list_t *list = arg;
+    if (list->count < MAX_MESSAGES) {
+        list->ids[list->count] = id;
+    }
+    list->count++;
+    return true;
+}
+
+/* The terms of chat/search.c as strings: ASCII letter and digit runs lowercased, other UTF-8 characters alone. */
+static int split_terms(const char *text, char terms[][TERM_BYTES])
+{
+    int count = 0;
+    const unsigned char *p = (const unsigned char *)text;
+    while (*p != '\0' && count < MAX_TERMS) {
+        int len = 0;
+        if (*p >= 0x80) {
+            terms[count][len++] = (char)*p++;
+            while ((*p & 0xC0) == 0x80 && len < TERM_BYTES - 1) {
+                terms[count][len++] = (char)*p++;
+            }
+        } else if (isalnum(*p)) {
+            while (*p != '\0' && *p < 0x80 && isalnum(*p) && len < TERM_BYTES - 1) {
+                terms[count][len++] = (char)tolower(*p++);
+            }
+        } else {
+            p++;
+            continue;
+        }
+        terms[count++][len] = '\0';
+    }
+    return count;
+}
+
+/* Ids from newest down to oldest whose text holds every term of query. */
+static void scan_terms(const char *query, uint64_t newest, uint64_t oldest, hit_list_t *list)
+{
+    char query_terms[MAX_TERMS][TERM_BYTES];
+    char text_terms[MAX_TERMS][TERM_BYTES];
+    int query_count = split_terms(query, query_terms);
+
+    list->count = 0;
+    for (uint64_t id = newest; id >= oldest && id > 0; id--) {
+        int text_count = split_terms(s_texts[(id - 1) % MESSAGE_COUNT], text_terms);
+        bool all = query_count > 0;
+        for (int q = 0; q < query_count && all; q++) {
+            bool found = false;
+            for (int t = 0; t < text_count && !found; t++) {
+                found = strcmp(query_terms[q], text_terms[t]) == 0;
+            }
+            all = found;
+        }
+        if (all) {
+            list_hit(id, list);
+        }
+    }
+}
+
+/*
+ * An insert that fills the posting ring drops postings of the oldest message still in the history,
+ * so while it is full only the ids after the one the oldest live posting belongs to are compared.
+ */
+static bool check_against_scan(void)
+{
+    chat_search_index_t index;
+    if (chat_search_init(&index, SEARCH_INDEX_BYTES) != ESP_OK) {
+        return false;
+    }
+
+    long inserts = bench_iterations(CHECK_INSERTS);
+    long checks = 0;
+    long full_checks = 0;
+    long hits = 0;
+    bool ok = true;
+    for (uint64_t id = 1; id <= (uint64_t)inserts && ok; id++) {
+        if (id > MAX_MESSAGES) {
+            chat_search_evict_through(&index, id - MAX_MESSAGES);
+        }
+        chat_search_add(&index, id, s_texts[(id - 1) % MESSAGE_COUNT], s_text_len[(id - 1) % MESSAGE_COUNT]);
+        if (id % CHECK_EVERY != 0) {
+            continue;
+        }
+
+        uint64_t oldest = id > MAX_MESSAGES ? id - MAX_MESSAGES + 1 : 1;
+        if (index.tail_seq - index.head_seq == index.posting_capacity) {
+            oldest = index.postings[index.head_seq % index.posting_capacity].id + 1;
+            full_checks++;
+        }
+        for (size_t q = 0; q < QUERY_COUNT && ok; q++) {
+            static hit_list_t found;
+            static hit_list_t expected;
+            found.count = 0;
+            chat_search_query(&index, s_queries[q], list_hit, &found);
+            while (found.count > 0 && found.ids[found.count - 1] < oldest) {
+                found.count--;
+            }
+            scan_terms(s_queries[q], id, oldest, &expected);
+            ok = found.count == expected.count &&
+                 memcmp(found.ids, expected.ids, (size_t)found.count * sizeof(found.ids[0])) == 0;
+            if (!ok) {
+                fprintf(stderr, "after id %llu, \"%s\": %d hits from the index, %d from the scan\n",
+                        (unsigned long long)id, s_queries[q], found.count, expected.count);
+            }
+            hits += expected.count;
+            checks++;
+        }
+    }
+    if (ok) {
+        printf("%ld inserts through the %d KB index: %ld queries match the scan, %ld hits; posting ring full at %ld "
+               "checkpoints\n", inserts, SEARCH_INDEX_BYTES / 1024, checks, hits, full_checks);
+    }
+    free(index.terms);
+    free(index.postings);
+    return ok;
+}
+
+static void time_queries(const chat_search_index_t *index, int oldest)
+{
+    long rounds = bench_iterations(20000);
+    for (size_t q = 0; q < QUERY_COUNT; q++) {
+        collect_t collect = { 0 };
+        uint64_t start = bench_now_ns();
+        for (long r = 0; r < rounds; r++) {
+            collect.hits = 0;
+            chat_search_query(index, s_queries[q], collect_hit, &collect);
+        }
+        uint64_t index_ns = (bench_now_ns() - start) / rounds;
+
+        int scan_hits = 0;
+        long scan_rounds = rounds / 100 > 0 ? rounds / 100 : 1;
+        start = bench_now_ns();
+        for (long r = 0; r < scan_rounds; r++) {
+            scan_hits = scan_texts(s_queries[q], oldest);
+        }
+        uint64_t scan_ns = (bench_now_ns() - start) / scan_rounds;
+
+        printf("  %-14s %2d hits  index %7.2f us   scan %7.2f us (%d hits)\n", s_queries[q], collect.hits,
+               index_ns / 1e3, scan_ns / 1e3, scan_hits);
+    }
+}
+
+int main(void)
+{
+    for (int i = 0; i < MESSAGE_COUNT; i++) {
+        s_text_len[i] = bench_message_data(s_texts[i], DATA_BYTES, (uint64_t)i + 1);
+    }
+
+    chat_search_index_t index;
+    if (chat_search_init(&index, LARGE_BUDGET) != ESP_OK) {
+        return EXIT_FAILURE;
+    }
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < MESSAGE_COUNT; i++) {
+        chat_search_add(&index, (uint64_t)i + 1, s_texts[i], s_text_len[i]);
+    }
+    uint64_t add_ns = bench_now_ns() - start;
+    printf("%d messages into a %u KB index: %.0f ns per add, %u postings, %u dropped terms\n", MESSAGE_COUNT,
+           LARGE_BUDGET / 1024, (double)add_ns / MESSAGE_COUNT, index.tail_seq - index.head_seq, index.dropped_terms);
+    time_queries(&index, 0);
+    free(index.terms);
+    free(index.postings);
+
+    /* Firmware budget: the ring keeps MAX_MESSAGES and evicts the oldest id before each insert. */
+    if (chat_search_init(&index, SEARCH_INDEX_BYTES) != ESP_OK) {
+        return EXIT_FAILURE;
+    }
+    long passes = bench_iterations(10);
+    start = bench_now_ns();
+    uint64_t id = 0;
+    for (long p = 0; p < passes; p++) {
+        for (int i = 0; i < MESSAGE_COUNT; i++) {
+            id++;
+            if (id > MAX_MESSAGES) {
+                chat_search_evict_through(&index, id - MAX_MESSAGES);
+            }
+            chat_search_add(&index, id, s_texts[i], s_text_len[i]);
+        }
+    }
+    uint64_t steady_ns = bench_now_ns() - start;
+    printf("%lu messages through a %d KB index with a %d-message ring: %.0f ns per add+evict, %u dropped terms\n",
+           (unsigned long)id, SEARCH_INDEX_BYTES / 1024, MAX_MESSAGES, (double)steady_ns / id, index.dropped_terms);
+    time_queries(&index, MESSAGE_COUNT - MAX_MESSAGES);
+    free(index.terms);
+    free(index.postings);
+
+    return check_against_scan() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,205 @@
+#include "bench_server.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_timer.h"
+
+#include "bench_messages.h"
+#include "chat/frame.h"
+#include "chat/groups.h"
+#include "chat/history.h"
+#include "chat/payload.h"
+#include "chat/persist.h"
+#include "server/websocket_server.h"
+#include "storage/message_id_store.h"
+#include "storage/message_log.h"
+
+app_context_t g_app_context;
+
+bench_traffic_t bench_traffic[BENCH_MAX_CONNECTIONS];
+
+/* The log keeps base paths under MESSAGE_LOG_PATH_BYTES, as short as the firmware's "/storage". */
+static char s_storage_dir[MESSAGE_LOG_PATH_BYTES];
+static bench_frame_fn s_hook;
+static void *s_hook_arg;
+
+static void count_frame(int fd, httpd_ws_type_t type, const uint8_t *data, size_t len, void *arg)
+{
+    int index = fd - HOST_WS_FIRST_FD;
+    if (index < 0 || index >= BENCH_MAX_CONNECTIONS) {
+        return;
+    }
+    bench_traffic[index].frames++;
+    bench_traffic[index].bytes += len;
+    if (s_hook != NULL) {
+        s_hook(index, type, data, len, s_hook_arg);
+    }
+}
+
+/* esp_http_server runs the session close callback once the socket is torn down. */
+static void close_session(httpd_handle_t handle, int fd, void *arg)
+{
+    chat_ws_session_close_handler(handle, fd);
+}
+
+void bench_server_start(bool storage)
+{
+    app_context_t *ctx = &g_app_context;
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->boot_start_id = 1;
+    ctx->client_mutex = xSemaphoreCreateMutex();
+    ctx->message_mutex = xSemaphoreCreateMutex();
+    ctx->message_log_mutex = xSemaphoreCreateMutex();
+    ctx->group_mutex = xSemaphoreCreateMutex();
+    ctx->server = (httpd_handle_t)ctx;
+
+    chat_message_id_state_t id_state = { 0 };
+    chat_message_ids_load(&id_state);
+    ctx->message_id_counter = id_state.current_id;
+    ctx->message_id_lease = id_state.lease_id;
+    ctx->boot_start_id = id_state.boot_start_id;
+
+    chat_history_init(ctx);
+
+    if (storage) {
+        snprintf(s_storage_dir, sizeof(s_storage_dir), "/tmp/cbXXXXXX");
+        if (mkdtemp(s_storage_dir) == NULL ||
+            chat_message_log_open(&ctx->message_log, s_storage_dir) != ESP_OK) {
+            fprintf(stderr, "cannot open a message log under /tmp\n");
+            exit(EXIT_FAILURE);
+        }
+        chat_groups_load(ctx, s_storage_dir);
+        chat_history_restore_from_log(ctx);
+    }
+
+    host_ws_set_capture(count_frame, NULL);
+    host_ws_set_close(close_session, NULL);
+}
+
+void bench_server_start_persist(void)
+{
+    if (chat_persist_start(&g_app_context) != ESP_OK) {
+        fprintf(stderr, "cannot start the storage task\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void bench_server_stop(void)
+{
+    if (s_storage_dir[0] == '\0') {
+        return;
+    }
+    DIR *dir = opendir(s_storage_dir);
+    struct dirent *entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        char path[sizeof(s_storage_dir) + 300];
+        if (entry->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", s_storage_dir, entry->d_name);
+            unlink(path);
+        }
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    rmdir(s_storage_dir);
+    s_storage_dir[0] = '\0';
+}
+
+void bench_connect(bench_conn_t *conn, int index)
+{
+    conn->fd = HOST_WS_FIRST_FD + index;
+    host_ws_connect(&conn->req, g_app_context.server, &g_app_context, conn->fd);
+}
+
+esp_err_t bench_send_frame(bench_conn_t *conn, httpd_ws_type_t type, const void *data, size_t len)
+{
+    host_ws_set_frame(&conn->req, type, data, len);
+    return chat_ws_handler(&conn->req);
+}
+
+esp_err_t bench_send(bench_conn_t *conn, const char *text)
+{
+    return bench_send_frame(conn, HTTPD_WS_TYPE_TEXT, text, strlen(text));
+}
+
+const char *bench_client_id(int index)
+{
+    static char ids[BENCH_MAX_CONNECTIONS][40];
+    if (index < BENCH_USER_COUNT) {
+        return bench_user_ids[index];
+    }
+    if (ids[index][0] == '\0') {
+        snprintf(ids[index], sizeof(ids[index]), "00000000-0000-4000-8000-%012d", index);
+    }
+    return ids[index];
+}
+
+const char *bench_client_name(int index)
+{
+    static char names[BENCH_MAX_CONNECTIONS][16];
+    if (index < BENCH_USER_COUNT) {
+        return bench_user_names[index];
+    }
+    if (names[index][0] == '\0') {
+        snprintf(names[index], sizeof(names[index]), "User %d", index);
+    }
+    return names[index];
+}
+
+esp_err_t bench_join(bench_conn_t *conn, const char *extra)
+{
+    int index = conn->fd - HOST_WS_FIRST_FD;
+    char join[512];
+    snprintf(join, sizeof(join),
+             "{\"type\":\"join\",\"from\":\"%s\",\"name\":\"%s\",\"timestamp\":%lld%s%s}",
+             bench_client_id(index), bench_client_name(index),
+             (long long)(1735689600 + esp_timer_get_time() / 1000000), extra ? "," : "", extra ? extra : "");
+    return bench_send(conn, join);
+}
+
+void bench_disconnect(bench_conn_t *conn)
+{
+    /* Status 1000; chat_ws_handler() ignores empty frames. */
+    static const uint8_t normal_closure[] = { 0x03, 0xe8 };
+    bench_send_frame(conn, HTTPD_WS_TYPE_CLOSE, normal_closure, sizeof(normal_closure));
+}
+
+bool bench_store_message(uint64_t seed)
+{
+    char text[512];
+    size_t len = bench_client_text(text, sizeof(text), seed);
+    chat_frame_t frame;
+    chat_payload_t *payload = NULL;
+    if (!chat_frame_parse(text, len, &frame) ||
+        chat_history_finalize_and_store_message(&g_app_context, &frame, text, len, &payload) != ESP_OK) {
+        return false;
+    }
+    chat_payload_release(payload);
+    return true;
+}
+
+void bench_traffic_reset(void)
+{
+    memset(bench_traffic, 0, sizeof(bench_traffic));
+}
+
+bench_traffic_t bench_traffic_total(void)
+{
+    bench_traffic_t total = { 0 };
+    for (int i = 0; i < BENCH_MAX_CONNECTIONS; i++) {
+        total.frames += bench_traffic[i].frames;
+        total.bytes += bench_traffic[i].bytes;
+    }
+    return total;
+}
+
+void bench_set_frame_hook(bench_frame_fn hook, void *arg)
+{
+    s_hook = hook;
+    s_hook_arg = arg;
+}
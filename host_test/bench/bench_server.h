@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "app_context.h"
+#include "esp_http_server.h"
+#include "host_runtime.h"
+
+/*
+ * The chat server of main.c without WiFi, DNS or HTTP routes, for benchmarks built with
+ * add_server_bench(). Connections are driven through chat_ws_handler() and every frame the server
+ * sends is counted per fd.
+ */
+
+#define BENCH_MAX_CONNECTIONS 128
+
+typedef struct {
+    uint64_t frames;
+    uint64_t bytes;
+} bench_traffic_t;
+
+typedef struct {
+    httpd_req_t req;
+    int fd;
+} bench_conn_t;
+
+/* Sets up g_app_context as app_main() does. With storage, the message log lives in a temporary directory. */
+void bench_server_start(bool storage);
+/* Starts the storage writer task, as app_main() does once the log is open. */
+void bench_server_start_persist(void);
+/* Removes the temporary storage directory. */
+void bench_server_stop(void);
+
+void bench_connect(bench_conn_t *conn, int index);
+esp_err_t bench_send(bench_conn_t *conn, const char *text);
+esp_err_t bench_send_frame(bench_conn_t *conn, httpd_ws_type_t type, const void *data, size_t len);
+/*
+ * The user behind connection index: the bench_messages.h users first, then generated ones, so the
+ * stored traffic addresses the first BENCH_USER_COUNT connections.
+ */
+const char *bench_client_id(int index);
+const char *bench_client_name(int index);
+/* A join as script.js sends it, with extra members (may be NULL) spliced in before the closing brace. */
+esp_err_t bench_join(bench_conn_t *conn, const char *extra);
+/* The client closes the connection; the server sees the close frame. */
+void bench_disconnect(bench_conn_t *conn);
+
+/* Stores message seed of bench_messages.h through chat_history_finalize_and_store_message(), without a sender. */
+bool bench_store_message(uint64_t seed);
+
+/* Per-connection traffic since the last reset, by connection index. */
+extern bench_traffic_t bench_traffic[BENCH_MAX_CONNECTIONS];
+void bench_traffic_reset(void);
+bench_traffic_t bench_traffic_total(void);
+
+/* Called for every frame the server sends, after it is counted; NULL to stop. */
+typedef void (*bench_frame_fn)(int index, httpd_ws_type_t type, const uint8_t *data, size_t len, void *arg);
+void bench_set_frame_hook(bench_frame_fn hook, void *arg);
@@ -0,0 +1,212 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "bench_server.h"
+#include "chat/sessions.h"
+#include "chat_config.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * Send-side session lookups racing join, set_wire and leave. WRITERS threads churn FDS connections
+ * through the real sessions.c, each owning every WRITERS-th fd, while READERS threads collect the
+ * broadcast fds and wires and look up the user and wire of a random fd, once through the
+ * session_snapshot readers and once through copies of the client_mutex scans they replaced.
+ * Every result is checked: no repeated fd, and no fd paired with another connection's wire or user.
+ */
+#define WRITERS     2
+#define READERS     4
+#define FDS         48
+#define FIRST_FD    HOST_WS_FIRST_FD
+
+static atomic_bool s_stop;
+static atomic_ulong s_reads;
+static atomic_ulong s_reader_takes;
+static atomic_ulong s_errors;
+static bool s_snapshot;
+static __thread bool s_is_reader;
+static char s_user_ids[FDS][40];
+
+BaseType_t __real_xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks);
+
+BaseType_t __wrap_xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks)
+{
+    if (s_is_reader && mutex == g_app_context.client_mutex) {
+        atomic_fetch_add_explicit(&s_reader_takes, 1, memory_order_relaxed);
+    }
+    return __real_xSemaphoreTake(mutex, ticks);
+}
+
+/* The wire each connection asks for in join; a reader may also see 0 before set_wire. */
+static uint8_t wire_of(int fd)
+{
+    return (uint8_t)(1 + fd % 3);
+}
+
+/* websocket_server.c before the snapshot: every broadcast scanned client_slots under client_mutex. */
+static int mutex_active_fds(app_context_t *ctx, int *fds, uint8_t *wires)
+{
+    int fd_count = 0;
+    xSemaphoreTake(ctx->client_mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (ctx->client_slots[i].active) {
+            wires[fd_count] = ctx->client_slots[i].wire;
+            fds[fd_count++] = ctx->client_slots[i].fd;
+        }
+    }
+    xSemaphoreGive(ctx->client_mutex);
+    return fd_count;
+}
+
+static int mutex_user_fds(app_context_t *ctx, const char *user_id, int *fds)
+{
+    int fd_count = 0;
+    xSemaphoreTake(ctx->client_mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        const client_slot_t *slot = &ctx->client_slots[i];
+        if (slot->active && slot->joined && strcmp(slot->user_id, user_id) == 0) {
+            fds[fd_count++] = slot->fd;
+        }
+    }
+    xSemaphoreGive(ctx->client_mutex);
+    return fd_count;
+}
+
+static uint8_t mutex_wire(app_context_t *ctx, int fd)
+{
+    uint8_t wire = 0;
+    xSemaphoreTake(ctx->client_mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (ctx->client_slots[i].active && ctx->client_slots[i].fd == fd) {
+            wire = ctx->client_slots[i].wire;
+            break;
+        }
+    }
+    xSemaphoreGive(ctx->client_mutex);
+    return wire;
+}
+
+static void *writer_main(void *arg)
+{
+    app_context_t *ctx = &g_app_context;
+    int writer = (int)(intptr_t)arg;
+    bool open[FDS] = { false };
+    uint32_t seed = 7u + (uint32_t)writer;
+
+    while (!atomic_load_explicit(&s_stop, memory_order_relaxed)) {
+        seed = seed * 1103515245u + 12345u;
+        int f = writer + WRITERS * (int)((seed >> 8) % (FDS / WRITERS));
+        int fd = FIRST_FD + f;
+        if (open[f]) {
+            chat_sessions_remove_by_fd(ctx, fd);
+            open[f] = false;
+            continue;
+        }
+        chat_session_t session;
+        if (chat_sessions_ensure_slot(ctx, fd, NULL, &session)) {
+            chat_sessions_update_identity(ctx, fd, s_user_ids[f], "Writer");
+            chat_sessions_set_wire(ctx, fd, wire_of(fd));
+            open[f] = true;
+        }
+    }
+    for (int f = 0; f < FDS; f++) {
+        if (open[f]) {
+            chat_sessions_remove_by_fd(ctx, FIRST_FD + f);
+        }
+    }
+    return NULL;
+}
+
+static bool valid_fd(int fd)
+{
+    return fd >= FIRST_FD && fd < FIRST_FD + FDS;
+}
+
+static void *reader_main(void *arg)
+{
+    app_context_t *ctx = &g_app_context;
+    uint32_t seed = 101u + (uint32_t)(intptr_t)arg;
+    unsigned long reads = 0;
+    unsigned long errors = 0;
+
+    s_is_reader = true;
+    while (!atomic_load_explicit(&s_stop, memory_order_relaxed)) {
+        int fds[MAX_CLIENTS];
+        uint8_t wires[MAX_CLIENTS];
+        int count = s_snapshot ? chat_sessions_active_fds(ctx, NULL, 0, fds, wires) : mutex_active_fds(ctx, fds, wires);
+        uint64_t seen = 0;
+        for (int i = 0; i < count; i++) {
+            uint64_t bit = valid_fd(fds[i]) ? 1ull << (fds[i] - FIRST_FD) : 0;
+            errors += bit == 0 || (seen & bit) != 0 || (wires[i] != 0 && wires[i] != wire_of(fds[i]));
+            seen |= bit;
+        }
+
+        seed = seed * 1103515245u + 12345u;
+        int f = (int)((seed >> 8) % FDS);
+        if (s_snapshot) {
+            chat_field_t user = { .type = JSON_SCAN_STRING, .str = s_user_ids[f], .len = strlen(s_user_ids[f]) };
+            count = chat_sessions_user_fds(ctx, &user, 1, fds);
+        } else {
+            count = mutex_user_fds(ctx, s_user_ids[f], fds);
+        }
+        for (int i = 0; i < count; i++) {
+            errors += fds[i] != FIRST_FD + f;
+        }
+        uint8_t wire = s_snapshot ? chat_sessions_wire(ctx, FIRST_FD + f) : mutex_wire(ctx, FIRST_FD + f);
+        errors += wire != 0 && wire != wire_of(FIRST_FD + f);
+        reads++;
+    }
+    atomic_fetch_add(&s_reads, reads);
+    atomic_fetch_add(&s_errors, errors);
+    return NULL;
+}
+
+static bool run(const char *label, bool snapshot, long duration_ms)
+{
+    pthread_t writers[WRITERS];
+    pthread_t readers[READERS];
+
+    s_snapshot = snapshot;
+    atomic_store(&s_stop, false);
+    atomic_store(&s_reads, 0);
+    atomic_store(&s_reader_takes, 0);
+    atomic_store(&s_errors, 0);
+    for (intptr_t i = 0; i < WRITERS; i++) {
+        pthread_create(&writers[i], NULL, writer_main, (void *)i);
+    }
+    for (intptr_t i = 0; i < READERS; i++) {
+        pthread_create(&readers[i], NULL, reader_main, (void *)i);
+    }
+    usleep((useconds_t)duration_ms * 1000);
+    atomic_store(&s_stop, true);
+    for (int i = 0; i < WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    unsigned long reads = atomic_load(&s_reads);
+    printf("  %-9s %6.2f M reads/s, %.3f reader client_mutex takes per read, %lu errors\n", label,
+           reads / (duration_ms * 1e3), reads ? (double)atomic_load(&s_reader_takes) / reads : 0.0,
+           atomic_load(&s_errors));
+    return atomic_load(&s_errors) == 0;
+}
+
+int main(void)
+{
+    for (int f = 0; f < FDS; f++) {
+        snprintf(s_user_ids[f], sizeof(s_user_ids[f]), "00000000-0000-4000-8000-%012d", f);
+    }
+    bench_server_start(false);
+
+    long duration_ms = bench_iterations(2000000) / 1000;
+    printf("%d writers over %d fds, %d readers, %d slots, %ld ms\n", WRITERS, FDS, READERS, MAX_CLIENTS, duration_ms);
+    bool ok = run("mutex", false, duration_ms);
+    ok = run("snapshot", true, duration_ms) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
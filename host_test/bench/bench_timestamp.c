@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "bench_server.h"
+#include "chat/sessions.h"
+#include "chat_config.h"
+#include "common/utils.h"
+
+BENCH_DEFINE_GLOBALS;
+
+/*
+ * The cost of a server timestamp with MAX_CLIENTS clients joined, built as bench_timestamp_<clients>:
+ * current_timestamp_s() once the consensus set the clock, and while it only holds the cached
+ * offset; the same timestamp with the quadratic search it ran before; and the refresh a changed
+ * time sample now costs. Then random samples check every published offset against that search.
+ */
+
+/* consensus_offset_s() as common/utils.c ran it on every timestamp before the offset was cached. */
+static bool search_consensus_offset(app_context_t *ctx, int64_t *offset_out)
+{
+    int64_t offsets[MAX_CLIENTS];
+    int count = 0;
+    int64_t selected_total = 0;
+    int selected_count = 0;
+
+    if (xSemaphoreTake(ctx->client_mutex, pdMS_TO_TICKS(20)) != pdTRUE) {
+        return false;
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        const client_slot_t *slot = &ctx->client_slots[i];
+        if (slot->active && slot->joined && slot->time_offset_valid) {
+            offsets[count++] = slot->time_offset_s;
+        }
+    }
+    xSemaphoreGive(ctx->client_mutex);
+
+    int required = (count * 2 + 2) / 3;
+    if (required == 0) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        int64_t total = 0;
+        int cluster_count = 0;
+        for (int j = 0; j < count; j++) {
+            if (offsets[j] >= offsets[i] && offsets[j] <= offsets[i] + TIME_SYNC_TOLERANCE_S) {
+                total += offsets[j];
+                cluster_count++;
+            }
+        }
+        if (cluster_count >= required && cluster_count > selected_count) {
+            selected_total = total;
+            selected_count = cluster_count;
+        }
+    }
+    if (selected_count == 0) {
+        return false;
+    }
+    *offset_out = selected_total / selected_count;
+    return true;
+}
+
+/* current_timestamp_s() with that search, as it was. */
+static int64_t searched_timestamp_s(app_context_t *ctx)
+{
+    time_t now = 0;
+    time(&now);
+    if ((int64_t)now >= VALID_EPOCH_START_S && (int64_t)now <= VALID_EPOCH_END_S) {
+        return (int64_t)now;
+    }
+    int64_t uptime = device_uptime_s();
+    int64_t offset = 0;
+    if (search_consensus_offset(ctx, &offset) && uptime + offset >= VALID_EPOCH_START_S &&
+        uptime + offset <= VALID_EPOCH_END_S) {
+        return uptime + offset;
+    }
+    return uptime;
+}
+
+/*
+ * The old search takes the first largest cluster in slot order, the sliding window the lowest, so
+ * the published offset must be the mean of some largest cluster, or 0 when none reaches two thirds.
+ */
+static bool consensus_matches_search(app_context_t *ctx)
+{
+    int64_t offsets[MAX_CLIENTS];
+    int count = 0;
+
+    xSemaphoreTake(ctx->client_mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        const client_slot_t *slot = &ctx->client_slots[i];
+        if (slot->active && slot->joined && slot->time_offset_valid) {
+            offsets[count++] = slot->time_offset_s;
+        }
+    }
+    int64_t published = atomic_load(&ctx->time_consensus_offset_s);
+    xSemaphoreGive(ctx->client_mutex);
+
+    int64_t searched = 0;
+    if (!search_consensus_offset(ctx, &searched)) {
+        return published == 0;
+    }
+    int largest = 0;
+    for (int i = 0; i < count; i++) {
+        int cluster_count = 0;
+        for (int j = 0; j < count; j++) {
+            cluster_count += offsets[j] >= offsets[i] && offsets[j] <= offsets[i] + TIME_SYNC_TOLERANCE_S;
+        }
+        largest = cluster_count > largest ? cluster_count : largest;
+    }
+    for (int i = 0; i < count; i++) {
+        int64_t total = 0;
+        int cluster_count = 0;
+        for (int j = 0; j < count; j++) {
+            if (offsets[j] >= offsets[i] && offsets[j] <= offsets[i] + TIME_SYNC_TOLERANCE_S) {
+                total += offsets[j];
+                cluster_count++;
+            }
+        }
+        if (cluster_count == largest && total / cluster_count == published) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static double time_timestamps(app_context_t *ctx, int64_t (*timestamp)(app_context_t *))
+{
+    long rounds = bench_iterations(10000000);
+    uint64_t start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        bench_sink += (uint64_t)timestamp(ctx);
+    }
+    return (double)(bench_now_ns() - start) / rounds;
+}
+
+int main(void)
+{
+    static bench_conn_t conns[MAX_CLIENTS];
+    app_context_t *ctx = &g_app_context;
+
+    bench_server_start(false);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        bench_connect(&conns[i], i);
+        bench_join(&conns[i], NULL);
+    }
+
+    double clock_ns = time_timestamps(ctx, current_timestamp_s);
+    host_clock_reset_wall();
+    double cached_ns = time_timestamps(ctx, current_timestamp_s);
+    double search_ns = time_timestamps(ctx, searched_timestamp_s);
+
+    /* Clients a few seconds apart; each sample moves one offset by a second, so every call refreshes. */
+    chat_field_t timestamp = { .type = JSON_SCAN_NUMBER };
+    long rounds = bench_iterations(1000000);
+    uint64_t start = bench_now_ns();
+    for (long r = 0; r < rounds; r++) {
+        int i = (int)(r % MAX_CLIENTS);
+        timestamp.number = (double)(1735689600 + device_uptime_s() + i * 3 + (r / MAX_CLIENTS) % 2);
+        chat_sessions_update_time_sample(ctx, conns[i].fd, &timestamp);
+    }
+    double refresh_ns = (double)(bench_now_ns() - start) / rounds;
+
+    printf("%2d clients: timestamp %5.1f ns with the clock set, %5.1f ns from the cached offset; "
+           "%6.1f ns with the old search; sample refresh %6.1f ns\n",
+           MAX_CLIENTS, clock_ns, cached_ns, search_ns, refresh_ns);
+
+    /* Offsets spread over two tolerance windows, so clusters form, split and tie. */
+    uint32_t seed = 1;
+    long with_consensus = 0;
+    long samples = bench_iterations(1000000);
+    for (long r = 0; r < samples; r++) {
+        seed = seed * 1103515245u + 12345u;
+        int i = (int)((seed >> 8) % MAX_CLIENTS);
+        seed = seed * 1103515245u + 12345u;
+        timestamp.number = (double)(1735689600 + device_uptime_s() + (seed >> 8) % (2 * TIME_SYNC_TOLERANCE_S));
+        chat_sessions_update_time_sample(ctx, conns[i].fd, &timestamp);
+        with_consensus += atomic_load(&ctx->time_consensus_offset_s) != 0;
+        if (!consensus_matches_search(ctx)) {
+            fprintf(stderr, "sample %ld: the published offset is not the mean of a largest cluster\n", r);
+            return EXIT_FAILURE;
+        }
+    }
+    printf("%2d clients: %ld random samples agree with the old search, %ld of them with a consensus\n", MAX_CLIENTS,
+           samples, with_consensus);
+    return EXIT_SUCCESS;
+}
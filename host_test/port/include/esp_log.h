@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdio.h>
+
+/* Host stand-in for ESP-IDF's esp_log.h. Logs go to stderr unless HOST_LOG_QUIET is set in the environment. */
+
+int host_log_enabled(void);
+
+#define HOST_LOG(level, tag, format, ...) \
+    do { if (host_log_enabled()) fprintf(stderr, level " (%s) " format "\n", tag, ##__VA_ARGS__); } while (0)
+
+#define ESP_LOGE(tag, format, ...) HOST_LOG("E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) HOST_LOG("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) HOST_LOG("I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) do { (void)(tag); } while (0)
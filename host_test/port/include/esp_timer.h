@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Microseconds since start, from the host clock in host_runtime.h. */
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Host stand-in for FreeRTOS on pthreads (host_test/port/runtime.c). One tick is one millisecond. */
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              pdTRUE
+#define pdFAIL              pdFALSE
+#define portMAX_DELAY       ((TickType_t)0xffffffffu)
+#define configTICK_RATE_HZ  1000
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))
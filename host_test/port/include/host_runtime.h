@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_http_server.h"
+
+/*
+ * Controls for the host runtime in runtime.c, which runs the firmware's FreeRTOS, esp_timer, NVS
+ * and httpd calls on the host so whole chat modules can be benchmarked.
+ */
+
+/* esp_timer_get_time() and the tick count follow the monotonic clock until the clock is made manual. */
+void host_clock_set_manual(bool manual);
+void host_clock_advance_us(int64_t us);
+
+/*
+ * time() and settimeofday() for objects linked with -Wl,--wrap=time,--wrap=settimeofday: like a
+ * SoftAP without NTP, the wall clock reads the uptime until settimeofday() sets it.
+ * host_clock_reset_wall() forgets the setting again, as a reboot does.
+ */
+void host_clock_reset_wall(void);
+
+/* Every nvs_commit() sleeps this long, as a stand-in for the flash write. */
+void host_nvs_set_commit_delay_us(uint32_t us);
+uint64_t host_nvs_commits(void);
+
+/* Called for every frame sent through httpd_ws_send_frame_async() or httpd_ws_send_data(). */
+typedef void (*host_ws_capture_fn)(int fd, httpd_ws_type_t type, const uint8_t *data, size_t len, void *arg);
+void host_ws_set_capture(host_ws_capture_fn capture, void *arg);
+
+/* Called from httpd_sess_trigger_close(); by default the close is only dropped. */
+typedef void (*host_ws_close_fn)(httpd_handle_t handle, int fd, void *arg);
+void host_ws_set_close(host_ws_close_fn close_fn, void *arg);
+
+/*
+ * A connection is one httpd_req_t kept for its lifetime, so sess_ctx survives between frames as
+ * it does in esp_http_server. Fake fds start at HOST_WS_FIRST_FD to stay clear of real descriptors.
+ */
+#define HOST_WS_FIRST_FD 1000
+
+void host_ws_connect(httpd_req_t *req, httpd_handle_t handle, void *user_ctx, int fd);
+void host_ws_set_frame(httpd_req_t *req, httpd_ws_type_t type, const void *data, size_t len);
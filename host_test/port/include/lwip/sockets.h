@@ -0,0 +1,5 @@
+#pragma once
+
+/* Host stand-in: websocket_server.c only needs errno values and close(). */
+#include <errno.h>
+#include <unistd.h>
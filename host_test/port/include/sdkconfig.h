@@ -0,0 +1,47 @@
+#pragma once
+
+/* The Kconfig defaults from main/Kconfig.projbuild, for host builds. Benchmarks may override the guarded ones. */
+
+#define CONFIG_CHAT_WIFI_SSID                   "ESPChat"
+#define CONFIG_CHAT_WIFI_PASSWORD               "esp-chat"
+#define CONFIG_CHAT_ADMIN_PASSWORD              "admin"
+#define CONFIG_CHAT_WIFI_CHANNEL                1
+#define CONFIG_CHAT_MAX_STA_CONN                8
+#ifndef CONFIG_CHAT_MAX_WS_CLIENTS
+#define CONFIG_CHAT_MAX_WS_CLIENTS              10
+#endif
+#define CONFIG_CHAT_MAX_GROUPS                  32
+#ifndef CONFIG_CHAT_MESSAGE_HISTORY_SIZE
+#define CONFIG_CHAT_MESSAGE_HISTORY_SIZE        100
+#endif
+#ifndef CONFIG_CHAT_MESSAGE_HISTORY_BYTES
+#define CONFIG_CHAT_MESSAGE_HISTORY_BYTES       32768
+#endif
+#define CONFIG_CHAT_SEARCH_INDEX_BYTES          32768
+#define CONFIG_CHAT_HEARTBEAT_INTERVAL_S        30
+#define CONFIG_CHAT_PRESENCE_DEBOUNCE_MS        500
+#define CONFIG_CHAT_MAX_MESSAGE_TEXT_LEN        256
+#define CONFIG_CHAT_MAX_WS_PAYLOAD_BYTES        1024
+#define CONFIG_CHAT_WS_MSGPACK                  1
+#define CONFIG_CHAT_WS_DEFLATE                  1
+#define CONFIG_CHAT_WS_DEFLATE_WINDOW_BITS      11
+#define CONFIG_CHAT_RATE_LIMIT                  1
+#define CONFIG_CHAT_RATE_CHAT_PER_S             5
+#ifndef CONFIG_CHAT_RATE_CHAT_BURST
+#define CONFIG_CHAT_RATE_CHAT_BURST             30
+#endif
+#define CONFIG_CHAT_RATE_HISTORY_PER_S          20
+#define CONFIG_CHAT_RATE_HISTORY_BURST          40
+#define CONFIG_CHAT_RATE_CONTROL_PER_S          5
+#define CONFIG_CHAT_RATE_CONTROL_BURST          20
+#ifndef CONFIG_CHAT_MESSAGE_ID_LEASE_SIZE
+#define CONFIG_CHAT_MESSAGE_ID_LEASE_SIZE       256
+#endif
+#define CONFIG_CHAT_MESSAGE_LOG_SEGMENT_BYTES   65536
+#define CONFIG_CHAT_MESSAGE_LOG_MAX_SEGMENTS    8
+#define CONFIG_CHAT_MESSAGE_LOG_INDEX_STRIDE    16
+#define CONFIG_CHAT_MESSAGE_LOG_REPLAY_MAX      200
+#ifndef CONFIG_CHAT_MESSAGE_LOG_ACK_AFTER_COMMIT
+#define CONFIG_CHAT_MESSAGE_LOG_ACK_AFTER_ENQUEUE 1
+#endif
+#define CONFIG_CHAT_MESSAGE_LOG_COMMIT_MS       50
@@ -0,0 +1,553 @@
+#include "host_runtime.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nvs.h"
+
+/* Clock */
+
+static pthread_mutex_t s_clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool s_clock_manual;
+static int64_t s_clock_start_us;
+static int64_t s_clock_manual_us;
+static int64_t s_wall_offset_s;
+static bool s_wall_set;
+
+static int64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    pthread_mutex_lock(&s_clock_lock);
+    if (s_clock_start_us == 0) {
+        /* Start at one second, so uptime-based values are never zero. */
+        s_clock_start_us = monotonic_us() - 1000000;
+    }
+    int64_t now = s_clock_manual ? s_clock_manual_us : monotonic_us() - s_clock_start_us;
+    pthread_mutex_unlock(&s_clock_lock);
+    return now;
+}
+
+void host_clock_set_manual(bool manual)
+{
+    int64_t now = esp_timer_get_time();
+    pthread_mutex_lock(&s_clock_lock);
+    if (manual && !s_clock_manual) {
+        s_clock_manual_us = now;
+    } else if (!manual && s_clock_manual) {
+        s_clock_start_us = monotonic_us() - s_clock_manual_us;
+    }
+    s_clock_manual = manual;
+    pthread_mutex_unlock(&s_clock_lock);
+}
+
+void host_clock_advance_us(int64_t us)
+{
+    pthread_mutex_lock(&s_clock_lock);
+    s_clock_manual_us += us;
+    pthread_mutex_unlock(&s_clock_lock);
+}
+
+time_t __wrap_time(time_t *out)
+{
+    int64_t now = esp_timer_get_time() / 1000000;
+    pthread_mutex_lock(&s_clock_lock);
+    now += s_wall_set ? s_wall_offset_s : 0;
+    pthread_mutex_unlock(&s_clock_lock);
+    if (out != NULL) {
+        *out = (time_t)now;
+    }
+    return (time_t)now;
+}
+
+int __wrap_settimeofday(const struct timeval *tv, const void *tz)
+{
+    if (tv == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    int64_t uptime = esp_timer_get_time() / 1000000;
+    pthread_mutex_lock(&s_clock_lock);
+    s_wall_offset_s = (int64_t)tv->tv_sec - uptime;
+    s_wall_set = true;
+    pthread_mutex_unlock(&s_clock_lock);
+    return 0;
+}
+
+void host_clock_reset_wall(void)
+{
+    pthread_mutex_lock(&s_clock_lock);
+    s_wall_set = false;
+    pthread_mutex_unlock(&s_clock_lock);
+}
+
+uint32_t esp_random(void)
+{
+    static _Atomic uint64_t state = 0x9e3779b97f4a7c15ull;
+    uint64_t x = atomic_fetch_add(&state, 0x9e3779b97f4a7c15ull);
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    return (uint32_t)(x >> 32);
+}
+
+/* FreeRTOS */
+
+static struct timespec deadline_after(TickType_t ticks)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ticks / 1000;
+    ts.tv_nsec += (long)(ticks % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    return ts;
+}
+
+/* Waits on cond until ready() holds or ticks pass; the lock is held on entry and return. */
+static bool wait_until(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks, bool (*ready)(void *), void *arg)
+{
+    if (ticks == portMAX_DELAY) {
+        while (!ready(arg)) {
+            pthread_cond_wait(cond, lock);
+        }
+        return true;
+    }
+    struct timespec deadline = deadline_after(ticks);
+    while (!ready(arg)) {
+        if (pthread_cond_timedwait(cond, lock, &deadline) == ETIMEDOUT) {
+            return ready(arg);
+        }
+    }
+    return true;
+}
+
+struct host_mutex {
+    pthread_mutex_t lock;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t mutex = calloc(1, sizeof(*mutex));
+    if (mutex != NULL) {
+        pthread_mutex_init(&mutex->lock, NULL);
+    }
+    return mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        return pthread_mutex_lock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+    }
+    if (ticks == 0) {
+        return pthread_mutex_trylock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+    }
+    struct timespec deadline = deadline_after(ticks);
+    return pthread_mutex_timedlock(&mutex->lock, &deadline) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    return pthread_mutex_unlock(&mutex->lock) == 0 ? pdTRUE : pdFALSE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t mutex)
+{
+    if (mutex != NULL) {
+        pthread_mutex_destroy(&mutex->lock);
+        free(mutex);
+    }
+}
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint8_t *items;
+    size_t item_size;
+    size_t length;
+    size_t head;
+    size_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    QueueHandle_t queue = calloc(1, sizeof(*queue));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->items = calloc(length, item_size);
+    if (queue->items == NULL) {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->item_size = item_size;
+    queue->length = length;
+    return queue;
+}
+
+static bool queue_has_room(void *arg)
+{
+    QueueHandle_t queue = arg;
+    return queue->count < queue->length;
+}
+
+static bool queue_has_item(void *arg)
+{
+    QueueHandle_t queue = arg;
+    return queue->count > 0;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    pthread_mutex_lock(&queue->lock);
+    bool room = wait_until(&queue->changed, &queue->lock, ticks, queue_has_room, queue);
+    if (room) {
+        size_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+        queue->count++;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return room ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    pthread_mutex_lock(&queue->lock);
+    bool ready = wait_until(&queue->changed, &queue->lock, ticks, queue_has_item, queue);
+    if (ready) {
+        memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ready ? pdTRUE : pdFALSE;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    if (queue != NULL) {
+        pthread_mutex_destroy(&queue->lock);
+        pthread_cond_destroy(&queue->changed);
+        free(queue->items);
+        free(queue);
+    }
+}
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t notified;
+    uint32_t value;
+    bool pending;
+};
+
+static _Thread_local struct host_task *s_current_task;
+
+static struct host_task *task_alloc(void)
+{
+    struct host_task *task = calloc(1, sizeof(*task));
+    if (task != NULL) {
+        pthread_mutex_init(&task->lock, NULL);
+        pthread_cond_init(&task->notified, NULL);
+    }
+    return task;
+}
+
+static void *task_main(void *arg)
+{
+    struct host_task *task = arg;
+    s_current_task = task;
+    task->fn(task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg, UBaseType_t priority,
+                       TaskHandle_t *handle)
+{
+    struct host_task *task = task_alloc();
+    if (task == NULL) {
+        return pdFAIL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    if (handle != NULL) {
+        *handle = task;
+    }
+    if (pthread_create(&task->thread, NULL, task_main, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == s_current_task) {
+        pthread_exit(NULL);
+    }
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t)ticks * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    if (s_current_task == NULL) {
+        s_current_task = task_alloc();
+    }
+    return s_current_task;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    BaseType_t ret = pdPASS;
+    pthread_mutex_lock(&task->lock);
+    switch (action) {
+    case eSetBits:
+        task->value |= value;
+        break;
+    case eIncrement:
+        task->value++;
+        break;
+    case eSetValueWithOverwrite:
+        task->value = value;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (task->pending) {
+            ret = pdFAIL;
+        } else {
+            task->value = value;
+        }
+        break;
+    case eNoAction:
+        break;
+    }
+    task->pending = true;
+    pthread_cond_broadcast(&task->notified);
+    pthread_mutex_unlock(&task->lock);
+    return ret;
+}
+
+static bool task_pending(void *arg)
+{
+    struct host_task *task = arg;
+    return task->pending;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks)
+{
+    struct host_task *task = xTaskGetCurrentTaskHandle();
+    pthread_mutex_lock(&task->lock);
+    if (!task->pending) {
+        task->value &= ~clear_on_entry;
+    }
+    bool ready = ticks == 0 ? task->pending : wait_until(&task->notified, &task->lock, ticks, task_pending, task);
+    if (ready) {
+        if (value != NULL) {
+            *value = task->value;
+        }
+        task->value &= ~clear_on_exit;
+        task->pending = false;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return ready ? pdTRUE : pdFALSE;
+}
+
+/* NVS */
+
+#define NVS_KEYS 16
+
+typedef struct {
+    char key[16];
+    uint64_t value;
+} nvs_entry_t;
+
+static pthread_mutex_t s_nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+static nvs_entry_t s_nvs[NVS_KEYS];
+static int s_nvs_count;
+static uint32_t s_nvs_commit_delay_us;
+static uint64_t s_nvs_commits;
+
+void host_nvs_set_commit_delay_us(uint32_t us)
+{
+    s_nvs_commit_delay_us = us;
+}
+
+uint64_t host_nvs_commits(void)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    uint64_t commits = s_nvs_commits;
+    pthread_mutex_unlock(&s_nvs_lock);
+    return commits;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t mode, nvs_handle_t *handle)
+{
+    *handle = 1;
+    return ESP_OK;
+}
+
+static nvs_entry_t *nvs_find(const char *key)
+{
+    for (int i = 0; i < s_nvs_count; i++) {
+        if (strcmp(s_nvs[i].key, key) == 0) {
+            return &s_nvs[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t nvs_get_u64(nvs_handle_t handle, const char *key, uint64_t *value)
+{
+    pthread_mutex_lock(&s_nvs_lock);
+    nvs_entry_t *entry = nvs_find(key);
+    if (entry != NULL) {
+        *value = entry->value;
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return entry != NULL ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t nvs_set_u64(nvs_handle_t handle, const char *key, uint64_t value)
+{
+    esp_err_t ret = ESP_OK;
+    pthread_mutex_lock(&s_nvs_lock);
+    nvs_entry_t *entry = nvs_find(key);
+    if (entry == NULL && s_nvs_count < NVS_KEYS) {
+        entry = &s_nvs[s_nvs_count++];
+        snprintf(entry->key, sizeof(entry->key), "%s", key);
+    }
+    if (entry != NULL) {
+        entry->value = value;
+    } else {
+        ret = ESP_ERR_NO_MEM;
+    }
+    pthread_mutex_unlock(&s_nvs_lock);
+    return ret;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    if (s_nvs_commit_delay_us > 0) {
+        usleep(s_nvs_commit_delay_us);
+    }
+    pthread_mutex_lock(&s_nvs_lock);
+    s_nvs_commits++;
+    pthread_mutex_unlock(&s_nvs_lock);
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+/* httpd */
+
+static host_ws_capture_fn s_capture;
+static void *s_capture_arg;
+static host_ws_close_fn s_close;
+static void *s_close_arg;
+
+void host_ws_set_capture(host_ws_capture_fn capture, void *arg)
+{
+    s_capture = capture;
+    s_capture_arg = arg;
+}
+
+void host_ws_set_close(host_ws_close_fn close_fn, void *arg)
+{
+    s_close = close_fn;
+    s_close_arg = arg;
+}
+
+void host_ws_connect(httpd_req_t *req, httpd_handle_t handle, void *user_ctx, int fd)
+{
+    memset(req, 0, sizeof(*req));
+    req->handle = handle;
+    req->user_ctx = user_ctx;
+    req->fd = fd;
+}
+
+void host_ws_set_frame(httpd_req_t *req, httpd_ws_type_t type, const void *data, size_t len)
+{
+    req->frame_type = type;
+    req->frame = data;
+    req->frame_len = len;
+}
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *pkt, size_t max_len)
+{
+    pkt->type = (httpd_ws_type_t)req->frame_type;
+    pkt->final = true;
+    if (max_len == 0) {
+        pkt->len = req->frame_len;
+        return ESP_OK;
+    }
+    if (pkt->payload == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pkt->len = req->frame_len < max_len ? req->frame_len : max_len;
+    memcpy(pkt->payload, req->frame, pkt->len);
+    return ESP_OK;
+}
+
+esp_err_t httpd_ws_send_frame_async(httpd_handle_t handle, int fd, httpd_ws_frame_t *frame)
+{
+    if (s_capture != NULL) {
+        s_capture(fd, frame->type, frame->payload, frame->len, s_capture_arg);
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_ws_send_data(httpd_handle_t handle, int fd, httpd_ws_frame_t *frame)
+{
+    return httpd_ws_send_frame_async(handle, fd, frame);
+}
+
+int httpd_req_to_sockfd(httpd_req_t *req)
+{
+    return req->fd;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int fd)
+{
+    if (s_close != NULL) {
+        s_close(handle, fd, s_close_arg);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Minimal assertions for the host tests: a failed CHECK reports the line and fails the test binary. */
+
+extern int check_failures;
+
+#define CHECK(cond)                                                                       \
+    do {                                                                                  \
+        if (!(cond)) {                                                                    \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond);       \
+            check_failures++;                                                             \
+        }                                                                                 \
+    } while (0)
+
+#define RUN_TEST(fn)                                                                      \
+    do {                                                                                  \
+        int before = check_failures;                                                      \
+        fn();                                                                             \
+        printf("%s %s\n", check_failures == before ? "PASS" : "FAIL", #fn);               \
+    } while (0)
+
+#define CHECK_DEFINE_GLOBALS int check_failures = 0
+
+#define CHECK_EXIT_CODE (check_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE)
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chat/compress.h"
+#include "check.h"
+
+CHECK_DEFINE_GLOBALS;
+
+#define BUF_BYTES 4096
+
+static const char *const s_samples[] = {
+    "{\"type\":\"text\",\"from\":\"3f2504e0-4f89-41d3-9a0c-0305e82c3301\","
+    "\"to\":{\"all\":true,\"users\":[]},\"name\":\"Alice\",\"data\":\"hello everyone\","
+    "\"id\":42,\"timestamp\":1735689600}",
+    "{\"type\":\"text\",\"from\":\"3f2504e0-4f89-41d3-9a0c-0305e82c3301\","
+    "\"to\":{\"all\":false,\"users\":[\"8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90\","
+    "\"d3b07384-d9a0-4c9b-8f3e-6a1b2c3d4e5f\"]},\"name\":\"Alice\",\"data\":\"see you at 6\","
+    "\"id\":43,\"timestamp\":1735689601}",
+    "{\"type\":\"newGroup\",\"from\":\"8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90\","
+    "\"to\":{\"all\":false,\"users\":[\"3f2504e0-4f89-41d3-9a0c-0305e82c3301\"]},\"name\":\"Bob\","
+    "\"groupId\":\"6ba7b810-9dad-11d1-80b4-00c04fd430c8\",\"groupName\":\"Ops\",\"id\":44,\"timestamp\":1735689602}",
+    /* Uppercase UUIDs are not packed and must pass through as literals. */
+    "{\"type\":\"text\",\"from\":\"3F2504E0-4F89-41D3-9A0C-0305E82C3301\",\"to\":{\"all\":true,\"users\":[]},"
+    "\"name\":\"中文\",\"data\":\"你好你好你好\",\"id\":45,\"timestamp\":1735689603}",
+};
+
+static void round_trip(const char *json)
+{
+    uint8_t packed[BUF_BYTES];
+    char plain[BUF_BYTES];
+    size_t len = strlen(json);
+
+    size_t packed_len = chat_compress(json, len, packed, sizeof(packed));
+    CHECK(packed_len > 0 && packed_len < len);
+    CHECK(chat_decompressed_size(packed, packed_len) == len);
+    CHECK(chat_decompress(packed, packed_len, plain, sizeof(plain)) == len);
+    CHECK(memcmp(plain, json, len) == 0);
+}
+
+static void test_round_trip_samples(void)
+{
+    for (size_t i = 0; i < sizeof(s_samples) / sizeof(s_samples[0]); i++) {
+        round_trip(s_samples[i]);
+    }
+}
+
+/* Long repeated runs exercise overlapping matches and literal runs at the 128-byte limit. */
+static void test_round_trip_long_runs(void)
+{
+    char json[BUF_BYTES / 2];
+    int len = snprintf(json, sizeof(json), "{\"type\":\"text\",\"data\":\"");
+    for (int i = 0; i < 300; i++) {
+        json[len++] = 'a';
+    }
+    for (int i = 0; i < 300; i++) {
+        json[len++] = (char)('!' + (i * 37) % 90);
+    }
+    snprintf(json + len, sizeof(json) - len, "\",\"id\":1}");
+    round_trip(json);
+}
+
+static void test_incompressible_is_rejected(void)
+{
+    uint8_t packed[BUF_BYTES];
+    CHECK(chat_compress("{}", 2, packed, sizeof(packed)) == 0);
+    CHECK(chat_compress(s_samples[0], strlen(s_samples[0]), packed, 8) == 0);
+}
+
+static void test_truncated_input_is_rejected(void)
+{
+    uint8_t packed[BUF_BYTES];
+    char plain[BUF_BYTES];
+    size_t len = strlen(s_samples[1]);
+    size_t packed_len = chat_compress(s_samples[1], len, packed, sizeof(packed));
+    CHECK(packed_len > 0);
+
+    for (size_t cut = 0; cut < packed_len; cut++) {
+        CHECK(chat_decompress(packed, cut, plain, sizeof(plain)) == 0);
+    }
+    CHECK(chat_decompress(packed, packed_len, plain, len - 1) == 0);
+}
+
+static void test_payload_open(void)
+{
+    uint8_t packed[BUF_BYTES];
+    const char *json = s_samples[2];
+    size_t len = strlen(json);
+    size_t packed_len = chat_compress(json, len, packed, sizeof(packed));
+
+    chat_payload_t *stored = chat_payload_create((const char *)packed, packed_len);
+    CHECK(stored != NULL);
+    stored->flags |= CHAT_PAYLOAD_FLAG_COMPRESSED;
+    chat_payload_t *plain = chat_payload_open(stored);
+    CHECK(plain != NULL && plain != stored);
+    CHECK(plain->len == len && memcmp(plain->data, json, len) == 0 && plain->data[len] == '\0');
+    chat_payload_release(plain);
+    chat_payload_release(stored);
+
+    /* Plain payloads are shared, not copied. */
+    chat_payload_t *text = chat_payload_create(json, len);
+    chat_payload_t *same = chat_payload_open(text);
+    CHECK(same == text);
+    chat_payload_release(same);
+    chat_payload_release(text);
+}
+
+int main(void)
+{
+    RUN_TEST(test_round_trip_samples);
+    RUN_TEST(test_round_trip_long_runs);
+    RUN_TEST(test_incompressible_is_rejected);
+    RUN_TEST(test_truncated_input_is_rejected);
+    RUN_TEST(test_payload_open);
+    return CHECK_EXIT_CODE;
+}
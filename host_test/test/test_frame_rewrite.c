@@ -0,0 +1,282 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "chat/frame.h"
+#include "check.h"
+
+CHECK_DEFINE_GLOBALS;
+
+#define RANDOM_FRAMES 3000
+#define TEXT_BYTES    4096
+
+typedef struct {
+    char buf[TEXT_BYTES];
+    size_t len;
+} text_t;
+
+static const char *const s_server_fields[] = { "id", "timestamp", NULL };
+static const char s_stamp[] = "\"id\":77,\"timestamp\":1735689600";
+static uint32_t s_seed = 1;
+
+static uint32_t next_random(uint32_t bound)
+{
+    s_seed = s_seed * 1103515245u + 12345u;
+    return (s_seed >> 8) % bound;
+}
+
+static void put(text_t *text, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(text->buf + text->len, sizeof(text->buf) - text->len, fmt, args);
+    va_end(args);
+    text->len += n > 0 ? (size_t)n : 0;
+    if (text->len >= sizeof(text->buf)) {
+        text->len = sizeof(text->buf) - 1;
+    }
+}
+
+static void put_ws(text_t *text)
+{
+    static const char *const ws[] = { "", "", "", " ", "\n  ", "\t", "\r\n" };
+    put(text, "%s", ws[next_random(sizeof(ws) / sizeof(ws[0]))]);
+}
+
+static void put_value(text_t *text, int depth);
+
+static void put_key(text_t *text, const char *const *keys, size_t key_count)
+{
+    put(text, "\"%s\"", keys[next_random((uint32_t)key_count)]);
+    put_ws(text);
+    put(text, ":");
+    put_ws(text);
+}
+
+static void put_value(text_t *text, int depth)
+{
+    static const char *const scalars[] = {
+        "0", "-7", "42", "1735689600", "3.25", "-1.5e-3", "1E+9", "true", "false", "null",
+        "\"\"", "\"hi\"", "\"quote \\\" inside\"", "\"tab\\tnew\\nline\"", "\"\\u00e9t\\u00e9\"",
+        "\"中文 ☃\"", "\"}{][,:\"", "\"id\"",
+    };
+    static const char *const nested_keys[] = { "id", "timestamp", "to", "all", "a", "中文" };
+    uint32_t kind = depth < 3 ? next_random(10) : 0;
+
+    if (kind < 7) {
+        put(text, "%s", scalars[next_random(sizeof(scalars) / sizeof(scalars[0]))]);
+        return;
+    }
+    bool object = kind >= 9;
+    int count = (int)next_random(4);
+    put(text, object ? "{" : "[");
+    put_ws(text);
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            put_ws(text);
+            put(text, ",");
+            put_ws(text);
+        }
+        if (object) {
+            put_key(text, nested_keys, sizeof(nested_keys) / sizeof(nested_keys[0]));
+        }
+        put_value(text, depth + 1);
+    }
+    put_ws(text);
+    put(text, object ? "}" : "]");
+}
+
+/* A "to" object; expected gets what chat_frame_rewrite() must make of it. */
+static void put_to_object(text_t *text, text_t *expected)
+{
+    static const char *const keys[] = { "all", "ALL", "users", "Users", "group", "x" };
+    unsigned present = 0;
+    int count = (int)next_random(4);
+
+    put(text, "{");
+    size_t lead = text->len;
+    put_ws(text);
+    if (count == 0) {
+        text->len = lead;
+    }
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            put_ws(text);
+            put(text, ",");
+            put_ws(text);
+        }
+        size_t key = text->len;
+        put_key(text, keys, sizeof(keys) / sizeof(keys[0]));
+        present |= strncasecmp(text->buf + key, "\"all\"", 5) == 0 ? 1u : 0;
+        present |= strncasecmp(text->buf + key, "\"users\"", 7) == 0 ? 2u : 0;
+        put_value(text, 1);
+    }
+    size_t members_end = text->len;
+    put_ws(text);
+    put(text, "}");
+
+    if (present == 3u) {
+        put(expected, "%.*s", (int)(text->len - lead + 1), text->buf + lead - 1);
+        return;
+    }
+    put(expected, "%.*s", (int)(members_end - lead + 1), text->buf + lead - 1);
+    bool members = count > 0;
+    if ((present & 1u) == 0) {
+        put(expected, members ? ",\"all\":false" : "\"all\":false");
+        members = true;
+    }
+    if ((present & 2u) == 0) {
+        put(expected, members ? ",\"users\":[]" : "\"users\":[]");
+    }
+    put(expected, "}");
+}
+
+/* A client frame with random members, order, key case and spacing, and the stored form it must become. */
+static void make_frame(text_t *frame, text_t *expected)
+{
+    static const char *const keys[] = {
+        "type", "from", "name", "data", "groupId", "x", "中文", "to", "TO", "id", "ID", "Id", "timestamp", "TimeStamp",
+    };
+    int count = (int)next_random(9);
+    bool seen_to = false;
+    int kept = 0;
+
+    frame->len = 0;
+    expected->len = 0;
+    put(frame, "{");
+    put(expected, "{");
+    put_ws(frame);
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            put_ws(frame);
+            put(frame, ",");
+            put_ws(frame);
+        }
+        size_t member = frame->len;
+        put_key(frame, keys, sizeof(keys) / sizeof(keys[0]));
+        const char *key = frame->buf + member;
+        bool strip = strncasecmp(key, "\"id\"", 4) == 0 || strncasecmp(key, "\"timestamp\"", 11) == 0;
+        bool to = strncasecmp(key, "\"to\"", 4) == 0;
+        text_t value = { .len = 0 };
+
+        if (!strip && kept++ > 0) {
+            put(expected, ",");
+        }
+        if (to && !seen_to && next_random(10) < 7) {
+            size_t key_len = frame->len - member;
+            if (!strip) {
+                put(expected, "%.*s", (int)key_len, frame->buf + member);
+            }
+            put_to_object(&value, expected);
+            put(frame, "%s", value.buf);
+        } else {
+            /* A first "to" that is an object is always filled, so the other branch covers those. */
+            do {
+                value.len = 0;
+                put_value(&value, 0);
+            } while (to && !seen_to && value.buf[0] == '{');
+            put(frame, "%s", value.buf);
+            if (!strip) {
+                put(expected, "%.*s", (int)(frame->len - member), frame->buf + member);
+            }
+        }
+        seen_to = seen_to || to;
+    }
+    put_ws(frame);
+    put(frame, "}");
+    put(expected, "%s%s}", kept > 0 ? "," : "", s_stamp);
+}
+
+static char *rewrite(const char *src, size_t len, size_t *len_out)
+{
+    chat_frame_rewrite_t rewrite = { .strip = s_server_fields, .fill_to = true, .append = s_stamp };
+    return chat_frame_rewrite(src, len, &rewrite, len_out);
+}
+
+static bool rewrites_to(const char *src, const char *expected)
+{
+    size_t len = 0;
+    char *out = chat_frame_can_rewrite(src, strlen(src)) ? rewrite(src, strlen(src), &len) : NULL;
+    bool same = out != NULL && len == strlen(expected) && strcmp(out, expected) == 0;
+    if (!same) {
+        fprintf(stderr, "  input    %s\n  expected %s\n  got      %s\n", src, expected, out ? out : "(null)");
+    }
+    free(out);
+    return same;
+}
+
+static void test_strips_server_fields_in_any_case(void)
+{
+    CHECK(rewrites_to("{\"ID\":1,\"type\":\"text\",\"id\":2,\"Timestamp\":3,\"data\":\"x\"}",
+                      "{\"type\":\"text\",\"data\":\"x\",\"id\":77,\"timestamp\":1735689600}"));
+    CHECK(rewrites_to("{\"id\":1}", "{\"id\":77,\"timestamp\":1735689600}"));
+    CHECK(rewrites_to("{\"data\":{\"id\":1}}", "{\"data\":{\"id\":1},\"id\":77,\"timestamp\":1735689600}"));
+}
+
+static void test_fills_the_first_to_object(void)
+{
+    CHECK(rewrites_to("{\"to\":{}}", "{\"to\":{\"all\":false,\"users\":[]},\"id\":77,\"timestamp\":1735689600}"));
+    CHECK(rewrites_to("{\"to\" : { \"ALL\":true } }",
+                      "{\"to\" : { \"ALL\":true,\"users\":[]},\"id\":77,\"timestamp\":1735689600}"));
+    CHECK(rewrites_to("{\"to\":\"x\",\"TO\":{}}", "{\"to\":\"x\",\"TO\":{},\"id\":77,\"timestamp\":1735689600}"));
+    CHECK(rewrites_to("{\"to\":{\"users\":[],\"all\":true}}",
+                      "{\"to\":{\"users\":[],\"all\":true},\"id\":77,\"timestamp\":1735689600}"));
+}
+
+static bool rewrites_users_to(const char *src, const char *users, const char *expected)
+{
+    chat_frame_rewrite_t rewrite = { .strip = s_server_fields, .fill_to = true, .to_users = users };
+    size_t len = 0;
+    char *out = chat_frame_rewrite(src, strlen(src), &rewrite, &len);
+    bool same = out != NULL && len == strlen(expected) && strcmp(out, expected) == 0;
+    if (!same) {
+        fprintf(stderr, "  input    %s\n  expected %s\n  got      %s\n", src, expected, out ? out : "(null)");
+    }
+    free(out);
+    return same;
+}
+
+static void test_replaces_to_users(void)
+{
+    CHECK(rewrites_users_to("{\"to\":{\"group\":\"g\"}}", "[\"a\",\"b\"]",
+                            "{\"to\":{\"group\":\"g\",\"all\":false,\"users\":[\"a\",\"b\"]}}"));
+    CHECK(rewrites_users_to("{\"to\" : { \"Users\":[\"x\"], \"group\":\"g\" ,\"all\":false},\"id\":1}", "[\"a\"]",
+                            "{\"to\" : {\"group\":\"g\",\"all\":false,\"users\":[\"a\"]}}"));
+    CHECK(rewrites_users_to("{\"to\":{}}", "[]", "{\"to\":{\"all\":false,\"users\":[]}}"));
+}
+
+static void test_escaped_keys_are_not_rewritten(void)
+{
+    const char *escaped = "{\"i\\u0064\":1,\"type\":\"text\"}";
+    CHECK(!chat_frame_can_rewrite(escaped, strlen(escaped)));
+}
+
+static void test_random_frames(void)
+{
+    static text_t frame;
+    static text_t expected;
+    int failures = 0;
+
+    for (int i = 0; i < RANDOM_FRAMES && failures < 5; i++) {
+        make_frame(&frame, &expected);
+        if (!rewrites_to(frame.buf, expected.buf)) {
+            fprintf(stderr, "random frame %d\n", i);
+            failures++;
+        }
+    }
+    CHECK(failures == 0);
+}
+
+int main(void)
+{
+    RUN_TEST(test_strips_server_fields_in_any_case);
+    RUN_TEST(test_fills_the_first_to_object);
+    RUN_TEST(test_replaces_to_users);
+    RUN_TEST(test_escaped_keys_are_not_rewritten);
+    RUN_TEST(test_random_frames);
+    return CHECK_EXIT_CODE;
+}
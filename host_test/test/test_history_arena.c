@@ -0,0 +1,267 @@
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chat/history_arena.h"
+#include "check.h"
+
+CHECK_DEFINE_GLOBALS;
+
+/*
+ * Soak test for the history arena, driven the way chat/history.c drives it: a ring of at most
+ * RING_SIZE messages evicts its oldest entry when an allocation does not fit, replays pin random
+ * records for a while, and records that cannot be placed fall back to the heap. Every payload
+ * carries a pattern derived from its id, checked whenever a reference is dropped.
+ */
+#define ARENA_BYTES     32768
+#define RING_SIZE       100
+#define MAX_LEN         1024
+#define MAX_PINS        8
+#define DEFAULT_CYCLES  2000000
+
+typedef struct {
+    chat_payload_t *payload;
+    uint64_t id;
+} entry_t;
+
+typedef struct {
+    chat_payload_t *payload;
+    uint64_t id;
+    uint32_t release_at;
+} pin_t;
+
+static entry_t s_ring[RING_SIZE];
+static int s_head;
+static int s_count;
+static pin_t s_pins[MAX_PINS];
+static size_t s_live_bytes;
+static uint64_t s_rng = 0x9E3779B97F4A7C15ull;
+
+static uint32_t rng(void)
+{
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 7;
+    s_rng ^= s_rng << 17;
+    return (uint32_t)s_rng;
+}
+
+/* Mostly short chat lines with the occasional body near the frame limit. */
+static size_t random_len(void)
+{
+    uint32_t r = rng();
+    return (r & 7) == 0 ? 512 + r % (MAX_LEN - 511) : 40 + r % 200;
+}
+
+static void fill(char *buf, uint64_t id, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (char)('a' + (id * 31 + i) % 26);
+    }
+}
+
+static bool intact(const chat_payload_t *payload, uint64_t id)
+{
+    for (uint32_t i = 0; i < payload->len; i++) {
+        if (payload->data[i] != (char)('a' + (id * 31 + i) % 26)) {
+            return false;
+        }
+    }
+    return payload->data[payload->len] == '\0';
+}
+
+static int oldest_index(void)
+{
+    return (s_head - s_count + RING_SIZE) % RING_SIZE;
+}
+
+static void evict_oldest(void)
+{
+    entry_t *oldest = &s_ring[oldest_index()];
+    CHECK(intact(oldest->payload, oldest->id));
+    if (oldest->payload->flags & CHAT_PAYLOAD_FLAG_ARENA) {
+        s_live_bytes -= chat_history_arena_record_size(oldest->payload->len);
+    }
+    chat_payload_release(oldest->payload);
+    oldest->payload = NULL;
+    s_count--;
+}
+
+static bool eviction_frees_arena(const chat_history_arena_t *arena)
+{
+    if (s_count == 0) {
+        return false;
+    }
+    chat_payload_t *oldest = s_ring[oldest_index()].payload;
+    if ((oldest->flags & CHAT_PAYLOAD_FLAG_ARENA) == 0) {
+        return true;
+    }
+    return oldest == chat_history_arena_oldest(arena) && atomic_load(&oldest->refs) == 1;
+}
+
+static void store(chat_history_arena_t *arena, uint64_t id, size_t *fallbacks)
+{
+    char data[MAX_LEN];
+    size_t len = random_len();
+    fill(data, id, len);
+
+    if (s_count == RING_SIZE) {
+        evict_oldest();
+    }
+    chat_history_arena_reclaim(arena);
+    chat_payload_t *payload = chat_history_arena_alloc(arena, data, len);
+    while (payload == NULL && eviction_frees_arena(arena)) {
+        evict_oldest();
+        chat_history_arena_reclaim(arena);
+        payload = chat_history_arena_alloc(arena, data, len);
+    }
+    if (payload != NULL) {
+        s_live_bytes += chat_history_arena_record_size(len);
+    } else {
+        payload = chat_payload_create(data, len);
+        (*fallbacks)++;
+    }
+
+    s_ring[s_head].payload = payload;
+    s_ring[s_head].id = id;
+    s_head = (s_head + 1) % RING_SIZE;
+    s_count++;
+}
+
+static void release_pins(uint32_t now, bool all)
+{
+    for (int i = 0; i < MAX_PINS; i++) {
+        pin_t *pin = &s_pins[i];
+        if (pin->payload != NULL && (all || pin->release_at <= now)) {
+            CHECK(intact(pin->payload, pin->id));
+            chat_payload_release(pin->payload);
+            pin->payload = NULL;
+        }
+    }
+}
+
+/* A join replay starts from the oldest messages and holds one while a few more are stored. */
+static void maybe_pin(uint32_t now)
+{
+    pin_t *pin = &s_pins[rng() % MAX_PINS];
+    if (pin->payload != NULL || s_count == 0 || rng() % 64 != 0) {
+        return;
+    }
+    entry_t *entry = &s_ring[(oldest_index() + rng() % (s_count / 8 + 1)) % RING_SIZE];
+    pin->payload = chat_payload_ref(entry->payload);
+    pin->id = entry->id;
+    pin->release_at = now + 1 + rng() % 16;
+}
+
+static void check_accounting(const chat_history_arena_t *arena)
+{
+    CHECK(arena->used >= s_live_bytes);
+    CHECK(arena->used + chat_history_arena_gap(arena) <= arena->capacity);
+    CHECK(chat_history_arena_gap(arena) < chat_history_arena_record_size(MAX_LEN));
+    if (arena->wrap == 0) {
+        CHECK(arena->tail - arena->head == arena->used);
+    } else {
+        CHECK(arena->tail <= arena->head);
+        CHECK(arena->wrap - arena->head + arena->tail == arena->used);
+    }
+}
+
+static void test_soak(void)
+{
+    chat_history_arena_t arena;
+    const char *env = getenv("ARENA_SOAK_CYCLES");
+    uint32_t cycles = env != NULL ? (uint32_t)strtoul(env, NULL, 10) : DEFAULT_CYCLES;
+    size_t fallbacks = 0;
+    size_t pinned_fallbacks = 0;
+    size_t max_gap = 0;
+    double used_sum = 0;
+
+    CHECK(chat_history_arena_init(&arena, ARENA_BYTES) == ESP_OK);
+    for (uint32_t now = 0; now < cycles; now++) {
+        bool pinned = false;
+        for (int i = 0; i < MAX_PINS; i++) {
+            pinned = pinned || s_pins[i].payload != NULL;
+        }
+        size_t before = fallbacks;
+        store(&arena, now + 1, &fallbacks);
+        if (fallbacks != before && pinned) {
+            pinned_fallbacks++;
+        }
+        maybe_pin(now);
+        release_pins(now, false);
+
+        chat_history_arena_reclaim(&arena);
+        if ((now & 1023) == 0) {
+            check_accounting(&arena);
+        }
+        size_t gap = chat_history_arena_gap(&arena);
+        max_gap = gap > max_gap ? gap : max_gap;
+        used_sum += (double)arena.used;
+    }
+
+    /* Without a pin on the oldest record the arena always makes room, so fallbacks need a pin. */
+    CHECK(fallbacks == pinned_fallbacks);
+    CHECK(fallbacks < cycles / 100 + 1);
+    check_accounting(&arena);
+
+    release_pins(0, true);
+    while (s_count > 0) {
+        evict_oldest();
+    }
+    chat_history_arena_reclaim(&arena);
+    CHECK(arena.used == 0 && s_live_bytes == 0);
+    CHECK(arena.head == 0 && arena.tail == 0 && arena.wrap == 0);
+
+    printf("%" PRIu32 " cycles: mean occupancy %.1f%%, max gap %zu bytes, heap fallbacks %zu\n", cycles,
+           100.0 * used_sum / cycles / arena.capacity, max_gap, fallbacks);
+    free(arena.base);
+}
+
+static void test_record_layout(void)
+{
+    chat_history_arena_t arena;
+    CHECK(chat_history_arena_init(&arena, 256) == ESP_OK);
+    size_t record = chat_history_arena_record_size(10);
+    CHECK(record % sizeof(uint32_t) == 0 && record >= offsetof(chat_payload_t, data) + 11);
+
+    chat_payload_t *a = chat_history_arena_alloc(&arena, "0123456789", 10);
+    chat_payload_t *b = chat_history_arena_alloc(&arena, "abcdefghij", 10);
+    CHECK(a != NULL && b != NULL && (uint8_t *)b == (uint8_t *)a + record);
+    CHECK(chat_history_arena_oldest(&arena) == a);
+
+    /* A referenced head blocks reclaim even when later records are free. */
+    chat_payload_release(b);
+    chat_history_arena_reclaim(&arena);
+    CHECK(arena.used == 2 * record);
+    chat_payload_release(a);
+    chat_history_arena_reclaim(&arena);
+    CHECK(arena.used == 0);
+
+    /* Records that reach past the end wrap to 0 and leave a gap. */
+    char big[160];
+    memset(big, 'x', sizeof(big));
+    chat_payload_t *first = chat_history_arena_alloc(&arena, big, 100);
+    chat_payload_t *second = chat_history_arena_alloc(&arena, big, 60);
+    CHECK(first != NULL && second != NULL);
+    chat_payload_release(first);
+    chat_history_arena_reclaim(&arena);
+    chat_payload_t *third = chat_history_arena_alloc(&arena, big, 90);
+    CHECK(third != NULL && (uint8_t *)third == arena.base);
+    CHECK(chat_history_arena_gap(&arena) == arena.capacity - arena.wrap);
+    CHECK(chat_history_arena_alloc(&arena, big, 100) == NULL);
+    chat_payload_release(second);
+    chat_history_arena_reclaim(&arena);
+    CHECK(chat_history_arena_oldest(&arena) == third && chat_history_arena_gap(&arena) == 0);
+    chat_payload_release(third);
+    chat_history_arena_reclaim(&arena);
+    CHECK(arena.used == 0);
+    free(arena.base);
+}
+
+int main(void)
+{
+    RUN_TEST(test_record_layout);
+    RUN_TEST(test_soak);
+    return CHECK_EXIT_CODE;
+}
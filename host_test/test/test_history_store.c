@@ -0,0 +1,69 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "bench_messages.h"
+#include "bench_server.h"
+#include "chat/compress.h"
+#include "chat/frame.h"
+#include "chat/history.h"
+#include "chat/payload.h"
+#include "check.h"
+
+CHECK_DEFINE_GLOBALS;
+
+/*
+ * chat_history_finalize_and_store_message() with CHAT_HISTORY_COMPRESSION on, where the plain
+ * copy for the broadcast is an allocation of its own. Linked with -Wl,--wrap=chat_payload_create.
+ */
+
+static int s_fail_creates;
+
+chat_payload_t *__real_chat_payload_create(const char *data, size_t len);
+
+chat_payload_t *__wrap_chat_payload_create(const char *data, size_t len)
+{
+    if (s_fail_creates > 0) {
+        s_fail_creates--;
+        return NULL;
+    }
+    return __real_chat_payload_create(data, len);
+}
+
+static esp_err_t store(uint64_t seed, chat_payload_t **payload)
+{
+    char text[512];
+    size_t len = bench_client_text(text, sizeof(text), seed);
+    chat_frame_t frame;
+    *payload = NULL;
+    CHECK(chat_frame_parse(text, len, &frame));
+    return chat_history_finalize_and_store_message(&g_app_context, &frame, text, len, payload);
+}
+
+/* A message the broadcast copy failed for is not kept, so the sender's retry stores it once. */
+static void test_failed_broadcast_copy_stores_nothing(void)
+{
+    app_context_t *ctx = &g_app_context;
+    chat_payload_t *payload = NULL;
+    uint64_t counter = ctx->message_id_counter;
+    int count = ctx->message_count;
+
+    s_fail_creates = 1;
+    CHECK(store(1, &payload) == ESP_ERR_NO_MEM);
+    CHECK(payload == NULL);
+    CHECK(ctx->message_id_counter == counter);
+    CHECK(ctx->message_count == count);
+
+    CHECK(store(1, &payload) == ESP_OK);
+    CHECK(payload != NULL && (payload->flags & CHAT_PAYLOAD_FLAG_COMPRESSED) == 0);
+    CHECK(ctx->message_id_counter == counter + 1);
+    CHECK(ctx->message_count == count + 1);
+    CHECK(ctx->message_buffer[count].payload->flags & CHAT_PAYLOAD_FLAG_COMPRESSED);
+    chat_payload_release(payload);
+}
+
+int main(void)
+{
+    bench_server_start(false);
+    RUN_TEST(test_failed_broadcast_copy_stores_nothing);
+    return CHECK_EXIT_CODE;
+}
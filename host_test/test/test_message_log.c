@@ -0,0 +1,385 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "storage/message_log.h"
+
+CHECK_DEFINE_GLOBALS;
+
+#define MAX_VISITS 1024
+
+typedef struct {
+    uint64_t ids[MAX_VISITS];
+    int count;
+    int bad_payloads;
+} visits_t;
+
+/* Base paths must fit MESSAGE_LOG_PATH_BYTES, like "/storage" on the device. */
+static void make_dir(char *path)
+{
+    strcpy(path, "/tmp/mlXXXXXX");
+    if (mkdtemp(path) == NULL) {
+        perror("mkdtemp");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void remove_dir(const char *path)
+{
+    DIR *dir = opendir(path);
+    struct dirent *entry = NULL;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        char file[300];
+        if (entry->d_name[0] != '.') {
+            snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+            remove(file);
+        }
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    rmdir(path);
+}
+
+static int count_segment_files(const char *path)
+{
+    int count = 0;
+    DIR *dir = opendir(path);
+    struct dirent *entry = NULL;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        count += strncmp(entry->d_name, "msg", 3) == 0;
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    return count;
+}
+
+/* Payloads are derived from the id, so a visitor can tell a record from its neighbours. */
+static size_t make_payload(uint64_t id, size_t pad, char *buf, size_t cap)
+{
+    int len = snprintf(buf, cap, "{\"id\":%" PRIu64 ",\"data\":\"", id);
+    for (size_t i = 0; i < pad && (size_t)len + 3 < cap; i++) {
+        buf[len++] = (char)('a' + (id + i) % 26);
+    }
+    buf[len++] = '"';
+    buf[len++] = '}';
+    buf[len] = '\0';
+    return (size_t)len;
+}
+
+static size_t s_pad = 16;
+
+static esp_err_t append_id(chat_message_log_t *log, uint64_t id)
+{
+    char payload[MAX_LOG_RECORD_BYTES];
+    size_t len = make_payload(id, s_pad, payload, sizeof(payload));
+    return chat_message_log_append(log, id, payload, len);
+}
+
+static void append_range(chat_message_log_t *log, uint64_t first, uint64_t last)
+{
+    for (uint64_t id = first; id <= last; id++) {
+        CHECK(append_id(log, id) == ESP_OK);
+    }
+    CHECK(chat_message_log_flush(log) == ESP_OK);
+}
+
+static bool record_visit(uint64_t id, const char *payload, size_t len, void *arg)
+{
+    visits_t *visits = (visits_t *)arg;
+    char expected[MAX_LOG_RECORD_BYTES];
+    size_t expected_len = make_payload(id, s_pad, expected, sizeof(expected));
+
+    if (len != expected_len || memcmp(payload, expected, len) != 0 || payload[len] != '\0') {
+        visits->bad_payloads++;
+    }
+    if (visits->count < MAX_VISITS) {
+        visits->ids[visits->count++] = id;
+    }
+    return true;
+}
+
+static visits_t read_after(chat_message_log_t *log, uint64_t since_id, int max_records)
+{
+    visits_t visits = { 0 };
+    CHECK(chat_message_log_read_after(log, since_id, max_records, record_visit, &visits) == ESP_OK);
+    CHECK(visits.bad_payloads == 0);
+    return visits;
+}
+
+static bool visits_are_range(const visits_t *visits, uint64_t first, uint64_t last)
+{
+    if (visits->count != (int)(last - first + 1)) {
+        return false;
+    }
+    for (int i = 0; i < visits->count; i++) {
+        if (visits->ids[i] != first + (uint64_t)i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void segment_file(const chat_message_log_t *log, int segment, char *path, size_t size)
+{
+    snprintf(path, size, "%s/msg%05" PRIu32 ".log", log->base_path, log->segments[segment].seq);
+}
+
+static long file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+/* Flips one byte of the payload that starts with {"id":<id>, wherever it sits in the file. */
+static bool corrupt_record(const char *path, uint64_t id)
+{
+    char needle[32];
+    snprintf(needle, sizeof(needle), "{\"id\":%" PRIu64 ",", id);
+
+    FILE *file = fopen(path, "r+b");
+    if (file == NULL) {
+        return false;
+    }
+    static char data[CONFIG_CHAT_MESSAGE_LOG_SEGMENT_BYTES + MAX_LOG_RECORD_BYTES];
+    size_t len = fread(data, 1, sizeof(data), file);
+    char *hit = memmem(data, len, needle, strlen(needle));
+    bool done = false;
+    if (hit != NULL) {
+        long offset = (long)(hit - data) + (long)strlen(needle) + 10;
+        done = fseek(file, offset, SEEK_SET) == 0 && fputc(data[offset] ^ 0x20, file) != EOF;
+    }
+    fclose(file);
+    return done;
+}
+
+static void test_append_and_reopen(void)
+{
+    char dir[16];
+    chat_message_log_t log;
+    uint64_t earliest = 0;
+    uint64_t latest = 0;
+
+    make_dir(dir);
+    CHECK(chat_message_log_open(&log, dir) == ESP_OK);
+    CHECK(!chat_message_log_bounds(&log, NULL, NULL));
+    append_range(&log, 1, 100);
+    CHECK(append_id(&log, 100) == ESP_ERR_INVALID_STATE);
+    CHECK(append_id(&log, 50) == ESP_ERR_INVALID_STATE);
+    chat_message_log_close(&log);
+
+    CHECK(chat_message_log_open(&log, dir) == ESP_OK);
+    CHECK(chat_message_log_bounds(&log, &earliest, &latest));
+    CHECK(earliest == 1 && latest == 100);
+    visits_t visits = read_after(&log, 0, MAX_VISITS);
+    CHECK(visits_are_range(&visits, 1, 100));
+
+    /* Reopened logs keep appending to the same segment. */
+    append_range(&log, 101, 110);
+    CHECK(log.segment_count == 1);
+    visits = read_after(&log, 95, MAX_VISITS);
+    CHECK(visits_are_range(&visits, 96, 110));
+    chat_message_log_close(&log);
+    remove_dir(dir);
+}
+
+/* A reboot during a write leaves part of a record at the end of the active segment. */
+static void test_torn_tail(void)
+{
+    static const long cuts[] = { 3, 19, 25 };   /* inside the payload, inside the header, header plus a little */
+
+    for (size_t c = 0; c < sizeof(cuts) / sizeof(cuts[0]); c++) {
+        char dir[16];
+        char path[64];
+        chat_message_log_t log;
+        uint64_t latest = 0;
+
+        make_dir(dir);
+        CHECK(chat_message_log_open(&log, dir) == ESP_OK);
+        append_range(&log, 1, 50);
+        segment_file(&log, 0, path, sizeof(path));
+        chat_message_log_close(&log);
+
+        /* Records are 20 header bytes plus the payload, so cutting fewer than one record tears only id 50. */
+        long size = file_size(path);
+        CHECK(size > 0 && truncate(path, size - cuts[c]) == 0);
+
+        CHECK(chat_message_log_open(&log, dir) == ESP_OK);
+        CHECK(chat_message_log_bounds(&log, NULL, &latest));
+        CHECK(latest == 49);
+        visits_t visits = read_after(&log, 0, MAX_VISITS);
+        CHECK(visits_are_range(&visits, 1, 49));
+
+        /* The torn segment is sealed; the next record starts a fresh segment behind it. */
+        long sealed = file_size(path);
+        append_range(&log, 50, 52);
+        CHECK(log.segment_count == 2);
+        CHECK(file_size(path) == sealed);
+        visits = read_after(&log, 0, MAX_VISITS);
+        CHECK(visits_are_range(&visits, 1, 52));
+        chat_message_log_close(&log);
+
+        CHECK(chat_message_log_open(&log, dir) == ESP_OK);
+        visits = read_after(&log, 40, MAX_VISITS);
+        CHECK(visits_are_range(&visits, 41, 52));
+        chat_message_log_close(&log);
+        remove_dir(dir);
+    }
+}
+
+/* A bad CRC in the middle of the last segment: the valid prefix survives, the rest is dropped. */
+static void test_damaged_last_segment(void)
+{
+    char dir[16];
+    char path[64];
+    chat_message_log_t log;
+    uint64_t earliest = 0;
+    uint64_t latest = 0;
+
+    make_dir(dir);
+    CHECK(chat_message_log_open(&log, dir) == ESP_OK);
+    append_range(&log, 1, 40);
+    segment_file(&log, 0, path, sizeof(path));
+    chat_message_log_close(&log);
+    CHECK(corrupt_record(path, 30));
+
+    CHECK(chat_message_log_open(&log, dir) == ESP_OK);
+    CHECK(chat_message_log_bounds(&log, &earliest, &latest));
+    CHECK(earliest == 1 && latest == 29);
+    visits_t visits = read_after(&log, 0, MAX_VISITS);
+    CHECK(visits_are_range(&visits, 1, 29));
+
+    append_range(&log, 41, 45);
+    CHECK(log.segment_count == 2);
+    visits = read_after(&log, 25, MAX_VISITS);
+    CHECK(visits.count == 9 && visits.ids[3] == 29 && visits.ids[4] == 41 && visits.ids[8] == 45);
+    chat_message_log_close(&log);
+
+    /* The damage is still there after another reboot and the same prefix is kept. */
+    CHECK(chat_message_log_open(&log, dir) == ESP_OK);
+    CHECK(chat_message_log_bounds(&log, &earliest, &latest));
+    CHECK(earliest == 1 && latest == 45);
+    visits = read_after(&log, 0, MAX_VISITS);
+    CHECK(visits.count == 34);
+    chat_message_log_close(&log);
+    remove_dir(dir);
+}
+
+static void test_rotation_and_pruning(void)
+{
+    char dir[16];
+    chat_message_log_t log;
+    uint64_t earliest = 0;
+    uint64_t latest = 0;
+    const uint64_t total = 700;
+
+    s_pad = 1000;
+    make_dir(dir);
+    CHECK(chat_message_log_open(&log, dir) == ESP_OK);
+    append_range(&log, 1, total);
+
+    /* About 64 records fill a segment, so 700 records rotate past the segment limit. */
+    CHECK(log.segment_count == MESSAGE_LOG_MAX_SEGMENTS);
+    CHECK(count_segment_files(dir) == MESSAGE_LOG_MAX_SEGMENTS);
+    for (int i = 0; i < log.segment_count; i++) {
+        CHECK(log.segments[i].size <= MESSAGE_LOG_SEGMENT_BYTES);
+        CHECK(i == 0 || log.segments[i].first_id == log.segments[i - 1].last_id + 1);
+    }
+    CHECK(chat_message_log_bounds(&log, &earliest, &latest));
+    CHECK(earliest > 1 && latest == total);
+    CHECK(earliest == log.segments[0].first_id);
+    chat_message_log_close(&log);
+
+    CHECK(chat_message_log_open(&log, dir) == ESP_OK);
+    uint64_t reopened_earliest = 0;
+    CHECK(chat_message_log_bounds(&log, &reopened_earliest, &latest));
+    CHECK(reopened_earliest == earliest && latest == total);
+    visits_t visits = read_after(&log, 0, MAX_VISITS);
+    CHECK(visits_are_range(&visits, earliest, total));
+
+    /* max_records bounds the walk across segment boundaries. */
+    uint64_t boundary = log.segments[2].first_id;
+    visits = read_after(&log, boundary - 3, 5);
+    CHECK(visits_are_range(&visits, boundary - 2, boundary + 2));
+    chat_message_log_close(&log);
+    remove_dir(dir);
+    s_pad = 16;
+}
+
+/*
+ * read_after() seeks through the sparse index instead of scanning the segment from the start.
+ * Damaging a record below the seek point proves it: reads that start past it are unaffected.
+ */
+static void test_read_after_seeks_by_index(void)
+{
+    char dir[16];
+    char path[64];
+    chat_message_log_t log;
+    const uint64_t total = 200;
+
+    make_dir(dir);
+    CHECK(chat_message_log_open(&log, dir) == ESP_OK);
+    append_range(&log, 1, total);
+    CHECK(log.segment_count == 1);
+    CHECK(log.segments[0].index_count == (int)((total + MESSAGE_LOG_INDEX_STRIDE - 1) / MESSAGE_LOG_INDEX_STRIDE));
+
+    static const uint64_t since[] = { 0, 1, 15, 16, 17, 31, 32, 100, 195, 199 };
+    for (size_t i = 0; i < sizeof(since) / sizeof(since[0]); i++) {
+        uint64_t last = since[i] + 5 < total ? since[i] + 5 : total;
+        visits_t visits = read_after(&log, since[i], 5);
+        CHECK(visits_are_range(&visits, since[i] + 1, last));
+    }
+    visits_t none = read_after(&log, total, 5);
+    CHECK(none.count == 0);
+
+    segment_file(&log, 0, path, sizeof(path));
+    CHECK(corrupt_record(path, 3));
+    visits_t visits = read_after(&log, 0, 5);
+    CHECK(visits_are_range(&visits, 1, 2));
+    visits = read_after(&log, 100, 5);
+    CHECK(visits_are_range(&visits, 101, 105));
+    visits = read_after(&log, MESSAGE_LOG_INDEX_STRIDE, 3);
+    CHECK(visits_are_range(&visits, MESSAGE_LOG_INDEX_STRIDE + 1, MESSAGE_LOG_INDEX_STRIDE + 3));
+    chat_message_log_close(&log);
+    remove_dir(dir);
+}
+
+static bool stop_after_first(uint64_t id, const char *payload, size_t len, void *arg)
+{
+    (*(int *)arg)++;
+    return false;
+}
+
+static void test_visitor_stops_walk(void)
+{
+    char dir[16];
+    chat_message_log_t log;
+    int calls = 0;
+
+    make_dir(dir);
+    CHECK(chat_message_log_open(&log, dir) == ESP_OK);
+    append_range(&log, 1, 10);
+    CHECK(chat_message_log_read_after(&log, 0, 10, stop_after_first, &calls) == ESP_OK);
+    CHECK(calls == 1);
+    chat_message_log_close(&log);
+    remove_dir(dir);
+}
+
+int main(void)
+{
+    RUN_TEST(test_append_and_reopen);
+    RUN_TEST(test_torn_tail);
+    RUN_TEST(test_damaged_last_segment);
+    RUN_TEST(test_rotation_and_pruning);
+    RUN_TEST(test_read_after_seeks_by_index);
+    RUN_TEST(test_visitor_stops_walk);
+    return CHECK_EXIT_CODE;
+}
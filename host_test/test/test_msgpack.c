@@ -0,0 +1,354 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "common/msgpack.h"
+
+CHECK_DEFINE_GLOBALS;
+
+#define BUF_BYTES 2048
+#define RANDOM_MESSAGES 3000
+
+static uint32_t s_seed = 1;
+
+static uint32_t next_random(uint32_t bound)
+{
+    s_seed = s_seed * 1103515245u + 12345u;
+    return (s_seed >> 8) % bound;
+}
+
+/* Already in the unformatted form cJSON prints, so JSON -> MessagePack -> JSON gives the same bytes. */
+static const char *const s_canonical[] = {
+    "{}",
+    "{\"type\":\"pong\"}",
+    "{\"type\":\"text\",\"from\":\"3f2504e0-4f89-41d3-9a0c-0305e82c3301\","
+    "\"to\":{\"all\":false,\"users\":[\"8c8a1b62-1f0e-4b5e-9d55-0a3c1d7e2b90\"]},"
+    "\"name\":\"Alice\",\"data\":\"hi\",\"id\":42,\"timestamp\":1735689600}",
+    "{\"n\":[0,127,128,255,256,65535,65536,4294967295,4294967296,9223372036854775807]}",
+    "{\"n\":[-1,-32,-33,-128,-129,-32768,-32769,-2147483648,-2147483649,-9223372036854775808]}",
+    "{\"f\":[0.5,-2.25,3.1415926535897931,1e+300],\"b\":[true,false,null],\"e\":[[],{}]}",
+    "{\"s\":\"quote \\\" backslash \\\\ tab \\t nl \\n ctl \\u0001 中文\"}",
+    "{\"nested\":{\"a\":{\"b\":{\"c\":[1,[2,[3]]]}}}}",
+};
+
+static size_t encode(const char *json, uint8_t *out, size_t cap)
+{
+    size_t len = strlen(json);
+    size_t need = msgpack_from_json(json, len, NULL, 0);
+    CHECK(need > 0 && need <= cap);
+    CHECK(msgpack_from_json(json, len, out, cap) == need);
+    return need;
+}
+
+static bool decode(const uint8_t *src, size_t len, char *out, size_t cap)
+{
+    json_writer_t writer;
+    json_writer_init(&writer, out, cap);
+    return msgpack_to_json(src, len, &writer) && json_writer_finish(&writer);
+}
+
+static void test_round_trip(void)
+{
+    uint8_t packed[BUF_BYTES];
+    char json[BUF_BYTES];
+
+    for (size_t i = 0; i < sizeof(s_canonical) / sizeof(s_canonical[0]); i++) {
+        size_t len = encode(s_canonical[i], packed, sizeof(packed));
+        CHECK(decode(packed, len, json, sizeof(json)));
+        if (strcmp(json, s_canonical[i]) != 0) {
+            fprintf(stderr, "expected %s\n     got %s\n", s_canonical[i], json);
+            check_failures++;
+        }
+    }
+}
+
+/* Formatting and escape spellings are normalised; the values survive. */
+/* Integers past int64 are not representable as MessagePack ints and travel as float64, as cJSON reads them. */
+static void test_large_integer_becomes_double(void)
+{
+    uint8_t packed[BUF_BYTES];
+    char json[BUF_BYTES];
+    size_t len = encode("{\"n\":18446744073709551615}", packed, sizeof(packed));
+    CHECK(len == 12 && packed[3] == 0xCB);
+    CHECK(decode(packed, len, json, sizeof(json)));
+    CHECK(strcmp(json, "{\"n\":1.8446744073709552e+19}") == 0);
+}
+
+static void test_normalises_input(void)
+{
+    uint8_t packed[BUF_BYTES];
+    char json[BUF_BYTES];
+    size_t len = encode(" { \"a\" : \"\\u00e9\\/\\ud83d\\ude00\" , \"b\" : [ 1 , 2 ] } ", packed, sizeof(packed));
+    CHECK(decode(packed, len, json, sizeof(json)));
+    CHECK(strcmp(json, "{\"a\":\"é/😀\",\"b\":[1,2]}") == 0);
+}
+
+static void test_wide_headers(void)
+{
+    static char json[BUF_BYTES];
+    uint8_t packed[BUF_BYTES];
+    char back[BUF_BYTES];
+    int len = snprintf(json, sizeof(json), "{\"s\":\"");
+    for (int i = 0; i < 300; i++) {
+        json[len++] = 'x';
+    }
+    len += snprintf(json + len, sizeof(json) - len, "\",\"a\":[");
+    for (int i = 0; i < 20; i++) {
+        len += snprintf(json + len, sizeof(json) - len, i == 0 ? "%d" : ",%d", i);
+    }
+    snprintf(json + len, sizeof(json) - len, "]}");
+
+    size_t packed_len = encode(json, packed, sizeof(packed));
+    CHECK(memmem(packed, packed_len, "\xDA\x01\x2C", 3) != NULL);   /* str16 of 300 bytes */
+    CHECK(memmem(packed, packed_len, "\xDC\x00\x14", 3) != NULL);   /* array16 of 20 items */
+    CHECK(decode(packed, packed_len, back, sizeof(back)));
+    CHECK(strcmp(back, json) == 0);
+}
+
+static void test_rejects_invalid(void)
+{
+    uint8_t packed[BUF_BYTES];
+    char json[BUF_BYTES];
+
+    CHECK(msgpack_from_json("[1]", 3, NULL, 0) == 0);
+    CHECK(msgpack_from_json("{\"a\":}", 6, NULL, 0) == 0);
+    CHECK(msgpack_from_json("{\"a\":1", 6, NULL, 0) == 0);
+
+    static const uint8_t array[] = { 0x91, 0x01 };
+    static const uint8_t bin[] = { 0x81, 0xA1, 'a', 0xC4, 0x01, 0x00 };
+    static const uint8_t int_key[] = { 0x81, 0x01, 0x01 };
+    static const uint8_t trailing[] = { 0x80, 0xC0 };
+    static const uint8_t nan[] = { 0x81, 0xA1, 'a', 0xCB, 0x7F, 0xF8, 0, 0, 0, 0, 0, 0 };
+    CHECK(!decode(array, sizeof(array), json, sizeof(json)));
+    CHECK(!decode(bin, sizeof(bin), json, sizeof(json)));
+    CHECK(!decode(int_key, sizeof(int_key), json, sizeof(json)));
+    CHECK(!decode(trailing, sizeof(trailing), json, sizeof(json)));
+    CHECK(!decode(nan, sizeof(nan), json, sizeof(json)));
+
+    size_t len = encode(s_canonical[2], packed, sizeof(packed));
+    for (size_t cut = 0; cut < len; cut++) {
+        CHECK(!decode(packed, cut, json, sizeof(json)));
+    }
+}
+
+static void test_small_output_buffer(void)
+{
+    uint8_t packed[BUF_BYTES];
+    const char *src = s_canonical[2];
+    size_t need = msgpack_from_json(src, strlen(src), NULL, 0);
+    memset(packed, 0xEE, sizeof(packed));
+    CHECK(msgpack_from_json(src, strlen(src), packed, need - 1) == need);
+    CHECK(packed[need - 1] == 0xEE);
+
+    char json[16];
+    size_t len = encode(src, packed, sizeof(packed));
+    CHECK(!decode(packed, len, json, sizeof(json)));
+}
+
+typedef struct {
+    char buf[BUF_BYTES];
+    size_t len;
+    bool overflow;
+} text_t;
+
+static void put(text_t *text, const char *str)
+{
+    size_t len = strlen(str);
+    if (text->len + len < sizeof(text->buf)) {
+        memcpy(text->buf + text->len, str, len + 1);
+        text->len += len;
+    } else {
+        text->overflow = true;
+    }
+}
+
+/* A string in the form msgpack_to_json() writes: short, 8-bit and 16-bit lengths, escapes and UTF-8. */
+static void put_string(text_t *text)
+{
+    static const char *const pieces[] = {
+        "a", "type", "quote \\\"", "\\\\", "\\n", "\\t", "\\r", "\\b", "\\f", "\\u0001", "\\u001f", "中文", "é", "😀", "/",
+    };
+    int count = (int)next_random(8);
+    int repeat = next_random(8) == 0 ? 1 + (int)next_random(300) : 0;
+    put(text, "\"");
+    for (int i = 0; i < count; i++) {
+        put(text, pieces[next_random(sizeof(pieces) / sizeof(pieces[0]))]);
+    }
+    for (int i = 0; i < repeat; i++) {
+        put(text, "x");
+    }
+    put(text, "\"");
+}
+
+static void put_number(text_t *text)
+{
+    static const char *const fixed[] = {
+        "0", "127", "128", "255", "256", "65535", "65536", "4294967295", "4294967296", "9223372036854775807",
+        "-1", "-32", "-33", "-128", "-129", "-32768", "-32769", "-2147483648", "-2147483649",
+        "-9223372036854775808", "0.5", "-2.25", "1e+300",
+    };
+    char number[32];
+    if (next_random(2) == 0) {
+        put(text, fixed[next_random(sizeof(fixed) / sizeof(fixed[0]))]);
+        return;
+    }
+    int64_t value = (int64_t)(((uint64_t)next_random(1u << 24) << 40) ^ ((uint64_t)next_random(1u << 24) << 16) ^
+                              next_random(1u << 16)) >> next_random(63);
+    snprintf(number, sizeof(number), "%lld", (long long)(next_random(2) ? value : -value));
+    put(text, number);
+}
+
+static void put_value(text_t *text, int depth)
+{
+    uint32_t kind = next_random(depth < 4 ? 10 : 7);
+    if (kind < 3) {
+        put_string(text);
+    } else if (kind < 6) {
+        put_number(text);
+    } else if (kind == 6) {
+        static const char *const literals[] = { "true", "false", "null" };
+        put(text, literals[next_random(3)]);
+    } else {
+        bool map = kind >= 8;
+        int count = (int)next_random(map ? 6 : 12);
+        put(text, map ? "{" : "[");
+        for (int i = 0; i < count; i++) {
+            if (i > 0) {
+                put(text, ",");
+            }
+            if (map) {
+                put_string(text);
+                put(text, ":");
+            }
+            put_value(text, depth + 1);
+        }
+        put(text, map ? "}" : "]");
+    }
+}
+
+/* Random messages already in decoded form survive JSON -> MessagePack -> JSON byte for byte. */
+static void test_random_round_trip(void)
+{
+    static text_t json;
+    static uint8_t packed[2 * BUF_BYTES];
+    static char back[2 * BUF_BYTES];
+    int failures = 0;
+
+    for (int i = 0; i < RANDOM_MESSAGES && failures < 5; i++) {
+        json.len = 0;
+        json.overflow = false;
+        put(&json, "{");
+        int count = (int)next_random(8);
+        for (int m = 0; m < count; m++) {
+            put(&json, m > 0 ? "," : "");
+            put_string(&json);
+            put(&json, ":");
+            put_value(&json, 1);
+        }
+        put(&json, "}");
+        if (json.overflow) {
+            continue;
+        }
+
+        size_t len = msgpack_from_json(json.buf, json.len, packed, sizeof(packed));
+        bool same = len > 0 && len <= sizeof(packed) && decode(packed, len, back, sizeof(back)) &&
+                    strcmp(back, json.buf) == 0;
+        if (!same) {
+            fprintf(stderr, "message %d\nexpected %s\n     got %s\n", i, json.buf, len > 0 ? back : "(not encoded)");
+            failures++;
+        }
+    }
+    CHECK(failures == 0);
+}
+
+/* Corrupted encodings and random bytes are refused or decode to JSON that encodes again; ASan watches the reads. */
+static void test_random_input(void)
+{
+    static uint8_t packed[BUF_BYTES];
+    static char json[2 * BUF_BYTES];
+    const char *src = s_canonical[2];
+    size_t base_len = encode(src, packed, sizeof(packed));
+    int decoded = 0;
+
+    for (int i = 0; i < RANDOM_MESSAGES; i++) {
+        uint8_t input[BUF_BYTES];
+        size_t len = base_len;
+        if (i % 2 == 0) {
+            memcpy(input, packed, len);
+            for (int flips = 1 + (int)next_random(4); flips > 0; flips--) {
+                input[next_random((uint32_t)len)] = (uint8_t)next_random(256);
+            }
+        } else {
+            len = 1 + next_random(64);
+            for (size_t b = 0; b < len; b++) {
+                input[b] = (uint8_t)next_random(256);
+            }
+            input[0] = (uint8_t)(0x80 | next_random(16));
+        }
+        /* Exact-size heap copies so a read past the end is caught. */
+        uint8_t *exact = malloc(len);
+        memcpy(exact, input, len);
+        if (decode(exact, len, json, sizeof(json))) {
+            decoded++;
+            CHECK(msgpack_from_json(json, strlen(json), NULL, 0) > 0);
+        }
+        const char *str = NULL;
+        size_t str_len = 0;
+        if (msgpack_map_string(exact, len, "type", &str, &str_len)) {
+            CHECK(str >= (const char *)exact && str + str_len <= (const char *)exact + len);
+        }
+        free(exact);
+    }
+    CHECK(decoded > 0);
+}
+
+static bool type_of(const char *json, char *out, size_t cap)
+{
+    uint8_t packed[BUF_BYTES];
+    const char *str = NULL;
+    size_t len = 0;
+    size_t packed_len = encode(json, packed, sizeof(packed));
+    if (!msgpack_map_string(packed, packed_len, "type", &str, &len) || len >= cap) {
+        return false;
+    }
+    memcpy(out, str, len);
+    out[len] = '\0';
+    return true;
+}
+
+/* The type is found past members of every shape without decoding them. */
+static void test_map_string(void)
+{
+    char type[32];
+    CHECK(type_of("{\"type\":\"text\"}", type, sizeof(type)) && strcmp(type, "text") == 0);
+    CHECK(type_of("{\"a\":[1,-1,300,-300,70000,5000000000,0.5,true,null,\"s\",{\"x\":{\"y\":[]}}],"
+                  "\"TYPE\":\"join\",\"type\":\"text\"}", type, sizeof(type)) && strcmp(type, "join") == 0);
+    CHECK(!type_of("{\"type\":1}", type, sizeof(type)));
+    CHECK(!type_of("{\"kind\":\"text\"}", type, sizeof(type)));
+
+    const char *str = NULL;
+    size_t len = 0;
+    static const uint8_t array[] = { 0x91, 0xA1, 't' };
+    static const uint8_t bin_first[] = { 0x82, 0xA1, 'a', 0xC4, 0x01, 0x00, 0xA4, 't', 'y', 'p', 'e', 0xA1, 't' };
+    static const uint8_t short_value[] = { 0x81, 0xA4, 't', 'y', 'p', 'e', 0xA4, 't', 'e' };
+    CHECK(!msgpack_map_string(array, sizeof(array), "type", &str, &len));
+    CHECK(!msgpack_map_string(bin_first, sizeof(bin_first), "type", &str, &len));
+    CHECK(!msgpack_map_string(short_value, sizeof(short_value), "type", &str, &len));
+}
+
+int main(void)
+{
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_large_integer_becomes_double);
+    RUN_TEST(test_normalises_input);
+    RUN_TEST(test_wide_headers);
+    RUN_TEST(test_rejects_invalid);
+    RUN_TEST(test_small_output_buffer);
+    RUN_TEST(test_map_string);
+    RUN_TEST(test_random_round_trip);
+    RUN_TEST(test_random_input);
+    return CHECK_EXIT_CODE;
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bench_server.h"
+#include "chat/groups.h"
+#include "chat_config.h"
+#include "check.h"
+#include "esp_timer.h"
+
+CHECK_DEFINE_GLOBALS;
+
+/* Frames through chat_ws_handler() as a browser would send them, on the server of bench_server.h. */
+
+#define ALICE   0
+#define BOB     1
+#define MALLORY 2
+#define CLIENTS 3
+
+static bench_conn_t s_conns[CLIENTS];
+static char s_received[CLIENTS][16384];
+
+static void record(int index, httpd_ws_type_t type, const uint8_t *data, size_t len, void *arg)
+{
+    if (index < CLIENTS && type == HTTPD_WS_TYPE_TEXT) {
+        size_t used = strlen(s_received[index]);
+        snprintf(s_received[index] + used, sizeof(s_received[index]) - used, "%.*s\n", (int)len, (const char *)data);
+    }
+}
+
+static long long now_s(void)
+{
+    return 1735689600 + esp_timer_get_time() / 1000000;
+}
+
+/* Sends frame from client and returns what client got back. */
+static const char *exchange(int client, const char *frame)
+{
+    memset(s_received, 0, sizeof(s_received));
+    bench_send(&s_conns[client], frame);
+    return s_received[client];
+}
+
+static void send_secret(void)
+{
+    char frame[512];
+    snprintf(frame, sizeof(frame),
+             "{\"type\":\"text\",\"from\":\"%s\",\"name\":\"%s\",\"to\":{\"all\":false,\"users\":[\"%s\"]},"
+             "\"data\":\"secret rendezvous\",\"timestamp\":%lld}",
+             bench_client_id(BOB), bench_client_name(BOB), bench_client_id(ALICE), now_s());
+    bench_send(&s_conns[BOB], frame);
+}
+
+/*
+ * The scanner skips escaped keys and cJSON takes the first "from", so the two parsers read
+ * different senders from these frames; the frame must be refused either way round.
+ */
+static void test_escaped_duplicate_from_is_refused(void)
+{
+    static const char *const types[] = {
+        "\"type\":\"search\",%s,\"query\":\"rendezvous\"",
+        "\"type\":\"historyQuery\",%s",
+    };
+    char from[256];
+    char members[512];
+    char frame[640];
+
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        for (int order = 0; order < 2; order++) {
+            const char *first = bench_client_id(order == 0 ? ALICE : MALLORY);
+            const char *second = bench_client_id(order == 0 ? MALLORY : ALICE);
+            snprintf(from, sizeof(from), "\"fro\\u006d\":\"%s\",\"from\":\"%s\"", first, second);
+            snprintf(members, sizeof(members), types[t], from);
+            snprintf(frame, sizeof(frame), "{%s,\"timestamp\":%lld}", members, now_s());
+
+            const char *reply = exchange(MALLORY, frame);
+            CHECK(strstr(reply, "bad_identity") != NULL);
+            CHECK(strstr(reply, "secret") == NULL);
+        }
+    }
+
+    uint64_t stored = g_app_context.message_id_counter;
+    snprintf(frame, sizeof(frame),
+             "{\"type\":\"text\",\"fro\\u006d\":\"%s\",\"from\":\"%s\",\"name\":\"Mallory\","
+             "\"to\":{\"all\":true,\"users\":[]},\"data\":\"hi\",\"timestamp\":%lld}",
+             bench_client_id(ALICE), bench_client_id(MALLORY), now_s());
+    CHECK(strstr(exchange(MALLORY, frame), "bad_identity") != NULL);
+    CHECK(g_app_context.message_id_counter == stored);
+}
+
+/* Queries run as the joined user, whatever else the frame carries. */
+static void test_queries_run_as_the_joined_user(void)
+{
+    char frame[512];
+
+    snprintf(frame, sizeof(frame), "{\"type\":\"search\",\"from\":\"%s\",\"quer\\u0079\":\"rendezvous\",\"timestamp\":%lld}",
+             bench_client_id(MALLORY), now_s());
+    const char *reply = exchange(MALLORY, frame);
+    CHECK(strstr(reply, "searchResults") != NULL);
+    CHECK(strstr(reply, "secret") == NULL);
+
+    snprintf(frame, sizeof(frame), "{\"type\":\"search\",\"from\":\"%s\",\"query\":\"rendezvous\",\"timestamp\":%lld}",
+             bench_client_id(ALICE), now_s());
+    CHECK(strstr(exchange(ALICE, frame), "secret rendezvous") != NULL);
+}
+
+/*
+ * mallory evicts a group of alice and bob with throwaway groups, then registers its id again with
+ * only itself as member. The earlier group messages must stay with alice and bob.
+ */
+static void test_reregistered_group_keeps_its_history(void)
+{
+    static const char group_id[] = "6ba7b810-9dad-11d1-80b4-00c04fd43000";
+    char frame[768];
+
+    snprintf(frame, sizeof(frame),
+             "{\"type\":\"newGroup\",\"from\":\"%s\",\"name\":\"%s\",\"groupId\":\"%s\",\"groupName\":\"Plans\","
+             "\"to\":{\"all\":false,\"users\":[\"%s\"]},\"data\":\"created Plans\",\"timestamp\":%lld}",
+             bench_client_id(ALICE), bench_client_name(ALICE), group_id, bench_client_id(BOB), now_s());
+    bench_send(&s_conns[ALICE], frame);
+    snprintf(frame, sizeof(frame),
+             "{\"type\":\"text\",\"from\":\"%s\",\"name\":\"%s\",\"to\":{\"group\":\"%s\"},\"groupId\":\"%s\","
+             "\"groupName\":\"Plans\",\"data\":\"group hideout\",\"timestamp\":%lld}",
+             bench_client_id(BOB), bench_client_name(BOB), group_id, group_id, now_s());
+    bench_send(&s_conns[BOB], frame);
+
+    for (int g = 0; g < MAX_GROUPS; g++) {
+        snprintf(frame, sizeof(frame),
+                 "{\"type\":\"newGroup\",\"from\":\"%s\",\"name\":\"Mallory\",\"groupId\":\"throwaway-%d\","
+                 "\"groupName\":\"x\",\"to\":{\"all\":false,\"users\":[\"%s\"]},\"data\":\"\",\"timestamp\":%lld}",
+                 bench_client_id(MALLORY), g, bench_client_id(BOB), now_s());
+        bench_send(&s_conns[MALLORY], frame);
+    }
+    CHECK(chat_groups_find(&g_app_context.groups, group_id, strlen(group_id)) == NULL);
+
+    snprintf(frame, sizeof(frame),
+             "{\"type\":\"text\",\"from\":\"%s\",\"name\":\"Mallory\",\"to\":{\"group\":\"%s\",\"users\":[\"%s\"]},"
+             "\"groupId\":\"%s\",\"groupName\":\"Plans\",\"data\":\"mine now\",\"timestamp\":%lld}",
+             bench_client_id(MALLORY), group_id, bench_client_id(MALLORY), group_id, now_s());
+    bench_send(&s_conns[MALLORY], frame);
+    CHECK(chat_groups_find(&g_app_context.groups, group_id, strlen(group_id)) != NULL);
+
+    for (int c = 0; c < CLIENTS; c++) {
+        snprintf(frame, sizeof(frame), "{\"type\":\"historyQuery\",\"from\":\"%s\",\"conversation\":\"%s\",\"timestamp\":%lld}",
+                 bench_client_id(c), group_id, now_s());
+        CHECK((strstr(exchange(c, frame), "group hideout") != NULL) == (c != MALLORY));
+    }
+}
+
+int main(void)
+{
+    bench_server_start(false);
+    for (int c = 0; c < CLIENTS; c++) {
+        bench_connect(&s_conns[c], c);
+        bench_join(&s_conns[c], NULL);
+    }
+    send_secret();
+    bench_set_frame_hook(record, NULL);
+
+    RUN_TEST(test_escaped_duplicate_from_is_refused);
+    RUN_TEST(test_queries_run_as_the_joined_user);
+    RUN_TEST(test_reregistered_group_keeps_its_history);
+    return CHECK_EXIT_CODE;
+}
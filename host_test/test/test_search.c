@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chat/search.h"
+#include "check.h"
+
+CHECK_DEFINE_GLOBALS;
+
+#define MAX_HITS 64
+
+typedef struct {
+    uint64_t ids[MAX_HITS];
+    int count;
+    int limit;
+} hits_t;
+
+static bool collect(uint64_t id, void *arg)
+{
+    hits_t *hits = (hits_t *)arg;
+    if (hits->count < MAX_HITS) {
+        hits->ids[hits->count] = id;
+    }
+    hits->count++;
+    return hits->limit == 0 || hits->count < hits->limit;
+}
+
+static hits_t query(const chat_search_index_t *index, const char *text, int limit)
+{
+    hits_t hits = { .limit = limit };
+    int matches = chat_search_query(index, text, collect, &hits);
+    CHECK(matches == hits.count);
+    return hits;
+}
+
+static bool hits_are(const hits_t *hits, const uint64_t *ids, int count)
+{
+    if (hits->count != count) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        if (hits->ids[i] != ids[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void add(chat_search_index_t *index, uint64_t id, const char *text)
+{
+    chat_search_add(index, id, text, strlen(text));
+}
+
+static void destroy(chat_search_index_t *index)
+{
+    free(index->terms);
+    free(index->postings);
+}
+
+static void test_terms_and_intersection(void)
+{
+    chat_search_index_t index;
+    CHECK(chat_search_init(&index, 8192) == ESP_OK);
+    add(&index, 1, "Lunch at the cafe?");
+    add(&index, 2, "lunch moved to noon, same cafe");
+    add(&index, 3, "Dinner at noon... no, LUNCH at noon");
+    add(&index, 4, "nothing here");
+
+    hits_t hits = query(&index, "lunch", 0);
+    CHECK(hits_are(&hits, (const uint64_t[]){ 3, 2, 1 }, 3));
+    hits = query(&index, "CAFE lunch", 0);
+    CHECK(hits_are(&hits, (const uint64_t[]){ 2, 1 }, 2));
+    hits = query(&index, "noon, lunch!", 0);
+    CHECK(hits_are(&hits, (const uint64_t[]){ 3, 2 }, 2));
+    hits = query(&index, "lunch dinner cafe", 0);
+    CHECK(hits.count == 0);
+    hits = query(&index, "missing", 0);
+    CHECK(hits.count == 0);
+    hits = query(&index, " ?! ", 0);
+    CHECK(hits.count == 0);
+
+    /* Whole words only; repeated words in one message give one posting. */
+    hits = query(&index, "lun", 0);
+    CHECK(hits.count == 0);
+    hits = query(&index, "at", 0);
+    CHECK(hits_are(&hits, (const uint64_t[]){ 3, 1 }, 2));
+    destroy(&index);
+}
+
+static void test_utf8_characters(void)
+{
+    chat_search_index_t index;
+    CHECK(chat_search_init(&index, 8192) == ESP_OK);
+    add(&index, 10, "明天开会");
+    add(&index, 11, "今天不开会");
+    add(&index, 12, "开车");
+
+    hits_t hits = query(&index, "开会", 0);
+    CHECK(hits_are(&hits, (const uint64_t[]){ 11, 10 }, 2));
+    hits = query(&index, "开", 0);
+    CHECK(hits_are(&hits, (const uint64_t[]){ 12, 11, 10 }, 3));
+    hits = query(&index, "明天", 0);
+    CHECK(hits_are(&hits, (const uint64_t[]){ 10 }, 1));
+    destroy(&index);
+}
+
+static void test_visitor_limit(void)
+{
+    chat_search_index_t index;
+    CHECK(chat_search_init(&index, 8192) == ESP_OK);
+    for (uint64_t id = 1; id <= 30; id++) {
+        add(&index, id, "status update");
+    }
+    hits_t hits = query(&index, "status", 5);
+    CHECK(hits_are(&hits, (const uint64_t[]){ 30, 29, 28, 27, 26 }, 5));
+    destroy(&index);
+}
+
+static void test_evict_through(void)
+{
+    chat_search_index_t index;
+    CHECK(chat_search_init(&index, 8192) == ESP_OK);
+    for (uint64_t id = 1; id <= 10; id++) {
+        add(&index, id, id % 2 ? "odd message" : "even message");
+    }
+
+    chat_search_evict_through(&index, 6);
+    hits_t hits = query(&index, "message", 0);
+    CHECK(hits_are(&hits, (const uint64_t[]){ 10, 9, 8, 7 }, 4));
+    hits = query(&index, "odd", 0);
+    CHECK(hits_are(&hits, (const uint64_t[]){ 9, 7 }, 2));
+
+    chat_search_evict_through(&index, 10);
+    hits = query(&index, "message", 0);
+    CHECK(hits.count == 0);
+
+    /* Evicted terms leave tombstones that new terms reuse. */
+    add(&index, 11, "odd again");
+    hits = query(&index, "odd", 0);
+    CHECK(hits_are(&hits, (const uint64_t[]){ 11 }, 1));
+    destroy(&index);
+}
+
+/* A full posting ring drops the oldest postings first, so old ids fall out of the results. */
+static void test_posting_ring_wraps(void)
+{
+    chat_search_index_t index;
+    CHECK(chat_search_init(&index, 1024) == ESP_OK);
+    uint32_t capacity = index.posting_capacity;
+    CHECK(capacity > 8 && capacity <= MAX_HITS);
+
+    uint64_t last = capacity * 3;
+    for (uint64_t id = 1; id <= last; id++) {
+        add(&index, id, "wrap");
+    }
+    CHECK(index.tail_seq - index.head_seq == capacity);
+    hits_t hits = query(&index, "wrap", 0);
+    CHECK(hits.count == (int)capacity);
+    CHECK(hits.ids[0] == last && hits.ids[capacity - 1] == last - capacity + 1);
+    destroy(&index);
+}
+
+/* With more distinct live terms than slots, new terms are dropped rather than corrupting others. */
+static void test_term_table_full(void)
+{
+    chat_search_index_t index;
+    char word[16];
+    CHECK(chat_search_init(&index, 4096) == ESP_OK);
+    uint32_t terms = index.term_capacity;
+    CHECK(index.posting_capacity > terms);
+
+    for (uint32_t i = 0; i < terms + 4; i++) {
+        snprintf(word, sizeof(word), "w%u", (unsigned)i);
+        add(&index, i + 1, word);
+    }
+    CHECK(index.dropped_terms == 4);
+    hits_t hits = query(&index, "w0", 0);
+    CHECK(hits_are(&hits, (const uint64_t[]){ 1 }, 1));
+    snprintf(word, sizeof(word), "w%u", (unsigned)(terms + 1));
+    hits = query(&index, word, 0);
+    CHECK(hits.count == 0);
+    destroy(&index);
+}
+
+static void test_disabled_index(void)
+{
+    chat_search_index_t index;
+    CHECK(chat_search_init(&index, 0) == ESP_OK);
+    add(&index, 1, "anything");
+    hits_t hits = query(&index, "anything", 0);
+    CHECK(hits.count == 0);
+}
+
+int main(void)
+{
+    RUN_TEST(test_terms_and_intersection);
+    RUN_TEST(test_utf8_characters);
+    RUN_TEST(test_visitor_limit);
+    RUN_TEST(test_evict_through);
+    RUN_TEST(test_posting_ring_wraps);
+    RUN_TEST(test_term_table_full);
+    RUN_TEST(test_disabled_index);
+    return CHECK_EXIT_CODE;
+}
@@ -1,23 +1,56 @@
 #pragma once
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "esp_http_server.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "freertos/semphr.h"
 #include "freertos/task.h"
 
 #include "chat_config.h"
 #include "chat_types.h"
+#include "chat/history_arena.h"
+#include "chat/search.h"
+#include "storage/message_log.h"
 
 typedef struct {
     client_slot_t client_slots[MAX_CLIENTS];
     SemaphoreHandle_t client_mutex;
+    chat_payload_t *online_users_payload;
+    atomic_int_least64_t time_consensus_offset_s;
+    uint32_t session_epoch;
+    chat_session_snapshot_t session_snapshot;
+    chat_presence_user_t presence_users[MAX_CLIENTS];   /* the joined set as of presence_version */
+    int presence_user_count;
+    uint32_t presence_version;
+    bool presence_pending;      /* the joined set moved since presence_version */
+    TaskHandle_t presence_task;
+    chat_group_table_t groups;
+    SemaphoreHandle_t group_mutex;
 
     message_t message_buffer[MAX_MESSAGES];
     uint64_t message_id_counter;
+    uint64_t message_id_lease;
     uint64_t boot_start_id;
     int message_buffer_head;
+    int message_count;
+    chat_history_arena_t message_arena;
+    size_t message_live_bytes;
+    uint32_t message_heap_fallbacks;
+    chat_user_table_t message_users;
+    chat_search_index_t message_search;
+    chat_message_log_t message_log;
+    SemaphoreHandle_t message_log_mutex;
+    QueueHandle_t persist_queue;
+    uint32_t persist_commits;
+    uint32_t persist_dropped;
+    chat_payload_t *history_info_payload;
+    history_bounds_t history_info_bounds;
+    chat_history_seen_t history_seen[HISTORY_SEEN_REQUESTS];  /* HTTPD task only */
+    int history_seen_next;
     SemaphoreHandle_t message_mutex;
 
     chat_settings_t settings;
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chat/payload.h"
+
+#define CHAT_PAYLOAD_FLAG_COMPRESSED 0x02
+
+/*
+ * Small LZ77 codec for stored chat JSON. Matches may reach back into a static dictionary
+ * of protocol keys, and lowercase UUIDs are packed to 16 bytes. chat_compress() uses a
+ * static match table, so callers must serialize it; decompression is reentrant.
+ */
+size_t chat_compress(const char *src, size_t len, uint8_t *dst, size_t cap);
+size_t chat_decompressed_size(const uint8_t *src, size_t len);
+size_t chat_decompress(const uint8_t *src, size_t len, char *dst, size_t cap);
+
+/* Returns a plain-text reference to payload, decompressing into a new heap payload if needed. */
+chat_payload_t *chat_payload_open(chat_payload_t *payload);
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cJSON.h"
+
+#include "chat_config.h"
+#include "common/json_scan.h"
+
+/* A field of an inbound frame. Strings are not NUL-terminated; type is JSON_SCAN_NONE when absent. */
+typedef struct {
+    json_scan_type_t type;
+    const char *str;
+    size_t len;
+    double number;
+} chat_field_t;
+
+/*
+ * The fields of the common message shapes, filled either straight from the receive buffer by
+ * chat_frame_parse() or from a cJSON tree for frames the scanner leaves to cJSON. Keys match
+ * case-insensitively and the first occurrence wins, as with cJSON_GetObjectItem().
+ */
+typedef struct {
+    chat_field_t type;
+    chat_field_t from;
+    chat_field_t name;
+    chat_field_t data;
+    chat_field_t group_id;
+    chat_field_t group_name;
+    chat_field_t request_id;
+    chat_field_t timestamp;
+    chat_field_t since_id;
+    chat_field_t last_seen_id;
+    chat_field_t replay_limit;
+    chat_field_t history_batch;
+    chat_field_t restore_before_id;
+    chat_field_t history_ranges;
+    chat_field_t presence_version;
+    chat_field_t encoding;
+    chat_field_t compression;
+    chat_field_t to;
+    chat_field_t to_all;
+    chat_field_t to_users;
+    chat_field_t to_group;
+    chat_field_t users[MAX_CLIENTS + 1];
+    int user_count;
+    bool users_valid;
+} chat_frame_t;
+
+/*
+ * Fills frame without allocating. Returns false when cJSON should take the frame instead: invalid
+ * or unusual JSON, an escaped string or key among the fields above, or a type not handled here.
+ * The fields scanned before that point, type included, are filled either way.
+ */
+bool chat_frame_parse(const char *src, size_t len, chat_frame_t *frame);
+void chat_frame_from_json(const cJSON *root, chat_frame_t *frame);
+void chat_field_from_json(const cJSON *item, chat_field_t *field);
+
+/* How chat_frame_rewrite() turns an inbound frame into the text the server stores or relays. */
+typedef struct {
+    const char *const *strip;   /* NULL-terminated; members dropped wherever they appear, case-insensitively */
+    bool fill_to;               /* add to.all=false / to.users=[] when the "to" object lacks them */
+    const char *to_users;       /* with fill_to, a JSON array that replaces to.users; NULL keeps the client's */
+    const char *append;         /* formatted members added last, e.g. "\"id\":7" */
+} chat_frame_rewrite_t;
+
+/* True when src is strict JSON with unescaped keys at the top level and in "to". */
+bool chat_frame_can_rewrite(const char *src, size_t len);
+
+/*
+ * Copies the members of src verbatim into a new NUL-terminated buffer, applying rewrite, without
+ * re-serializing values. src must pass chat_frame_can_rewrite(). The caller frees the result.
+ */
+char *chat_frame_rewrite(const char *src, size_t len, const chat_frame_rewrite_t *rewrite, size_t *len_out);
+
+bool chat_field_string_in_range(const chat_field_t *field, size_t max_len, bool allow_empty);
+bool chat_field_equals(const chat_field_t *field, const char *literal);
+void chat_field_copy(char *dst, size_t dst_size, const chat_field_t *field);
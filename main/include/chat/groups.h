@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#include "app_context.h"
+#include "chat/frame.h"
+
+/* Loads the registry saved in the storage partition. Call before chat_history_restore_from_log(). */
+void chat_groups_load(app_context_t *ctx, const char *base_path);
+
+/*
+ * Registers id with the sender and to.users of frame as members. Registering the same members
+ * again succeeds. ESP_ERR_INVALID_STATE when the id is taken by another member set,
+ * ESP_ERR_INVALID_SIZE when the member list is full. A full registry evicts its least recently
+ * used group. With persist the storage task rewrites the registry file.
+ */
+esp_err_t chat_groups_register(app_context_t *ctx, const chat_field_t *id, const chat_frame_t *frame, bool persist);
+
+/* What chat_groups_register() would return, without changing the registry. */
+esp_err_t chat_groups_check(app_context_t *ctx, const chat_field_t *id, const chat_frame_t *frame);
+void chat_groups_save(app_context_t *ctx);
+
+chat_group_t *chat_groups_find(chat_group_table_t *groups, const char *id, size_t len);
+/* chat_groups_find() that also marks the group used, so eviction takes it last. HTTPD task only. */
+chat_group_t *chat_groups_use(chat_group_table_t *groups, const char *id, size_t len);
+bool chat_group_has_member(const chat_group_t *group, const char *user_id, size_t len);
+
+/*
+ * Points frame->users at the members of the group in to.group, so the recipient mask of a stored
+ * group message covers the group. Returns false when the frame names an unknown group.
+ */
+bool chat_groups_expand_frame(chat_group_table_t *groups, chat_frame_t *frame);
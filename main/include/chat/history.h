@@ -7,12 +7,54 @@
 #include "cJSON.h"
 
 #include "app_context.h"
+#include "chat/frame.h"
+#include "chat/payload.h"
 
-bool chat_history_parse_since_id(const cJSON *root, uint64_t *since_id_out);
+typedef struct {
+    const char *user_id;
+    uint64_t since_id;
+    int replay_limit;
+    bool batched;
+} history_replay_t;
+
+typedef struct {
+    const char *user_id;
+    const char *request_id;
+    const char *conversation;
+    uint64_t before_id;
+    int limit;
+} history_query_t;
+
+typedef struct {
+    const char *user_id;
+    const char *request_id;
+    const char *query;
+    int limit;
+} history_search_t;
+
+bool chat_history_parse_since_id(const chat_frame_t *frame, uint64_t *since_id_out);
+/*
+ * Parses join.history_ranges, e.g. "1-120,150,160-300": ascending, disjoint, at most
+ * HISTORY_PEER_RANGES spans. An absent field parses as zero ranges.
+ */
+bool chat_history_parse_ranges(const chat_field_t *field, chat_id_range_t *ranges, int *count_out);
 void chat_history_fill_bounds_locked(app_context_t *ctx, history_bounds_t *bounds);
 uint64_t chat_history_current_restore_before_id(app_context_t *ctx);
-char *chat_history_build_info_payload(app_context_t *ctx);
+/*
+ * True when message id was already relayed for request_id. Remembers the last
+ * HISTORY_SEEN_REQUESTS requests and HISTORY_SEEN_IDS ids below the boundary for each; anything
+ * outside that counts as unseen. Called only from the HTTPD task.
+ */
+bool chat_history_response_seen(app_context_t *ctx, const char *request_id, uint64_t id);
+/* Records id as relayed for request_id; call it only once the relay was sent. */
+void chat_history_response_mark_seen(app_context_t *ctx, const char *request_id, uint64_t id, uint64_t restore_before_id);
+chat_payload_t *chat_history_info_payload(app_context_t *ctx);
 void chat_history_send_info_to_client(app_context_t *ctx, int fd);
 bool chat_history_broadcast_info(app_context_t *ctx);
-void chat_history_send_to_client(app_context_t *ctx, int fd, uint64_t since_id);
-esp_err_t chat_history_finalize_and_store_message(app_context_t *ctx, cJSON *root, char **payload_out);
+void chat_history_send_to_client(app_context_t *ctx, int fd, const history_replay_t *replay);
+void chat_history_send_page(app_context_t *ctx, int fd, const history_query_t *query);
+void chat_history_send_search(app_context_t *ctx, int fd, const history_search_t *search);
+void chat_history_init(app_context_t *ctx);
+void chat_history_restore_from_log(app_context_t *ctx);
+esp_err_t chat_history_finalize_and_store_message(app_context_t *ctx, const chat_frame_t *frame, const char *src,
+                                                  size_t len, chat_payload_t **payload_out);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "chat/payload.h"
+
+/*
+ * One preallocated buffer used as a circular log of chat_payload_t records. Records are
+ * written at tail and reclaimed from head once nobody holds a reference any more; a record
+ * that does not fit before the end of the buffer wraps to offset 0 and the gap is skipped.
+ */
+typedef struct {
+    uint8_t *base;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+    size_t wrap;
+    size_t used;
+} chat_history_arena_t;
+
+esp_err_t chat_history_arena_init(chat_history_arena_t *arena, size_t capacity);
+size_t chat_history_arena_record_size(size_t len);
+chat_payload_t *chat_history_arena_alloc(chat_history_arena_t *arena, const char *data, size_t len);
+chat_payload_t *chat_history_arena_oldest(const chat_history_arena_t *arena);
+void chat_history_arena_reclaim(chat_history_arena_t *arena);
+size_t chat_history_arena_gap(const chat_history_arena_t *arena);
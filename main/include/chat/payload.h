@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHAT_PAYLOAD_FLAG_ARENA    0x01
+
+/*
+ * Immutable, reference-counted JSON payload. The history ring, replay and broadcast
+ * all share one buffer per message; whoever drops the last reference frees it.
+ * Arena payloads are never freed here: the history arena reclaims them once refs is 0.
+ */
+typedef struct {
+    atomic_uint refs;
+    uint32_t len;
+    uint8_t flags;
+    char data[];
+} chat_payload_t;
+
+/* The caller fills data[0..len) before sharing the payload; data[len] is already '\0'. */
+chat_payload_t *chat_payload_alloc(size_t len);
+chat_payload_t *chat_payload_create(const char *data, size_t len);
+chat_payload_t *chat_payload_ref(chat_payload_t *payload);
+void chat_payload_release(chat_payload_t *payload);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#include "app_context.h"
+#include "chat/payload.h"
+
+/*
+ * Storage writer task. Message log records are queued under message_mutex and written by one
+ * task, which commits each group of records with a single flush.
+ */
+esp_err_t chat_persist_start(app_context_t *ctx);
+
+/*
+ * Called with message_mutex held. With a waiter, the writer notifies that task once the record is
+ * committed and this returns true; the caller then calls chat_persist_wait() after dropping the lock.
+ */
+bool chat_persist_enqueue_locked(app_context_t *ctx, uint64_t id, chat_payload_t *payload, TaskHandle_t waiter);
+
+esp_err_t chat_persist_wait(uint64_t id);
+
+/* Has the writer rewrite the group registry file after its current group; saves inline without it. */
+void chat_persist_save_groups(app_context_t *ctx);
@@ -1,8 +1,16 @@
 #pragma once
 
+#include <stddef.h>
+
 #include "esp_err.h"
-#include "cJSON.h"
 
 #include "app_context.h"
+#include "chat/sessions.h"
 
-esp_err_t chat_protocol_handle_json(app_context_t *ctx, int fd, cJSON *root);
+/* Parses and handles one text frame from session; src must be NUL-terminated after len bytes. */
+esp_err_t chat_protocol_handle_frame(app_context_t *ctx, const chat_session_t *session, const char *src, size_t len);
+/*
+ * The same for a MessagePack frame. Its rate token is spent on the peeked type before anything is
+ * decoded, and the JSON it decodes to may be no larger than a text frame.
+ */
+esp_err_t chat_protocol_handle_msgpack(app_context_t *ctx, const chat_session_t *session, const uint8_t *src, size_t len);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "cJSON.h"
+
+#include "chat_types.h"
+#include "chat/frame.h"
+
+bool chat_message_visible_to_user(chat_group_table_t *groups, const cJSON *message, const char *user_id);
+bool chat_message_in_conversation(const cJSON *message, const char *user_id, const char *conversation);
+uint32_t chat_recipients_group_hash(const char *group_id);
+void chat_recipients_from_frame(chat_user_table_t *table, const chat_frame_t *message, chat_recipients_t *recipients);
+void chat_recipients_release(chat_user_table_t *table, const chat_recipients_t *recipients);
+int chat_user_table_find(const chat_user_table_t *table, const char *user_id);
+bool chat_recipients_visible(chat_group_table_t *groups, const chat_recipients_t *recipients, int handle,
+                             chat_payload_t *payload, const char *user_id);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+ * Inverted index over the text of messages in the history ring. Postings live in a FIFO
+ * ring in insertion order, so evicting the oldest messages pops postings from the front;
+ * each posting links to the previous posting of the same term, newest first.
+ */
+typedef struct {
+    uint64_t id;
+    uint32_t term;
+    uint32_t prev_seq;
+} chat_search_posting_t;
+
+typedef struct {
+    uint32_t term;
+    uint32_t newest_seq;
+    uint32_t count;
+} chat_search_term_t;
+
+typedef struct {
+    chat_search_posting_t *postings;
+    uint32_t posting_capacity;
+    uint32_t head_seq;
+    uint32_t tail_seq;
+    chat_search_term_t *terms;
+    uint32_t term_capacity;
+    uint32_t dropped_terms;
+} chat_search_index_t;
+
+/* Return false to stop the search early. */
+typedef bool (*chat_search_visit_fn)(uint64_t id, void *arg);
+
+esp_err_t chat_search_init(chat_search_index_t *index, size_t budget_bytes);
+void chat_search_add(chat_search_index_t *index, uint64_t id, const char *text, size_t len);
+void chat_search_evict_through(chat_search_index_t *index, uint64_t id);
+int chat_search_query(const chat_search_index_t *index, const char *query, chat_search_visit_fn visit, void *arg);
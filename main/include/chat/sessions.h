@@ -2,18 +2,85 @@
 
 #include <stdbool.h>
 
-#include "cJSON.h"
+#include "esp_err.h"
 
 #include "app_context.h"
+#include "chat/frame.h"
 
+/*
+ * The connection an inbound frame arrived on. slot is where fd was found when the frame came in;
+ * the heartbeat may free it meanwhile, so every use re-checks slot->fd under client_mutex.
+ */
+typedef struct {
+    int fd;
+    client_slot_t *slot;
+} chat_session_t;
+
+typedef struct {
+    bool allowed;           /* the frame's rate bucket had a token */
+    bool notify_limited;    /* first drop of a run; answer with rate_limited */
+    bool joined;
+    bool identity_ok;       /* joined, and frame "from" is the joined user */
+    char user_id[MAX_USER_ID_LEN + 1];  /* the joined user, when joined */
+} chat_admission_t;
+
+/*
+ * Finds fd's slot, trying hint (the slot the connection used last time) before scanning, or
+ * takes a free one, and marks it alive. False when every slot is taken.
+ */
+bool chat_sessions_ensure_slot(app_context_t *ctx, int fd, client_slot_t *hint, chat_session_t *session);
+/*
+ * All a frame needs from its slot in one client_mutex hold: spends a token of rate_class, reports
+ * whether the slot is joined as frame->from and if so takes frame->timestamp as a clock sample.
+ * CHAT_RATE_CLASSES spends nothing, for frames already charged by chat_sessions_take_token().
+ */
+void chat_sessions_admit_frame(app_context_t *ctx, const chat_session_t *session, const chat_frame_t *frame,
+                               chat_rate_class_t rate_class, chat_admission_t *admission);
+/*
+ * For a frame the scanner left to cJSON, once frame holds the cJSON fields: the two parsers can
+ * disagree on escaped or repeated keys, so identity_ok also needs frame->from to be the joined
+ * user, and the clock sample is taken from frame->timestamp.
+ */
+void chat_sessions_admit_parsed_frame(app_context_t *ctx, const chat_session_t *session, const chat_frame_t *frame,
+                                      chat_admission_t *admission);
+/* Spends a token of rate_class alone, before a frame is decoded; notify_limited as in chat_admission_t. */
+bool chat_sessions_take_token(app_context_t *ctx, const chat_session_t *session, chat_rate_class_t rate_class,
+                              bool *notify_limited);
 bool chat_sessions_update_identity(app_context_t *ctx, int fd, const char *user_id, const char *name);
-bool chat_sessions_ensure_slot(app_context_t *ctx, int fd);
-bool chat_sessions_is_joined(app_context_t *ctx, int fd);
-bool chat_sessions_identity_matches(app_context_t *ctx, int fd, const char *user_id);
-void chat_sessions_update_time_sample(app_context_t *ctx, int fd, const cJSON *root);
-bool chat_sessions_mark_alive(app_context_t *ctx, int fd);
+/*
+ * Fills fds (MAX_CLIENTS entries) with the joined sessions of the listed users; returns the count.
+ * Reads session_snapshot, so it does not wait on client_mutex.
+ */
+int chat_sessions_user_fds(app_context_t *ctx, const chat_field_t *users, int user_count, int *fds);
+/*
+ * The same for a registered group. The slot mask is cached in the group and only recomputed after
+ * the joined set changes, so a group send usually costs one pass over the mask.
+ */
+int chat_sessions_group_fds(app_context_t *ctx, chat_group_t *group, int *fds);
+/* Message id ranges the client on fd holds, from join.history_ranges; known is false when it sent none. */
+void chat_sessions_set_history_ranges(app_context_t *ctx, int fd, const chat_id_range_t *ranges, int count, bool known);
+/*
+ * Fills fds with the peers a historyRequest from fd should reach: a greedy cover of the ids below
+ * before_id that fd lacks, plus every peer that advertised no ranges. Other sessions of the same
+ * user are skipped. Returns -1 when the cover cannot be computed and the caller should broadcast.
+ */
+int chat_sessions_history_peer_fds(app_context_t *ctx, int fd, uint64_t before_id, int *fds);
+/* CHAT_WIRE_* flags for frames sent to fd, as the client asked for in its join message. */
+void chat_sessions_set_wire(app_context_t *ctx, int fd, uint8_t wire);
+uint8_t chat_sessions_wire(app_context_t *ctx, int fd);
+/*
+ * Fills fds and wires (MAX_CLIENTS entries each) with every active session, or only those in
+ * only_fds when given, from one consistent session_snapshot. Returns the count.
+ */
+int chat_sessions_active_fds(app_context_t *ctx, const int *only_fds, int only_count, int *fds, uint8_t *wires);
+void chat_sessions_update_time_sample(app_context_t *ctx, int fd, const chat_field_t *timestamp);
 bool chat_sessions_remove_by_fd(app_context_t *ctx, int fd);
-char *chat_sessions_build_online_users_payload(app_context_t *ctx);
-void chat_sessions_broadcast_online_users(app_context_t *ctx);
-void chat_sessions_send_online_users_to_client(app_context_t *ctx, int fd);
+chat_payload_t *chat_sessions_online_users_payload(app_context_t *ctx);
+/* Sends the onlineUsers snapshot to fd unless known_version (may be absent) is the current presence version. */
+void chat_sessions_send_online_users_to_client(app_context_t *ctx, int fd, const chat_field_t *known_version);
 void chat_sessions_start_heartbeat(app_context_t *ctx);
+/*
+ * Starts the task that turns changes of the joined set into versioned presence deltas, one frame per
+ * PRESENCE_DEBOUNCE_MS window. Without it clients only learn of changes from onlineUsers snapshots.
+ */
+esp_err_t chat_sessions_start_presence(app_context_t *ctx);
@@ -8,17 +8,73 @@
 #define CHAT_WIFI_CHANNEL          CONFIG_CHAT_WIFI_CHANNEL
 #define CHAT_MAX_STA_CONN          CONFIG_CHAT_MAX_STA_CONN
 #define MAX_CLIENTS                CONFIG_CHAT_MAX_WS_CLIENTS
+#define MAX_GROUPS                 CONFIG_CHAT_MAX_GROUPS
 #define MAX_MESSAGES               CONFIG_CHAT_MESSAGE_HISTORY_SIZE
+#define MESSAGE_HISTORY_BYTES      CONFIG_CHAT_MESSAGE_HISTORY_BYTES
+#define SEARCH_INDEX_BYTES         CONFIG_CHAT_SEARCH_INDEX_BYTES
 #define HEARTBEAT_INTERVAL_S       CONFIG_CHAT_HEARTBEAT_INTERVAL_S
+#define PRESENCE_DEBOUNCE_MS       CONFIG_CHAT_PRESENCE_DEBOUNCE_MS
 #define MAX_TEXT_BYTES             CONFIG_CHAT_MAX_MESSAGE_TEXT_LEN
 #define MAX_WS_PAYLOAD_BYTES       CONFIG_CHAT_MAX_WS_PAYLOAD_BYTES
+#define MESSAGE_ID_LEASE_SIZE      CONFIG_CHAT_MESSAGE_ID_LEASE_SIZE
+#define MESSAGE_LOG_SEGMENT_BYTES  CONFIG_CHAT_MESSAGE_LOG_SEGMENT_BYTES
+#define MESSAGE_LOG_MAX_SEGMENTS   CONFIG_CHAT_MESSAGE_LOG_MAX_SEGMENTS
+#define MESSAGE_LOG_INDEX_STRIDE   CONFIG_CHAT_MESSAGE_LOG_INDEX_STRIDE
+#define MESSAGE_LOG_REPLAY_MAX     CONFIG_CHAT_MESSAGE_LOG_REPLAY_MAX
+#define MESSAGE_LOG_COMMIT_MS      CONFIG_CHAT_MESSAGE_LOG_COMMIT_MS
+
+#ifdef CONFIG_CHAT_HISTORY_COMPRESSION
+#define HISTORY_COMPRESSION        1
+#else
+#define HISTORY_COMPRESSION        0
+#endif
+
+#ifdef CONFIG_CHAT_MESSAGE_LOG_ACK_AFTER_COMMIT
+#define MESSAGE_LOG_ACK_AFTER_COMMIT 1
+#else
+#define MESSAGE_LOG_ACK_AFTER_COMMIT 0
+#endif
+
+#ifdef CONFIG_CHAT_WS_MSGPACK
+#define WS_MSGPACK                 1
+#else
+#define WS_MSGPACK                 0
+#endif
+
+#ifdef CONFIG_CHAT_WS_DEFLATE
+#define WS_DEFLATE                 1
+#define WS_DEFLATE_WINDOW_BITS     CONFIG_CHAT_WS_DEFLATE_WINDOW_BITS
+#else
+#define WS_DEFLATE                 0
+#define WS_DEFLATE_WINDOW_BITS     11
+#endif
+
+#ifdef CONFIG_CHAT_RATE_LIMIT
+#define RATE_LIMIT                 1
+#define RATE_CHAT_PER_S            CONFIG_CHAT_RATE_CHAT_PER_S
+#define RATE_CHAT_BURST            CONFIG_CHAT_RATE_CHAT_BURST
+#define RATE_HISTORY_PER_S         CONFIG_CHAT_RATE_HISTORY_PER_S
+#define RATE_HISTORY_BURST         CONFIG_CHAT_RATE_HISTORY_BURST
+#define RATE_CONTROL_PER_S         CONFIG_CHAT_RATE_CONTROL_PER_S
+#define RATE_CONTROL_BURST         CONFIG_CHAT_RATE_CONTROL_BURST
+#else
+#define RATE_LIMIT                 0
+#define RATE_CHAT_PER_S            1
+#define RATE_CHAT_BURST            1
+#define RATE_HISTORY_PER_S         1
+#define RATE_HISTORY_BURST         1
+#define RATE_CONTROL_PER_S         1
+#define RATE_CONTROL_BURST         1
+#endif
 
 #define TIME_SYNC_TOLERANCE_S      120
+#define TIME_SYNC_APPLY_MIN_CLIENTS 2
 #define MAX_USER_ID_LEN            63
 #define MAX_NAME_LEN               31
 #define MAX_REQUEST_ID_LEN         63
 #define MAX_GROUP_ID_LEN           63
 #define MAX_GROUP_NAME_LEN         63
+#define GROUP_MAX_MEMBERS          (MAX_CLIENTS + 1)
 #define MAX_WIFI_SSID_LEN          32
 #define MIN_WIFI_PASS_LEN          8
 #define MAX_WIFI_PASS_LEN          63
@@ -32,3 +88,30 @@
 #define HTTP_STATIC_SOCKET_MARGIN  2
 #define VALID_EPOCH_START_S        946684800LL
 #define VALID_EPOCH_END_S          4102444800LL
+#define STORAGE_BASE_PATH          "/storage"
+#define MESSAGE_LOG_PATH_BYTES     16
+#define MAX_LOG_RECORD_BYTES       8192
+#define MESSAGE_LOG_REPLAY_CHUNK   16
+#define HISTORY_BATCH_MAX_BYTES    4096
+#define MESSAGE_USER_HANDLES       64
+#define HISTORY_QUERY_MAX_LIMIT    50
+#define HISTORY_QUERY_DEFAULT_LIMIT 20
+#define HISTORY_QUERY_SCAN_IDS     200
+#define HISTORY_PEER_RANGES        8
+#define HISTORY_RESPONSE_MAX_MESSAGES 32
+#define HISTORY_SEEN_REQUESTS      4
+#define HISTORY_SEEN_IDS           1024
+#define SESSION_SNAPSHOT_ATTEMPTS  4
+#define HISTORY_PAGE_MAX_BYTES     8192
+#define SEARCH_MAX_TERMS_PER_MESSAGE 64
+#define SEARCH_MAX_QUERY_TERMS     8
+#define SEARCH_MAX_RESULTS         20
+#define PERSIST_QUEUE_DEPTH        32
+#define PERSIST_BATCH_RECORDS      16
+#define PERSIST_BATCH_BYTES        4096
+#define PERSIST_ENQUEUE_WAIT_MS    200
+#define PERSIST_ACK_TIMEOUT_MS     2000
+#define WS_ERROR_PAYLOAD_BYTES     256
+#define WS_DEFLATE_MIN_BYTES       128
+#define WS_DEFLATE_FRAME_TAG       0xC1
+#define HISTORY_INFO_PAYLOAD_BYTES 512
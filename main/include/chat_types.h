@@ -1,9 +1,36 @@
 #pragma once
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "chat_config.h"
+#include "chat/payload.h"
+
+/* Wire format a client asked for in its join message. */
+#define CHAT_WIRE_MSGPACK          0x01
+#define CHAT_WIRE_DEFLATE          0x02
+
+/* Frame classes with separate per-client rate budgets. */
+typedef enum {
+    CHAT_RATE_CHAT,
+    CHAT_RATE_HISTORY,
+    CHAT_RATE_CONTROL,
+    CHAT_RATE_CLASSES,
+} chat_rate_class_t;
+
+typedef struct {
+    uint32_t milli_tokens;      /* 1000 per frame */
+    int64_t refill_ms;
+    bool limited;               /* a frame was dropped since the last one let through */
+} chat_token_bucket_t;
+
+/* Inclusive span of message ids, as advertised in join.history_ranges. */
+typedef struct {
+    uint64_t first;
+    uint64_t last;
+} chat_id_range_t;
 
 typedef struct {
     int fd;
@@ -11,14 +38,107 @@ typedef struct {
     bool joined;
     bool is_alive;
     bool time_offset_valid;
+    uint8_t wire;
     int64_t time_offset_s;
+    uint32_t user_hash;         /* hash_string() of user_id, 0 until joined */
     char user_id[MAX_USER_ID_LEN + 1];
     char name[MAX_NAME_LEN + 1];
+    bool history_ranges_known;  /* false for clients that joined without history_ranges */
+    uint8_t history_range_count;
+    chat_id_range_t history_ranges[HISTORY_PEER_RANGES];
+    chat_token_bucket_t buckets[CHAT_RATE_CLASSES];
 } client_slot_t;
 
+/* A joined user as clients were last told about it. */
+typedef struct {
+    char id[MAX_USER_ID_LEN + 1];
+    char name[MAX_NAME_LEN + 1];
+} chat_presence_user_t;
+
+/* What sends need from one slot, mirrored for readers that do not take client_mutex. */
+typedef struct {
+    bool active;
+    bool joined;
+    uint8_t wire;
+    int fd;
+    uint32_t user_hash;
+    char user_id[MAX_USER_ID_LEN + 1];
+} chat_session_entry_t;
+
+/*
+ * Seqlock-published copy of client_slots. The writer holds client_mutex and keeps seq odd while
+ * it rewrites entries; readers copy what they need and retry when seq was odd or has moved.
+ */
+typedef struct {
+    atomic_uint seq;
+    chat_session_entry_t entries[MAX_CLIENTS];
+} chat_session_snapshot_t;
+
+/*
+ * Who may see a stored message: everyone, or the users whose handle bits are set. from_handle and
+ * group_hash (0 when the message has no groupId) let history queries match a conversation without parsing.
+ */
+typedef struct {
+    bool all;
+    bool overflow;
+    int8_t from_handle;
+    uint32_t group_hash;
+    uint64_t mask;
+} chat_recipients_t;
+
+typedef struct {
+    char user_id[MAX_USER_ID_LEN + 1];
+    uint32_t hash;
+    uint16_t refs;
+} chat_user_handle_t;
+
+typedef struct {
+    chat_user_handle_t handles[MESSAGE_USER_HANDLES];
+} chat_user_table_t;
+
+/*
+ * A registered group. An entry is filled in before it is published and its members never change.
+ * Eviction frees it, but only registrations evict and they run on the HTTPD task like every reader
+ * that keeps an entry pointer, so those readers need no lock. last_used orders eviction. slot_mask
+ * caches the client slots of the joined members as of session_epoch and is guarded by client_mutex.
+ */
+typedef struct {
+    char id[MAX_GROUP_ID_LEN + 1];
+    uint32_t hash;
+    uint8_t member_count;
+    atomic_uint last_used;
+    uint32_t member_hashes[GROUP_MAX_MEMBERS];
+    const char *members[GROUP_MAX_MEMBERS];
+    uint32_t slot_mask;
+    uint32_t session_epoch;
+} chat_group_t;
+
+/*
+ * Registrations and evictions are serialized by group_mutex. Entries are published by storing
+ * count until the table is full; after that an eviction replaces the least recently used entry.
+ */
+typedef struct {
+    chat_group_t *entries[MAX_GROUPS];
+    atomic_int count;
+    atomic_uint use_clock;      /* bumped by chat_groups_use() without group_mutex */
+    atomic_bool save_queued;    /* a registry save is waiting in the storage queue */
+    const char *base_path;      /* NULL while the registry lives only in memory */
+} chat_group_table_t;
+
+/*
+ * Message ids already relayed for one historyRequest, as a bitmap over the HISTORY_SEEN_IDS ids
+ * just below the restore boundary at the time the first response was relayed.
+ */
+typedef struct {
+    char request_id[MAX_REQUEST_ID_LEN + 1];   /* empty when unused */
+    uint64_t base_id;
+    uint8_t ids[HISTORY_SEEN_IDS / 8];
+} chat_history_seen_t;
+
 typedef struct {
-    char *payload;
+    chat_payload_t *payload;
     uint64_t id;
+    chat_recipients_t recipients;
 } message_t;
 
 typedef struct {
@@ -37,4 +157,11 @@ typedef struct {
     int count;
     int capacity;
     bool has_more_before;
+    size_t bytes_capacity;
+    size_t bytes_used;
+    size_t bytes_live;
+    size_t bytes_gap;
+    uint32_t heap_fallbacks;
+    uint32_t log_commits;
+    uint32_t log_dropped;
 } history_bounds_t;
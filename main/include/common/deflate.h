@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEFLATE_MIN_WINDOW_BITS 8
+#define DEFLATE_MAX_WINDOW_BITS 15
+
+/*
+ * Raw DEFLATE (RFC 1951) encoder for small, independent messages: greedy LZ77 over hash chains
+ * limited to a 2^window_bits byte window, emitted as one fixed-Huffman block. Each call starts
+ * from an empty window and allocates its match tables for the duration of the call only.
+ *
+ * Returns the compressed size, or 0 when the result would not be smaller than src, does not fit
+ * in cap, or memory is short; the caller then sends src as is.
+ */
+size_t deflate_raw(const uint8_t *src, size_t len, uint8_t *dst, size_t cap, int window_bits);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define JSON_SCAN_MAX_DEPTH 16
+
+/*
+ * Allocation-free JSON tokenizer. Tokens point into the caller's buffer, which must stay alive
+ * and be NUL-terminated somewhere after the document so numbers can be read with strtod().
+ */
+typedef enum {
+    JSON_SCAN_NONE = 0,
+    JSON_SCAN_STRING,
+    JSON_SCAN_NUMBER,
+    JSON_SCAN_TRUE,
+    JSON_SCAN_FALSE,
+    JSON_SCAN_NULL,
+    JSON_SCAN_OBJECT,
+    JSON_SCAN_ARRAY,
+} json_scan_type_t;
+
+typedef struct {
+    json_scan_type_t type;
+    const char *start;  /* strings: the first byte after the opening quote */
+    size_t len;         /* strings: raw bytes between the quotes; containers: including brackets */
+    bool escaped;       /* strings: contains backslash escapes, so len is not the decoded length */
+} json_token_t;
+
+/* Return false to stop the walk; the walk then returns false too. */
+typedef bool (*json_scan_member_fn)(const json_token_t *key, const json_token_t *value, void *arg);
+typedef bool (*json_scan_item_fn)(const json_token_t *item, void *arg);
+
+/*
+ * Validates src[0..len) as a single JSON object, optionally surrounded by whitespace, and visits
+ * its members in order. Anything the strict grammar rejects, or nesting deeper than
+ * JSON_SCAN_MAX_DEPTH, fails the scan.
+ */
+bool json_scan_object(const char *src, size_t len, json_scan_member_fn visit, void *arg);
+
+/* Visits the elements of an array token returned by an earlier scan. */
+bool json_scan_array(const json_token_t *array, json_scan_item_fn visit, void *arg);
+
+/* Byte end of a token in the source, past the closing quote for strings. */
+const char *json_token_end(const json_token_t *token);
+
+bool json_token_equals(const json_token_t *token, const char *literal);
+bool json_token_equals_nocase(const json_token_t *token, const char *literal);
+double json_token_number(const json_token_t *token);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Appends JSON text for fixed-shape server messages straight into a caller buffer. Callers write
+ * the constant parts with JSON_WRITER_LITERAL() and only values go through the formatters. With a
+ * NULL buffer the writer only measures, so a message can be sized exactly before it is written.
+ */
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t len;         /* bytes the message needs so far, even past cap */
+    bool overflow;
+} json_writer_t;
+
+#define JSON_WRITER_LITERAL(writer, literal) json_writer_raw((writer), (literal), sizeof(literal) - 1)
+
+void json_writer_init(json_writer_t *writer, char *buf, size_t cap);
+void json_writer_raw(json_writer_t *writer, const char *data, size_t len);
+/* Quoted, escaped as cJSON_PrintUnformatted() does; NULL writes null. */
+void json_writer_string(json_writer_t *writer, const char *str);
+void json_writer_string_n(json_writer_t *writer, const char *str, size_t len);
+void json_writer_uint(json_writer_t *writer, uint64_t value);
+void json_writer_int(json_writer_t *writer, int64_t value);
+void json_writer_bool(json_writer_t *writer, bool value);
+/* NUL-terminates the buffer. False when it was too small for the message. */
+bool json_writer_finish(json_writer_t *writer);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common/json_writer.h"
+
+/*
+ * MessagePack form of the chat JSON messages. Integers without a fraction or exponent become
+ * MessagePack ints, other numbers float64, strings are unescaped to UTF-8. Binary and extension
+ * types have no JSON counterpart and are rejected.
+ */
+
+/*
+ * Encodes the JSON object src[0..len) into out and returns the encoded size, or 0 when src is not
+ * a valid object. With out NULL, or cap too small, nothing is written and only the size is returned.
+ */
+size_t msgpack_from_json(const char *src, size_t len, uint8_t *out, size_t cap);
+
+/* Decodes a MessagePack map into JSON text; false for anything else or trailing bytes. */
+bool msgpack_to_json(const uint8_t *src, size_t len, json_writer_t *writer);
+
+/*
+ * Finds the string value of key among the top-level members of a MessagePack map without decoding
+ * the rest. Keys match case-insensitively and the first occurrence wins, as in chat_frame_parse().
+ * str points into src and is not NUL-terminated.
+ */
+bool msgpack_map_string(const uint8_t *src, size_t len, const char *key, const char **str, size_t *str_len);
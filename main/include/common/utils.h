@@ -11,5 +11,7 @@
 void copy_bounded(char *dst, size_t dst_size, const char *src);
 bool json_string_in_range(const cJSON *item, size_t max_len, bool allow_empty);
 bool json_array_contains_string(cJSON *array, const char *value);
+/* FNV-1a over len bytes; never 0, so 0 can stand for "no string". */
+uint32_t hash_string(const char *str, size_t len);
 int64_t device_uptime_s(void);
 int64_t current_timestamp_s(app_context_t *ctx);
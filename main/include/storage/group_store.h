@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+/*
+ * The group registry file in the storage partition. The store only moves bytes; chat/groups
+ * decides the format. Saves replace the whole file through a temporary copy, so a reboot during a
+ * write leaves either the old registry or the new one.
+ */
+esp_err_t chat_group_store_save(const char *base_path, const char *data, size_t len);
+
+/* Returns a NUL-terminated copy of the saved registry that the caller frees, or NULL when none. */
+char *chat_group_store_load(const char *base_path, size_t *len_out);
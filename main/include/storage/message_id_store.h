@@ -9,7 +9,9 @@
 typedef struct {
     uint64_t boot_start_id;
     uint64_t current_id;
+    uint64_t lease_id;
 } chat_message_id_state_t;
 
 esp_err_t chat_message_ids_load(chat_message_id_state_t *state);
-esp_err_t chat_message_ids_persist(uint64_t current_id, uint64_t boot_start_id);
+esp_err_t chat_message_ids_reserve(uint64_t lease_id, uint64_t boot_start_id);
+uint64_t chat_message_ids_next_lease(uint64_t id);
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+
+#include "chat_config.h"
+
+typedef struct {
+    uint64_t id;
+    uint32_t offset;
+} chat_message_log_index_entry_t;
+
+typedef struct {
+    uint32_t seq;
+    uint32_t size;
+    uint32_t record_count;
+    uint64_t first_id;
+    uint64_t last_id;
+    chat_message_log_index_entry_t *index;
+    int index_count;
+    int index_capacity;
+} chat_message_log_segment_t;
+
+typedef struct {
+    bool ready;
+    char base_path[MESSAGE_LOG_PATH_BYTES];
+    chat_message_log_segment_t segments[MESSAGE_LOG_MAX_SEGMENTS];
+    int segment_count;
+    FILE *active;
+    char *read_buf;
+    size_t read_buf_size;
+} chat_message_log_t;
+
+/* Return false to stop the walk early. The payload is NUL-terminated and only valid during the call. */
+typedef bool (*chat_message_log_visit_fn)(uint64_t id, const char *payload, size_t len, void *arg);
+
+esp_err_t chat_message_log_open(chat_message_log_t *log, const char *base_path);
+void chat_message_log_close(chat_message_log_t *log);
+/* Appends are buffered; chat_message_log_flush() commits every record appended since the last flush. */
+esp_err_t chat_message_log_append(chat_message_log_t *log, uint64_t id, const char *payload, size_t len);
+esp_err_t chat_message_log_flush(chat_message_log_t *log);
+bool chat_message_log_bounds(const chat_message_log_t *log, uint64_t *earliest_id, uint64_t *latest_id);
+esp_err_t chat_message_log_read_after(chat_message_log_t *log, uint64_t since_id, int max_records,
+                                      chat_message_log_visit_fn visit, void *arg);
@@ -0,0 +1,282 @@
+#include "chat/compress.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Stream: varint raw length, then tokens.
+ *   0x00-0x7f  literal run of (b + 1) bytes
+ *   0x80-0xef  match of (b - 0x80 + MIN_MATCH) bytes, followed by a varint distance
+ *   0xf0       lowercase 8-4-4-4-12 UUID packed into 16 bytes
+ * Distances count back through the dictionary followed by the output produced so far.
+ */
+#define LITERAL_MAX   128
+#define MIN_MATCH     3
+#define MATCH_MAX     (0xef - 0x80 + MIN_MATCH)
+#define TOKEN_UUID    0xf0
+#define UUID_CHARS    36
+#define UUID_BYTES    16
+#define HASH_BITS     10
+
+/* Most frequent fragments last, so they sit at the shortest distances. */
+static const char s_dictionary[] =
+    "\",\"groupName\":\"" "\",\"groupId\":\""
+    "{\"type\":\"newGroup\",\"from\":\""
+    "\",\"to\":{\"all\":false,\"users\":[\""
+    "\"]},\"name\":\""
+    "\",\"to\":{\"all\":true,\"users\":[]},\"name\":\""
+    "{\"type\":\"text\",\"from\":\""
+    "\",\"data\":\""
+    "\",\"id\":"
+    ",\"timestamp\":17";
+
+#define DICT_LEN (sizeof(s_dictionary) - 1)
+
+static uint16_t s_head[1 << HASH_BITS];
+
+static size_t put_varint(uint8_t *dst, size_t cap, size_t pos, size_t value)
+{
+    do {
+        if (pos >= cap) {
+            return 0;
+        }
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        dst[pos++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return pos;
+}
+
+static size_t get_varint(const uint8_t *src, size_t len, size_t pos, size_t *value)
+{
+    size_t result = 0;
+    for (int shift = 0; pos < len && shift < 28; shift += 7) {
+        uint8_t byte = src[pos++];
+        result |= (size_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return pos;
+        }
+    }
+    return 0;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static bool is_uuid(const char *p, size_t remaining)
+{
+    if (remaining < UUID_CHARS) {
+        return false;
+    }
+    for (int i = 0; i < UUID_CHARS; i++) {
+        bool dash = i == 8 || i == 13 || i == 18 || i == 23;
+        if (dash ? p[i] != '-' : hex_value(p[i]) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint8_t virtual_byte(const char *src, size_t pos)
+{
+    return pos < DICT_LEN ? (uint8_t)s_dictionary[pos] : (uint8_t)src[pos - DICT_LEN];
+}
+
+static uint32_t hash3(const char *src, size_t pos)
+{
+    uint32_t v = virtual_byte(src, pos) | (virtual_byte(src, pos + 1) << 8) | (virtual_byte(src, pos + 2) << 16);
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static size_t flush_literals(const char *src, size_t start, size_t end, uint8_t *dst, size_t cap, size_t out)
+{
+    while (start < end) {
+        size_t run = end - start > LITERAL_MAX ? LITERAL_MAX : end - start;
+        if (out + 1 + run > cap) {
+            return 0;
+        }
+        dst[out++] = (uint8_t)(run - 1);
+        memcpy(dst + out, src + start, run);
+        out += run;
+        start += run;
+    }
+    return out;
+}
+
+size_t chat_compress(const char *src, size_t len, uint8_t *dst, size_t cap)
+{
+    if (src == NULL || dst == NULL || DICT_LEN + len >= UINT16_MAX) {
+        return 0;
+    }
+
+    size_t out = put_varint(dst, cap, 0, len);
+    if (out == 0) {
+        return 0;
+    }
+
+    memset(s_head, 0, sizeof(s_head));
+    for (size_t pos = 0; pos + MIN_MATCH <= DICT_LEN; pos++) {
+        s_head[hash3(src, pos)] = (uint16_t)(pos + 1);
+    }
+
+    size_t literal_start = 0;
+    size_t i = 0;
+    while (i < len) {
+        if (is_uuid(src + i, len - i)) {
+            out = flush_literals(src, literal_start, i, dst, cap, out);
+            if (out == 0 || out + 1 + UUID_BYTES > cap) {
+                return 0;
+            }
+            dst[out++] = TOKEN_UUID;
+            const char *p = src + i;
+            for (int k = 0, nibble = 0; k < UUID_CHARS; k++) {
+                if (p[k] == '-') {
+                    continue;
+                }
+                if ((nibble & 1) == 0) {
+                    dst[out] = (uint8_t)(hex_value(p[k]) << 4);
+                } else {
+                    dst[out++] |= (uint8_t)hex_value(p[k]);
+                }
+                nibble++;
+            }
+            i += UUID_CHARS;
+            literal_start = i;
+            continue;
+        }
+
+        size_t vpos = DICT_LEN + i;
+        size_t match_len = 0;
+        size_t distance = 0;
+        if (i + MIN_MATCH <= len) {
+            uint32_t h = hash3(src, vpos);
+            size_t candidate = s_head[h];
+            s_head[h] = (uint16_t)(vpos + 1);
+            if (candidate != 0) {
+                candidate--;
+                size_t limit = len - i > MATCH_MAX ? MATCH_MAX : len - i;
+                while (match_len < limit && virtual_byte(src, candidate + match_len) == (uint8_t)src[i + match_len]) {
+                    match_len++;
+                }
+                distance = vpos - candidate;
+            }
+        }
+
+        if (match_len < MIN_MATCH) {
+            i++;
+            continue;
+        }
+
+        out = flush_literals(src, literal_start, i, dst, cap, out);
+        if (out == 0 || out >= cap) {
+            return 0;
+        }
+        dst[out++] = (uint8_t)(0x80 + match_len - MIN_MATCH);
+        out = put_varint(dst, cap, out, distance);
+        if (out == 0) {
+            return 0;
+        }
+
+        for (size_t k = 1; k < match_len && i + k + MIN_MATCH <= len; k++) {
+            s_head[hash3(src, vpos + k)] = (uint16_t)(vpos + k + 1);
+        }
+        i += match_len;
+        literal_start = i;
+    }
+
+    out = flush_literals(src, literal_start, len, dst, cap, out);
+    return out != 0 && out < len ? out : 0;
+}
+
+size_t chat_decompressed_size(const uint8_t *src, size_t len)
+{
+    size_t raw_len = 0;
+    return src != NULL && get_varint(src, len, 0, &raw_len) != 0 ? raw_len : 0;
+}
+
+size_t chat_decompress(const uint8_t *src, size_t len, char *dst, size_t cap)
+{
+    size_t raw_len = 0;
+    size_t in = src != NULL && dst != NULL ? get_varint(src, len, 0, &raw_len) : 0;
+    if (in == 0 || raw_len > cap) {
+        return 0;
+    }
+
+    size_t out = 0;
+    while (in < len) {
+        uint8_t token = src[in++];
+        if (token < 0x80) {
+            size_t run = (size_t)token + 1;
+            if (in + run > len || out + run > raw_len) {
+                return 0;
+            }
+            memcpy(dst + out, src + in, run);
+            in += run;
+            out += run;
+        } else if (token < TOKEN_UUID) {
+            size_t match_len = (size_t)token - 0x80 + MIN_MATCH;
+            size_t distance = 0;
+            in = get_varint(src, len, in, &distance);
+            if (in == 0 || distance == 0 || distance > DICT_LEN + out || out + match_len > raw_len) {
+                return 0;
+            }
+            size_t from = DICT_LEN + out - distance;
+            for (size_t k = 0; k < match_len; k++, from++) {
+                dst[out++] = from < DICT_LEN ? s_dictionary[from] : dst[from - DICT_LEN];
+            }
+        } else if (token == TOKEN_UUID) {
+            static const char hex[] = "0123456789abcdef";
+            if (in + UUID_BYTES > len || out + UUID_CHARS > raw_len) {
+                return 0;
+            }
+            for (int k = 0, nibble = 0; k < UUID_CHARS; k++) {
+                if (k == 8 || k == 13 || k == 18 || k == 23) {
+                    dst[out++] = '-';
+                    continue;
+                }
+                uint8_t byte = src[in + nibble / 2];
+                dst[out++] = hex[(nibble & 1) ? (byte & 0x0f) : (byte >> 4)];
+                nibble++;
+            }
+            in += UUID_BYTES;
+        } else {
+            return 0;
+        }
+    }
+
+    return out == raw_len ? out : 0;
+}
+
+chat_payload_t *chat_payload_open(chat_payload_t *payload)
+{
+    if (payload == NULL || (payload->flags & CHAT_PAYLOAD_FLAG_COMPRESSED) == 0) {
+        return chat_payload_ref(payload);
+    }
+
+    const uint8_t *src = (const uint8_t *)payload->data;
+    size_t raw_len = chat_decompressed_size(src, payload->len);
+    chat_payload_t *plain = raw_len > 0 ? malloc(sizeof(*plain) + raw_len + 1) : NULL;
+    if (plain == NULL) {
+        return NULL;
+    }
+    if (chat_decompress(src, payload->len, plain->data, raw_len) != raw_len) {
+        free(plain);
+        return NULL;
+    }
+
+    atomic_init(&plain->refs, 1);
+    plain->len = (uint32_t)raw_len;
+    plain->flags = 0;
+    plain->data[raw_len] = '\0';
+    return plain;
+}
@@ -0,0 +1,408 @@
+#include "chat/frame.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char *key;
+    size_t offset;
+} frame_key_t;
+
+static const frame_key_t s_frame_keys[] = {
+    { "type", offsetof(chat_frame_t, type) },
+    { "from", offsetof(chat_frame_t, from) },
+    { "name", offsetof(chat_frame_t, name) },
+    { "data", offsetof(chat_frame_t, data) },
+    { "groupId", offsetof(chat_frame_t, group_id) },
+    { "groupName", offsetof(chat_frame_t, group_name) },
+    { "requestId", offsetof(chat_frame_t, request_id) },
+    { "timestamp", offsetof(chat_frame_t, timestamp) },
+    { "since_id", offsetof(chat_frame_t, since_id) },
+    { "last_seen_id", offsetof(chat_frame_t, last_seen_id) },
+    { "replay_limit", offsetof(chat_frame_t, replay_limit) },
+    { "history_batch", offsetof(chat_frame_t, history_batch) },
+    { "restore_before_id", offsetof(chat_frame_t, restore_before_id) },
+    { "history_ranges", offsetof(chat_frame_t, history_ranges) },
+    { "presence_version", offsetof(chat_frame_t, presence_version) },
+    { "encoding", offsetof(chat_frame_t, encoding) },
+    { "compression", offsetof(chat_frame_t, compression) },
+    { "to", offsetof(chat_frame_t, to) },
+};
+
+static const frame_key_t s_to_keys[] = {
+    { "all", offsetof(chat_frame_t, to_all) },
+    { "users", offsetof(chat_frame_t, to_users) },
+    { "group", offsetof(chat_frame_t, to_group) },
+};
+
+static const char *const s_fast_types[] = {
+    "pong", "join", "getOnlineUser", "text", "newGroup", "historyRequest",
+};
+
+typedef struct {
+    chat_frame_t *frame;
+    const frame_key_t *keys;
+    size_t key_count;
+    bool fallback;
+} frame_scan_t;
+
+static void field_from_token(const json_token_t *token, chat_field_t *field)
+{
+    field->type = token->type;
+    field->str = token->start;
+    field->len = token->len;
+    field->number = json_token_number(token);
+}
+
+static bool visit_member(const json_token_t *key, const json_token_t *value, void *arg)
+{
+    frame_scan_t *scan = (frame_scan_t *)arg;
+
+    if (key->escaped) {
+        scan->fallback = true;
+        return true;
+    }
+    for (size_t i = 0; i < scan->key_count; i++) {
+        if (!json_token_equals_nocase(key, scan->keys[i].key)) {
+            continue;
+        }
+        chat_field_t *field = (chat_field_t *)((char *)scan->frame + scan->keys[i].offset);
+        if (field->type == JSON_SCAN_NONE) {
+            scan->fallback = scan->fallback || value->escaped;
+            field_from_token(value, field);
+        }
+        break;
+    }
+    return true;
+}
+
+static bool visit_user(const json_token_t *item, void *arg)
+{
+    frame_scan_t *scan = (frame_scan_t *)arg;
+    chat_frame_t *frame = scan->frame;
+
+    if (item->type != JSON_SCAN_STRING || frame->user_count == MAX_CLIENTS + 1) {
+        frame->users_valid = false;
+        return true;
+    }
+    scan->fallback = scan->fallback || item->escaped;
+    field_from_token(item, &frame->users[frame->user_count++]);
+    return true;
+}
+
+static bool fast_type(const chat_field_t *type)
+{
+    for (size_t i = 0; i < sizeof(s_fast_types) / sizeof(s_fast_types[0]); i++) {
+        if (chat_field_equals(type, s_fast_types[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool chat_frame_parse(const char *src, size_t len, chat_frame_t *frame)
+{
+    if (src == NULL || frame == NULL) {
+        return false;
+    }
+
+    memset(frame, 0, sizeof(*frame));
+    frame->users_valid = true;
+    frame_scan_t scan = {
+        .frame = frame,
+        .keys = s_frame_keys,
+        .key_count = sizeof(s_frame_keys) / sizeof(s_frame_keys[0]),
+    };
+    if (!json_scan_object(src, len, visit_member, &scan) || scan.fallback || !fast_type(&frame->type)) {
+        return false;
+    }
+
+    if (frame->to.type == JSON_SCAN_OBJECT) {
+        scan.keys = s_to_keys;
+        scan.key_count = sizeof(s_to_keys) / sizeof(s_to_keys[0]);
+        json_scan_object(frame->to.str, frame->to.len, visit_member, &scan);
+    }
+    if (frame->to_users.type == JSON_SCAN_ARRAY) {
+        json_token_t users = { .type = JSON_SCAN_ARRAY, .start = frame->to_users.str, .len = frame->to_users.len };
+        json_scan_array(&users, visit_user, &scan);
+    } else if (frame->to_users.type != JSON_SCAN_NONE) {
+        frame->users_valid = false;
+    }
+    return !scan.fallback;
+}
+
+void chat_field_from_json(const cJSON *item, chat_field_t *field)
+{
+    memset(field, 0, sizeof(*field));
+    if (item == NULL) {
+        return;
+    }
+
+    if (cJSON_IsString(item) && item->valuestring != NULL) {
+        field->type = JSON_SCAN_STRING;
+        field->str = item->valuestring;
+        field->len = strlen(item->valuestring);
+    } else if (cJSON_IsNumber(item)) {
+        field->type = JSON_SCAN_NUMBER;
+        field->number = item->valuedouble;
+    } else if (cJSON_IsTrue(item)) {
+        field->type = JSON_SCAN_TRUE;
+    } else if (cJSON_IsFalse(item)) {
+        field->type = JSON_SCAN_FALSE;
+    } else if (cJSON_IsObject(item)) {
+        field->type = JSON_SCAN_OBJECT;
+    } else if (cJSON_IsArray(item)) {
+        field->type = JSON_SCAN_ARRAY;
+    } else {
+        field->type = JSON_SCAN_NULL;
+    }
+}
+
+void chat_frame_from_json(const cJSON *root, chat_frame_t *frame)
+{
+    memset(frame, 0, sizeof(*frame));
+    frame->users_valid = true;
+
+    for (size_t i = 0; i < sizeof(s_frame_keys) / sizeof(s_frame_keys[0]); i++) {
+        chat_field_t *field = (chat_field_t *)((char *)frame + s_frame_keys[i].offset);
+        chat_field_from_json(cJSON_GetObjectItem(root, s_frame_keys[i].key), field);
+    }
+
+    cJSON *to = cJSON_GetObjectItem(root, "to");
+    if (!cJSON_IsObject(to)) {
+        return;
+    }
+    chat_field_from_json(cJSON_GetObjectItem(to, "all"), &frame->to_all);
+    chat_field_from_json(cJSON_GetObjectItem(to, "group"), &frame->to_group);
+
+    cJSON *users = cJSON_GetObjectItem(to, "users");
+    chat_field_from_json(users, &frame->to_users);
+    if (users != NULL && !cJSON_IsArray(users)) {
+        frame->users_valid = false;
+        return;
+    }
+
+    cJSON *user = NULL;
+    cJSON_ArrayForEach(user, users) {
+        if (!cJSON_IsString(user) || frame->user_count == MAX_CLIENTS + 1) {
+            frame->users_valid = false;
+            return;
+        }
+        chat_field_from_json(user, &frame->users[frame->user_count++]);
+    }
+}
+
+static bool plain_key(const json_token_t *key, const json_token_t *value, void *arg)
+{
+    return !key->escaped;
+}
+
+typedef struct {
+    json_token_t to;
+    bool seen_to;
+} plain_scan_t;
+
+static bool plain_top_key(const json_token_t *key, const json_token_t *value, void *arg)
+{
+    plain_scan_t *scan = (plain_scan_t *)arg;
+
+    if (key->escaped) {
+        return false;
+    }
+    if (!scan->seen_to && json_token_equals_nocase(key, "to")) {
+        scan->seen_to = true;
+        scan->to = *value;
+    }
+    return true;
+}
+
+bool chat_frame_can_rewrite(const char *src, size_t len)
+{
+    plain_scan_t scan = { 0 };
+    if (!json_scan_object(src, len, plain_top_key, &scan)) {
+        return false;
+    }
+    return scan.to.type != JSON_SCAN_OBJECT || json_scan_object(scan.to.start, scan.to.len, plain_key, NULL);
+}
+
+typedef struct {
+    const chat_frame_rewrite_t *rewrite;
+    char *out;
+    size_t len;
+    bool seen_to;
+} rewrite_state_t;
+
+static void emit(rewrite_state_t *state, const char *src, size_t len)
+{
+    memcpy(state->out + state->len, src, len);
+    state->len += len;
+}
+
+static bool note_to_member(const json_token_t *key, const json_token_t *value, void *arg)
+{
+    unsigned *present = (unsigned *)arg;
+    if (json_token_equals_nocase(key, "all")) {
+        *present |= 1u;
+    } else if (json_token_equals_nocase(key, "users")) {
+        *present |= 2u;
+    }
+    return true;
+}
+
+typedef struct {
+    rewrite_state_t *state;
+    bool members;
+    bool all;
+} to_copy_t;
+
+static bool copy_to_member(const json_token_t *key, const json_token_t *value, void *arg)
+{
+    to_copy_t *copy = (to_copy_t *)arg;
+    if (json_token_equals_nocase(key, "users")) {
+        return true;
+    }
+
+    copy->all = copy->all || json_token_equals_nocase(key, "all");
+    if (copy->members) {
+        emit(copy->state, ",", 1);
+    }
+    const char *member = key->start - 1;
+    emit(copy->state, member, (size_t)(json_token_end(value) - member));
+    copy->members = true;
+    return true;
+}
+
+/* Emits the "to" member with its users replaced by rewrite->to_users. */
+static void emit_to_users(rewrite_state_t *state, const char *member, const json_token_t *value)
+{
+    to_copy_t copy = { .state = state };
+    emit(state, member, (size_t)(value->start + 1 - member));
+    json_scan_object(value->start, value->len, copy_to_member, &copy);
+    if (!copy.all) {
+        emit(state, copy.members ? ",\"all\":false" : "\"all\":false", copy.members ? 12 : 11);
+        copy.members = true;
+    }
+    emit(state, copy.members ? ",\"users\":" : "\"users\":", copy.members ? 9 : 8);
+    emit(state, state->rewrite->to_users, strlen(state->rewrite->to_users));
+    emit(state, "}", 1);
+}
+
+/* Emits the "to" member with the defaults validate_to_object() would have added to the tree. */
+static void emit_to(rewrite_state_t *state, const char *member, const json_token_t *value)
+{
+    if (state->rewrite->to_users != NULL) {
+        emit_to_users(state, member, value);
+        return;
+    }
+
+    unsigned present = 0;
+    json_scan_object(value->start, value->len, note_to_member, &present);
+    if (present == 3u) {
+        emit(state, member, (size_t)(json_token_end(value) - member));
+        return;
+    }
+
+    const char *close = value->start + value->len - 1;
+    while (close > value->start + 1 && (close[-1] == ' ' || close[-1] == '\t' || close[-1] == '\n' || close[-1] == '\r')) {
+        close--;
+    }
+    emit(state, member, (size_t)(close - member));
+
+    bool members = close > value->start + 1;
+    if ((present & 1u) == 0) {
+        emit(state, members ? ",\"all\":false" : "\"all\":false", members ? 12 : 11);
+        members = true;
+    }
+    if ((present & 2u) == 0) {
+        emit(state, members ? ",\"users\":[]" : "\"users\":[]", members ? 11 : 10);
+    }
+    emit(state, "}", 1);
+}
+
+static bool rewrite_member(const json_token_t *key, const json_token_t *value, void *arg)
+{
+    rewrite_state_t *state = (rewrite_state_t *)arg;
+    const chat_frame_rewrite_t *rewrite = state->rewrite;
+
+    for (const char *const *strip = rewrite->strip; strip != NULL && *strip != NULL; strip++) {
+        if (json_token_equals_nocase(key, *strip)) {
+            return true;
+        }
+    }
+
+    if (state->len > 1) {
+        emit(state, ",", 1);
+    }
+    const char *member = key->start - 1;
+    if (!state->seen_to && json_token_equals_nocase(key, "to")) {
+        state->seen_to = true;
+        if (rewrite->fill_to && value->type == JSON_SCAN_OBJECT) {
+            emit_to(state, member, value);
+            return true;
+        }
+    }
+    emit(state, member, (size_t)(json_token_end(value) - member));
+    return true;
+}
+
+char *chat_frame_rewrite(const char *src, size_t len, const chat_frame_rewrite_t *rewrite, size_t *len_out)
+{
+    if (src == NULL || rewrite == NULL) {
+        return NULL;
+    }
+
+    size_t append_len = rewrite->append != NULL ? strlen(rewrite->append) : 0;
+    size_t users_len = rewrite->to_users != NULL ? strlen(rewrite->to_users) : 0;
+    /* Members are only dropped or copied, so the input bounds the output apart from the additions. */
+    char *out = malloc(len + append_len + users_len + sizeof(",\"all\":false,\"users\":[]") + 2);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    rewrite_state_t state = { .rewrite = rewrite, .out = out };
+    emit(&state, "{", 1);
+    if (!json_scan_object(src, len, rewrite_member, &state)) {
+        free(out);
+        return NULL;
+    }
+    if (append_len > 0) {
+        if (state.len > 1) {
+            emit(&state, ",", 1);
+        }
+        emit(&state, rewrite->append, append_len);
+    }
+    emit(&state, "}", 1);
+    out[state.len] = '\0';
+
+    if (len_out != NULL) {
+        *len_out = state.len;
+    }
+    return out;
+}
+
+bool chat_field_string_in_range(const chat_field_t *field, size_t max_len, bool allow_empty)
+{
+    return field != NULL && field->type == JSON_SCAN_STRING && (allow_empty || field->len > 0) && field->len <= max_len;
+}
+
+bool chat_field_equals(const chat_field_t *field, const char *literal)
+{
+    size_t len = strlen(literal);
+    return field != NULL && field->type == JSON_SCAN_STRING && field->len == len && memcmp(field->str, literal, len) == 0;
+}
+
+void chat_field_copy(char *dst, size_t dst_size, const chat_field_t *field)
+{
+    if (dst == NULL || dst_size == 0) {
+        return;
+    }
+
+    size_t len = field != NULL && field->type == JSON_SCAN_STRING ? field->len : 0;
+    if (len >= dst_size) {
+        len = dst_size - 1;
+    }
+    if (len > 0) {
+        memcpy(dst, field->str, len);
+    }
+    dst[len] = '\0';
+}
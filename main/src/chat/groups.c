@@ -0,0 +1,353 @@
+#include "chat/groups.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "common/json_writer.h"
+#include "chat/persist.h"
+#include "common/utils.h"
+#include "storage/group_store.h"
+
+static const char *TAG = "CHAT_GROUPS";
+
+typedef struct {
+    const char *str[GROUP_MAX_MEMBERS];
+    size_t len[GROUP_MAX_MEMBERS];
+    int count;
+} member_list_t;
+
+static bool add_member(member_list_t *list, const char *str, size_t len)
+{
+    if (str == NULL || len == 0 || len > MAX_USER_ID_LEN) {
+        return false;
+    }
+    for (int i = 0; i < list->count; i++) {
+        if (list->len[i] == len && memcmp(list->str[i], str, len) == 0) {
+            return true;
+        }
+    }
+    if (list->count == GROUP_MAX_MEMBERS) {
+        return false;
+    }
+
+    list->str[list->count] = str;
+    list->len[list->count] = len;
+    list->count++;
+    return true;
+}
+
+chat_group_t *chat_groups_find(chat_group_table_t *groups, const char *id, size_t len)
+{
+    if (groups == NULL || id == NULL || len == 0 || len > MAX_GROUP_ID_LEN) {
+        return NULL;
+    }
+
+    uint32_t hash = hash_string(id, len);
+    int count = atomic_load_explicit(&groups->count, memory_order_acquire);
+    for (int i = 0; i < count; i++) {
+        chat_group_t *group = groups->entries[i];
+        if (group->hash == hash && strncmp(group->id, id, len) == 0 && group->id[len] == '\0') {
+            return group;
+        }
+    }
+    return NULL;
+}
+
+/* Atomic, as senders mark use without group_mutex while a registry save reads the order under it. */
+static void mark_used(chat_group_table_t *groups, chat_group_t *group)
+{
+    unsigned tick = atomic_fetch_add_explicit(&groups->use_clock, 1, memory_order_relaxed) + 1;
+    atomic_store_explicit(&group->last_used, tick, memory_order_relaxed);
+}
+
+static uint32_t last_used(const chat_group_t *group)
+{
+    return atomic_load_explicit(&group->last_used, memory_order_relaxed);
+}
+
+chat_group_t *chat_groups_use(chat_group_table_t *groups, const char *id, size_t len)
+{
+    chat_group_t *group = chat_groups_find(groups, id, len);
+    if (group != NULL) {
+        mark_used(groups, group);
+    }
+    return group;
+}
+
+bool chat_group_has_member(const chat_group_t *group, const char *user_id, size_t len)
+{
+    if (group == NULL || user_id == NULL || len == 0) {
+        return false;
+    }
+
+    uint32_t hash = hash_string(user_id, len);
+    for (int i = 0; i < group->member_count; i++) {
+        if (group->member_hashes[i] == hash && strncmp(group->members[i], user_id, len) == 0 &&
+            group->members[i][len] == '\0') {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool same_members(const chat_group_t *group, const member_list_t *list)
+{
+    if (group->member_count != list->count) {
+        return false;
+    }
+    for (int i = 0; i < list->count; i++) {
+        if (!chat_group_has_member(group, list->str[i], list->len[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* One allocation holds the entry and its member strings. */
+static chat_group_t *create_group(const char *id, size_t id_len, const member_list_t *list)
+{
+    size_t string_bytes = 0;
+    for (int i = 0; i < list->count; i++) {
+        string_bytes += list->len[i] + 1;
+    }
+
+    chat_group_t *group = calloc(1, sizeof(*group) + string_bytes);
+    if (group == NULL) {
+        return NULL;
+    }
+
+    memcpy(group->id, id, id_len);
+    group->id[id_len] = '\0';
+    group->hash = hash_string(id, id_len);
+
+    char *strings = (char *)(group + 1);
+    for (int i = 0; i < list->count; i++) {
+        memcpy(strings, list->str[i], list->len[i]);
+        strings[list->len[i]] = '\0';
+        group->members[i] = strings;
+        group->member_hashes[i] = hash_string(list->str[i], list->len[i]);
+        strings += list->len[i] + 1;
+    }
+    group->member_count = (uint8_t)list->count;
+    return group;
+}
+
+/* The least recently used entry, which a registration replaces once the table is full. */
+static int oldest_group(const chat_group_table_t *groups, int count)
+{
+    int oldest = 0;
+    for (int i = 1; i < count; i++) {
+        if ((int32_t)(last_used(groups->entries[i]) - last_used(groups->entries[oldest])) < 0) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+static esp_err_t add_group(app_context_t *ctx, const char *id, size_t id_len, const member_list_t *list, bool *added)
+{
+    chat_group_table_t *groups = &ctx->groups;
+    esp_err_t ret = ESP_OK;
+
+    *added = false;
+    if (xSemaphoreTake(ctx->group_mutex, portMAX_DELAY) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    chat_group_t *group = chat_groups_find(groups, id, id_len);
+    int count = atomic_load_explicit(&groups->count, memory_order_relaxed);
+    if (group != NULL) {
+        ret = same_members(group, list) ? ESP_OK : ESP_ERR_INVALID_STATE;
+    } else if ((group = create_group(id, id_len, list)) == NULL) {
+        ret = ESP_ERR_NO_MEM;
+    } else if (count == MAX_GROUPS) {
+        int slot = oldest_group(groups, count);
+        ESP_LOGI(TAG, "Registry full; evicting group %s", groups->entries[slot]->id);
+        free(groups->entries[slot]);
+        groups->entries[slot] = group;
+        *added = true;
+    } else {
+        groups->entries[count] = group;
+        atomic_store_explicit(&groups->count, count + 1, memory_order_release);
+        *added = true;
+    }
+    if (ret == ESP_OK) {
+        mark_used(groups, group);
+    }
+
+    xSemaphoreGive(ctx->group_mutex);
+    return ret;
+}
+
+/* The sender plus to.users, deduplicated. */
+static esp_err_t list_frame_members(const chat_frame_t *frame, member_list_t *list)
+{
+    if (frame == NULL || !frame->users_valid || frame->from.type != JSON_SCAN_STRING) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    bool listed = add_member(list, frame->from.str, frame->from.len);
+    for (int i = 0; i < frame->user_count && listed; i++) {
+        listed = frame->users[i].type == JSON_SCAN_STRING && add_member(list, frame->users[i].str, frame->users[i].len);
+    }
+    return listed ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+esp_err_t chat_groups_check(app_context_t *ctx, const chat_field_t *id, const chat_frame_t *frame)
+{
+    member_list_t list = { 0 };
+
+    if (ctx == NULL || id == NULL || !chat_field_string_in_range(id, MAX_GROUP_ID_LEN, false)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = list_frame_members(frame, &list);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    chat_group_t *group = chat_groups_find(&ctx->groups, id->str, id->len);
+    return group == NULL || same_members(group, &list) ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+esp_err_t chat_groups_register(app_context_t *ctx, const chat_field_t *id, const chat_frame_t *frame, bool persist)
+{
+    member_list_t list = { 0 };
+    bool added = false;
+
+    if (ctx == NULL || id == NULL || !chat_field_string_in_range(id, MAX_GROUP_ID_LEN, false)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = list_frame_members(frame, &list);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    ret = add_group(ctx, id->str, id->len, &list, &added);
+    if (added && persist) {
+        chat_persist_save_groups(ctx);
+    }
+    return ret;
+}
+
+/* Oldest use first, so loading the file in order restores the eviction order. */
+static void order_by_use(chat_group_table_t *groups, int count, uint8_t *order)
+{
+    for (int i = 0; i < count; i++) {
+        int j = i;
+        for (; j > 0 && (int32_t)(last_used(groups->entries[order[j - 1]]) - last_used(groups->entries[i])) > 0; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = (uint8_t)i;
+    }
+}
+
+static void write_registry(json_writer_t *writer, chat_group_table_t *groups, const uint8_t *order, int count)
+{
+    JSON_WRITER_LITERAL(writer, "{\"groups\":[");
+    for (int i = 0; i < count; i++) {
+        const chat_group_t *group = groups->entries[order[i]];
+        if (i > 0) {
+            JSON_WRITER_LITERAL(writer, ",");
+        }
+        JSON_WRITER_LITERAL(writer, "{\"id\":");
+        json_writer_string(writer, group->id);
+        JSON_WRITER_LITERAL(writer, ",\"members\":[");
+        for (int j = 0; j < group->member_count; j++) {
+            if (j > 0) {
+                JSON_WRITER_LITERAL(writer, ",");
+            }
+            json_writer_string(writer, group->members[j]);
+        }
+        JSON_WRITER_LITERAL(writer, "]}");
+    }
+    JSON_WRITER_LITERAL(writer, "]}");
+}
+
+void chat_groups_save(app_context_t *ctx)
+{
+    if (ctx == NULL || ctx->groups.base_path == NULL || xSemaphoreTake(ctx->group_mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    esp_err_t ret = ESP_ERR_NO_MEM;
+    int count = atomic_load_explicit(&ctx->groups.count, memory_order_relaxed);
+    uint8_t order[MAX_GROUPS];
+    order_by_use(&ctx->groups, count, order);
+    json_writer_t writer;
+    json_writer_init(&writer, NULL, 0);
+    write_registry(&writer, &ctx->groups, order, count);
+
+    size_t cap = writer.len + 1;
+    char *data = malloc(cap);
+    if (data != NULL) {
+        json_writer_init(&writer, data, cap);
+        write_registry(&writer, &ctx->groups, order, count);
+        ret = json_writer_finish(&writer) ? chat_group_store_save(ctx->groups.base_path, data, writer.len) : ESP_ERR_INVALID_SIZE;
+    }
+    xSemaphoreGive(ctx->group_mutex);
+    free(data);
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Group registry not saved: %s", esp_err_to_name(ret));
+    }
+}
+
+void chat_groups_load(app_context_t *ctx, const char *base_path)
+{
+    if (ctx == NULL || base_path == NULL) {
+        return;
+    }
+    ctx->groups.base_path = base_path;
+
+    size_t len = 0;
+    char *data = chat_group_store_load(base_path, &len);
+    cJSON *root = data ? cJSON_ParseWithLength(data, len) : NULL;
+    free(data);
+
+    int skipped = 0;
+    cJSON *entry = NULL;
+    cJSON_ArrayForEach(entry, cJSON_GetObjectItem(root, "groups")) {
+        cJSON *id = cJSON_GetObjectItem(entry, "id");
+        cJSON *member = NULL;
+        member_list_t list = { 0 };
+        bool listed = json_string_in_range(id, MAX_GROUP_ID_LEN, false);
+        cJSON_ArrayForEach(member, cJSON_GetObjectItem(entry, "members")) {
+            listed = listed && cJSON_IsString(member) && add_member(&list, member->valuestring, strlen(member->valuestring));
+        }
+
+        bool added = false;
+        if (!listed || list.count == 0 || add_group(ctx, id->valuestring, strlen(id->valuestring), &list, &added) != ESP_OK) {
+            skipped++;
+        }
+    }
+    cJSON_Delete(root);
+
+    ESP_LOGI(TAG, "Loaded %d groups (%d skipped)", atomic_load(&ctx->groups.count), skipped);
+}
+
+bool chat_groups_expand_frame(chat_group_table_t *groups, chat_frame_t *frame)
+{
+    if (frame == NULL || frame->to_group.type == JSON_SCAN_NONE) {
+        return true;
+    }
+
+    chat_group_t *group = frame->to_group.type == JSON_SCAN_STRING
+        ? chat_groups_find(groups, frame->to_group.str, frame->to_group.len)
+        : NULL;
+    if (group == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < group->member_count; i++) {
+        frame->users[i] = (chat_field_t){
+            .type = JSON_SCAN_STRING,
+            .str = group->members[i],
+            .len = strlen(group->members[i]),
+        };
+    }
+    frame->user_count = group->member_count;
+    frame->users_valid = true;
+    return true;
+}
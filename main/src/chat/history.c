@@ -1,22 +1,29 @@
 #include "chat/history.h"
 
 #include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "esp_log.h"
 
+#include "chat/compress.h"
+#include "chat/groups.h"
+#include "chat/persist.h"
+#include "chat/recipients.h"
+#include "chat/search.h"
+#include "common/json_writer.h"
 #include "common/utils.h"
 #include "server/websocket_server.h"
 #include "storage/message_id_store.h"
 
 static const char *TAG = "CHAT_HISTORY";
 
-bool chat_history_parse_since_id(const cJSON *root, uint64_t *since_id_out)
+bool chat_history_parse_since_id(const chat_frame_t *frame, uint64_t *since_id_out)
 {
-    cJSON *since_id = cJSON_GetObjectItem(root, "since_id");
-    if (since_id == NULL) {
-        since_id = cJSON_GetObjectItem(root, "last_seen_id");
+    const chat_field_t *since_id = &frame->since_id;
+    if (since_id->type == JSON_SCAN_NONE) {
+        since_id = &frame->last_seen_id;
     }
 
     if (since_id_out == NULL) {
@@ -24,18 +31,18 @@ bool chat_history_parse_since_id(const cJSON *root, uint64_t *since_id_out)
     }
     *since_id_out = 0;
 
-    if (since_id == NULL) {
+    if (since_id->type == JSON_SCAN_NONE) {
         return true;
     }
 
-    if (!cJSON_IsNumber(since_id) ||
-        since_id->valuedouble < 0 ||
-        since_id->valuedouble > (double)CHAT_MESSAGE_MAX_SAFE_ID) {
+    if (since_id->type != JSON_SCAN_NUMBER ||
+        since_id->number < 0 ||
+        since_id->number > (double)CHAT_MESSAGE_MAX_SAFE_ID) {
         return false;
     }
 
-    uint64_t parsed = (uint64_t)since_id->valuedouble;
-    if ((double)parsed != since_id->valuedouble) {
+    uint64_t parsed = (uint64_t)since_id->number;
+    if ((double)parsed != since_id->number) {
         return false;
     }
 
@@ -43,6 +50,99 @@ bool chat_history_parse_since_id(const cJSON *root, uint64_t *since_id_out)
     return true;
 }
 
+static bool parse_range_id(const char **cursor, const char *end, uint64_t *id_out)
+{
+    const char *p = *cursor;
+    uint64_t id = 0;
+
+    if (p == end || *p < '0' || *p > '9') {
+        return false;
+    }
+    while (p < end && *p >= '0' && *p <= '9') {
+        id = id * 10 + (uint64_t)(*p - '0');
+        if (id > CHAT_MESSAGE_MAX_SAFE_ID) {
+            return false;
+        }
+        p++;
+    }
+
+    *cursor = p;
+    *id_out = id;
+    return true;
+}
+
+bool chat_history_parse_ranges(const chat_field_t *field, chat_id_range_t *ranges, int *count_out)
+{
+    if (field == NULL || ranges == NULL || count_out == NULL) {
+        return false;
+    }
+    *count_out = 0;
+
+    if (field->type == JSON_SCAN_NONE) {
+        return true;
+    }
+    if (field->type != JSON_SCAN_STRING) {
+        return false;
+    }
+
+    const char *p = field->str;
+    const char *end = field->str + field->len;
+    uint64_t previous_last = 0;
+    int count = 0;
+    while (p < end) {
+        chat_id_range_t range;
+        if (count == HISTORY_PEER_RANGES || !parse_range_id(&p, end, &range.first)) {
+            return false;
+        }
+        range.last = range.first;
+        if (p < end && *p == '-') {
+            p++;
+            if (!parse_range_id(&p, end, &range.last)) {
+                return false;
+            }
+        }
+        if (range.first == 0 || range.last < range.first || (count > 0 && range.first <= previous_last)) {
+            return false;
+        }
+        if (p < end && (*p != ',' || ++p == end)) {
+            return false;
+        }
+
+        previous_last = range.last;
+        ranges[count++] = range;
+    }
+
+    *count_out = count;
+    return true;
+}
+
+static int oldest_index_locked(const app_context_t *ctx)
+{
+    return (ctx->message_buffer_head + MAX_MESSAGES - ctx->message_count) % MAX_MESSAGES;
+}
+
+static const message_t *logical_message_locked(const app_context_t *ctx, int position)
+{
+    return &ctx->message_buffer[(oldest_index_locked(ctx) + position) % MAX_MESSAGES];
+}
+
+/* Ids in the ring are strictly increasing from oldest to newest, so the first one after since_id is a binary search. */
+static int first_position_after_locked(const app_context_t *ctx, uint64_t since_id)
+{
+    int low = 0;
+    int high = ctx->message_count;
+
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (logical_message_locked(ctx, mid)->id <= since_id) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
 void chat_history_fill_bounds_locked(app_context_t *ctx, history_bounds_t *bounds)
 {
     if (ctx == NULL || bounds == NULL) {
@@ -53,24 +153,21 @@ void chat_history_fill_bounds_locked(app_context_t *ctx, history_bounds_t *bound
     bounds->boot_start_id = ctx->boot_start_id;
     bounds->current_id = ctx->message_id_counter;
     bounds->capacity = MAX_MESSAGES;
-
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        if (ctx->message_buffer[i].payload == NULL) {
-            continue;
-        }
-
-        uint64_t id = ctx->message_buffer[i].id;
-        if (bounds->count == 0 || id < bounds->earliest_id) {
-            bounds->earliest_id = id;
-        }
-        if (id > bounds->latest_id) {
-            bounds->latest_id = id;
-        }
-        bounds->count++;
+    bounds->count = ctx->message_count;
+    if (ctx->message_count > 0) {
+        bounds->earliest_id = logical_message_locked(ctx, 0)->id;
+        bounds->latest_id = logical_message_locked(ctx, ctx->message_count - 1)->id;
     }
 
     bounds->restore_before_id = bounds->count > 0 ? bounds->earliest_id : bounds->boot_start_id;
     bounds->has_more_before = bounds->restore_before_id > 1;
+    bounds->bytes_capacity = ctx->message_arena.capacity;
+    bounds->bytes_used = ctx->message_arena.used;
+    bounds->bytes_live = ctx->message_live_bytes;
+    bounds->bytes_gap = chat_history_arena_gap(&ctx->message_arena);
+    bounds->heap_fallbacks = ctx->message_heap_fallbacks;
+    bounds->log_commits = ctx->persist_commits;
+    bounds->log_dropped = ctx->persist_dropped;
 }
 
 uint64_t chat_history_current_restore_before_id(app_context_t *ctx)
@@ -87,150 +184,1028 @@ uint64_t chat_history_current_restore_before_id(app_context_t *ctx)
     return restore_before_id;
 }
 
-char *chat_history_build_info_payload(app_context_t *ctx)
+static void write_info(app_context_t *ctx, const history_bounds_t *bounds, json_writer_t *writer)
 {
-    cJSON *root = cJSON_CreateObject();
-    if (ctx == NULL || root == NULL) {
-        cJSON_Delete(root);
-        return NULL;
+    JSON_WRITER_LITERAL(writer, "{\"type\":\"historyInfo\",\"from\":\"server\",\"timestamp\":");
+    json_writer_int(writer, current_timestamp_s(ctx));
+    JSON_WRITER_LITERAL(writer, ",\"to\":{\"users\":[],\"all\":true},\"boot_start_id\":");
+    json_writer_uint(writer, bounds->boot_start_id);
+    JSON_WRITER_LITERAL(writer, ",\"current_id\":");
+    json_writer_uint(writer, bounds->current_id);
+    JSON_WRITER_LITERAL(writer, ",\"earliest_id\":");
+    json_writer_uint(writer, bounds->earliest_id);
+    JSON_WRITER_LITERAL(writer, ",\"latest_id\":");
+    json_writer_uint(writer, bounds->latest_id);
+    JSON_WRITER_LITERAL(writer, ",\"restore_before_id\":");
+    json_writer_uint(writer, bounds->restore_before_id);
+    JSON_WRITER_LITERAL(writer, ",\"count\":");
+    json_writer_int(writer, bounds->count);
+    JSON_WRITER_LITERAL(writer, ",\"capacity\":");
+    json_writer_int(writer, bounds->capacity);
+    JSON_WRITER_LITERAL(writer, ",\"has_more_before\":");
+    json_writer_bool(writer, bounds->has_more_before);
+    JSON_WRITER_LITERAL(writer, ",\"bytes_capacity\":");
+    json_writer_uint(writer, bounds->bytes_capacity);
+    JSON_WRITER_LITERAL(writer, ",\"bytes_used\":");
+    json_writer_uint(writer, bounds->bytes_used);
+    JSON_WRITER_LITERAL(writer, ",\"bytes_wasted\":");
+    json_writer_uint(writer, bounds->bytes_used - bounds->bytes_live + bounds->bytes_gap);
+    JSON_WRITER_LITERAL(writer, ",\"heap_fallbacks\":");
+    json_writer_uint(writer, bounds->heap_fallbacks);
+    JSON_WRITER_LITERAL(writer, ",\"log_commits\":");
+    json_writer_uint(writer, bounds->log_commits);
+    JSON_WRITER_LITERAL(writer, ",\"log_dropped\":");
+    json_writer_uint(writer, bounds->log_dropped);
+    JSON_WRITER_LITERAL(writer, ",\"max_frame_bytes\":");
+    json_writer_int(writer, MAX_WS_PAYLOAD_BYTES);
+    JSON_WRITER_LITERAL(writer, "}");
+}
+
+static chat_history_seen_t *find_seen(app_context_t *ctx, const char *request_id)
+{
+    for (int i = 0; i < HISTORY_SEEN_REQUESTS; i++) {
+        if (ctx->history_seen[i].request_id[0] != '\0' && strcmp(ctx->history_seen[i].request_id, request_id) == 0) {
+            return &ctx->history_seen[i];
+        }
     }
+    return NULL;
+}
 
-    cJSON_AddStringToObject(root, "type", "historyInfo");
-    cJSON_AddStringToObject(root, "from", "server");
-    cJSON_AddNumberToObject(root, "timestamp", current_timestamp_s(ctx));
+/* Bit of id in seen's bitmap, or -1 when id is outside the window it remembers. */
+static int64_t seen_bit(const chat_history_seen_t *seen, uint64_t id)
+{
+    if (id >= seen->base_id || seen->base_id - id > HISTORY_SEEN_IDS) {
+        return -1;
+    }
+    return (int64_t)(seen->base_id - id - 1);
+}
 
-    cJSON *to = cJSON_AddObjectToObject(root, "to");
-    cJSON *users = to ? cJSON_AddArrayToObject(to, "users") : NULL;
-    if (to == NULL || users == NULL) {
-        cJSON_Delete(root);
-        return NULL;
+bool chat_history_response_seen(app_context_t *ctx, const char *request_id, uint64_t id)
+{
+    if (ctx == NULL || request_id == NULL) {
+        return false;
     }
-    cJSON_AddBoolToObject(to, "all", true);
 
-    if (xSemaphoreTake(ctx->message_mutex, portMAX_DELAY) != pdTRUE) {
-        cJSON_Delete(root);
+    const chat_history_seen_t *seen = find_seen(ctx, request_id);
+    int64_t bit = seen != NULL ? seen_bit(seen, id) : -1;
+    return bit >= 0 && (seen->ids[bit / 8] & (1u << (bit % 8))) != 0;
+}
+
+void chat_history_response_mark_seen(app_context_t *ctx, const char *request_id, uint64_t id, uint64_t restore_before_id)
+{
+    if (ctx == NULL || request_id == NULL || request_id[0] == '\0') {
+        return;
+    }
+
+    chat_history_seen_t *seen = find_seen(ctx, request_id);
+    if (seen == NULL) {
+        /* The oldest request gives up its slot; late answers to it are relayed undeduplicated. */
+        seen = &ctx->history_seen[ctx->history_seen_next];
+        ctx->history_seen_next = (ctx->history_seen_next + 1) % HISTORY_SEEN_REQUESTS;
+        memset(seen, 0, sizeof(*seen));
+        copy_bounded(seen->request_id, sizeof(seen->request_id), request_id);
+        seen->base_id = restore_before_id;
+    }
+
+    int64_t bit = seen_bit(seen, id);
+    if (bit >= 0) {
+        seen->ids[bit / 8] |= (uint8_t)(1u << (bit % 8));
+    }
+}
+
+/* Rebuilt only when the bounds differ from the ones the cached payload was written from. */
+chat_payload_t *chat_history_info_payload(app_context_t *ctx)
+{
+    chat_payload_t *payload = NULL;
+
+    if (ctx == NULL || xSemaphoreTake(ctx->message_mutex, portMAX_DELAY) != pdTRUE) {
         return NULL;
     }
 
     history_bounds_t bounds;
     chat_history_fill_bounds_locked(ctx, &bounds);
-    xSemaphoreGive(ctx->message_mutex);
+    if (ctx->history_info_payload == NULL || memcmp(&bounds, &ctx->history_info_bounds, sizeof(bounds)) != 0) {
+        char buf[HISTORY_INFO_PAYLOAD_BYTES];
+        json_writer_t writer;
+        json_writer_init(&writer, buf, sizeof(buf));
+        write_info(ctx, &bounds, &writer);
 
-    cJSON_AddNumberToObject(root, "boot_start_id", (double)bounds.boot_start_id);
-    cJSON_AddNumberToObject(root, "current_id", (double)bounds.current_id);
-    cJSON_AddNumberToObject(root, "earliest_id", (double)bounds.earliest_id);
-    cJSON_AddNumberToObject(root, "latest_id", (double)bounds.latest_id);
-    cJSON_AddNumberToObject(root, "restore_before_id", (double)bounds.restore_before_id);
-    cJSON_AddNumberToObject(root, "count", bounds.count);
-    cJSON_AddNumberToObject(root, "capacity", bounds.capacity);
-    cJSON_AddBoolToObject(root, "has_more_before", bounds.has_more_before);
-
-    char *payload = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
+        chat_payload_t *built = json_writer_finish(&writer) ? chat_payload_create(buf, writer.len) : NULL;
+        if (built != NULL) {
+            chat_payload_release(ctx->history_info_payload);
+            ctx->history_info_payload = built;
+            memcpy(&ctx->history_info_bounds, &bounds, sizeof(bounds));
+        }
+    }
+    payload = chat_payload_ref(ctx->history_info_payload);
+
+    xSemaphoreGive(ctx->message_mutex);
     return payload;
 }
 
 void chat_history_send_info_to_client(app_context_t *ctx, int fd)
 {
-    char *payload = chat_history_build_info_payload(ctx);
+    chat_payload_t *payload = chat_history_info_payload(ctx);
     if (payload == NULL) {
         chat_ws_send_error(ctx, fd, "server_busy", "History boundary is temporarily unavailable");
         return;
     }
 
-    chat_ws_send_text(ctx, fd, payload);
-    free(payload);
+    chat_ws_send_payload(ctx, fd, payload);
+    chat_payload_release(payload);
 }
 
 bool chat_history_broadcast_info(app_context_t *ctx)
 {
-    char *payload = chat_history_build_info_payload(ctx);
+    chat_payload_t *payload = chat_history_info_payload(ctx);
     if (payload == NULL) {
         ESP_LOGW(TAG, "Failed to build history boundary payload");
         return false;
     }
 
-    bool closed_client = chat_ws_broadcast(ctx, payload);
-    free(payload);
+    bool closed_client = chat_ws_broadcast_payload(ctx, payload);
+    chat_payload_release(payload);
     return closed_client;
 }
 
-void chat_history_send_to_client(app_context_t *ctx, int fd, uint64_t since_id)
+#define HISTORY_BATCH_PREFIX "{\"type\":\"historyBatch\",\"from\":\"server\",\"messages\":["
+#define HISTORY_BATCH_SUFFIX "]}"
+
+static esp_err_t send_batch(app_context_t *ctx, int fd, char *batch, size_t len, int pending, int *sent)
 {
-    char **payloads = calloc(MAX_MESSAGES, sizeof(char *));
-    bool allocation_failed = false;
+    memcpy(batch + len, HISTORY_BATCH_SUFFIX, sizeof(HISTORY_BATCH_SUFFIX));
+    esp_err_t ret = chat_ws_send_text(ctx, fd, batch);
+    if (ret == ESP_OK) {
+        *sent += pending;
+    }
+    return ret;
+}
+
+/* Swaps a stored payload for its plain text; on failure the entry is released and cleared. */
+static bool open_payload(chat_payload_t **payload)
+{
+    chat_payload_t *plain = chat_payload_open(*payload);
+    chat_payload_release(*payload);
+    *payload = plain;
+    return plain != NULL;
+}
+
+/*
+ * Sends and releases every payload. With a batch buffer, consecutive payloads are packed into
+ * historyBatch frames of at most HISTORY_BATCH_MAX_BYTES; a payload too large for one goes out alone.
+ */
+static bool send_payloads(app_context_t *ctx, int fd, chat_payload_t **payloads, int count, char *batch, int *sent)
+{
+    const size_t overhead = sizeof(HISTORY_BATCH_PREFIX) - 1 + sizeof(HISTORY_BATCH_SUFFIX);
     bool send_failed = false;
+    size_t len = 0;
+    int pending = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (!send_failed && open_payload(&payloads[i])) {
+            esp_err_t ret = ESP_OK;
+            size_t need = payloads[i]->len + 1;
+
+            if (pending > 0 && len + need + sizeof(HISTORY_BATCH_SUFFIX) > HISTORY_BATCH_MAX_BYTES) {
+                ret = send_batch(ctx, fd, batch, len, pending, sent);
+                pending = 0;
+            }
+
+            if (ret == ESP_OK && batch != NULL && need + overhead <= HISTORY_BATCH_MAX_BYTES) {
+                if (pending == 0) {
+                    memcpy(batch, HISTORY_BATCH_PREFIX, sizeof(HISTORY_BATCH_PREFIX) - 1);
+                    len = sizeof(HISTORY_BATCH_PREFIX) - 1;
+                } else {
+                    batch[len++] = ',';
+                }
+                memcpy(batch + len, payloads[i]->data, payloads[i]->len);
+                len += payloads[i]->len;
+                pending++;
+            } else if (ret == ESP_OK) {
+                ret = chat_ws_send_payload(ctx, fd, payloads[i]);
+                if (ret == ESP_OK) {
+                    (*sent)++;
+                }
+            }
+
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "History send failed for fd=%d: %s", fd, esp_err_to_name(ret));
+                chat_ws_close_client(ctx, fd);
+                send_failed = true;
+            }
+        }
+        chat_payload_release(payloads[i]);
+        payloads[i] = NULL;
+    }
+
+    if (!send_failed && pending > 0) {
+        esp_err_t ret = send_batch(ctx, fd, batch, len, pending, sent);
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "History send failed for fd=%d: %s", fd, esp_err_to_name(ret));
+            chat_ws_close_client(ctx, fd);
+            send_failed = true;
+        }
+    }
+
+    return !send_failed;
+}
+
+typedef struct {
+    chat_payload_t **payloads;
+    uint64_t *ids;
+    int count;
+    uint64_t until_id;
+    uint64_t last_id;
+    bool allocation_failed;
+} log_replay_chunk_t;
+
+static bool collect_log_record(uint64_t id, const char *payload, size_t len, void *arg)
+{
+    log_replay_chunk_t *chunk = (log_replay_chunk_t *)arg;
+    if (id >= chunk->until_id) {
+        return false;
+    }
+
+    chunk->payloads[chunk->count] = chat_payload_create(payload, len);
+    if (chunk->payloads[chunk->count] == NULL) {
+        chunk->allocation_failed = true;
+        return false;
+    }
+    if (chunk->ids != NULL) {
+        chunk->ids[chunk->count] = id;
+    }
+    chunk->count++;
+    chunk->last_id = id;
+    return chunk->count < MESSAGE_LOG_REPLAY_CHUNK;
+}
+
+/* Reads up to MESSAGE_LOG_REPLAY_CHUNK records after cursor; the log lock is held only for the read. */
+static esp_err_t read_log_chunk(app_context_t *ctx, uint64_t cursor, log_replay_chunk_t *chunk)
+{
+    if (xSemaphoreTake(ctx->message_log_mutex, portMAX_DELAY) != pdTRUE) {
+        chunk->allocation_failed = true;
+        return ESP_ERR_TIMEOUT;
+    }
+    esp_err_t ret = chat_message_log_read_after(&ctx->message_log, cursor, MESSAGE_LOG_REPLAY_CHUNK,
+                                                collect_log_record, chunk);
+    xSemaphoreGive(ctx->message_log_mutex);
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Message log read failed: %s", esp_err_to_name(ret));
+    }
+    return ret;
+}
+
+static bool log_chunk_exhausted(esp_err_t ret, const log_replay_chunk_t *chunk)
+{
+    return ret != ESP_OK || chunk->allocation_failed || chunk->count < MESSAGE_LOG_REPLAY_CHUNK;
+}
+
+/* Flash records carry no recipient descriptor, so they are parsed once here, outside the message lock. */
+static int drop_invisible_log_records(app_context_t *ctx, chat_payload_t **payloads, int count, const char *user_id)
+{
+    int kept = 0;
+
+    for (int i = 0; i < count; i++) {
+        cJSON *message = cJSON_ParseWithLength(payloads[i]->data, payloads[i]->len);
+        bool visible = chat_message_visible_to_user(&ctx->groups, message, user_id);
+        cJSON_Delete(message);
+
+        if (visible) {
+            payloads[kept++] = payloads[i];
+        } else {
+            chat_payload_release(payloads[i]);
+        }
+    }
+    return kept;
+}
+
+/* Replays (since_id, until_id) from flash in small chunks so the message lock is never held across a send. */
+static bool send_log_range_to_client(app_context_t *ctx, int fd, const char *user_id, uint64_t since_id,
+                                     uint64_t until_id, char *batch, int *sent, bool *allocation_failed)
+{
+    chat_payload_t *payloads[MESSAGE_LOG_REPLAY_CHUNK];
+    uint64_t cursor = since_id;
+
+    while (cursor + 1 < until_id) {
+        log_replay_chunk_t chunk = {
+            .payloads = payloads,
+            .until_id = until_id,
+        };
+
+        esp_err_t ret = read_log_chunk(ctx, cursor, &chunk);
+        if (chunk.allocation_failed) {
+            *allocation_failed = true;
+        }
+        int visible = drop_invisible_log_records(ctx, payloads, chunk.count, user_id);
+        if (!send_payloads(ctx, fd, payloads, visible, batch, sent)) {
+            return false;
+        }
+        if (log_chunk_exhausted(ret, &chunk)) {
+            break;
+        }
+        cursor = chunk.last_id;
+    }
+
+    return true;
+}
+
+/* Tells the client that visible messages with since_id < id < before_id were left out of its replay. */
+static void send_gap(app_context_t *ctx, int fd, uint64_t since_id, uint64_t before_id)
+{
+    char buf[128];
+    json_writer_t writer;
+    json_writer_init(&writer, buf, sizeof(buf));
+    JSON_WRITER_LITERAL(&writer, "{\"type\":\"historyGap\",\"from\":\"server\",\"timestamp\":");
+    json_writer_int(&writer, current_timestamp_s(ctx));
+    JSON_WRITER_LITERAL(&writer, ",\"since_id\":");
+    json_writer_uint(&writer, since_id);
+    JSON_WRITER_LITERAL(&writer, ",\"before_id\":");
+    json_writer_uint(&writer, before_id);
+    JSON_WRITER_LITERAL(&writer, "}");
+    if (json_writer_finish(&writer)) {
+        chat_ws_send_text(ctx, fd, buf);
+    }
+}
+
+/*
+ * Whatever a replay leaves out, the flash log beyond MESSAGE_LOG_REPLAY_MAX or everything older
+ * than the newest replay_limit messages, is reported with historyGap before the messages go out,
+ * so the client can page it with historyQuery instead of skipping it with its next since_id.
+ */
+void chat_history_send_to_client(app_context_t *ctx, int fd, const history_replay_t *replay)
+{
+    chat_payload_t **payloads = calloc(MAX_MESSAGES, sizeof(chat_payload_t *));
+    uint64_t *ids = calloc(MAX_MESSAGES, sizeof(uint64_t));
+    char *batch = replay && replay->batched ? malloc(HISTORY_BATCH_MAX_BYTES) : NULL;
+    bool allocation_failed = false;
+    uint64_t gap_before_id = 0;
     int count = 0;
+    int sent = 0;
 
-    if (payloads == NULL) {
+    if (payloads == NULL || ids == NULL || replay == NULL) {
+        free(payloads);
+        free(ids);
+        free(batch);
         chat_ws_send_error(ctx, fd, "server_busy", "Message history is temporarily unavailable");
         return;
     }
 
     if (ctx == NULL || xSemaphoreTake(ctx->message_mutex, portMAX_DELAY) != pdTRUE) {
         free(payloads);
+        free(ids);
+        free(batch);
         chat_ws_send_error(ctx, fd, "server_busy", "Message history is temporarily unavailable");
         return;
     }
 
-    int current_pos = ctx->message_buffer_head;
-    for (int i = 0; i < MAX_MESSAGES; i++) {
-        int index = (current_pos + i) % MAX_MESSAGES;
-        if (ctx->message_buffer[index].payload == NULL || ctx->message_buffer[index].id <= since_id) {
-            continue;
+    history_bounds_t bounds;
+    chat_history_fill_bounds_locked(ctx, &bounds);
+    uint64_t log_until = bounds.count > 0 ? bounds.earliest_id : bounds.current_id + 1;
+    xSemaphoreGive(ctx->message_mutex);
+
+    bool log_behind = ctx->message_log.ready && replay->since_id + 1 < log_until;
+    if (log_behind && replay->replay_limit > 0) {
+        gap_before_id = log_until;
+    } else if (log_behind) {
+        uint64_t log_since = replay->since_id;
+        if (log_until > MESSAGE_LOG_REPLAY_MAX + 1 && log_since < log_until - 1 - MESSAGE_LOG_REPLAY_MAX) {
+            log_since = log_until - 1 - MESSAGE_LOG_REPLAY_MAX;
+            send_gap(ctx, fd, replay->since_id, log_since + 1);
+        }
+        if (!send_log_range_to_client(ctx, fd, replay->user_id, log_since, log_until, batch, &sent,
+                                      &allocation_failed)) {
+            free(payloads);
+            free(ids);
+            free(batch);
+            return;
         }
+    }
 
-        size_t len = strlen(ctx->message_buffer[index].payload);
-        payloads[count] = malloc(len + 1);
-        if (payloads[count] == NULL) {
-            allocation_failed = true;
-            break;
+    if (xSemaphoreTake(ctx->message_mutex, portMAX_DELAY) != pdTRUE) {
+        free(payloads);
+        free(ids);
+        free(batch);
+        chat_ws_send_error(ctx, fd, "server_busy", "Message history is temporarily unavailable");
+        return;
+    }
+
+    int handle = chat_user_table_find(&ctx->message_users, replay->user_id);
+    for (int i = first_position_after_locked(ctx, replay->since_id); i < ctx->message_count; i++) {
+        const message_t *message = logical_message_locked(ctx, i);
+        if (chat_recipients_visible(&ctx->groups, &message->recipients, handle, message->payload, replay->user_id)) {
+            ids[count] = message->id;
+            payloads[count++] = chat_payload_ref(message->payload);
         }
-        memcpy(payloads[count], ctx->message_buffer[index].payload, len + 1);
-        count++;
     }
 
     xSemaphoreGive(ctx->message_mutex);
 
-    int sent = 0;
-    for (int i = 0; i < count; i++) {
-        esp_err_t ret = chat_ws_send_text(ctx, fd, payloads[i]);
-        free(payloads[i]);
-        payloads[i] = NULL;
-        if (ret == ESP_OK) {
-            sent++;
-            continue;
+    int skipped = 0;
+    if (replay->replay_limit > 0 && count > replay->replay_limit) {
+        skipped = count - replay->replay_limit;
+        gap_before_id = ids[skipped];
+        for (int i = 0; i < skipped; i++) {
+            chat_payload_release(payloads[i]);
         }
+    }
+    if (gap_before_id != 0) {
+        send_gap(ctx, fd, replay->since_id, gap_before_id);
+    }
 
-        ESP_LOGW(TAG, "History send failed for fd=%d: %s", fd, esp_err_to_name(ret));
-        chat_ws_close_client(ctx, fd);
-        send_failed = true;
-        break;
+    bool send_ok = send_payloads(ctx, fd, payloads + skipped, count - skipped, batch, &sent);
+    if (allocation_failed && send_ok) {
+        chat_ws_send_error(ctx, fd, "server_busy", "Message history is temporarily unavailable");
     }
 
-    for (int i = 0; i < count; i++) {
-        free(payloads[i]);
+    ESP_LOGI(TAG, "Sent %d history messages to fd=%d since_id=%" PRIu64, sent, fd, replay->since_id);
+    free(payloads);
+    free(ids);
+    free(batch);
+}
+
+typedef struct {
+    const history_query_t *query;
+    chat_group_table_t *groups;
+    int self_handle;
+    int peer_handle;
+    uint32_t group_hash;
+} page_filter_t;
+
+static bool payload_matches_page(chat_payload_t *payload, const page_filter_t *filter)
+{
+    chat_payload_t *plain = chat_payload_open(payload);
+    cJSON *message = plain ? cJSON_ParseWithLength(plain->data, plain->len) : NULL;
+    chat_payload_release(plain);
+    bool matches = chat_message_visible_to_user(filter->groups, message, filter->query->user_id) &&
+        (filter->query->conversation == NULL ||
+         chat_message_in_conversation(message, filter->query->user_id, filter->query->conversation));
+    cJSON_Delete(message);
+    return matches;
+}
+
+static bool message_matches_page_locked(const message_t *message, const page_filter_t *filter)
+{
+    const chat_recipients_t *recipients = &message->recipients;
+    const char *conversation = filter->query->conversation;
+
+    if (recipients->overflow) {
+        return payload_matches_page(message->payload, filter);
+    }
+    if (!chat_recipients_visible(filter->groups, recipients, filter->self_handle, message->payload,
+                                 filter->query->user_id)) {
+        return false;
     }
+    if (conversation == NULL) {
+        return true;
+    }
+    if (strcmp(conversation, "global") == 0) {
+        return recipients->all && recipients->group_hash == 0;
+    }
+    if (recipients->group_hash != 0) {
+        return recipients->group_hash == filter->group_hash && payload_matches_page(message->payload, filter);
+    }
+    if (recipients->all || filter->self_handle < 0 || filter->peer_handle < 0) {
+        return false;
+    }
+
+    uint64_t self_bit = UINT64_C(1) << filter->self_handle;
+    uint64_t peer_bit = UINT64_C(1) << filter->peer_handle;
+    return (recipients->from_handle == filter->self_handle && (recipients->mask & peer_bit) != 0) ||
+        (recipients->from_handle == filter->peer_handle && (recipients->mask & self_bit) != 0);
+}
+
+typedef struct {
+    chat_payload_t *payloads[HISTORY_QUERY_MAX_LIMIT];
+    uint64_t ids[HISTORY_QUERY_MAX_LIMIT];
+    int count;
+} history_page_t;
+
+/* Keeps the newest `capacity` matches of an ascending scan, oldest first. */
+static void page_keep_newest(history_page_t *page, int capacity, chat_payload_t *payload, uint64_t id)
+{
+    if (capacity <= 0) {
+        chat_payload_release(payload);
+        return;
+    }
+    if (page->count == capacity) {
+        chat_payload_release(page->payloads[0]);
+        memmove(&page->payloads[0], &page->payloads[1], (size_t)(capacity - 1) * sizeof(page->payloads[0]));
+        memmove(&page->ids[0], &page->ids[1], (size_t)(capacity - 1) * sizeof(page->ids[0]));
+        page->count--;
+    }
+    page->payloads[page->count] = payload;
+    page->ids[page->count] = id;
+    page->count++;
+}
+
+static void collect_log_page(app_context_t *ctx, const page_filter_t *filter, uint64_t floor_id, uint64_t until_id,
+                             int capacity, history_page_t *page)
+{
+    chat_payload_t *payloads[MESSAGE_LOG_REPLAY_CHUNK];
+    uint64_t ids[MESSAGE_LOG_REPLAY_CHUNK];
+    uint64_t cursor = floor_id;
+
+    while (cursor + 1 < until_id) {
+        log_replay_chunk_t chunk = {
+            .payloads = payloads,
+            .ids = ids,
+            .until_id = until_id,
+        };
+
+        esp_err_t ret = read_log_chunk(ctx, cursor, &chunk);
+        for (int i = 0; i < chunk.count; i++) {
+            if (payload_matches_page(payloads[i], filter)) {
+                page_keep_newest(page, capacity, payloads[i], ids[i]);
+            } else {
+                chat_payload_release(payloads[i]);
+            }
+        }
+        if (log_chunk_exhausted(ret, &chunk)) {
+            break;
+        }
+        cursor = chunk.last_id;
+    }
+}
+
+/* Decompresses entries in place, dropping any that cannot be, then drops the oldest until the frame fits. */
+static int page_fit_frame(history_page_t *page)
+{
+    int opened = 0;
+    for (int i = 0; i < page->count; i++) {
+        if (open_payload(&page->payloads[i])) {
+            page->ids[opened] = page->ids[i];
+            page->payloads[opened++] = page->payloads[i];
+        }
+    }
+    page->count = opened;
+
+    size_t bytes = 0;
+    int first = page->count;
+    while (first > 0 && bytes + page->payloads[first - 1]->len + 1 <= HISTORY_PAGE_MAX_BYTES) {
+        bytes += page->payloads[--first]->len + 1;
+    }
+    for (int i = 0; i < first; i++) {
+        chat_payload_release(page->payloads[i]);
+    }
+    page->count -= first;
+    memmove(page->payloads, page->payloads + first, (size_t)page->count * sizeof(page->payloads[0]));
+    memmove(page->ids, page->ids + first, (size_t)page->count * sizeof(page->ids[0]));
+    return first;
+}
+
+static void page_release(history_page_t *page)
+{
+    for (int i = 0; i < page->count; i++) {
+        chat_payload_release(page->payloads[i]);
+    }
+    page->count = 0;
+}
+
+/* The members of a historyPage or searchResults reply ahead of its "messages"; NULL strings are left out. */
+typedef struct {
+    const char *type;
+    const char *request_id;
+    const char *conversation;
+    const char *query;
+    bool paged;                 /* historyPage: next_before_id and has_more follow */
+    uint64_t next_before_id;
+    bool has_more;
+} reply_header_t;
+
+static void write_reply(json_writer_t *writer, const reply_header_t *header, const history_page_t *page)
+{
+    JSON_WRITER_LITERAL(writer, "{\"type\":");
+    json_writer_string(writer, header->type);
+    JSON_WRITER_LITERAL(writer, ",\"from\":\"server\"");
+    if (header->request_id != NULL) {
+        JSON_WRITER_LITERAL(writer, ",\"requestId\":");
+        json_writer_string(writer, header->request_id);
+    }
+    if (header->conversation != NULL) {
+        JSON_WRITER_LITERAL(writer, ",\"conversation\":");
+        json_writer_string(writer, header->conversation);
+    }
+    if (header->query != NULL) {
+        JSON_WRITER_LITERAL(writer, ",\"query\":");
+        json_writer_string(writer, header->query);
+    }
+    if (header->paged) {
+        JSON_WRITER_LITERAL(writer, ",\"next_before_id\":");
+        json_writer_uint(writer, header->next_before_id);
+        JSON_WRITER_LITERAL(writer, ",\"has_more\":");
+        json_writer_bool(writer, header->has_more);
+    }
+    JSON_WRITER_LITERAL(writer, ",\"messages\":[");
+    for (int i = 0; i < page->count; i++) {
+        if (i > 0) {
+            JSON_WRITER_LITERAL(writer, ",");
+        }
+        json_writer_raw(writer, page->payloads[i]->data, page->payloads[i]->len);
+    }
+    JSON_WRITER_LITERAL(writer, "]}");
+}
 
-    if (allocation_failed && !send_failed) {
+/* Sends header with the page spliced in as its "messages" array; payloads are copied as-is. */
+static esp_err_t send_with_messages(app_context_t *ctx, int fd, const reply_header_t *header,
+                                    const history_page_t *page)
+{
+    json_writer_t writer;
+    json_writer_init(&writer, NULL, 0);
+    write_reply(&writer, header, page);
+
+    size_t cap = writer.len + 1;
+    char *frame = malloc(cap);
+    if (frame == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    json_writer_init(&writer, frame, cap);
+    write_reply(&writer, header, page);
+    esp_err_t ret = json_writer_finish(&writer) ? chat_ws_send_text(ctx, fd, frame) : ESP_ERR_INVALID_SIZE;
+    free(frame);
+    return ret;
+}
+
+/*
+ * Answers historyQuery with up to `limit` visible messages older than before_id, newest last. At most
+ * HISTORY_QUERY_SCAN_IDS ids are examined per request; next_before_id tells the client where to resume.
+ */
+void chat_history_send_page(app_context_t *ctx, int fd, const history_query_t *query)
+{
+    history_page_t *page = calloc(2, sizeof(*page));
+    history_page_t *newer = page ? &page[1] : NULL;
+    if (ctx == NULL || query == NULL || page == NULL ||
+        xSemaphoreTake(ctx->message_mutex, portMAX_DELAY) != pdTRUE) {
+        free(page);
         chat_ws_send_error(ctx, fd, "server_busy", "Message history is temporarily unavailable");
+        return;
     }
 
-    ESP_LOGI(TAG, "Sent %d history messages to fd=%d since_id=%" PRIu64, sent, fd, since_id);
-    free(payloads);
+    int limit = query->limit > HISTORY_QUERY_MAX_LIMIT ? HISTORY_QUERY_MAX_LIMIT : query->limit;
+    uint64_t before_id = query->before_id;
+    if (before_id == 0 || before_id > ctx->message_id_counter + 1) {
+        before_id = ctx->message_id_counter + 1;
+    }
+    uint64_t floor_id = before_id > HISTORY_QUERY_SCAN_IDS + 1 ? before_id - 1 - HISTORY_QUERY_SCAN_IDS : 0;
+
+    page_filter_t filter = {
+        .query = query,
+        .groups = &ctx->groups,
+        .self_handle = chat_user_table_find(&ctx->message_users, query->user_id),
+        .peer_handle = chat_user_table_find(&ctx->message_users, query->conversation),
+        .group_hash = chat_recipients_group_hash(query->conversation),
+    };
+
+    history_bounds_t bounds;
+    chat_history_fill_bounds_locked(ctx, &bounds);
+    uint64_t ring_floor = bounds.count > 0 ? bounds.earliest_id : bounds.current_id + 1;
+
+    for (int i = first_position_after_locked(ctx, before_id - 1) - 1; i >= 0 && newer->count < limit; i--) {
+        const message_t *message = logical_message_locked(ctx, i);
+        if (message->id <= floor_id) {
+            break;
+        }
+        if (message_matches_page_locked(message, &filter)) {
+            newer->ids[newer->count] = message->id;
+            newer->payloads[newer->count++] = chat_payload_ref(message->payload);
+        }
+    }
+
+    xSemaphoreGive(ctx->message_mutex);
+
+    uint64_t earliest_stored = bounds.earliest_id;
+    uint64_t log_earliest = 0;
+    if (ctx->message_log.ready && xSemaphoreTake(ctx->message_log_mutex, portMAX_DELAY) == pdTRUE) {
+        if (chat_message_log_bounds(&ctx->message_log, &log_earliest, NULL) &&
+            (earliest_stored == 0 || log_earliest < earliest_stored)) {
+            earliest_stored = log_earliest;
+        }
+        xSemaphoreGive(ctx->message_log_mutex);
+    }
+
+    uint64_t log_until = before_id < ring_floor ? before_id : ring_floor;
+    if (newer->count < limit && ctx->message_log.ready && floor_id + 1 < log_until) {
+        collect_log_page(ctx, &filter, floor_id, log_until, limit - newer->count, page);
+    }
+    for (int i = newer->count - 1; i >= 0; i--) {
+        page->payloads[page->count] = newer->payloads[i];
+        page->ids[page->count++] = newer->ids[i];
+    }
+
+    /* If the frame overflowed, the cursor resumes from the oldest message that was sent. */
+    int dropped = page_fit_frame(page);
+    bool truncated = dropped > 0 || page->count == limit;
+    uint64_t next_before_id = truncated && page->count > 0 ? page->ids[0] : floor_id + 1;
+    bool has_more = earliest_stored != 0 && next_before_id > earliest_stored;
+
+    reply_header_t header = {
+        .type = "historyPage",
+        .request_id = query->request_id,
+        .conversation = query->conversation,
+        .paged = true,
+        .next_before_id = next_before_id,
+        .has_more = has_more,
+    };
+    esp_err_t ret = send_with_messages(ctx, fd, &header, page);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "History page send failed for fd=%d: %s", fd, esp_err_to_name(ret));
+    }
+    page_release(page);
+    free(page);
 }
 
-esp_err_t chat_history_finalize_and_store_message(app_context_t *ctx, cJSON *root, char **payload_out)
+typedef struct {
+    app_context_t *ctx;
+    const history_search_t *search;
+    int handle;
+    history_page_t *page;
+} search_collect_t;
+
+static bool collect_search_hit(uint64_t id, void *arg)
 {
-    char *payload = NULL;
+    search_collect_t *collect = (search_collect_t *)arg;
+    app_context_t *ctx = collect->ctx;
+
+    int position = first_position_after_locked(ctx, id - 1);
+    if (position < ctx->message_count) {
+        const message_t *message = logical_message_locked(ctx, position);
+        if (message->id == id &&
+            chat_recipients_visible(&ctx->groups, &message->recipients, collect->handle, message->payload,
+                                    collect->search->user_id)) {
+            history_page_t *page = collect->page;
+            page->ids[page->count] = id;
+            page->payloads[page->count++] = chat_payload_ref(message->payload);
+        }
+    }
+    return collect->page->count < collect->search->limit;
+}
+
+/* Answers a search request from the index; hits are newest first and only messages the user may see are sent. */
+void chat_history_send_search(app_context_t *ctx, int fd, const history_search_t *search)
+{
+    history_page_t *page = calloc(1, sizeof(*page));
+    if (ctx == NULL || search == NULL || page == NULL ||
+        xSemaphoreTake(ctx->message_mutex, portMAX_DELAY) != pdTRUE) {
+        free(page);
+        chat_ws_send_error(ctx, fd, "server_busy", "Search is temporarily unavailable");
+        return;
+    }
+
+    search_collect_t collect = {
+        .ctx = ctx,
+        .search = search,
+        .handle = chat_user_table_find(&ctx->message_users, search->user_id),
+        .page = page,
+    };
+    chat_search_query(&ctx->message_search, search->query, collect_search_hit, &collect);
+    xSemaphoreGive(ctx->message_mutex);
+
+    for (int i = 0, j = page->count - 1; i < j; i++, j--) {
+        chat_payload_t *payload = page->payloads[i];
+        uint64_t id = page->ids[i];
+        page->payloads[i] = page->payloads[j];
+        page->ids[i] = page->ids[j];
+        page->payloads[j] = payload;
+        page->ids[j] = id;
+    }
+    page_fit_frame(page);
+
+    reply_header_t header = {
+        .type = "searchResults",
+        .request_id = search->request_id,
+        .query = search->query,
+    };
+    esp_err_t ret = send_with_messages(ctx, fd, &header, page);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Search results send failed for fd=%d: %s", fd, esp_err_to_name(ret));
+    }
+    page_release(page);
+    free(page);
+}
+
+static void evict_oldest_locked(app_context_t *ctx)
+{
+    message_t *oldest = &ctx->message_buffer[oldest_index_locked(ctx)];
+    if (oldest->payload->flags & CHAT_PAYLOAD_FLAG_ARENA) {
+        ctx->message_live_bytes -= chat_history_arena_record_size(oldest->payload->len);
+    }
+    chat_recipients_release(&ctx->message_users, &oldest->recipients);
+    chat_search_evict_through(&ctx->message_search, oldest->id);
+    chat_payload_release(oldest->payload);
+    oldest->payload = NULL;
+    oldest->id = 0;
+    ctx->message_count--;
+}
+
+/* Evicting only frees arena space while the oldest record is ours alone; a replay in flight pins it. */
+static bool eviction_frees_arena_locked(app_context_t *ctx)
+{
+    if (ctx->message_count == 0) {
+        return false;
+    }
+
+    chat_payload_t *oldest = ctx->message_buffer[oldest_index_locked(ctx)].payload;
+    if ((oldest->flags & CHAT_PAYLOAD_FLAG_ARENA) == 0) {
+        return true;
+    }
+    return oldest == chat_history_arena_oldest(&ctx->message_arena) &&
+           atomic_load_explicit(&oldest->refs, memory_order_acquire) == 1;
+}
+
+static chat_payload_t *store_payload_locked(app_context_t *ctx, uint64_t id, const chat_frame_t *message,
+                                            const char *data, size_t len)
+{
+    chat_history_arena_t *arena = &ctx->message_arena;
+    uint8_t *packed = HISTORY_COMPRESSION ? malloc(len) : NULL;
+    size_t packed_len = packed ? chat_compress(data, len, packed, len) : 0;
+    if (packed_len > 0) {
+        data = (const char *)packed;
+        len = packed_len;
+    }
+    size_t need = chat_history_arena_record_size(len);
+
+    if (ctx->message_count == MAX_MESSAGES) {
+        evict_oldest_locked(ctx);
+    }
+
+    chat_history_arena_reclaim(arena);
+    chat_payload_t *payload = chat_history_arena_alloc(arena, data, len);
+    if (arena->base != NULL && need <= arena->capacity) {
+        while (payload == NULL && eviction_frees_arena_locked(ctx)) {
+            evict_oldest_locked(ctx);
+            chat_history_arena_reclaim(arena);
+            payload = chat_history_arena_alloc(arena, data, len);
+        }
+    }
+
+    if (payload != NULL) {
+        ctx->message_live_bytes += need;
+    } else {
+        payload = chat_payload_create(data, len);
+        if (payload == NULL) {
+            free(packed);
+            return NULL;
+        }
+        ctx->message_heap_fallbacks++;
+    }
+    if (packed_len > 0) {
+        payload->flags |= CHAT_PAYLOAD_FLAG_COMPRESSED;
+    }
+    free(packed);
+
+    message_t *slot = &ctx->message_buffer[ctx->message_buffer_head];
+    slot->payload = payload;
+    slot->id = id;
+    chat_recipients_from_frame(&ctx->message_users, message, &slot->recipients);
+
+    if (message != NULL && chat_field_equals(&message->type, "text") && message->data.type == JSON_SCAN_STRING) {
+        chat_search_add(&ctx->message_search, id, message->data.str, message->data.len);
+    }
+    ctx->message_buffer_head = (ctx->message_buffer_head + 1) % MAX_MESSAGES;
+    ctx->message_count++;
+    return payload;
+}
+
+void chat_history_init(app_context_t *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+
+    esp_err_t ret = chat_history_arena_init(&ctx->message_arena, MESSAGE_HISTORY_BYTES);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "History arena unavailable, message bodies fall back to the heap: %s", esp_err_to_name(ret));
+    }
+
+    ret = chat_search_init(&ctx->message_search, SEARCH_INDEX_BYTES);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Search index unavailable: %s", esp_err_to_name(ret));
+    }
+}
+
+typedef struct {
+    app_context_t *ctx;
+    int restored;
+} log_restore_state_t;
+
+static bool restore_log_record(uint64_t id, const char *payload, size_t len, void *arg)
+{
+    /* Restore runs once under message_mutex; the frame is too large for the caller's stack. */
+    static chat_frame_t frame;
+    log_restore_state_t *state = (log_restore_state_t *)arg;
+    cJSON *message = cJSON_ParseWithLength(payload, len);
+    if (cJSON_IsObject(message)) {
+        chat_frame_from_json(message, &frame);
+        /*
+         * Groups missing from the registry are adopted from their newGroup records, or from a group
+         * message that listed its members. Replaying in id order also replays the eviction order.
+         * A group message keeps the members it listed; only older records without them are expanded.
+         */
+        if (chat_field_equals(&frame.type, "newGroup")) {
+            chat_groups_register(state->ctx, &frame.group_id, &frame, false);
+        } else if (frame.to_group.type == JSON_SCAN_STRING &&
+                   chat_groups_use(&state->ctx->groups, frame.to_group.str, frame.to_group.len) == NULL &&
+                   frame.user_count > 0) {
+            chat_groups_register(state->ctx, &frame.to_group, &frame, false);
+        }
+        if (frame.user_count == 0) {
+            chat_groups_expand_frame(&state->ctx->groups, &frame);
+        }
+    }
+    chat_payload_t *stored = store_payload_locked(state->ctx, id, cJSON_IsObject(message) ? &frame : NULL, payload, len);
+    cJSON_Delete(message);
+
+    if (stored == NULL) {
+        return false;
+    }
+    state->restored++;
+    return true;
+}
+
+void chat_history_restore_from_log(app_context_t *ctx)
+{
+    uint64_t latest_id = 0;
+    if (ctx == NULL || !chat_message_log_bounds(&ctx->message_log, NULL, &latest_id)) {
+        return;
+    }
+
+    if (xSemaphoreTake(ctx->message_mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    log_restore_state_t state = { .ctx = ctx };
+    uint32_t group_clock = atomic_load(&ctx->groups.use_clock);
+    uint64_t since_id = latest_id > MAX_MESSAGES ? latest_id - MAX_MESSAGES : 0;
+    xSemaphoreTake(ctx->message_log_mutex, portMAX_DELAY);
+    chat_message_log_read_after(&ctx->message_log, since_id, MAX_MESSAGES, restore_log_record, &state);
+    xSemaphoreGive(ctx->message_log_mutex);
+
+    if (latest_id > ctx->message_id_counter && latest_id <= CHAT_MESSAGE_MAX_SAFE_ID) {
+        ESP_LOGW(TAG, "Message log is ahead of the stored id counter; advancing to %" PRIu64, latest_id);
+        ctx->message_id_counter = latest_id;
+        ctx->boot_start_id = latest_id < CHAT_MESSAGE_MAX_SAFE_ID ? latest_id + 1 : CHAT_MESSAGE_MAX_SAFE_ID;
+    }
+
+    xSemaphoreGive(ctx->message_mutex);
+    if (atomic_load(&ctx->groups.use_clock) != group_clock) {
+        chat_groups_save(ctx);
+    }
+    ESP_LOGI(TAG, "Restored %d messages from the message log", state.restored);
+}
+
+static void write_users(json_writer_t *writer, const chat_frame_t *frame)
+{
+    JSON_WRITER_LITERAL(writer, "[");
+    for (int i = 0; i < frame->user_count; i++) {
+        if (i > 0) {
+            JSON_WRITER_LITERAL(writer, ",");
+        }
+        json_writer_string_n(writer, frame->users[i].str, frame->users[i].len);
+    }
+    JSON_WRITER_LITERAL(writer, "]");
+}
+
+/*
+ * A group message is stored with the members it was sent to, as expanded from the registry, so
+ * who can read it later does not depend on which entry holds its group id by then.
+ */
+static char *group_users_json(const chat_frame_t *frame)
+{
+    json_writer_t writer;
+    json_writer_init(&writer, NULL, 0);
+    write_users(&writer, frame);
+
+    size_t cap = writer.len + 1;
+    char *users = malloc(cap);
+    if (users != NULL) {
+        json_writer_init(&writer, users, cap);
+        write_users(&writer, frame);
+        json_writer_finish(&writer);
+    }
+    return users;
+}
+
+esp_err_t chat_history_finalize_and_store_message(app_context_t *ctx, const chat_frame_t *frame, const char *src,
+                                                  size_t len, chat_payload_t **payload_out)
+{
+    /* Case-insensitive like cJSON lookups, so a client "ID" cannot shadow the server id. */
+    static const char *const server_fields[] = { "id", "timestamp", NULL };
+    chat_payload_t *payload = NULL;
+    bool wait_for_commit = false;
+    uint64_t id = 0;
     esp_err_t ret = ESP_OK;
 
-    if (ctx == NULL || payload_out == NULL) {
+    if (ctx == NULL || frame == NULL || src == NULL || payload_out == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
     *payload_out = NULL;
 
+    char *to_users = NULL;
+    if (frame->to_group.type == JSON_SCAN_STRING && (to_users = group_users_json(frame)) == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
     if (xSemaphoreTake(ctx->message_mutex, portMAX_DELAY) != pdTRUE) {
+        free(to_users);
         return ESP_ERR_TIMEOUT;
     }
 
@@ -239,39 +1214,57 @@ esp_err_t chat_history_finalize_and_store_message(app_context_t *ctx, cJSON *roo
         goto out;
     }
 
-    uint64_t id = ctx->message_id_counter + 1;
-    int64_t timestamp = current_timestamp_s(ctx);
-
-    cJSON_DeleteItemFromObjectCaseSensitive(root, "id");
-    cJSON_DeleteItemFromObjectCaseSensitive(root, "timestamp");
-    if (cJSON_AddNumberToObject(root, "id", (double)id) == NULL ||
-        cJSON_AddNumberToObject(root, "timestamp", (double)timestamp) == NULL) {
-        ret = ESP_ERR_NO_MEM;
-        goto out;
-    }
+    id = ctx->message_id_counter + 1;
+    char stamp[64];
+    snprintf(stamp, sizeof(stamp), "\"id\":%" PRIu64 ",\"timestamp\":%" PRId64, id, current_timestamp_s(ctx));
 
-    payload = cJSON_PrintUnformatted(root);
-    if (payload != NULL) {
-        ret = chat_message_ids_persist(id, ctx->boot_start_id);
+    if (id > ctx->message_id_lease) {
+        uint64_t lease = chat_message_ids_next_lease(id);
+        ret = chat_message_ids_reserve(lease, ctx->boot_start_id);
         if (ret != ESP_OK) {
-            free(payload);
             goto out;
         }
+        ctx->message_id_lease = lease;
+    }
 
-        if (ctx->message_buffer[ctx->message_buffer_head].payload != NULL) {
-            free(ctx->message_buffer[ctx->message_buffer_head].payload);
-        }
-
+    chat_frame_rewrite_t rewrite = {
+        .strip = server_fields,
+        .fill_to = true,
+        .to_users = to_users,
+        .append = stamp,
+    };
+    size_t printed_len = 0;
+    char *printed = chat_frame_rewrite(src, len, &rewrite, &printed_len);
+    /*
+     * The broadcast needs plain text, and a compressed history entry stays behind in the ring. The
+     * copy is made before the store, so running out of memory leaves no message for a retry to repeat.
+     */
+    chat_payload_t *plain = printed && HISTORY_COMPRESSION ? chat_payload_create(printed, printed_len) : NULL;
+    if (printed != NULL && (plain != NULL || !HISTORY_COMPRESSION)) {
+        payload = store_payload_locked(ctx, id, frame, printed, printed_len);
+    }
+    if (payload != NULL) {
         ctx->message_id_counter = id;
-        ctx->message_buffer[ctx->message_buffer_head].payload = payload;
-        ctx->message_buffer[ctx->message_buffer_head].id = id;
-        ctx->message_buffer_head = (ctx->message_buffer_head + 1) % MAX_MESSAGES;
-        *payload_out = payload;
+        if (payload->flags & CHAT_PAYLOAD_FLAG_COMPRESSED) {
+            *payload_out = plain;
+            plain = NULL;
+        } else {
+            *payload_out = chat_payload_ref(payload);
+        }
+        TaskHandle_t waiter = MESSAGE_LOG_ACK_AFTER_COMMIT ? xTaskGetCurrentTaskHandle() : NULL;
+        wait_for_commit = chat_persist_enqueue_locked(ctx, id, *payload_out, waiter);
     } else {
         ret = ESP_ERR_NO_MEM;
     }
+    chat_payload_release(plain);
+    free(printed);
 
 out:
     xSemaphoreGive(ctx->message_mutex);
+    free(to_users);
+    /* A failed or slow commit is only logged; the message is already in the in-memory history. */
+    if (wait_for_commit) {
+        chat_persist_wait(id);
+    }
     return ret;
 }
@@ -0,0 +1,116 @@
+#include "chat/history_arena.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN alignof(chat_payload_t)
+
+esp_err_t chat_history_arena_init(chat_history_arena_t *arena, size_t capacity)
+{
+    if (arena == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(arena, 0, sizeof(*arena));
+    capacity &= ~(size_t)(ARENA_ALIGN - 1);
+    arena->base = malloc(capacity);
+    if (arena->base == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    arena->capacity = capacity;
+    return ESP_OK;
+}
+
+size_t chat_history_arena_record_size(size_t len)
+{
+    size_t size = offsetof(chat_payload_t, data) + len + 1;
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static size_t free_bytes_at(const chat_history_arena_t *arena, size_t offset)
+{
+    if (arena->wrap != 0) {
+        return arena->head - offset;
+    }
+    return arena->capacity - offset;
+}
+
+chat_payload_t *chat_history_arena_alloc(chat_history_arena_t *arena, const char *data, size_t len)
+{
+    if (arena == NULL || arena->base == NULL || data == NULL || len > UINT32_MAX - 1) {
+        return NULL;
+    }
+
+    size_t need = chat_history_arena_record_size(len);
+    if (arena->used == 0) {
+        arena->head = 0;
+        arena->tail = 0;
+        arena->wrap = 0;
+    }
+
+    size_t offset = arena->tail;
+    if (need > free_bytes_at(arena, offset)) {
+        /* Only an unwrapped log can restart at 0, and only if the oldest record is far enough in. */
+        if (arena->wrap != 0 || need > arena->head) {
+            return NULL;
+        }
+        arena->wrap = arena->tail;
+        offset = 0;
+    }
+
+    chat_payload_t *payload = (chat_payload_t *)(arena->base + offset);
+    atomic_init(&payload->refs, 1);
+    payload->len = (uint32_t)len;
+    payload->flags = CHAT_PAYLOAD_FLAG_ARENA;
+    memcpy(payload->data, data, len);
+    payload->data[len] = '\0';
+
+    arena->tail = offset + need;
+    arena->used += need;
+    return payload;
+}
+
+chat_payload_t *chat_history_arena_oldest(const chat_history_arena_t *arena)
+{
+    if (arena == NULL || arena->used == 0) {
+        return NULL;
+    }
+    return (chat_payload_t *)(arena->base + arena->head);
+}
+
+void chat_history_arena_reclaim(chat_history_arena_t *arena)
+{
+    if (arena == NULL) {
+        return;
+    }
+
+    while (arena->used > 0) {
+        chat_payload_t *oldest = (chat_payload_t *)(arena->base + arena->head);
+        if (atomic_load_explicit(&oldest->refs, memory_order_acquire) != 0) {
+            break;
+        }
+
+        size_t size = chat_history_arena_record_size(oldest->len);
+        arena->head += size;
+        arena->used -= size;
+        if (arena->wrap != 0 && arena->head == arena->wrap) {
+            arena->head = 0;
+            arena->wrap = 0;
+        }
+    }
+
+    if (arena->used == 0) {
+        arena->head = 0;
+        arena->tail = 0;
+        arena->wrap = 0;
+    }
+}
+
+size_t chat_history_arena_gap(const chat_history_arena_t *arena)
+{
+    if (arena == NULL || arena->wrap == 0) {
+        return 0;
+    }
+    return arena->capacity - arena->wrap;
+}
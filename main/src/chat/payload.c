@@ -0,0 +1,55 @@
+#include "chat/payload.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+chat_payload_t *chat_payload_alloc(size_t len)
+{
+    if (len > UINT32_MAX - 1) {
+        return NULL;
+    }
+
+    chat_payload_t *payload = malloc(sizeof(*payload) + len + 1);
+    if (payload == NULL) {
+        return NULL;
+    }
+
+    atomic_init(&payload->refs, 1);
+    payload->len = (uint32_t)len;
+    payload->flags = 0;
+    payload->data[len] = '\0';
+    return payload;
+}
+
+chat_payload_t *chat_payload_create(const char *data, size_t len)
+{
+    if (data == NULL) {
+        return NULL;
+    }
+
+    chat_payload_t *payload = chat_payload_alloc(len);
+    if (payload != NULL) {
+        memcpy(payload->data, data, len);
+    }
+    return payload;
+}
+
+chat_payload_t *chat_payload_ref(chat_payload_t *payload)
+{
+    if (payload != NULL) {
+        atomic_fetch_add_explicit(&payload->refs, 1, memory_order_relaxed);
+    }
+    return payload;
+}
+
+void chat_payload_release(chat_payload_t *payload)
+{
+    if (payload == NULL) {
+        return;
+    }
+
+    if (atomic_fetch_sub_explicit(&payload->refs, 1, memory_order_acq_rel) == 1 &&
+        (payload->flags & CHAT_PAYLOAD_FLAG_ARENA) == 0) {
+        free(payload);
+    }
+}
@@ -0,0 +1,193 @@
+#include "chat/persist.h"
+
+#include <inttypes.h>
+
+#include "esp_log.h"
+
+#include "chat/groups.h"
+
+static const char *TAG = "CHAT_PERSIST";
+
+#define NOTIFY_FAILED 1u
+
+/* An item without a payload asks for a group registry save instead of a log record. */
+typedef struct {
+    uint64_t id;
+    chat_payload_t *payload;
+    TaskHandle_t waiter;
+    esp_err_t result;
+} persist_item_t;
+
+/* The low id bits let a waiter tell its own commit from a late one for an earlier timed-out wait. */
+static uint32_t notify_value(uint64_t id, esp_err_t ret)
+{
+    return ((uint32_t)id << 1) | (ret == ESP_OK ? 0 : NOTIFY_FAILED);
+}
+
+static void write_group(app_context_t *ctx, persist_item_t *items, int count)
+{
+    int appended = 0;
+    bool save_groups = false;
+
+    xSemaphoreTake(ctx->message_log_mutex, portMAX_DELAY);
+    for (int i = 0; i < count; i++) {
+        if (items[i].payload == NULL) {
+            save_groups = true;
+            continue;
+        }
+        items[i].result = chat_message_log_append(&ctx->message_log, items[i].id, items[i].payload->data,
+                                                  items[i].payload->len);
+        if (items[i].result == ESP_OK) {
+            appended++;
+        }
+    }
+    esp_err_t flush_ret = appended > 0 ? chat_message_log_flush(&ctx->message_log) : ESP_OK;
+    xSemaphoreGive(ctx->message_log_mutex);
+
+    if (save_groups) {
+        atomic_store(&ctx->groups.save_queued, false);
+        chat_groups_save(ctx);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (items[i].payload == NULL) {
+            continue;
+        }
+        if (items[i].result == ESP_OK) {
+            items[i].result = flush_ret;
+        }
+        if (items[i].result != ESP_OK) {
+            ESP_LOGW(TAG, "Message %" PRIu64 " was not written to the message log: %s", items[i].id,
+                     esp_err_to_name(items[i].result));
+        }
+    }
+}
+
+/*
+ * Waits for the first record, then gathers more until the group is full. When nobody waits on the
+ * commit it lingers up to MESSAGE_LOG_COMMIT_MS for stragglers; otherwise it only takes what is queued.
+ */
+static int gather_group(app_context_t *ctx, persist_item_t *items)
+{
+    xQueueReceive(ctx->persist_queue, &items[0], portMAX_DELAY);
+
+    TickType_t start = xTaskGetTickCount();
+    TickType_t linger = pdMS_TO_TICKS(MESSAGE_LOG_COMMIT_MS);
+    bool waited_on = items[0].waiter != NULL;
+    size_t bytes = items[0].payload ? items[0].payload->len : 0;
+    int count = 1;
+
+    while (count < PERSIST_BATCH_RECORDS && bytes < PERSIST_BATCH_BYTES) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        TickType_t wait = waited_on || elapsed >= linger ? 0 : linger - elapsed;
+        if (xQueueReceive(ctx->persist_queue, &items[count], wait) != pdTRUE) {
+            break;
+        }
+        waited_on = waited_on || items[count].waiter != NULL;
+        bytes += items[count].payload ? items[count].payload->len : 0;
+        count++;
+    }
+    return count;
+}
+
+static void persist_task(void *arg)
+{
+    app_context_t *ctx = (app_context_t *)arg;
+    persist_item_t items[PERSIST_BATCH_RECORDS];
+
+    for (;;) {
+        int count = gather_group(ctx, items);
+        write_group(ctx, items, count);
+        ctx->persist_commits++;
+
+        for (int i = 0; i < count; i++) {
+            if (items[i].waiter != NULL) {
+                xTaskNotify(items[i].waiter, notify_value(items[i].id, items[i].result), eSetValueWithOverwrite);
+            }
+            chat_payload_release(items[i].payload);
+        }
+    }
+}
+
+esp_err_t chat_persist_start(app_context_t *ctx)
+{
+    if (ctx == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ctx->persist_queue = xQueueCreate(PERSIST_QUEUE_DEPTH, sizeof(persist_item_t));
+    if (ctx->persist_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreate(persist_task, "persist_task", 4096, ctx, 5, NULL) != pdPASS) {
+        vQueueDelete(ctx->persist_queue);
+        ctx->persist_queue = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool chat_persist_enqueue_locked(app_context_t *ctx, uint64_t id, chat_payload_t *payload, TaskHandle_t waiter)
+{
+    if (ctx == NULL || payload == NULL || !ctx->message_log.ready) {
+        return false;
+    }
+
+    /* Without a writer task records are committed inline, as before it existed. */
+    if (ctx->persist_queue == NULL) {
+        persist_item_t item = { .id = id, .payload = payload };
+        write_group(ctx, &item, 1);
+        return false;
+    }
+
+    persist_item_t item = {
+        .id = id,
+        .payload = chat_payload_ref(payload),
+        .waiter = waiter,
+    };
+    if (xQueueSend(ctx->persist_queue, &item, pdMS_TO_TICKS(PERSIST_ENQUEUE_WAIT_MS)) != pdTRUE) {
+        chat_payload_release(payload);
+        ctx->persist_dropped++;
+        ESP_LOGW(TAG, "Storage queue full; message %" PRIu64 " will not be persisted", id);
+        return false;
+    }
+    return waiter != NULL;
+}
+
+esp_err_t chat_persist_wait(uint64_t id)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(PERSIST_ACK_TIMEOUT_MS);
+    uint32_t value = 0;
+
+    for (;;) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout || xTaskNotifyWait(0, UINT32_MAX, &value, timeout - elapsed) != pdTRUE) {
+            ESP_LOGW(TAG, "Timed out waiting for message %" PRIu64 " to be committed", id);
+            return ESP_ERR_TIMEOUT;
+        }
+        if ((value & ~NOTIFY_FAILED) == notify_value(id, ESP_OK)) {
+            return (value & NOTIFY_FAILED) ? ESP_FAIL : ESP_OK;
+        }
+    }
+}
+
+void chat_persist_save_groups(app_context_t *ctx)
+{
+    if (ctx == NULL || ctx->groups.base_path == NULL) {
+        return;
+    }
+    if (ctx->persist_queue == NULL) {
+        chat_groups_save(ctx);
+        return;
+    }
+    if (atomic_exchange(&ctx->groups.save_queued, true)) {
+        return;
+    }
+
+    persist_item_t item = { 0 };
+    if (xQueueSend(ctx->persist_queue, &item, pdMS_TO_TICKS(PERSIST_ENQUEUE_WAIT_MS)) != pdTRUE) {
+        atomic_store(&ctx->groups.save_queued, false);
+        ESP_LOGW(TAG, "Storage queue full; the group registry is saved with the next registration");
+    }
+}
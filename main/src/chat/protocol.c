@@ -1,18 +1,63 @@
 #include "chat/protocol.h"
 
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "esp_log.h"
 
+#include "chat/frame.h"
+#include "chat/groups.h"
 #include "chat/history.h"
+#include "chat/recipients.h"
 #include "chat/sessions.h"
+#include "common/json_writer.h"
+#include "common/msgpack.h"
 #include "common/utils.h"
 #include "server/websocket_server.h"
 #include "storage/message_id_store.h"
 
 static const char *TAG = "CHAT_PROTOCOL";
 
+typedef struct {
+    chat_frame_t frame;
+    const char *src;
+    size_t len;
+    cJSON *root;
+    char *normalized;
+    chat_admission_t admission;
+} inbound_t;
+
+/* Frames taken by the scanner carry no tree; only the fallback paths below build one. */
+static cJSON *inbound_root(inbound_t *in)
+{
+    if (in->root == NULL) {
+        in->root = cJSON_ParseWithLength(in->src, in->len);
+    }
+    return in->root;
+}
+
+/*
+ * Stored and relayed frames are spliced from the received bytes. Input the splice cannot copy
+ * verbatim (lenient syntax cJSON accepted, escaped keys) is reprinted by cJSON once first.
+ */
+static bool inbound_rewritable(inbound_t *in)
+{
+    if (in->normalized != NULL || chat_frame_can_rewrite(in->src, in->len)) {
+        return true;
+    }
+
+    cJSON *root = inbound_root(in);
+    in->normalized = root ? cJSON_PrintUnformatted(root) : NULL;
+    if (in->normalized == NULL) {
+        return false;
+    }
+    in->src = in->normalized;
+    in->len = strlen(in->normalized);
+    return chat_frame_can_rewrite(in->src, in->len);
+}
+
 static bool validate_to_object(cJSON *root)
 {
     cJSON *to = cJSON_GetObjectItem(root, "to");
@@ -49,43 +94,70 @@ static bool validate_to_object(cJSON *root)
         }
     }
 
+    cJSON *group = cJSON_GetObjectItem(to, "group");
+    if (group != NULL) {
+        return json_string_in_range(group, MAX_GROUP_ID_LEN, false) && !cJSON_IsTrue(all);
+    }
+
     return cJSON_IsTrue(all) || cJSON_GetArraySize(users) > 0;
 }
 
-static bool message_visible_to_user(cJSON *message, const char *user_id)
+static bool field_target_valid(const chat_frame_t *frame)
 {
-    if (!cJSON_IsObject(message) || user_id == NULL || user_id[0] == '\0') {
+    if (frame->to.type != JSON_SCAN_OBJECT || !frame->users_valid ||
+        (frame->to_all.type != JSON_SCAN_NONE && frame->to_all.type != JSON_SCAN_TRUE &&
+         frame->to_all.type != JSON_SCAN_FALSE)) {
         return false;
     }
 
-    cJSON *from = cJSON_GetObjectItem(message, "from");
-    if (cJSON_IsString(from) && from->valuestring != NULL && strcmp(from->valuestring, user_id) == 0) {
-        return true;
+    for (int i = 0; i < frame->user_count; i++) {
+        if (!chat_field_string_in_range(&frame->users[i], MAX_USER_ID_LEN, false)) {
+            return false;
+        }
     }
 
-    cJSON *to = cJSON_GetObjectItem(message, "to");
-    if (!cJSON_IsObject(to)) {
-        return false;
+    /*
+     * A group message names its group instead of listing the members. It may list them as well,
+     * so a group the server does not know (yet, or any more) is registered from the message.
+     */
+    if (frame->to_group.type != JSON_SCAN_NONE) {
+        return chat_field_string_in_range(&frame->to_group, MAX_GROUP_ID_LEN, false) &&
+            frame->to_all.type != JSON_SCAN_TRUE;
     }
 
-    cJSON *all = cJSON_GetObjectItem(to, "all");
-    if (cJSON_IsTrue(all)) {
-        return true;
-    }
+    return frame->to_all.type == JSON_SCAN_TRUE || frame->user_count > 0;
+}
 
-    return json_array_contains_string(cJSON_GetObjectItem(to, "users"), user_id);
+/* A groupId next to to.group must name the same group. */
+static bool group_id_matches_target(const chat_frame_t *frame)
+{
+    return frame->group_id.type == JSON_SCAN_NONE ||
+        (frame->group_id.type == JSON_SCAN_STRING && frame->group_id.len == frame->to_group.len &&
+         memcmp(frame->group_id.str, frame->to_group.str, frame->to_group.len) == 0);
 }
 
-static bool json_safe_message_id(cJSON *item, bool allow_zero, uint64_t *id_out)
+static esp_err_t send_group_error(app_context_t *ctx, int fd, esp_err_t ret)
+{
+    if (ret == ESP_ERR_INVALID_STATE) {
+        return chat_ws_send_error(ctx, fd, "group_exists", "Group id is already registered with other members");
+    }
+    if (ret == ESP_ERR_INVALID_SIZE) {
+        return chat_ws_send_error(ctx, fd, "group_limit", "Group registry or member list is full");
+    }
+    ESP_LOGW(TAG, "Unable to register group: %s", esp_err_to_name(ret));
+    return chat_ws_send_error(ctx, fd, "server_busy", "Unable to register group");
+}
+
+static bool field_safe_message_id(const chat_field_t *field, bool allow_zero, uint64_t *id_out)
 {
-    if (!cJSON_IsNumber(item) ||
-        item->valuedouble < (allow_zero ? 0 : 1) ||
-        item->valuedouble > (double)CHAT_MESSAGE_MAX_SAFE_ID) {
+    if (field->type != JSON_SCAN_NUMBER ||
+        field->number < (allow_zero ? 0 : 1) ||
+        field->number > (double)CHAT_MESSAGE_MAX_SAFE_ID) {
         return false;
     }
 
-    uint64_t parsed = (uint64_t)item->valuedouble;
-    if ((double)parsed != item->valuedouble) {
+    uint64_t parsed = (uint64_t)field->number;
+    if ((double)parsed != field->number) {
         return false;
     }
 
@@ -95,44 +167,26 @@ static bool json_safe_message_id(cJSON *item, bool allow_zero, uint64_t *id_out)
     return true;
 }
 
-static esp_err_t relay_payload_to_targets(app_context_t *ctx, cJSON *to, const char *payload)
+static bool json_safe_message_id(cJSON *item, bool allow_zero, uint64_t *id_out)
 {
-    if (ctx == NULL || !cJSON_IsObject(to) || payload == NULL) {
-        return ESP_ERR_INVALID_ARG;
-    }
-
-    cJSON *all = cJSON_GetObjectItem(to, "all");
-    cJSON *users = cJSON_GetObjectItem(to, "users");
-    bool send_all = cJSON_IsTrue(all);
+    chat_field_t field;
+    chat_field_from_json(item, &field);
+    return field_safe_message_id(&field, allow_zero, id_out);
+}
 
-    if (!send_all && (!cJSON_IsArray(users) || cJSON_GetArraySize(users) == 0)) {
+/* delivered counts the sessions the payload was written to. */
+static esp_err_t relay_payload_to_targets(app_context_t *ctx, const chat_frame_t *targets, const char *payload,
+                                          int *delivered)
+{
+    *delivered = 0;
+    if (ctx == NULL || targets == NULL || !targets->users_valid || targets->user_count == 0 || payload == NULL) {
         return ESP_ERR_INVALID_ARG;
     }
 
     int fds[MAX_CLIENTS];
-    int fd_count = 0;
-
-    if (xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
-        return ESP_ERR_TIMEOUT;
-    }
-
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (!ctx->client_slots[i].active || !ctx->client_slots[i].joined || ctx->client_slots[i].user_id[0] == '\0') {
-            continue;
-        }
-        if (!send_all && !json_array_contains_string(users, ctx->client_slots[i].user_id)) {
-            continue;
-        }
-
-        if (fd_count < MAX_CLIENTS) {
-            fds[fd_count++] = ctx->client_slots[i].fd;
-        }
-    }
-
-    xSemaphoreGive(ctx->client_mutex);
+    int fd_count = chat_sessions_user_fds(ctx, targets->users, targets->user_count, fds);
 
     esp_err_t first_error = ESP_OK;
-    bool closed_client = false;
     for (int i = 0; i < fd_count; i++) {
         esp_err_t ret = chat_ws_send_text(ctx, fds[i], payload);
         if (ret != ESP_OK && first_error == ESP_OK) {
@@ -140,95 +194,126 @@ static esp_err_t relay_payload_to_targets(app_context_t *ctx, cJSON *to, const c
         }
         if (ret != ESP_OK) {
             chat_ws_close_client(ctx, fds[i]);
-            closed_client = true;
+        } else {
+            (*delivered)++;
         }
     }
 
-    if (closed_client) {
-        chat_sessions_broadcast_online_users(ctx);
-    }
-
     return first_error;
 }
 
-static esp_err_t require_joined_identity(app_context_t *ctx, int fd, cJSON *root)
-{
-    if (!chat_sessions_is_joined(ctx, fd)) {
-        return chat_ws_send_error(ctx, fd, "not_joined", "Join before sending chat messages");
-    }
-
-    cJSON *from = cJSON_GetObjectItem(root, "from");
-    if (!json_string_in_range(from, MAX_USER_ID_LEN, false) ||
-        !chat_sessions_identity_matches(ctx, fd, from->valuestring)) {
-        return chat_ws_send_error(ctx, fd, "bad_identity", "Message sender does not match the joined user");
-    }
-
-    chat_sessions_update_time_sample(ctx, fd, root);
-    return ESP_OK;
-}
-
-static esp_err_t handle_join_message(app_context_t *ctx, int fd, cJSON *root)
+static esp_err_t handle_join_message(app_context_t *ctx, int fd, const chat_frame_t *frame)
 {
-    cJSON *from = cJSON_GetObjectItem(root, "from");
-    cJSON *name = cJSON_GetObjectItem(root, "name");
+    const chat_field_t *replay_limit = &frame->replay_limit;
     uint64_t since_id = 0;
 
-    if (!json_string_in_range(from, MAX_USER_ID_LEN, false) ||
-        !json_string_in_range(name, MAX_NAME_LEN, false)) {
+    if (!chat_field_string_in_range(&frame->from, MAX_USER_ID_LEN, false) ||
+        !chat_field_string_in_range(&frame->name, MAX_NAME_LEN, false)) {
         return chat_ws_send_error(ctx, fd, "bad_join", "Join requires valid from and name fields");
     }
-    if (!chat_history_parse_since_id(root, &since_id)) {
+    if (!chat_history_parse_since_id(frame, &since_id)) {
         return chat_ws_send_error(ctx, fd, "bad_since_id", "since_id must be a safe non-negative integer");
     }
+    if (replay_limit->type != JSON_SCAN_NONE &&
+        (replay_limit->type != JSON_SCAN_NUMBER || replay_limit->number < 0 || replay_limit->number > MAX_MESSAGES ||
+         replay_limit->number != (double)(int)replay_limit->number)) {
+        return chat_ws_send_error(ctx, fd, "bad_join", "replay_limit must be an integer between 0 and the history size");
+    }
+    chat_id_range_t ranges[HISTORY_PEER_RANGES];
+    int range_count = 0;
+    if (!chat_history_parse_ranges(&frame->history_ranges, ranges, &range_count)) {
+        return chat_ws_send_error(ctx, fd, "bad_join", "history_ranges must list ascending, disjoint message id ranges");
+    }
 
-    if (!chat_sessions_update_identity(ctx, fd, from->valuestring, name->valuestring)) {
+    char from[MAX_USER_ID_LEN + 1];
+    char name[MAX_NAME_LEN + 1];
+    chat_field_copy(from, sizeof(from), &frame->from);
+    chat_field_copy(name, sizeof(name), &frame->name);
+    if (!chat_sessions_update_identity(ctx, fd, from, name)) {
         return chat_ws_send_error(ctx, fd, "not_registered", "WebSocket client slot was not found");
     }
 
-    chat_sessions_update_time_sample(ctx, fd, root);
-    chat_history_send_to_client(ctx, fd, since_id);
+    chat_sessions_update_time_sample(ctx, fd, &frame->timestamp);
+    uint8_t wire = 0;
+    if (WS_MSGPACK && chat_field_equals(&frame->encoding, "msgpack")) {
+        wire |= CHAT_WIRE_MSGPACK;
+    }
+    if (WS_DEFLATE && chat_field_equals(&frame->compression, "deflate")) {
+        wire |= CHAT_WIRE_DEFLATE;
+    }
+    chat_sessions_set_wire(ctx, fd, wire);
+    chat_sessions_set_history_ranges(ctx, fd, ranges, range_count, frame->history_ranges.type != JSON_SCAN_NONE);
+    history_replay_t replay = {
+        .user_id = from,
+        .since_id = since_id,
+        .replay_limit = replay_limit->type == JSON_SCAN_NUMBER ? (int)replay_limit->number : 0,
+        .batched = frame->history_batch.type == JSON_SCAN_TRUE,
+    };
+    chat_history_send_to_client(ctx, fd, &replay);
     chat_history_send_info_to_client(ctx, fd);
-    chat_sessions_send_online_users_to_client(ctx, fd);
-    chat_sessions_broadcast_online_users(ctx);
+    chat_sessions_send_online_users_to_client(ctx, fd, &frame->presence_version);
     return ESP_OK;
 }
 
-static esp_err_t handle_chat_message(app_context_t *ctx, int fd, cJSON *root)
+static esp_err_t handle_chat_message(app_context_t *ctx, int fd, inbound_t *in)
 {
-    cJSON *type = cJSON_GetObjectItem(root, "type");
-    cJSON *from = cJSON_GetObjectItem(root, "from");
-    cJSON *name = cJSON_GetObjectItem(root, "name");
+    const chat_frame_t *frame = &in->frame;
+    const chat_field_t *register_id = NULL;
+    chat_group_t *group = NULL;
 
-    if (!json_string_in_range(from, MAX_USER_ID_LEN, false) ||
-        !json_string_in_range(name, MAX_NAME_LEN, false)) {
+    if (!chat_field_string_in_range(&frame->from, MAX_USER_ID_LEN, false) ||
+        !chat_field_string_in_range(&frame->name, MAX_NAME_LEN, false)) {
         return chat_ws_send_error(ctx, fd, "bad_message", "Message requires valid from and name fields");
     }
 
-    if (strcmp(type->valuestring, "text") == 0) {
-        cJSON *data = cJSON_GetObjectItem(root, "data");
-        if (!json_string_in_range(data, MAX_TEXT_BYTES, false)) {
+    if (chat_field_equals(&frame->type, "text")) {
+        if (!chat_field_string_in_range(&frame->data, MAX_TEXT_BYTES, false)) {
             return chat_ws_send_error(ctx, fd, "bad_text", "Text message is empty or too long");
         }
-        if (!validate_to_object(root)) {
-            return chat_ws_send_error(ctx, fd, "bad_target", "Message target must be all users or a non-empty user list");
+        if (!field_target_valid(frame)) {
+            return chat_ws_send_error(ctx, fd, "bad_target", "Message target must be all users, a non-empty user list, or a group");
+        }
+        if (frame->to_group.type != JSON_SCAN_NONE) {
+            if (!group_id_matches_target(frame)) {
+                return chat_ws_send_error(ctx, fd, "bad_target", "groupId and to.group name different groups");
+            }
+            group = chat_groups_use(&ctx->groups, frame->to_group.str, frame->to_group.len);
+            if (group == NULL && frame->user_count == 0) {
+                return chat_ws_send_error(ctx, fd, "unknown_group", "Message targets a group the server does not know");
+            }
+            if (group == NULL) {
+                register_id = &frame->to_group;
+            } else if (!chat_group_has_member(group, frame->from.str, frame->from.len)) {
+                return chat_ws_send_error(ctx, fd, "bad_target", "Sender is not a member of the target group");
+            } else {
+                chat_groups_expand_frame(&ctx->groups, &in->frame);
+            }
         }
-    } else if (strcmp(type->valuestring, "newGroup") == 0) {
-        cJSON *group_id = cJSON_GetObjectItem(root, "groupId");
-        cJSON *group_name = cJSON_GetObjectItem(root, "groupName");
-        cJSON *data = cJSON_GetObjectItem(root, "data");
-
-        if (!json_string_in_range(group_id, MAX_GROUP_ID_LEN, false) ||
-            !json_string_in_range(group_name, MAX_GROUP_NAME_LEN, false) ||
-            !json_string_in_range(data, MAX_TEXT_BYTES, true) ||
-            !validate_to_object(root)) {
+    } else if (chat_field_equals(&frame->type, "newGroup")) {
+        if (!chat_field_string_in_range(&frame->group_id, MAX_GROUP_ID_LEN, false) ||
+            !chat_field_string_in_range(&frame->group_name, MAX_GROUP_NAME_LEN, false) ||
+            !chat_field_string_in_range(&frame->data, MAX_TEXT_BYTES, true) ||
+            !field_target_valid(frame) || frame->to_group.type != JSON_SCAN_NONE) {
             return chat_ws_send_error(ctx, fd, "bad_group", "Group creation requires groupId, groupName, data, and target users");
         }
+        register_id = &frame->group_id;
     } else {
         return chat_ws_send_error(ctx, fd, "unknown_type", "Unsupported chat message type");
     }
 
-    char *payload = NULL;
-    esp_err_t store_ret = chat_history_finalize_and_store_message(ctx, root, &payload);
+    if (!inbound_rewritable(in)) {
+        return chat_ws_send_error(ctx, fd, "bad_json", "Invalid JSON object");
+    }
+    /* Checked before the store and registered after it, so a failed store leaves no group behind. */
+    if (register_id != NULL) {
+        esp_err_t group_ret = chat_groups_check(ctx, register_id, frame);
+        if (group_ret != ESP_OK) {
+            return send_group_error(ctx, fd, group_ret);
+        }
+    }
+
+    chat_payload_t *payload = NULL;
+    esp_err_t store_ret = chat_history_finalize_and_store_message(ctx, frame, in->src, in->len, &payload);
     if (store_ret != ESP_OK || payload == NULL) {
         if (store_ret == ESP_ERR_INVALID_SIZE) {
             return chat_ws_send_error(ctx, fd, "id_exhausted", "Message id space is exhausted");
@@ -237,7 +322,23 @@ static esp_err_t handle_chat_message(app_context_t *ctx, int fd, cJSON *root)
         return chat_ws_send_error(ctx, fd, "server_busy", "Unable to persist message id");
     }
 
-    chat_ws_broadcast(ctx, payload);
+    if (register_id != NULL) {
+        esp_err_t group_ret = chat_groups_register(ctx, register_id, frame, true);
+        if (group_ret != ESP_OK) {
+            ESP_LOGW(TAG, "Stored message left its group unregistered: %s", esp_err_to_name(group_ret));
+        } else if (frame->to_group.type != JSON_SCAN_NONE) {
+            group = chat_groups_find(&ctx->groups, frame->to_group.str, frame->to_group.len);
+        }
+    }
+
+    if (group != NULL) {
+        int fds[MAX_CLIENTS];
+        int fd_count = chat_sessions_group_fds(ctx, group, fds);
+        chat_ws_multicast_payload(ctx, fds, fd_count, payload);
+    } else {
+        chat_ws_broadcast_payload(ctx, payload);
+    }
+    chat_payload_release(payload);
     chat_history_broadcast_info(ctx);
     return ESP_OK;
 }
@@ -276,7 +377,7 @@ static bool validate_history_message_object(cJSON *message)
     return false;
 }
 
-static bool history_response_targets_match_message(cJSON *root, cJSON *message)
+static bool history_response_targets_match_message(app_context_t *ctx, cJSON *root, cJSON *message)
 {
     cJSON *to = cJSON_GetObjectItem(root, "to");
     cJSON *users = cJSON_IsObject(to) ? cJSON_GetObjectItem(to, "users") : NULL;
@@ -287,7 +388,7 @@ static bool history_response_targets_match_message(cJSON *root, cJSON *message)
     cJSON *target = NULL;
     cJSON_ArrayForEach(target, users) {
         if (!json_string_in_range(target, MAX_USER_ID_LEN, false) ||
-            !message_visible_to_user(message, target->valuestring)) {
+            !chat_message_visible_to_user(&ctx->groups, message, target->valuestring)) {
             return false;
         }
     }
@@ -295,23 +396,19 @@ static bool history_response_targets_match_message(cJSON *root, cJSON *message)
     return true;
 }
 
-static esp_err_t handle_history_request_message(app_context_t *ctx, int fd, cJSON *root)
+static esp_err_t handle_history_request_message(app_context_t *ctx, int fd, inbound_t *in)
 {
-    cJSON *from = cJSON_GetObjectItem(root, "from");
-    cJSON *name = cJSON_GetObjectItem(root, "name");
-    cJSON *request_id = cJSON_GetObjectItem(root, "requestId");
-    cJSON *restore_before = cJSON_GetObjectItem(root, "restore_before_id");
+    const chat_frame_t *frame = &in->frame;
+    uint64_t requested_before = 0;
 
-    if (!json_string_in_range(from, MAX_USER_ID_LEN, false) ||
-        !json_string_in_range(name, MAX_NAME_LEN, false) ||
-        !json_string_in_range(request_id, MAX_REQUEST_ID_LEN, false) ||
-        !json_safe_message_id(restore_before, false, NULL) ||
-        restore_before->valuedouble <= 1) {
+    if (!chat_field_string_in_range(&frame->from, MAX_USER_ID_LEN, false) ||
+        !chat_field_string_in_range(&frame->name, MAX_NAME_LEN, false) ||
+        !chat_field_string_in_range(&frame->request_id, MAX_REQUEST_ID_LEN, false) ||
+        !field_safe_message_id(&frame->restore_before_id, false, &requested_before) ||
+        requested_before <= 1) {
         return chat_ws_send_error(ctx, fd, "bad_history_request", "History request is invalid");
     }
 
-    uint64_t requested_before = 0;
-    json_safe_message_id(restore_before, false, &requested_before);
     uint64_t allowed_before = chat_history_current_restore_before_id(ctx);
     if (requested_before > allowed_before) {
         requested_before = allowed_before;
@@ -320,27 +417,120 @@ static esp_err_t handle_history_request_message(app_context_t *ctx, int fd, cJSO
         return chat_ws_send_error(ctx, fd, "no_restorable_history", "No older server history boundary is available");
     }
 
-    cJSON_DeleteItemFromObjectCaseSensitive(root, "restore_before_id");
-    if (cJSON_AddNumberToObject(root, "restore_before_id", (double)requested_before) == NULL) {
-        return chat_ws_send_error(ctx, fd, "server_busy", "Unable to relay history request");
+    static const char *const restore_field[] = { "restore_before_id", NULL };
+    char restore[48];
+    snprintf(restore, sizeof(restore), "\"restore_before_id\":%" PRIu64, requested_before);
+    chat_frame_rewrite_t rewrite = {
+        .strip = restore_field,
+        .append = restore,
+    };
+
+    int fds[MAX_CLIENTS];
+    int fd_count = chat_sessions_history_peer_fds(ctx, fd, requested_before, fds);
+    if (fd_count == 0) {
+        return chat_ws_send_error(ctx, fd, "no_history_peers", "No online device holds the missing history");
     }
 
-    char *payload = cJSON_PrintUnformatted(root);
+    size_t len = 0;
+    char *text = inbound_rewritable(in) ? chat_frame_rewrite(in->src, in->len, &rewrite, &len) : NULL;
+    chat_payload_t *payload = text ? chat_payload_create(text, len) : NULL;
+    free(text);
     if (payload == NULL) {
         return chat_ws_send_error(ctx, fd, "server_busy", "Unable to relay history request");
     }
 
-    chat_ws_broadcast(ctx, payload);
-    free(payload);
+    if (fd_count < 0) {
+        chat_ws_broadcast_payload(ctx, payload);
+    } else {
+        chat_ws_multicast_payload(ctx, fds, fd_count, payload);
+    }
+    chat_payload_release(payload);
+    return ESP_OK;
+}
+
+static esp_err_t handle_history_query_message(app_context_t *ctx, int fd, cJSON *root, const char *user_id)
+{
+    cJSON *request_id = cJSON_GetObjectItem(root, "requestId");
+    cJSON *before = cJSON_GetObjectItem(root, "before_id");
+    cJSON *limit = cJSON_GetObjectItem(root, "limit");
+    cJSON *conversation = cJSON_GetObjectItem(root, "conversation");
+    uint64_t before_id = 0;
+
+    if ((request_id != NULL && !json_string_in_range(request_id, MAX_REQUEST_ID_LEN, false)) ||
+        (before != NULL && !json_safe_message_id(before, true, &before_id)) ||
+        (limit != NULL && (!cJSON_IsNumber(limit) || limit->valuedouble < 1 ||
+                           limit->valuedouble > HISTORY_QUERY_MAX_LIMIT ||
+                           limit->valuedouble != (double)limit->valueint)) ||
+        (conversation != NULL && !json_string_in_range(conversation, MAX_GROUP_ID_LEN, false))) {
+        return chat_ws_send_error(ctx, fd, "bad_history_query", "History query is invalid");
+    }
+
+    history_query_t query = {
+        .user_id = user_id,
+        .request_id = request_id ? request_id->valuestring : NULL,
+        .conversation = conversation ? conversation->valuestring : NULL,
+        .before_id = before_id,
+        .limit = limit ? limit->valueint : HISTORY_QUERY_DEFAULT_LIMIT,
+    };
+    chat_history_send_page(ctx, fd, &query);
     return ESP_OK;
 }
 
-static esp_err_t handle_history_response_message(app_context_t *ctx, int fd, cJSON *root)
+static esp_err_t handle_search_message(app_context_t *ctx, int fd, cJSON *root, const char *user_id)
+{
+    cJSON *request_id = cJSON_GetObjectItem(root, "requestId");
+    cJSON *query = cJSON_GetObjectItem(root, "query");
+    cJSON *limit = cJSON_GetObjectItem(root, "limit");
+
+    if ((request_id != NULL && !json_string_in_range(request_id, MAX_REQUEST_ID_LEN, false)) ||
+        !json_string_in_range(query, MAX_TEXT_BYTES, false) ||
+        (limit != NULL && (!cJSON_IsNumber(limit) || limit->valuedouble < 1 ||
+                           limit->valuedouble > SEARCH_MAX_RESULTS ||
+                           limit->valuedouble != (double)limit->valueint))) {
+        return chat_ws_send_error(ctx, fd, "bad_search", "Search requires a query and a limit of 1 to 20");
+    }
+
+    history_search_t search = {
+        .user_id = user_id,
+        .request_id = request_id ? request_id->valuestring : NULL,
+        .query = query->valuestring,
+        .limit = limit ? limit->valueint : SEARCH_MAX_RESULTS,
+    };
+    chat_history_send_search(ctx, fd, &search);
+    return ESP_OK;
+}
+
+/* NULL when message may be relayed to the targets of root, otherwise why not. */
+static const char *history_response_message_problem(app_context_t *ctx, cJSON *root, cJSON *message, uint64_t restore_before_id)
+{
+    if (!validate_history_message_object(message)) {
+        return "History response contains an invalid message";
+    }
+
+    uint64_t response_id = 0;
+    json_safe_message_id(cJSON_GetObjectItem(message, "id"), false, &response_id);
+    if (response_id >= restore_before_id) {
+        return "History response is not older than the server boundary";
+    }
+    if (!history_response_targets_match_message(ctx, root, message)) {
+        return "History response is not visible to the requested user";
+    }
+    return NULL;
+}
+
+/*
+ * A response carries either one "message" or a "messages" array. Messages another peer already
+ * delivered for the same requestId are dropped; a frame left with none is not relayed. Ids only
+ * count as delivered once the relay reached the requester, so a failed send leaves them to the
+ * next peer's answer.
+ */
+static esp_err_t handle_history_response_message(app_context_t *ctx, int fd, cJSON *root, const chat_frame_t *frame)
 {
     cJSON *from = cJSON_GetObjectItem(root, "from");
     cJSON *name = cJSON_GetObjectItem(root, "name");
     cJSON *request_id = cJSON_GetObjectItem(root, "requestId");
     cJSON *message = cJSON_GetObjectItem(root, "message");
+    cJSON *messages = cJSON_GetObjectItem(root, "messages");
 
     if (!json_string_in_range(from, MAX_USER_ID_LEN, false) ||
         !json_string_in_range(name, MAX_NAME_LEN, false) ||
@@ -355,19 +545,40 @@ static esp_err_t handle_history_response_message(app_context_t *ctx, int fd, cJS
     if (cJSON_IsTrue(cJSON_GetObjectItem(to, "all"))) {
         return chat_ws_send_error(ctx, fd, "bad_history_response", "History response must target specific users");
     }
-    if (!validate_history_message_object(message)) {
-        return chat_ws_send_error(ctx, fd, "bad_history_response", "History response contains an invalid message");
+    if ((message == NULL) == (messages == NULL) ||
+        (messages != NULL && (!cJSON_IsArray(messages) || cJSON_GetArraySize(messages) == 0 ||
+                              cJSON_GetArraySize(messages) > HISTORY_RESPONSE_MAX_MESSAGES))) {
+        return chat_ws_send_error(ctx, fd, "bad_history_response", "History response needs one message or a messages array");
     }
 
-    cJSON *id = cJSON_GetObjectItem(message, "id");
-    uint64_t response_id = 0;
-    json_safe_message_id(id, false, &response_id);
     uint64_t restore_before_id = chat_history_current_restore_before_id(ctx);
-    if (response_id >= restore_before_id) {
-        return chat_ws_send_error(ctx, fd, "bad_history_response", "History response is not older than the server boundary");
+    cJSON *first = messages != NULL ? messages->child : message;
+    for (cJSON *item = first; item != NULL; item = messages != NULL ? item->next : NULL) {
+        const char *problem = history_response_message_problem(ctx, root, item, restore_before_id);
+        if (problem != NULL) {
+            return chat_ws_send_error(ctx, fd, "bad_history_response", problem);
+        }
+    }
+
+    uint64_t kept_ids[HISTORY_RESPONSE_MAX_MESSAGES];
+    int kept = 0;
+    cJSON *next = NULL;
+    for (cJSON *item = first; item != NULL; item = next) {
+        next = messages != NULL ? item->next : NULL;
+        uint64_t id = 0;
+        json_safe_message_id(cJSON_GetObjectItem(item, "id"), false, &id);
+        bool duplicate = chat_history_response_seen(ctx, request_id->valuestring, id);
+        for (int i = 0; i < kept && !duplicate; i++) {
+            duplicate = kept_ids[i] == id;
+        }
+        if (!duplicate) {
+            kept_ids[kept++] = id;
+        } else if (messages != NULL) {
+            cJSON_Delete(cJSON_DetachItemViaPointer(messages, item));
+        }
     }
-    if (!history_response_targets_match_message(root, message)) {
-        return chat_ws_send_error(ctx, fd, "bad_history_response", "History response is not visible to the requested user");
+    if (kept == 0) {
+        return ESP_OK;
     }
 
     char *payload = cJSON_PrintUnformatted(root);
@@ -375,55 +586,164 @@ static esp_err_t handle_history_response_message(app_context_t *ctx, int fd, cJS
         return chat_ws_send_error(ctx, fd, "server_busy", "Unable to relay history response");
     }
 
-    esp_err_t ret = relay_payload_to_targets(ctx, to, payload);
+    int delivered = 0;
+    esp_err_t ret = relay_payload_to_targets(ctx, frame, payload, &delivered);
     free(payload);
     if (ret != ESP_OK) {
         return chat_ws_send_error(ctx, fd, "relay_failed", "Unable to relay history response");
     }
 
+    for (int i = 0; i < kept && delivered > 0; i++) {
+        chat_history_response_mark_seen(ctx, request_id->valuestring, kept_ids[i], restore_before_id);
+    }
     return ESP_OK;
 }
 
-esp_err_t chat_protocol_handle_json(app_context_t *ctx, int fd, cJSON *root)
+static esp_err_t dispatch_frame(app_context_t *ctx, int fd, inbound_t *in)
 {
-    cJSON *type = cJSON_GetObjectItem(root, "type");
-    if (!json_string_in_range(type, 24, false)) {
+    const chat_frame_t *frame = &in->frame;
+    if (!chat_field_string_in_range(&frame->type, 24, false)) {
         return chat_ws_send_error(ctx, fd, "bad_type", "Message type is required");
     }
 
-    if (strcmp(type->valuestring, "pong") == 0) {
-        chat_sessions_mark_alive(ctx, fd);
-        if (chat_sessions_is_joined(ctx, fd)) {
-            chat_sessions_update_time_sample(ctx, fd, root);
-        }
+    /* chat_sessions_ensure_slot() already marked the slot alive and admission took the clock sample. */
+    if (chat_field_equals(&frame->type, "pong")) {
         return ESP_OK;
     }
 
-    if (strcmp(type->valuestring, "join") == 0) {
-        return handle_join_message(ctx, fd, root);
+    if (chat_field_equals(&frame->type, "join")) {
+        return handle_join_message(ctx, fd, frame);
     }
 
-    esp_err_t identity_ret = require_joined_identity(ctx, fd, root);
-    if (identity_ret != ESP_OK) {
-        return identity_ret;
+    /* A sent error is ESP_OK too, so these return before anything below can run. */
+    if (!in->admission.joined) {
+        return chat_ws_send_error(ctx, fd, "not_joined", "Join before sending chat messages");
+    }
+    if (!in->admission.identity_ok) {
+        return chat_ws_send_error(ctx, fd, "bad_identity", "Message sender does not match the joined user");
     }
 
-    if (strcmp(type->valuestring, "getOnlineUser") == 0) {
-        chat_sessions_send_online_users_to_client(ctx, fd);
+    if (chat_field_equals(&frame->type, "getOnlineUser")) {
+        chat_sessions_send_online_users_to_client(ctx, fd, &frame->presence_version);
         return ESP_OK;
     }
 
-    if (strcmp(type->valuestring, "text") == 0 || strcmp(type->valuestring, "newGroup") == 0) {
-        return handle_chat_message(ctx, fd, root);
+    if (chat_field_equals(&frame->type, "text") || chat_field_equals(&frame->type, "newGroup")) {
+        return handle_chat_message(ctx, fd, in);
+    }
+
+    if (chat_field_equals(&frame->type, "historyRequest")) {
+        return handle_history_request_message(ctx, fd, in);
     }
 
-    if (strcmp(type->valuestring, "historyRequest") == 0) {
-        return handle_history_request_message(ctx, fd, root);
+    /* The scanner never takes the types below, so these frames always arrive with a tree. */
+    cJSON *root = inbound_root(in);
+    if (root == NULL) {
+        return chat_ws_send_error(ctx, fd, "bad_json", "Invalid JSON object");
     }
 
-    if (strcmp(type->valuestring, "historyResponse") == 0) {
-        return handle_history_response_message(ctx, fd, root);
+    if (chat_field_equals(&frame->type, "search")) {
+        return handle_search_message(ctx, fd, root, in->admission.user_id);
+    }
+
+    if (chat_field_equals(&frame->type, "historyQuery")) {
+        return handle_history_query_message(ctx, fd, root, in->admission.user_id);
+    }
+
+    if (chat_field_equals(&frame->type, "historyResponse")) {
+        return handle_history_response_message(ctx, fd, root, frame);
     }
 
     return chat_ws_send_error(ctx, fd, "unknown_type", "Unsupported message type");
 }
+
+/* httpd runs every WebSocket handler on its single task, so one frame slot serves all receives. */
+static inbound_t s_inbound;
+
+/* The scanner fills type even for frames it leaves to cJSON; unreadable frames count as control. */
+static chat_rate_class_t frame_rate_class(const chat_field_t *type)
+{
+    if (chat_field_equals(type, "text") || chat_field_equals(type, "newGroup")) {
+        return CHAT_RATE_CHAT;
+    }
+    if (chat_field_equals(type, "historyRequest") || chat_field_equals(type, "historyResponse") ||
+        chat_field_equals(type, "historyQuery") || chat_field_equals(type, "search")) {
+        return CHAT_RATE_HISTORY;
+    }
+    return CHAT_RATE_CONTROL;
+}
+
+/*
+ * The slot is consulted once, on the scanned fields and before any cJSON work. A "from" the
+ * scanner saw escaped is compared as written and so never matches; browsers do not escape ids.
+ * Frames left to cJSON are checked again on the cJSON fields, which are the ones dispatched.
+ */
+static esp_err_t handle_frame(app_context_t *ctx, const chat_session_t *session, const char *src, size_t len,
+                              bool charged)
+{
+    inbound_t *in = &s_inbound;
+    int fd = session->fd;
+    in->src = src;
+    in->len = len;
+    in->root = NULL;
+
+    esp_err_t ret;
+    bool scanned = chat_frame_parse(src, len, &in->frame);
+    if (!scanned) {
+        in->frame.timestamp = (chat_field_t){ 0 };
+    }
+    chat_rate_class_t rate_class = charged ? CHAT_RATE_CLASSES : frame_rate_class(&in->frame.type);
+    chat_sessions_admit_frame(ctx, session, &in->frame, rate_class, &in->admission);
+    if (!in->admission.allowed) {
+        ret = in->admission.notify_limited ? chat_ws_send_error(ctx, fd, "rate_limited", "Too many messages; slow down") : ESP_OK;
+    } else if (scanned) {
+        ret = dispatch_frame(ctx, fd, in);
+    } else {
+        in->root = cJSON_ParseWithLength(src, len);
+        if (!cJSON_IsObject(in->root)) {
+            ret = chat_ws_send_error(ctx, fd, "bad_json", "Invalid JSON object");
+        } else {
+            chat_frame_from_json(in->root, &in->frame);
+            chat_sessions_admit_parsed_frame(ctx, session, &in->frame, &in->admission);
+            ret = dispatch_frame(ctx, fd, in);
+        }
+    }
+
+    cJSON_Delete(in->root);
+    free(in->normalized);
+    in->root = NULL;
+    in->normalized = NULL;
+    return ret;
+}
+
+esp_err_t chat_protocol_handle_frame(app_context_t *ctx, const chat_session_t *session, const char *src, size_t len)
+{
+    return handle_frame(ctx, session, src, len, false);
+}
+
+/* Decoded MessagePack frames, on the httpd task like s_inbound; one byte over the limit marks an oversized frame. */
+static char s_msgpack_json[MAX_WS_PAYLOAD_BYTES + 1];
+
+esp_err_t chat_protocol_handle_msgpack(app_context_t *ctx, const chat_session_t *session, const uint8_t *src, size_t len)
+{
+    int fd = session->fd;
+    chat_field_t type = { 0 };
+    bool notify_limited = false;
+
+    if (msgpack_map_string(src, len, "type", &type.str, &type.len)) {
+        type.type = JSON_SCAN_STRING;
+    }
+    if (!chat_sessions_take_token(ctx, session, frame_rate_class(&type), &notify_limited)) {
+        return notify_limited ? chat_ws_send_error(ctx, fd, "rate_limited", "Too many messages; slow down") : ESP_OK;
+    }
+
+    json_writer_t writer;
+    json_writer_init(&writer, s_msgpack_json, sizeof(s_msgpack_json));
+    if (!msgpack_to_json(src, len, &writer)) {
+        return chat_ws_send_error(ctx, fd, "bad_json", "Invalid MessagePack object");
+    }
+    if (!json_writer_finish(&writer)) {
+        return chat_ws_send_error(ctx, fd, "payload_too_large", "WebSocket payload is too large");
+    }
+    return handle_frame(ctx, session, s_msgpack_json, writer.len, true);
+}
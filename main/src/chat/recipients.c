@@ -0,0 +1,205 @@
+#include "chat/recipients.h"
+
+#include <string.h>
+
+#include "chat/compress.h"
+#include "chat/groups.h"
+#include "common/utils.h"
+
+_Static_assert(MESSAGE_USER_HANDLES <= 64, "recipient masks are 64 bits wide");
+
+bool chat_message_visible_to_user(chat_group_table_t *groups, const cJSON *message, const char *user_id)
+{
+    if (!cJSON_IsObject(message) || user_id == NULL || user_id[0] == '\0') {
+        return false;
+    }
+
+    cJSON *from = cJSON_GetObjectItem(message, "from");
+    if (cJSON_IsString(from) && from->valuestring != NULL && strcmp(from->valuestring, user_id) == 0) {
+        return true;
+    }
+
+    cJSON *to = cJSON_GetObjectItem(message, "to");
+    if (!cJSON_IsObject(to)) {
+        return false;
+    }
+
+    cJSON *all = cJSON_GetObjectItem(to, "all");
+    if (cJSON_IsTrue(all)) {
+        return true;
+    }
+
+    /*
+     * Group messages are stored with the members they were sent to. Only records from before that
+     * list nothing and fall back to whoever the registry holds for to.group.
+     */
+    cJSON *users = cJSON_GetObjectItem(to, "users");
+    cJSON *group = cJSON_GetObjectItem(to, "group");
+    if (cJSON_GetArraySize(users) > 0 || !cJSON_IsString(group) || group->valuestring == NULL) {
+        return json_array_contains_string(users, user_id);
+    }
+    chat_group_t *entry = chat_groups_find(groups, group->valuestring, strlen(group->valuestring));
+    return entry != NULL && chat_group_has_member(entry, user_id, strlen(user_id));
+}
+
+/* Mirrors belongsToCurrentConversation() in script.js: "global", a groupId, or the peer of a private chat. */
+bool chat_message_in_conversation(const cJSON *message, const char *user_id, const char *conversation)
+{
+    if (!cJSON_IsObject(message) || user_id == NULL || conversation == NULL) {
+        return false;
+    }
+
+    cJSON *group_id = cJSON_GetObjectItem(message, "groupId");
+    cJSON *to = cJSON_GetObjectItem(message, "to");
+    bool to_all = cJSON_IsTrue(cJSON_GetObjectItem(to, "all"));
+    bool has_group = cJSON_IsString(group_id) && group_id->valuestring != NULL;
+
+    if (strcmp(conversation, "global") == 0) {
+        return to_all && !has_group;
+    }
+    if (has_group) {
+        return strcmp(group_id->valuestring, conversation) == 0;
+    }
+    if (to_all) {
+        return false;
+    }
+
+    cJSON *from = cJSON_GetObjectItem(message, "from");
+    cJSON *users = cJSON_GetObjectItem(to, "users");
+    if (!cJSON_IsString(from) || from->valuestring == NULL) {
+        return false;
+    }
+    return (strcmp(from->valuestring, user_id) == 0 && json_array_contains_string(users, conversation)) ||
+        (strcmp(from->valuestring, conversation) == 0 && json_array_contains_string(users, user_id));
+}
+
+uint32_t chat_recipients_group_hash(const char *group_id)
+{
+    return group_id != NULL ? hash_string(group_id, strlen(group_id)) : 0;
+}
+
+static int find_user(const chat_user_table_t *table, const char *user_id, uint32_t hash)
+{
+    for (int i = 0; i < MESSAGE_USER_HANDLES; i++) {
+        if (table->handles[i].refs > 0 && table->handles[i].hash == hash &&
+            strcmp(table->handles[i].user_id, user_id) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int chat_user_table_find(const chat_user_table_t *table, const char *user_id)
+{
+    if (table == NULL || user_id == NULL || user_id[0] == '\0') {
+        return -1;
+    }
+    return find_user(table, user_id, hash_string(user_id, strlen(user_id)));
+}
+
+static bool add_user(chat_user_table_t *table, const chat_field_t *field, chat_recipients_t *recipients, int *handle_out)
+{
+    if (field->type != JSON_SCAN_STRING || field->len == 0) {
+        return true;
+    }
+
+    char user_id[MAX_USER_ID_LEN + 1];
+    chat_field_copy(user_id, sizeof(user_id), field);
+    uint32_t hash = hash_string(user_id, strlen(user_id));
+    int handle = find_user(table, user_id, hash);
+    if (handle < 0) {
+        for (int i = 0; i < MESSAGE_USER_HANDLES; i++) {
+            if (table->handles[i].refs == 0) {
+                copy_bounded(table->handles[i].user_id, sizeof(table->handles[i].user_id), user_id);
+                table->handles[i].hash = hash;
+                handle = i;
+                break;
+            }
+        }
+    }
+    if (handle < 0) {
+        return false;
+    }
+
+    if ((recipients->mask & (UINT64_C(1) << handle)) == 0) {
+        recipients->mask |= UINT64_C(1) << handle;
+        table->handles[handle].refs++;
+    }
+    if (handle_out != NULL) {
+        *handle_out = handle;
+    }
+    return true;
+}
+
+void chat_recipients_from_frame(chat_user_table_t *table, const chat_frame_t *message, chat_recipients_t *recipients)
+{
+    if (recipients == NULL) {
+        return;
+    }
+    memset(recipients, 0, sizeof(*recipients));
+    recipients->from_handle = -1;
+
+    if (table == NULL || message == NULL || !message->users_valid) {
+        recipients->overflow = true;
+        return;
+    }
+
+    if (message->group_id.type == JSON_SCAN_STRING) {
+        recipients->group_hash = hash_string(message->group_id.str, message->group_id.len);
+    }
+
+    if (message->to_all.type == JSON_SCAN_TRUE) {
+        recipients->all = true;
+        return;
+    }
+
+    /* Once the table is full the message keeps no handles and replay falls back to parsing it. */
+    int from_handle = -1;
+    bool interned = add_user(table, &message->from, recipients, &from_handle);
+    for (int i = 0; i < message->user_count && interned; i++) {
+        interned = add_user(table, &message->users[i], recipients, NULL);
+    }
+
+    if (!interned) {
+        chat_recipients_release(table, recipients);
+        recipients->mask = 0;
+        recipients->overflow = true;
+        return;
+    }
+    recipients->from_handle = (int8_t)from_handle;
+}
+
+void chat_recipients_release(chat_user_table_t *table, const chat_recipients_t *recipients)
+{
+    if (table == NULL || recipients == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < MESSAGE_USER_HANDLES; i++) {
+        if ((recipients->mask & (UINT64_C(1) << i)) != 0 && table->handles[i].refs > 0) {
+            table->handles[i].refs--;
+        }
+    }
+}
+
+bool chat_recipients_visible(chat_group_table_t *groups, const chat_recipients_t *recipients, int handle,
+                             chat_payload_t *payload, const char *user_id)
+{
+    if (recipients == NULL) {
+        return false;
+    }
+    if (recipients->all) {
+        return true;
+    }
+
+    if (recipients->overflow) {
+        chat_payload_t *plain = chat_payload_open(payload);
+        cJSON *message = plain ? cJSON_ParseWithLength(plain->data, plain->len) : NULL;
+        bool visible = chat_message_visible_to_user(groups, message, user_id);
+        cJSON_Delete(message);
+        chat_payload_release(plain);
+        return visible;
+    }
+
+    return handle >= 0 && (recipients->mask & (UINT64_C(1) << handle)) != 0;
+}
@@ -0,0 +1,256 @@
+#include "chat/search.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chat_config.h"
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME  16777619u
+
+esp_err_t chat_search_init(chat_search_index_t *index, size_t budget_bytes)
+{
+    if (index == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(index, 0, sizeof(*index));
+    index->head_seq = 1;
+    index->tail_seq = 1;
+    if (budget_bytes == 0) {
+        return ESP_OK;
+    }
+
+    /* A quarter of the budget goes to the term table, rounded down to a power of two for masking. */
+    uint32_t term_capacity = 1;
+    while ((size_t)term_capacity * 2 * sizeof(chat_search_term_t) <= budget_bytes / 4) {
+        term_capacity *= 2;
+    }
+    size_t posting_bytes = budget_bytes - term_capacity * sizeof(chat_search_term_t);
+
+    index->terms = calloc(term_capacity, sizeof(chat_search_term_t));
+    index->postings = malloc(posting_bytes);
+    if (index->terms == NULL || index->postings == NULL) {
+        free(index->terms);
+        free(index->postings);
+        index->terms = NULL;
+        index->postings = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    index->term_capacity = term_capacity;
+    index->posting_capacity = posting_bytes / sizeof(chat_search_posting_t);
+    return ESP_OK;
+}
+
+/* ASCII letters and digits form words; every other byte >= 0x80 starts a UTF-8 character indexed on its own. */
+static const char *next_term(const char *p, const char *end, uint32_t *term_out)
+{
+    while (p < end && (unsigned char)*p < 0x80 && !isalnum((unsigned char)*p)) {
+        p++;
+    }
+    if (p == end) {
+        return NULL;
+    }
+
+    uint32_t hash = FNV_OFFSET;
+    if ((unsigned char)*p >= 0x80) {
+        hash = (hash ^ (unsigned char)*p++) * FNV_PRIME;
+        while (p < end && ((unsigned char)*p & 0xC0) == 0x80) {
+            hash = (hash ^ (unsigned char)*p++) * FNV_PRIME;
+        }
+    } else {
+        while (p < end && (unsigned char)*p < 0x80 && isalnum((unsigned char)*p)) {
+            hash = (hash ^ (unsigned char)tolower((unsigned char)*p++)) * FNV_PRIME;
+        }
+    }
+
+    *term_out = hash != 0 ? hash : 1;
+    return p;
+}
+
+static chat_search_term_t *find_term(const chat_search_index_t *index, uint32_t term)
+{
+    uint32_t mask = index->term_capacity - 1;
+    for (uint32_t i = 0; i < index->term_capacity; i++) {
+        chat_search_term_t *slot = &index->terms[(term + i) & mask];
+        if (slot->term == 0) {
+            return NULL;
+        }
+        if (slot->term == term) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+/* Terms whose postings have all been evicted keep their slot as a tombstone until another term reuses it. */
+static chat_search_term_t *intern_term(chat_search_index_t *index, uint32_t term)
+{
+    uint32_t mask = index->term_capacity - 1;
+    chat_search_term_t *reusable = NULL;
+
+    for (uint32_t i = 0; i < index->term_capacity; i++) {
+        chat_search_term_t *slot = &index->terms[(term + i) & mask];
+        if (slot->term == term) {
+            return slot;
+        }
+        if (slot->term == 0) {
+            if (reusable == NULL) {
+                reusable = slot;
+            }
+            break;
+        }
+        if (slot->count == 0 && reusable == NULL) {
+            reusable = slot;
+        }
+    }
+
+    if (reusable != NULL) {
+        reusable->term = term;
+        reusable->newest_seq = 0;
+        reusable->count = 0;
+    }
+    return reusable;
+}
+
+static bool seq_live(const chat_search_index_t *index, uint32_t seq)
+{
+    return seq != 0 && seq >= index->head_seq && seq < index->tail_seq;
+}
+
+static const chat_search_posting_t *posting_at(const chat_search_index_t *index, uint32_t seq)
+{
+    return &index->postings[seq % index->posting_capacity];
+}
+
+static void pop_oldest(chat_search_index_t *index)
+{
+    chat_search_term_t *slot = find_term(index, posting_at(index, index->head_seq)->term);
+    if (slot != NULL && slot->count > 0) {
+        slot->count--;
+    }
+    index->head_seq++;
+}
+
+void chat_search_add(chat_search_index_t *index, uint64_t id, const char *text, size_t len)
+{
+    if (index == NULL || index->postings == NULL || text == NULL) {
+        return;
+    }
+
+    uint32_t seen[SEARCH_MAX_TERMS_PER_MESSAGE];
+    int seen_count = 0;
+    uint32_t term = 0;
+    const char *p = text;
+    const char *end = text + len;
+
+    while ((p = next_term(p, end, &term)) != NULL) {
+        bool duplicate = false;
+        for (int i = 0; i < seen_count && !duplicate; i++) {
+            duplicate = seen[i] == term;
+        }
+        if (duplicate) {
+            continue;
+        }
+        if (seen_count < SEARCH_MAX_TERMS_PER_MESSAGE) {
+            seen[seen_count++] = term;
+        }
+
+        if (index->tail_seq - index->head_seq == index->posting_capacity) {
+            pop_oldest(index);
+        }
+        chat_search_term_t *slot = intern_term(index, term);
+        if (slot == NULL) {
+            index->dropped_terms++;
+            continue;
+        }
+
+        uint32_t seq = index->tail_seq++;
+        chat_search_posting_t *posting = &index->postings[seq % index->posting_capacity];
+        posting->id = id;
+        posting->term = term;
+        posting->prev_seq = slot->newest_seq;
+        slot->newest_seq = seq;
+        slot->count++;
+    }
+}
+
+void chat_search_evict_through(chat_search_index_t *index, uint64_t id)
+{
+    if (index == NULL || index->postings == NULL) {
+        return;
+    }
+
+    while (index->head_seq < index->tail_seq && posting_at(index, index->head_seq)->id <= id) {
+        pop_oldest(index);
+    }
+}
+
+static uint32_t older_posting(const chat_search_index_t *index, uint32_t seq)
+{
+    uint32_t prev = posting_at(index, seq)->prev_seq;
+    return seq_live(index, prev) ? prev : 0;
+}
+
+/* Visits ids containing every query term, newest first, by intersecting the per-term chains. */
+int chat_search_query(const chat_search_index_t *index, const char *query, chat_search_visit_fn visit, void *arg)
+{
+    if (index == NULL || index->postings == NULL || query == NULL || visit == NULL) {
+        return 0;
+    }
+
+    uint32_t cursors[SEARCH_MAX_QUERY_TERMS];
+    int term_count = 0;
+    uint32_t term = 0;
+    const char *p = query;
+    const char *end = query + strlen(query);
+
+    while ((p = next_term(p, end, &term)) != NULL && term_count < SEARCH_MAX_QUERY_TERMS) {
+        chat_search_term_t *slot = find_term(index, term);
+        if (slot == NULL || slot->count == 0 || !seq_live(index, slot->newest_seq)) {
+            return 0;
+        }
+        cursors[term_count++] = slot->newest_seq;
+    }
+    if (term_count == 0) {
+        return 0;
+    }
+
+    int matches = 0;
+    for (;;) {
+        uint64_t candidate = UINT64_MAX;
+        for (int i = 0; i < term_count; i++) {
+            if (cursors[i] == 0) {
+                return matches;
+            }
+            uint64_t id = posting_at(index, cursors[i])->id;
+            if (id < candidate) {
+                candidate = id;
+            }
+        }
+
+        bool everywhere = true;
+        for (int i = 0; i < term_count; i++) {
+            while (cursors[i] != 0 && posting_at(index, cursors[i])->id > candidate) {
+                cursors[i] = older_posting(index, cursors[i]);
+            }
+            if (cursors[i] == 0) {
+                return matches;
+            }
+            everywhere = everywhere && posting_at(index, cursors[i])->id == candidate;
+        }
+        if (!everywhere) {
+            continue;
+        }
+
+        matches++;
+        if (!visit(candidate, arg)) {
+            return matches;
+        }
+        for (int i = 0; i < term_count; i++) {
+            while (cursors[i] != 0 && posting_at(index, cursors[i])->id == candidate) {
+                cursors[i] = older_posting(index, cursors[i]);
+            }
+        }
+    }
+}
@@ -1,17 +1,43 @@
 #include "chat/sessions.h"
 
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include <time.h>
 
-#include "cJSON.h"
 #include "esp_log.h"
 #include "esp_http_server.h"
+#include "esp_random.h"
+#include "esp_timer.h"
 
+#include "common/json_writer.h"
 #include "common/utils.h"
 #include "server/websocket_server.h"
 
 static const char *TAG = "CHAT_SESSIONS";
 
+typedef struct {
+    uint32_t per_s;
+    uint32_t burst;
+} rate_limit_t;
+
+static const rate_limit_t s_rate_limits[CHAT_RATE_CLASSES] = {
+    [CHAT_RATE_CHAT] = { RATE_CHAT_PER_S, RATE_CHAT_BURST },
+    [CHAT_RATE_HISTORY] = { RATE_HISTORY_PER_S, RATE_HISTORY_BURST },
+    [CHAT_RATE_CONTROL] = { RATE_CONTROL_PER_S, RATE_CONTROL_BURST },
+};
+
+static void fill_buckets(client_slot_t *slot, int64_t now_ms)
+{
+    for (int c = 0; c < CHAT_RATE_CLASSES; c++) {
+        slot->buckets[c] = (chat_token_bucket_t){
+            .milli_tokens = s_rate_limits[c].burst * 1000,
+            .refill_ms = now_ms,
+        };
+    }
+}
+
 static void clear_slot_identity(client_slot_t *slot)
 {
     if (slot == NULL) {
@@ -23,9 +49,186 @@ static void clear_slot_identity(client_slot_t *slot)
     slot->joined = false;
     slot->is_alive = false;
     slot->time_offset_valid = false;
+    slot->wire = 0;
     slot->time_offset_s = 0;
+    slot->user_hash = 0;
     slot->user_id[0] = '\0';
     slot->name[0] = '\0';
+    slot->history_ranges_known = false;
+    slot->history_range_count = 0;
+}
+
+/*
+ * Rewrites session_snapshot from client_slots. Only client_mutex holders publish, so writers never
+ * race each other; the odd seq tells readers that the entries they are copying may be torn.
+ */
+static void publish_snapshot_locked(app_context_t *ctx)
+{
+    chat_session_snapshot_t *snapshot = &ctx->session_snapshot;
+    unsigned seq = atomic_load_explicit(&snapshot->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&snapshot->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        const client_slot_t *slot = &ctx->client_slots[i];
+        chat_session_entry_t *entry = &snapshot->entries[i];
+        entry->active = slot->active;
+        entry->joined = slot->active && slot->joined && slot->user_hash != 0;
+        entry->wire = slot->wire;
+        entry->fd = slot->fd;
+        entry->user_hash = slot->user_hash;
+        memcpy(entry->user_id, slot->user_id, sizeof(entry->user_id));
+    }
+    atomic_store_explicit(&snapshot->seq, seq + 2, memory_order_release);
+}
+
+static int collect_joined_locked(const app_context_t *ctx, chat_presence_user_t *users)
+{
+    int count = 0;
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        const client_slot_t *slot = &ctx->client_slots[i];
+        if (!slot->active || !slot->joined || slot->user_id[0] == '\0') {
+            continue;
+        }
+        copy_bounded(users[count].id, sizeof(users[count].id), slot->user_id);
+        copy_bounded(users[count].name, sizeof(users[count].name), slot->name[0] ? slot->name : "New User");
+        count++;
+    }
+    return count;
+}
+
+/* The joined set as of now, for whoever holds client_mutex. */
+static chat_presence_user_t s_joined[MAX_CLIENTS];
+
+/*
+ * Every change to the joined set goes through here; the presence task tells clients after the
+ * debounce window. Without it the presence version moves at once and clients only see the list
+ * when they join or ask for it.
+ */
+static void joined_set_changed_locked(app_context_t *ctx)
+{
+    ctx->session_epoch++;
+    publish_snapshot_locked(ctx);
+    if (ctx->presence_task != NULL) {
+        ctx->presence_pending = true;
+        xTaskNotify(ctx->presence_task, 0, eNoAction);
+        return;
+    }
+
+    ctx->presence_user_count = collect_joined_locked(ctx, ctx->presence_users);
+    ctx->presence_version++;
+    chat_payload_release(ctx->online_users_payload);
+    ctx->online_users_payload = NULL;
+}
+
+/* Copies what a reader needs from the snapshot entries into arg; must cope with torn entries. */
+typedef int (*snapshot_reader_t)(const chat_session_entry_t *entries, void *arg);
+
+/*
+ * Runs reader against session_snapshot without client_mutex and keeps the result of a pass no
+ * writer overlapped. A reader that keeps losing to writers takes the mutex rather than spin: the
+ * writer may be a lower-priority task it has preempted.
+ */
+static int read_snapshot(app_context_t *ctx, snapshot_reader_t reader, void *arg)
+{
+    chat_session_snapshot_t *snapshot = &ctx->session_snapshot;
+
+    for (int attempt = 0; attempt < SESSION_SNAPSHOT_ATTEMPTS; attempt++) {
+        unsigned seq = atomic_load_explicit(&snapshot->seq, memory_order_acquire);
+        if (seq & 1u) {
+            continue;
+        }
+        int result = reader(snapshot->entries, arg);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&snapshot->seq, memory_order_relaxed) == seq) {
+            return result;
+        }
+    }
+
+    if (xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
+        return 0;
+    }
+    int result = reader(snapshot->entries, arg);
+    xSemaphoreGive(ctx->client_mutex);
+    return result;
+}
+
+static int time_sync_threshold(int count)
+{
+    if (count <= 0) {
+        return 0;
+    }
+    return (count * 2 + 2) / 3;
+}
+
+/* Sets the system clock once, so current_timestamp_s() takes the time() fast path from then on. */
+static void apply_consensus_clock(int64_t offset)
+{
+    time_t now = 0;
+    time(&now);
+    if ((int64_t)now >= VALID_EPOCH_START_S && (int64_t)now <= VALID_EPOCH_END_S) {
+        return;
+    }
+
+    int64_t consensus_now = device_uptime_s() + offset;
+    if (consensus_now < VALID_EPOCH_START_S || consensus_now > VALID_EPOCH_END_S) {
+        return;
+    }
+
+    struct timeval tv = { .tv_sec = (time_t)consensus_now };
+    if (settimeofday(&tv, NULL) == 0) {
+        ESP_LOGI(TAG, "System clock set from client consensus: %" PRId64, consensus_now);
+    }
+}
+
+/*
+ * Recomputes the clock offset agreed on by at least two thirds of the joined clients: the largest
+ * cluster within TIME_SYNC_TOLERANCE_S, found with a sliding window over the sorted offsets. Called
+ * whenever a sample or the joined set changes; readers only load the published offset (0 = none).
+ */
+static void refresh_time_consensus_locked(app_context_t *ctx)
+{
+    int64_t offsets[MAX_CLIENTS];
+    int count = 0;
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        const client_slot_t *slot = &ctx->client_slots[i];
+        if (!slot->active || !slot->joined || !slot->time_offset_valid) {
+            continue;
+        }
+
+        int j = count++;
+        while (j > 0 && offsets[j - 1] > slot->time_offset_s) {
+            offsets[j] = offsets[j - 1];
+            j--;
+        }
+        offsets[j] = slot->time_offset_s;
+    }
+
+    int best_count = 0;
+    int64_t best_total = 0;
+    int64_t total = 0;
+    for (int lo = 0, hi = 0; lo < count; lo++) {
+        while (hi < count && offsets[hi] <= offsets[lo] + TIME_SYNC_TOLERANCE_S) {
+            total += offsets[hi++];
+        }
+        if (hi - lo > best_count) {
+            best_count = hi - lo;
+            best_total = total;
+        }
+        total -= offsets[lo];
+    }
+
+    int64_t consensus = 0;
+    if (count > 0 && best_count >= time_sync_threshold(count)) {
+        consensus = best_total / best_count;
+    }
+    atomic_store_explicit(&ctx->time_consensus_offset_s, consensus, memory_order_relaxed);
+
+    if (consensus != 0 && best_count >= TIME_SYNC_APPLY_MIN_CLIENTS) {
+        apply_consensus_clock(consensus);
+    }
 }
 
 bool chat_sessions_update_identity(app_context_t *ctx, int fd, const char *user_id, const char *name)
@@ -33,6 +236,7 @@ bool chat_sessions_update_identity(app_context_t *ctx, int fd, const char *user_
     bool updated = false;
     int stale_fds[MAX_CLIENTS];
     int stale_count = 0;
+    uint32_t user_hash = user_id != NULL ? hash_string(user_id, strlen(user_id)) : 0;
 
     if (ctx == NULL || xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
         return false;
@@ -46,7 +250,7 @@ bool chat_sessions_update_identity(app_context_t *ctx, int fd, const char *user_
             fd_slot = i;
             continue;
         }
-        if (ctx->client_slots[i].active && user_id != NULL && ctx->client_slots[i].user_id[0] != '\0' &&
+        if (ctx->client_slots[i].active && user_id != NULL && ctx->client_slots[i].user_hash == user_hash &&
             strcmp(ctx->client_slots[i].user_id, user_id) == 0) {
             same_user_slot = i;
         }
@@ -71,6 +275,7 @@ bool chat_sessions_update_identity(app_context_t *ctx, int fd, const char *user_
             ctx->client_slots[target].time_offset_s = 0;
         }
         copy_bounded(ctx->client_slots[target].user_id, sizeof(ctx->client_slots[target].user_id), user_id);
+        ctx->client_slots[target].user_hash = user_hash;
         copy_bounded(ctx->client_slots[target].name, sizeof(ctx->client_slots[target].name), name);
         updated = true;
 
@@ -85,7 +290,7 @@ bool chat_sessions_update_identity(app_context_t *ctx, int fd, const char *user_
 
     if (updated && user_id != NULL) {
         for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (i == target || !ctx->client_slots[i].active || ctx->client_slots[i].user_id[0] == '\0') {
+            if (i == target || !ctx->client_slots[i].active || ctx->client_slots[i].user_hash != user_hash) {
                 continue;
             }
             if (strcmp(ctx->client_slots[i].user_id, user_id) == 0) {
@@ -97,6 +302,10 @@ bool chat_sessions_update_identity(app_context_t *ctx, int fd, const char *user_
         }
     }
 
+    if (updated) {
+        joined_set_changed_locked(ctx);
+        refresh_time_consensus_locked(ctx);
+    }
     xSemaphoreGive(ctx->client_mutex);
 
     for (int i = 0; i < stale_count; i++) {
@@ -108,128 +317,539 @@ bool chat_sessions_update_identity(app_context_t *ctx, int fd, const char *user_
     return updated;
 }
 
-bool chat_sessions_ensure_slot(app_context_t *ctx, int fd)
+static bool slot_is_user(const client_slot_t *slot, uint32_t hash, const char *user_id, size_t len)
 {
-    bool ready = false;
+    return hash == slot->user_hash && strncmp(slot->user_id, user_id, len) == 0 && slot->user_id[len] == '\0';
+}
 
+bool chat_sessions_ensure_slot(app_context_t *ctx, int fd, client_slot_t *hint, chat_session_t *session)
+{
+    client_slot_t *found = NULL;
+
+    session->fd = fd;
+    session->slot = NULL;
     if (ctx == NULL || xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
         return false;
     }
 
-    for (int i = 0; i < MAX_CLIENTS; i++) {
+    if (hint != NULL && hint->active && hint->fd == fd) {
+        found = hint;
+    }
+    for (int i = 0; i < MAX_CLIENTS && found == NULL; i++) {
         if (ctx->client_slots[i].active && ctx->client_slots[i].fd == fd) {
-            ctx->client_slots[i].is_alive = true;
-            ready = true;
-            break;
+            found = &ctx->client_slots[i];
         }
     }
 
-    if (!ready) {
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (!ctx->client_slots[i].active) {
-                ctx->client_slots[i].fd = fd;
-                ctx->client_slots[i].active = true;
-                ctx->client_slots[i].joined = false;
-                ctx->client_slots[i].is_alive = true;
-                ctx->client_slots[i].time_offset_valid = false;
-                ctx->client_slots[i].time_offset_s = 0;
-                ctx->client_slots[i].user_id[0] = '\0';
-                copy_bounded(ctx->client_slots[i].name, sizeof(ctx->client_slots[i].name), "New User");
-                ready = true;
-                ESP_LOGI(TAG, "Registered WebSocket client slot for fd=%d", fd);
-                break;
-            }
+    for (int i = 0; i < MAX_CLIENTS && found == NULL; i++) {
+        client_slot_t *slot = &ctx->client_slots[i];
+        if (!slot->active) {
+            slot->fd = fd;
+            slot->active = true;
+            slot->joined = false;
+            slot->time_offset_valid = false;
+            slot->wire = 0;
+            slot->time_offset_s = 0;
+            slot->user_hash = 0;
+            slot->user_id[0] = '\0';
+            slot->history_ranges_known = false;
+            slot->history_range_count = 0;
+            fill_buckets(slot, esp_timer_get_time() / 1000);
+            copy_bounded(slot->name, sizeof(slot->name), "New User");
+            found = slot;
+            publish_snapshot_locked(ctx);
+            ESP_LOGI(TAG, "Registered WebSocket client slot for fd=%d", fd);
         }
     }
 
+    if (found != NULL) {
+        found->is_alive = true;
+    }
     xSemaphoreGive(ctx->client_mutex);
-    return ready;
+    session->slot = found;
+    return found != NULL;
 }
 
-bool chat_sessions_is_joined(app_context_t *ctx, int fd)
+static bool take_token_locked(client_slot_t *slot, chat_rate_class_t rate_class, bool *notify)
 {
-    bool joined = false;
+    const rate_limit_t *limit = &s_rate_limits[rate_class];
+    chat_token_bucket_t *bucket = &slot->buckets[rate_class];
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    uint64_t tokens = bucket->milli_tokens + (uint64_t)(now_ms - bucket->refill_ms) * limit->per_s;
+    bucket->milli_tokens = tokens > limit->burst * 1000 ? limit->burst * 1000 : (uint32_t)tokens;
+    bucket->refill_ms = now_ms;
 
-    if (ctx == NULL || xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
+    if (bucket->milli_tokens < 1000) {
+        *notify = !bucket->limited;
+        bucket->limited = true;
         return false;
     }
+    bucket->milli_tokens -= 1000;
+    bucket->limited = false;
+    return true;
+}
+
+static void apply_time_sample_locked(app_context_t *ctx, client_slot_t *slot, const chat_field_t *timestamp)
+{
+    if (timestamp->type != JSON_SCAN_NUMBER ||
+        timestamp->number < VALID_EPOCH_START_S ||
+        timestamp->number > VALID_EPOCH_END_S) {
+        return;
+    }
+
+    int64_t offset = (int64_t)timestamp->number - device_uptime_s();
+    if (!slot->time_offset_valid || slot->time_offset_s != offset) {
+        slot->time_offset_s = offset;
+        slot->time_offset_valid = true;
+        refresh_time_consensus_locked(ctx);
+    }
+}
+
+static bool is_user(const char *user_id, const chat_field_t *from)
+{
+    return from->type == JSON_SCAN_STRING && from->len <= MAX_USER_ID_LEN &&
+           strncmp(user_id, from->str, from->len) == 0 && user_id[from->len] == '\0';
+}
+
+void chat_sessions_admit_frame(app_context_t *ctx, const chat_session_t *session, const chat_frame_t *frame,
+                               chat_rate_class_t rate_class, chat_admission_t *admission)
+{
+    *admission = (chat_admission_t){ .allowed = true };
+    if (ctx == NULL || session->slot == NULL || xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    client_slot_t *slot = session->slot;
+    if (slot->active && slot->fd == session->fd) {
+        if (RATE_LIMIT && rate_class < CHAT_RATE_CLASSES) {
+            admission->allowed = take_token_locked(slot, rate_class, &admission->notify_limited);
+        }
+        admission->joined = slot->joined && slot->user_id[0] != '\0';
+        if (admission->joined) {
+            memcpy(admission->user_id, slot->user_id, sizeof(admission->user_id));
+        }
+        admission->identity_ok = admission->joined && is_user(admission->user_id, &frame->from);
+        if (admission->allowed && admission->identity_ok) {
+            apply_time_sample_locked(ctx, slot, &frame->timestamp);
+        }
+    }
+
+    xSemaphoreGive(ctx->client_mutex);
+}
+
+void chat_sessions_admit_parsed_frame(app_context_t *ctx, const chat_session_t *session, const chat_frame_t *frame,
+                                      chat_admission_t *admission)
+{
+    admission->identity_ok = admission->identity_ok && is_user(admission->user_id, &frame->from);
+    if (ctx == NULL || !admission->allowed || !admission->identity_ok ||
+        xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    client_slot_t *slot = session->slot;
+    if (slot->active && slot->fd == session->fd) {
+        apply_time_sample_locked(ctx, slot, &frame->timestamp);
+    }
+    xSemaphoreGive(ctx->client_mutex);
+}
+
+bool chat_sessions_take_token(app_context_t *ctx, const chat_session_t *session, chat_rate_class_t rate_class,
+                              bool *notify_limited)
+{
+    bool allowed = true;
+    *notify_limited = false;
+    if (!RATE_LIMIT || rate_class >= CHAT_RATE_CLASSES || ctx == NULL || session->slot == NULL ||
+        xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
+        return true;
+    }
+
+    client_slot_t *slot = session->slot;
+    if (slot->active && slot->fd == session->fd) {
+        allowed = take_token_locked(slot, rate_class, notify_limited);
+    }
+    xSemaphoreGive(ctx->client_mutex);
+    return allowed;
+}
+
+static int mask_fds_locked(const app_context_t *ctx, uint32_t mask, int *fds)
+{
+    int fd_count = 0;
+    while (mask != 0) {
+        int i = __builtin_ctz(mask);
+        mask &= mask - 1;
+        fds[fd_count++] = ctx->client_slots[i].fd;
+    }
+    return fd_count;
+}
+
+typedef struct {
+    const chat_field_t *users;
+    const uint32_t *hashes;
+    int user_count;
+    int *fds;
+} user_fds_read_t;
+
+static bool entry_is_user(const chat_session_entry_t *entry, uint32_t hash, const char *user_id, size_t len)
+{
+    return hash == entry->user_hash && len <= MAX_USER_ID_LEN && strncmp(entry->user_id, user_id, len) == 0 &&
+           entry->user_id[len] == '\0';
+}
+
+static int read_user_fds(const chat_session_entry_t *entries, void *arg)
+{
+    const user_fds_read_t *read = arg;
+    int fd_count = 0;
 
     for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (ctx->client_slots[i].active && ctx->client_slots[i].fd == fd) {
-            joined = ctx->client_slots[i].joined && ctx->client_slots[i].user_id[0] != '\0';
+        const chat_session_entry_t *entry = &entries[i];
+        if (!entry->joined) {
+            continue;
+        }
+        for (int j = 0; j < read->user_count; j++) {
+            if (entry_is_user(entry, read->hashes[j], read->users[j].str, read->users[j].len)) {
+                read->fds[fd_count++] = entry->fd;
+                break;
+            }
+        }
+    }
+    return fd_count;
+}
+
+int chat_sessions_user_fds(app_context_t *ctx, const chat_field_t *users, int user_count, int *fds)
+{
+    uint32_t hashes[MAX_CLIENTS + 1];
+
+    if (ctx == NULL || users == NULL || fds == NULL || user_count <= 0 || user_count > MAX_CLIENTS + 1) {
+        return 0;
+    }
+
+    /* Hash each target once; entries then match on the interned hash. */
+    for (int j = 0; j < user_count; j++) {
+        hashes[j] = users[j].type == JSON_SCAN_STRING ? hash_string(users[j].str, users[j].len) : 0;
+    }
+
+    user_fds_read_t read = { .users = users, .hashes = hashes, .user_count = user_count, .fds = fds };
+    return read_snapshot(ctx, read_user_fds, &read);
+}
+
+int chat_sessions_group_fds(app_context_t *ctx, chat_group_t *group, int *fds)
+{
+    if (ctx == NULL || group == NULL || fds == NULL || xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
+        return 0;
+    }
+
+    if (group->session_epoch != ctx->session_epoch) {
+        uint32_t mask = 0;
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            const client_slot_t *slot = &ctx->client_slots[i];
+            if (!slot->active || !slot->joined || slot->user_hash == 0) {
+                continue;
+            }
+            for (int j = 0; j < group->member_count; j++) {
+                if (slot_is_user(slot, group->member_hashes[j], group->members[j], strlen(group->members[j]))) {
+                    mask |= 1u << i;
+                    break;
+                }
+            }
+        }
+        group->slot_mask = mask;
+        group->session_epoch = ctx->session_epoch;
+    }
+
+    int fd_count = mask_fds_locked(ctx, group->slot_mask, fds);
+    xSemaphoreGive(ctx->client_mutex);
+    return fd_count;
+}
+
+void chat_sessions_set_history_ranges(app_context_t *ctx, int fd, const chat_id_range_t *ranges, int count, bool known)
+{
+    if (ctx == NULL || count < 0 || count > HISTORY_PEER_RANGES ||
+        xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        client_slot_t *slot = &ctx->client_slots[i];
+        if (slot->active && slot->fd == fd) {
+            slot->history_ranges_known = known;
+            slot->history_range_count = (uint8_t)count;
+            if (count > 0) {
+                memcpy(slot->history_ranges, ranges, (size_t)count * sizeof(ranges[0]));
+            }
             break;
         }
     }
 
     xSemaphoreGive(ctx->client_mutex);
-    return joined;
 }
 
-bool chat_sessions_identity_matches(app_context_t *ctx, int fd, const char *user_id)
+static int compare_ids(const void *a, const void *b)
 {
-    bool matches = false;
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
 
-    if (ctx == NULL || user_id == NULL || xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
-        return false;
+/* Appends the span of range inside [1, before_id) as two segment bounds. */
+static int add_range_bounds(uint64_t *bounds, int count, const chat_id_range_t *range, uint64_t before_id)
+{
+    if (range->first >= before_id) {
+        return count;
+    }
+    bounds[count++] = range->first;
+    bounds[count++] = range->last + 1 < before_id ? range->last + 1 : before_id;
+    return count;
+}
+
+static bool slot_holds(const client_slot_t *slot, uint64_t id)
+{
+    for (int r = 0; r < slot->history_range_count; r++) {
+        if (slot->history_ranges[r].first <= id && id <= slot->history_ranges[r].last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct {
+    uint64_t first;
+    uint64_t end;       /* exclusive */
+    uint32_t holders;   /* slots still able to cover this segment; 0 once covered */
+} cover_segment_t;
+
+/*
+ * Greedy set cover over the ids below before_id that the requester lacks. The advertised ranges
+ * cut [1, before_id) into segments, each with the mask of peers holding it; the peer covering the
+ * most still-missing ids is taken until nothing more can be covered.
+ */
+static uint32_t cover_missing_locked(const app_context_t *ctx, int requester, uint32_t candidates,
+                                     uint64_t before_id, uint64_t *bounds, cover_segment_t *segments)
+{
+    const client_slot_t *self = &ctx->client_slots[requester];
+    int bound_count = 0;
+
+    bounds[bound_count++] = 1;
+    bounds[bound_count++] = before_id;
+    for (int r = 0; r < self->history_range_count; r++) {
+        bound_count = add_range_bounds(bounds, bound_count, &self->history_ranges[r], before_id);
+    }
+    for (uint32_t mask = candidates; mask != 0; mask &= mask - 1) {
+        const client_slot_t *slot = &ctx->client_slots[__builtin_ctz(mask)];
+        for (int r = 0; r < slot->history_range_count; r++) {
+            bound_count = add_range_bounds(bounds, bound_count, &slot->history_ranges[r], before_id);
+        }
+    }
+    qsort(bounds, (size_t)bound_count, sizeof(bounds[0]), compare_ids);
+
+    int segment_count = 0;
+    for (int b = 0; b + 1 < bound_count; b++) {
+        if (bounds[b] == bounds[b + 1] || slot_holds(self, bounds[b])) {
+            continue;
+        }
+        uint32_t holders = 0;
+        for (uint32_t mask = candidates; mask != 0; mask &= mask - 1) {
+            int i = __builtin_ctz(mask);
+            if (slot_holds(&ctx->client_slots[i], bounds[b])) {
+                holders |= 1u << i;
+            }
+        }
+        if (holders != 0) {
+            segments[segment_count++] = (cover_segment_t){ bounds[b], bounds[b + 1], holders };
+        }
+    }
+
+    uint32_t chosen = 0;
+    for (;;) {
+        uint64_t gain[MAX_CLIENTS] = { 0 };
+        for (int s = 0; s < segment_count; s++) {
+            for (uint32_t mask = segments[s].holders; mask != 0; mask &= mask - 1) {
+                gain[__builtin_ctz(mask)] += segments[s].end - segments[s].first;
+            }
+        }
+
+        int best = -1;
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (gain[i] > 0 && (best < 0 || gain[i] > gain[best])) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            return chosen;
+        }
+
+        chosen |= 1u << best;
+        for (int s = 0; s < segment_count; s++) {
+            if (segments[s].holders & (1u << best)) {
+                segments[s].holders = 0;
+            }
+        }
+    }
+}
+
+int chat_sessions_history_peer_fds(app_context_t *ctx, int fd, uint64_t before_id, int *fds)
+{
+    const size_t max_bounds = MAX_CLIENTS * HISTORY_PEER_RANGES * 2 + 2;
+
+    if (ctx == NULL || fds == NULL || before_id <= 1) {
+        return -1;
+    }
+
+    uint64_t *bounds = malloc(max_bounds * sizeof(*bounds));
+    cover_segment_t *segments = malloc(max_bounds * sizeof(*segments));
+    if (bounds == NULL || segments == NULL || xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
+        free(bounds);
+        free(segments);
+        return -1;
     }
 
+    int requester = -1;
     for (int i = 0; i < MAX_CLIENTS; i++) {
         if (ctx->client_slots[i].active && ctx->client_slots[i].fd == fd) {
-            matches = ctx->client_slots[i].joined &&
-                ctx->client_slots[i].user_id[0] != '\0' &&
-                strcmp(ctx->client_slots[i].user_id, user_id) == 0;
+            requester = i;
             break;
         }
     }
 
+    int fd_count = -1;
+    if (requester >= 0) {
+        /*
+         * Peers that joined without history_ranges may hold anything, so they are always asked.
+         * Other sessions of the requesting user are skipped only on a full id match, not on the hash.
+         */
+        const client_slot_t *self = &ctx->client_slots[requester];
+        size_t self_len = strlen(self->user_id);
+        uint32_t unknown = 0;
+        uint32_t candidates = 0;
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            const client_slot_t *slot = &ctx->client_slots[i];
+            if (i == requester || !slot->active || !slot->joined || slot->user_hash == 0 ||
+                slot_is_user(slot, self->user_hash, self->user_id, self_len)) {
+                continue;
+            }
+            if (slot->history_ranges_known) {
+                candidates |= 1u << i;
+            } else {
+                unknown |= 1u << i;
+            }
+        }
+
+        uint32_t chosen = candidates != 0
+            ? cover_missing_locked(ctx, requester, candidates, before_id, bounds, segments)
+            : 0;
+        fd_count = mask_fds_locked(ctx, chosen | unknown, fds);
+    }
+
     xSemaphoreGive(ctx->client_mutex);
-    return matches;
+    free(bounds);
+    free(segments);
+    return fd_count;
 }
 
-void chat_sessions_update_time_sample(app_context_t *ctx, int fd, const cJSON *root)
+void chat_sessions_set_wire(app_context_t *ctx, int fd, uint8_t wire)
 {
-    cJSON *timestamp = root ? cJSON_GetObjectItem(root, "timestamp") : NULL;
-    if (ctx == NULL ||
-        !cJSON_IsNumber(timestamp) ||
-        timestamp->valuedouble < VALID_EPOCH_START_S ||
-        timestamp->valuedouble > VALID_EPOCH_END_S) {
+    if (ctx == NULL || xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
         return;
     }
 
-    int64_t offset = (int64_t)timestamp->valuedouble - device_uptime_s();
-    if (xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
-        return;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (ctx->client_slots[i].active && ctx->client_slots[i].fd == fd) {
+            ctx->client_slots[i].wire = wire;
+            publish_snapshot_locked(ctx);
+            break;
+        }
     }
 
+    xSemaphoreGive(ctx->client_mutex);
+}
+
+typedef struct {
+    int fd;
+    uint8_t wire;
+} wire_read_t;
+
+static int read_wire(const chat_session_entry_t *entries, void *arg)
+{
+    wire_read_t *read = arg;
+
+    read->wire = 0;
     for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (ctx->client_slots[i].active && ctx->client_slots[i].joined && ctx->client_slots[i].fd == fd) {
-            ctx->client_slots[i].time_offset_s = offset;
-            ctx->client_slots[i].time_offset_valid = true;
+        if (entries[i].active && entries[i].fd == read->fd) {
+            read->wire = entries[i].wire;
             break;
         }
     }
+    return 0;
+}
 
-    xSemaphoreGive(ctx->client_mutex);
+uint8_t chat_sessions_wire(app_context_t *ctx, int fd)
+{
+    wire_read_t read = { .fd = fd };
+
+    if (ctx == NULL || fd < 0) {
+        return 0;
+    }
+    read_snapshot(ctx, read_wire, &read);
+    return read.wire;
 }
 
-bool chat_sessions_mark_alive(app_context_t *ctx, int fd)
+typedef struct {
+    const int *only_fds;
+    int only_count;
+    int *fds;
+    uint8_t *wires;
+} active_fds_read_t;
+
+static bool listed_fd(const int *only_fds, int only_count, int fd)
 {
-    bool marked = false;
+    for (int i = 0; i < only_count; i++) {
+        if (only_fds[i] == fd) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    if (ctx == NULL || xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
-        return false;
+static int read_active_fds(const chat_session_entry_t *entries, void *arg)
+{
+    const active_fds_read_t *read = arg;
+    int fd_count = 0;
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        int fd = entries[i].fd;
+        if (!entries[i].active || (read->only_fds != NULL && !listed_fd(read->only_fds, read->only_count, fd))) {
+            continue;
+        }
+        read->wires[fd_count] = entries[i].wire;
+        read->fds[fd_count++] = fd;
+    }
+    return fd_count;
+}
+
+int chat_sessions_active_fds(app_context_t *ctx, const int *only_fds, int only_count, int *fds, uint8_t *wires)
+{
+    if (ctx == NULL || fds == NULL || wires == NULL) {
+        return 0;
+    }
+
+    active_fds_read_t read = { .only_fds = only_fds, .only_count = only_count, .fds = fds, .wires = wires };
+    return read_snapshot(ctx, read_active_fds, &read);
+}
+
+void chat_sessions_update_time_sample(app_context_t *ctx, int fd, const chat_field_t *timestamp)
+{
+    if (ctx == NULL || timestamp == NULL || xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
+        return;
     }
 
     for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (ctx->client_slots[i].active && ctx->client_slots[i].fd == fd) {
-            ctx->client_slots[i].is_alive = true;
-            marked = true;
+        client_slot_t *slot = &ctx->client_slots[i];
+        if (slot->active && slot->joined && slot->fd == fd) {
+            apply_time_sample_locked(ctx, slot, timestamp);
             break;
         }
     }
 
     xSemaphoreGive(ctx->client_mutex);
-    return marked;
 }
 
 bool chat_sessions_remove_by_fd(app_context_t *ctx, int fd)
@@ -247,85 +867,227 @@ bool chat_sessions_remove_by_fd(app_context_t *ctx, int fd)
             break;
         }
     }
+    if (removed) {
+        joined_set_changed_locked(ctx);
+        refresh_time_consensus_locked(ctx);
+    }
 
     xSemaphoreGive(ctx->client_mutex);
     return removed;
 }
 
-char *chat_sessions_build_online_users_payload(app_context_t *ctx)
+static void write_online_users_locked(app_context_t *ctx, json_writer_t *writer, int64_t timestamp,
+                                      const chat_presence_user_t *users, int count)
 {
-    cJSON *root = cJSON_CreateObject();
-    cJSON *to = NULL;
-    cJSON *users = NULL;
-    cJSON *data = NULL;
-    char *payload = NULL;
+    JSON_WRITER_LITERAL(writer, "{\"type\":\"onlineUsers\",\"from\":\"server\",\"timestamp\":");
+    json_writer_int(writer, timestamp);
+    JSON_WRITER_LITERAL(writer, ",\"version\":");
+    json_writer_uint(writer, ctx->presence_version);
+    JSON_WRITER_LITERAL(writer, ",\"to\":{\"users\":[");
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            JSON_WRITER_LITERAL(writer, ",");
+        }
+        json_writer_string(writer, users[i].id);
+    }
 
-    if (ctx == NULL || root == NULL) {
-        cJSON_Delete(root);
-        return NULL;
+    JSON_WRITER_LITERAL(writer, "],\"all\":true},\"data\":[");
+    for (int i = 0; i < count; i++) {
+        if (i > 0) {
+            JSON_WRITER_LITERAL(writer, ",");
+        }
+        JSON_WRITER_LITERAL(writer, "{\"id\":");
+        json_writer_string(writer, users[i].id);
+        JSON_WRITER_LITERAL(writer, ",\"name\":");
+        json_writer_string(writer, users[i].name);
+        JSON_WRITER_LITERAL(writer, "}");
     }
+    JSON_WRITER_LITERAL(writer, "]}");
+}
 
-    cJSON_AddStringToObject(root, "type", "onlineUsers");
-    cJSON_AddStringToObject(root, "from", "server");
-    cJSON_AddNumberToObject(root, "timestamp", current_timestamp_s(ctx));
+static chat_payload_t *build_online_users_locked(app_context_t *ctx, const chat_presence_user_t *users, int count)
+{
+    int64_t timestamp = current_timestamp_s(ctx);
+    json_writer_t writer;
+    json_writer_init(&writer, NULL, 0);
+    write_online_users_locked(ctx, &writer, timestamp, users, count);
 
-    to = cJSON_AddObjectToObject(root, "to");
-    users = to ? cJSON_AddArrayToObject(to, "users") : NULL;
-    data = cJSON_AddArrayToObject(root, "data");
-    if (to == NULL || users == NULL || data == NULL) {
-        cJSON_Delete(root);
-        return NULL;
+    chat_payload_t *built = chat_payload_alloc(writer.len);
+    if (built != NULL) {
+        json_writer_init(&writer, built->data, writer.len + 1);
+        write_online_users_locked(ctx, &writer, timestamp, users, count);
+        json_writer_finish(&writer);
     }
-    cJSON_AddBoolToObject(to, "all", true);
+    return built;
+}
 
-    if (xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) == pdTRUE) {
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (!ctx->client_slots[i].active || !ctx->client_slots[i].joined || ctx->client_slots[i].user_id[0] == '\0') {
-                continue;
-            }
+/*
+ * The list of presence_users is serialized once per presence version and shared by reference, so
+ * its timestamp is the time of that version. While a change waits out the debounce window the list
+ * is built from the current joined set instead, still labelled presence_version: the pending
+ * delta only joins, renames and removes users, so applying it to the newer list is harmless.
+ */
+chat_payload_t *chat_sessions_online_users_payload(app_context_t *ctx)
+{
+    chat_payload_t *payload = NULL;
 
-            cJSON *id = cJSON_CreateString(ctx->client_slots[i].user_id);
-            if (id) {
-                cJSON_AddItemToArray(users, id);
-            }
+    if (ctx == NULL || xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
+        return NULL;
+    }
 
-            cJSON *entry = cJSON_CreateObject();
-            if (entry) {
-                cJSON_AddStringToObject(entry, "id", ctx->client_slots[i].user_id);
-                cJSON_AddStringToObject(entry, "name", ctx->client_slots[i].name[0] ? ctx->client_slots[i].name : "New User");
-                cJSON_AddItemToArray(data, entry);
-            }
+    if (ctx->presence_pending) {
+        payload = build_online_users_locked(ctx, s_joined, collect_joined_locked(ctx, s_joined));
+    } else {
+        if (ctx->online_users_payload == NULL) {
+            ctx->online_users_payload = build_online_users_locked(ctx, ctx->presence_users, ctx->presence_user_count);
         }
-        xSemaphoreGive(ctx->client_mutex);
+        payload = chat_payload_ref(ctx->online_users_payload);
     }
 
-    payload = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
+    xSemaphoreGive(ctx->client_mutex);
     return payload;
 }
 
-void chat_sessions_broadcast_online_users(app_context_t *ctx)
+static bool known_presence_version(app_context_t *ctx, const chat_field_t *version)
 {
-    char *payload = chat_sessions_build_online_users_payload(ctx);
+    bool known = false;
+
+    if (version == NULL || version->type != JSON_SCAN_NUMBER || version->number < 0 || version->number > UINT32_MAX ||
+        xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+    known = version->number == (double)ctx->presence_version;
+    xSemaphoreGive(ctx->client_mutex);
+    return known;
+}
+
+void chat_sessions_send_online_users_to_client(app_context_t *ctx, int fd, const chat_field_t *known_version)
+{
+    if (ctx == NULL || known_presence_version(ctx, known_version)) {
+        return;
+    }
+
+    chat_payload_t *payload = chat_sessions_online_users_payload(ctx);
     if (payload == NULL) {
-        ESP_LOGW(TAG, "Failed to build online user list");
+        chat_ws_send_error(ctx, fd, "server_busy", "Unable to build online user list");
         return;
     }
 
-    chat_ws_broadcast(ctx, payload);
-    free(payload);
+    chat_ws_send_payload(ctx, fd, payload);
+    chat_payload_release(payload);
 }
 
-void chat_sessions_send_online_users_to_client(app_context_t *ctx, int fd)
+static const chat_presence_user_t *find_presence_user(const chat_presence_user_t *users, int count, const char *id)
 {
-    char *payload = chat_sessions_build_online_users_payload(ctx);
-    if (payload == NULL) {
-        chat_ws_send_error(ctx, fd, "server_busy", "Unable to build online user list");
+    for (int i = 0; i < count; i++) {
+        if (strcmp(users[i].id, id) == 0) {
+            return &users[i];
+        }
+    }
+    return NULL;
+}
+
+static void write_presence_event(json_writer_t *writer, int *events, const char *type, const chat_presence_user_t *user,
+                                 bool with_name)
+{
+    if (*events > 0) {
+        JSON_WRITER_LITERAL(writer, ",");
+    }
+    JSON_WRITER_LITERAL(writer, "{\"type\":");
+    json_writer_string(writer, type);
+    JSON_WRITER_LITERAL(writer, ",\"id\":");
+    json_writer_string(writer, user->id);
+    if (with_name) {
+        JSON_WRITER_LITERAL(writer, ",\"name\":");
+        json_writer_string(writer, user->name);
+    }
+    JSON_WRITER_LITERAL(writer, "}");
+    (*events)++;
+}
+
+/* Writes how current differs from presence_users as one presence frame; returns the event count. */
+static int write_presence_locked(const app_context_t *ctx, json_writer_t *writer, int64_t timestamp,
+                                 const chat_presence_user_t *current, int count)
+{
+    int events = 0;
+
+    JSON_WRITER_LITERAL(writer, "{\"type\":\"presence\",\"from\":\"server\",\"timestamp\":");
+    json_writer_int(writer, timestamp);
+    JSON_WRITER_LITERAL(writer, ",\"base\":");
+    json_writer_uint(writer, ctx->presence_version);
+    JSON_WRITER_LITERAL(writer, ",\"version\":");
+    json_writer_uint(writer, (uint32_t)(ctx->presence_version + 1));
+    JSON_WRITER_LITERAL(writer, ",\"events\":[");
+    for (int i = 0; i < ctx->presence_user_count; i++) {
+        if (find_presence_user(current, count, ctx->presence_users[i].id) == NULL) {
+            write_presence_event(writer, &events, "userLeft", &ctx->presence_users[i], false);
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        const chat_presence_user_t *known = find_presence_user(ctx->presence_users, ctx->presence_user_count, current[i].id);
+        if (known == NULL) {
+            write_presence_event(writer, &events, "userJoined", &current[i], true);
+        } else if (strcmp(known->name, current[i].name) != 0) {
+            write_presence_event(writer, &events, "userRenamed", &current[i], true);
+        }
+    }
+    JSON_WRITER_LITERAL(writer, "]}");
+    return events;
+}
+
+/* Publishes the joined set as the next presence version and broadcasts the delta, if anything changed. */
+static void flush_presence(app_context_t *ctx)
+{
+    chat_presence_user_t *current = s_joined;
+    chat_payload_t *payload = NULL;
+    bool retry = false;
+
+    if (xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
         return;
     }
 
-    chat_ws_send_text(ctx, fd, payload);
-    free(payload);
+    int count = collect_joined_locked(ctx, current);
+    int64_t timestamp = current_timestamp_s(ctx);
+    json_writer_t writer;
+    json_writer_init(&writer, NULL, 0);
+    if (write_presence_locked(ctx, &writer, timestamp, current, count) > 0) {
+        payload = chat_payload_alloc(writer.len);
+        retry = payload == NULL;
+    }
+    if (payload != NULL) {
+        json_writer_init(&writer, payload->data, writer.len + 1);
+        write_presence_locked(ctx, &writer, timestamp, current, count);
+        json_writer_finish(&writer);
+        memcpy(ctx->presence_users, current, sizeof(current[0]) * count);
+        ctx->presence_user_count = count;
+        ctx->presence_version++;
+        chat_payload_release(ctx->online_users_payload);
+        ctx->online_users_payload = NULL;
+    }
+    ctx->presence_pending = retry;
+    xSemaphoreGive(ctx->client_mutex);
+
+    if (retry) {
+        ESP_LOGW(TAG, "Failed to build presence update; retrying");
+        xTaskNotify(ctx->presence_task, 0, eNoAction);
+    }
+    if (payload != NULL) {
+        chat_ws_broadcast_payload(ctx, payload);
+        chat_payload_release(payload);
+    }
+}
+
+static void presence_task(void *pvParameters)
+{
+    app_context_t *ctx = (app_context_t *)pvParameters;
+
+    while (1) {
+        xTaskNotifyWait(0, 0, NULL, portMAX_DELAY);
+        /* Changes made during the window land in this frame, so drop their pending notifications. */
+        vTaskDelay(pdMS_TO_TICKS(PRESENCE_DEBOUNCE_MS));
+        xTaskNotifyWait(0, 0, NULL, 0);
+        flush_presence(ctx);
+    }
 }
 
 static void heartbeat_task(void *pvParameters)
@@ -366,6 +1128,10 @@ static void heartbeat_task(void *pvParameters)
             }
         }
 
+        if (changed) {
+            joined_set_changed_locked(ctx);
+            refresh_time_consensus_locked(ctx);
+        }
         xSemaphoreGive(ctx->client_mutex);
 
         for (int i = 0; i < close_count; i++) {
@@ -379,13 +1145,8 @@ static void heartbeat_task(void *pvParameters)
             if (ret != ESP_OK) {
                 ESP_LOGW(TAG, "Ping failed for fd=%d: %s", ping_fds[i], esp_err_to_name(ret));
                 chat_ws_close_client(ctx, ping_fds[i]);
-                changed = true;
             }
         }
-
-        if (changed) {
-            chat_sessions_broadcast_online_users(ctx);
-        }
     }
 }
 
@@ -393,3 +1154,18 @@ void chat_sessions_start_heartbeat(app_context_t *ctx)
 {
     xTaskCreate(heartbeat_task, "heartbeat_task", 4096, ctx, 5, NULL);
 }
+
+esp_err_t chat_sessions_start_presence(app_context_t *ctx)
+{
+    if (ctx == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* A random first version keeps clients from matching the version of a previous boot. */
+    ctx->presence_version = esp_random();
+    if (xTaskCreate(presence_task, "presence_task", 4096, ctx, 5, &ctx->presence_task) != pdPASS) {
+        ctx->presence_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,171 @@
+#include "common/deflate.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_BITS   10
+#define MIN_MATCH   3
+#define MAX_MATCH   258
+#define MAX_CHAIN   16
+
+typedef struct {
+    uint8_t *dst;
+    size_t cap;
+    size_t len;
+    uint32_t bits;
+    int count;
+    bool overflow;
+} bit_writer_t;
+
+/* Length codes 257..285 and distance codes 0..29 (RFC 1951, 3.2.5). */
+static const uint16_t s_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t s_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t s_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const uint8_t s_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+static void put_bits(bit_writer_t *writer, uint32_t value, int count)
+{
+    writer->bits |= value << writer->count;
+    writer->count += count;
+    while (writer->count >= 8) {
+        if (writer->len < writer->cap) {
+            writer->dst[writer->len] = (uint8_t)writer->bits;
+        } else {
+            writer->overflow = true;
+        }
+        writer->len++;
+        writer->bits >>= 8;
+        writer->count -= 8;
+    }
+}
+
+/* Huffman codes are packed most significant bit first, unlike every other field. */
+static void put_code(bit_writer_t *writer, uint32_t code, int count)
+{
+    uint32_t reversed = 0;
+    for (int i = 0; i < count; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1u);
+    }
+    put_bits(writer, reversed, count);
+}
+
+static void put_symbol(bit_writer_t *writer, int symbol)
+{
+    if (symbol < 144) {
+        put_code(writer, 0x30 + symbol, 8);
+    } else if (symbol < 256) {
+        put_code(writer, 0x190 + symbol - 144, 9);
+    } else if (symbol < 280) {
+        put_code(writer, symbol - 256, 7);
+    } else {
+        put_code(writer, 0xC0 + symbol - 280, 8);
+    }
+}
+
+static void put_match(bit_writer_t *writer, size_t length, size_t distance)
+{
+    int code = 28;
+    while (s_length_base[code] > length) {
+        code--;
+    }
+    put_symbol(writer, 257 + code);
+    put_bits(writer, (uint32_t)(length - s_length_base[code]), s_length_extra[code]);
+
+    code = 29;
+    while (s_dist_base[code] > distance) {
+        code--;
+    }
+    put_code(writer, (uint32_t)code, 5);
+    put_bits(writer, (uint32_t)(distance - s_dist_base[code]), s_dist_extra[code]);
+}
+
+static uint32_t hash3(const uint8_t *p)
+{
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+size_t deflate_raw(const uint8_t *src, size_t len, uint8_t *dst, size_t cap, int window_bits)
+{
+    if (src == NULL || dst == NULL || len == 0 || len >= UINT16_MAX ||
+        window_bits < DEFLATE_MIN_WINDOW_BITS || window_bits > DEFLATE_MAX_WINDOW_BITS) {
+        return 0;
+    }
+
+    size_t window = (size_t)1 << window_bits;
+    /* Entries hold position + 1 so that zero means empty. */
+    uint16_t *head = calloc((1u << HASH_BITS) + window, sizeof(uint16_t));
+    if (head == NULL) {
+        return 0;
+    }
+    uint16_t *prev = head + (1u << HASH_BITS);
+
+    bit_writer_t writer = { .dst = dst, .cap = cap < len ? cap : len - 1 };
+    put_bits(&writer, 1, 1);    /* BFINAL */
+    put_bits(&writer, 1, 2);    /* BTYPE = fixed Huffman */
+
+    size_t i = 0;
+    while (i < len && !writer.overflow) {
+        size_t best_len = 0;
+        size_t best_dist = 0;
+
+        if (i + MIN_MATCH <= len) {
+            uint32_t h = hash3(src + i);
+            size_t limit = len - i > MAX_MATCH ? MAX_MATCH : len - i;
+            size_t candidate = head[h];
+            for (int chain = 0; candidate != 0 && chain < MAX_CHAIN; chain++) {
+                size_t pos = candidate - 1;
+                if (pos >= i || i - pos > window) {
+                    break;
+                }
+                if (src[pos + best_len] == src[i + best_len]) {
+                    size_t n = 0;
+                    while (n < limit && src[pos + n] == src[i + n]) {
+                        n++;
+                    }
+                    if (n > best_len) {
+                        best_len = n;
+                        best_dist = i - pos;
+                        if (n == limit) {
+                            break;
+                        }
+                    }
+                }
+                candidate = prev[pos & (window - 1)];
+            }
+        }
+
+        size_t end = i + (best_len >= MIN_MATCH ? best_len : 1);
+        if (best_len >= MIN_MATCH) {
+            put_match(&writer, best_len, best_dist);
+        } else {
+            put_symbol(&writer, src[i]);
+        }
+
+        for (; i < end; i++) {
+            if (i + MIN_MATCH <= len) {
+                uint32_t h = hash3(src + i);
+                prev[i & (window - 1)] = head[h];
+                head[h] = (uint16_t)(i + 1);
+            }
+        }
+    }
+    free(head);
+
+    put_symbol(&writer, 256);   /* end of block */
+    put_bits(&writer, 0, 7);    /* pad the last byte */
+    return writer.overflow ? 0 : writer.len;
+}
@@ -0,0 +1,269 @@
+#include "common/json_scan.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const char *p;
+    const char *end;
+} scanner_t;
+
+static bool scan_value(scanner_t *s, json_token_t *token, int depth);
+
+static void skip_whitespace(scanner_t *s)
+{
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r')) {
+        s->p++;
+    }
+}
+
+static bool at(const scanner_t *s, char c)
+{
+    return s->p < s->end && *s->p == c;
+}
+
+static bool scan_string(scanner_t *s, json_token_t *token)
+{
+    const char *start = ++s->p;
+    bool escaped = false;
+
+    while (s->p < s->end) {
+        unsigned char c = (unsigned char)*s->p;
+        if (c == '"') {
+            token->type = JSON_SCAN_STRING;
+            token->start = start;
+            token->len = (size_t)(s->p - start);
+            token->escaped = escaped;
+            s->p++;
+            return true;
+        }
+        if (c < 0x20) {
+            return false;
+        }
+        if (c == '\\') {
+            escaped = true;
+            if (++s->p >= s->end) {
+                return false;
+            }
+            c = (unsigned char)*s->p;
+            if (c == 'u') {
+                if (s->end - s->p < 5) {
+                    return false;
+                }
+                for (int i = 1; i <= 4; i++) {
+                    if (!isxdigit((unsigned char)s->p[i])) {
+                        return false;
+                    }
+                }
+                s->p += 4;
+            } else if (c == '\0' || strchr("\"\\/bfnrt", c) == NULL) {
+                return false;
+            }
+        }
+        s->p++;
+    }
+    return false;
+}
+
+static bool scan_digits(scanner_t *s)
+{
+    const char *start = s->p;
+    while (s->p < s->end && isdigit((unsigned char)*s->p)) {
+        s->p++;
+    }
+    return s->p > start;
+}
+
+static bool scan_number(scanner_t *s, json_token_t *token)
+{
+    const char *start = s->p;
+
+    if (at(s, '-')) {
+        s->p++;
+    }
+    if (at(s, '0')) {
+        s->p++;
+    } else if (!scan_digits(s)) {
+        return false;
+    }
+    if (at(s, '.')) {
+        s->p++;
+        if (!scan_digits(s)) {
+            return false;
+        }
+    }
+    if (at(s, 'e') || at(s, 'E')) {
+        s->p++;
+        if (at(s, '+') || at(s, '-')) {
+            s->p++;
+        }
+        if (!scan_digits(s)) {
+            return false;
+        }
+    }
+
+    token->type = JSON_SCAN_NUMBER;
+    token->start = start;
+    token->len = (size_t)(s->p - start);
+    token->escaped = false;
+    return true;
+}
+
+static bool scan_literal(scanner_t *s, const char *word, json_scan_type_t type, json_token_t *token)
+{
+    size_t len = strlen(word);
+    if ((size_t)(s->end - s->p) < len || memcmp(s->p, word, len) != 0) {
+        return false;
+    }
+
+    token->type = type;
+    token->start = s->p;
+    token->len = len;
+    token->escaped = false;
+    s->p += len;
+    return true;
+}
+
+static bool scan_container(scanner_t *s, json_token_t *token, int depth, json_scan_member_fn member,
+                           json_scan_item_fn item, void *arg)
+{
+    bool object = *s->p == '{';
+    char close = object ? '}' : ']';
+    const char *start = s->p++;
+
+    if (depth >= JSON_SCAN_MAX_DEPTH) {
+        return false;
+    }
+
+    skip_whitespace(s);
+    if (at(s, close)) {
+        s->p++;
+    } else {
+        for (;;) {
+            json_token_t key = { 0 };
+            json_token_t value = { 0 };
+
+            if (object) {
+                if (!at(s, '"') || !scan_string(s, &key)) {
+                    return false;
+                }
+                skip_whitespace(s);
+                if (!at(s, ':')) {
+                    return false;
+                }
+                s->p++;
+                skip_whitespace(s);
+            }
+            if (!scan_value(s, &value, depth + 1)) {
+                return false;
+            }
+            if (object && member != NULL && !member(&key, &value, arg)) {
+                return false;
+            }
+            if (!object && item != NULL && !item(&value, arg)) {
+                return false;
+            }
+
+            skip_whitespace(s);
+            if (at(s, ',')) {
+                s->p++;
+                skip_whitespace(s);
+                continue;
+            }
+            if (at(s, close)) {
+                s->p++;
+                break;
+            }
+            return false;
+        }
+    }
+
+    token->type = object ? JSON_SCAN_OBJECT : JSON_SCAN_ARRAY;
+    token->start = start;
+    token->len = (size_t)(s->p - start);
+    token->escaped = false;
+    return true;
+}
+
+static bool scan_value(scanner_t *s, json_token_t *token, int depth)
+{
+    if (s->p >= s->end) {
+        return false;
+    }
+
+    switch (*s->p) {
+    case '"':
+        return scan_string(s, token);
+    case '{':
+    case '[':
+        return scan_container(s, token, depth, NULL, NULL, NULL);
+    case 't':
+        return scan_literal(s, "true", JSON_SCAN_TRUE, token);
+    case 'f':
+        return scan_literal(s, "false", JSON_SCAN_FALSE, token);
+    case 'n':
+        return scan_literal(s, "null", JSON_SCAN_NULL, token);
+    default:
+        return scan_number(s, token);
+    }
+}
+
+bool json_scan_object(const char *src, size_t len, json_scan_member_fn visit, void *arg)
+{
+    if (src == NULL) {
+        return false;
+    }
+
+    scanner_t s = { .p = src, .end = src + len };
+    json_token_t token;
+
+    skip_whitespace(&s);
+    if (!at(&s, '{') || !scan_container(&s, &token, 0, visit, NULL, arg)) {
+        return false;
+    }
+    skip_whitespace(&s);
+    return s.p == s.end;
+}
+
+bool json_scan_array(const json_token_t *array, json_scan_item_fn visit, void *arg)
+{
+    if (array == NULL || array->type != JSON_SCAN_ARRAY) {
+        return false;
+    }
+
+    scanner_t s = { .p = array->start, .end = array->start + array->len };
+    json_token_t token;
+    return scan_container(&s, &token, 0, NULL, visit, arg);
+}
+
+const char *json_token_end(const json_token_t *token)
+{
+    return token->start + token->len + (token->type == JSON_SCAN_STRING ? 1 : 0);
+}
+
+bool json_token_equals(const json_token_t *token, const char *literal)
+{
+    size_t len = strlen(literal);
+    return token->type == JSON_SCAN_STRING && !token->escaped && token->len == len &&
+        memcmp(token->start, literal, len) == 0;
+}
+
+bool json_token_equals_nocase(const json_token_t *token, const char *literal)
+{
+    size_t len = strlen(literal);
+    if (token->type != JSON_SCAN_STRING || token->escaped || token->len != len) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (tolower((unsigned char)token->start[i]) != tolower((unsigned char)literal[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+double json_token_number(const json_token_t *token)
+{
+    return token->type == JSON_SCAN_NUMBER ? strtod(token->start, NULL) : 0;
+}
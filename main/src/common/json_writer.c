@@ -0,0 +1,121 @@
+#include "common/json_writer.h"
+
+#include <string.h>
+
+void json_writer_init(json_writer_t *writer, char *buf, size_t cap)
+{
+    writer->buf = buf;
+    writer->cap = cap;
+    writer->len = 0;
+    writer->overflow = false;
+}
+
+void json_writer_raw(json_writer_t *writer, const char *data, size_t len)
+{
+    /* One byte of cap is kept for the terminator written by json_writer_finish(). */
+    if (writer->buf != NULL && !writer->overflow && writer->len + len < writer->cap) {
+        memcpy(writer->buf + writer->len, data, len);
+    } else if (writer->buf != NULL) {
+        writer->overflow = true;
+    }
+    writer->len += len;
+}
+
+void json_writer_string(json_writer_t *writer, const char *str)
+{
+    if (str == NULL) {
+        JSON_WRITER_LITERAL(writer, "null");
+        return;
+    }
+    json_writer_string_n(writer, str, strlen(str));
+}
+
+void json_writer_string_n(json_writer_t *writer, const char *str, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *end = str + len;
+
+    JSON_WRITER_LITERAL(writer, "\"");
+    const char *run = str;
+    for (const char *p = str; p < end; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        json_writer_raw(writer, run, (size_t)(p - run));
+        run = p + 1;
+        switch (c) {
+        case '"':
+            JSON_WRITER_LITERAL(writer, "\\\"");
+            break;
+        case '\\':
+            JSON_WRITER_LITERAL(writer, "\\\\");
+            break;
+        case '\b':
+            JSON_WRITER_LITERAL(writer, "\\b");
+            break;
+        case '\f':
+            JSON_WRITER_LITERAL(writer, "\\f");
+            break;
+        case '\n':
+            JSON_WRITER_LITERAL(writer, "\\n");
+            break;
+        case '\r':
+            JSON_WRITER_LITERAL(writer, "\\r");
+            break;
+        case '\t':
+            JSON_WRITER_LITERAL(writer, "\\t");
+            break;
+        default: {
+            char escape[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0f] };
+            json_writer_raw(writer, escape, sizeof(escape));
+            break;
+        }
+        }
+    }
+    json_writer_raw(writer, run, (size_t)(end - run));
+    JSON_WRITER_LITERAL(writer, "\"");
+}
+
+void json_writer_uint(json_writer_t *writer, uint64_t value)
+{
+    char digits[20];
+    size_t count = 0;
+
+    do {
+        digits[sizeof(digits) - ++count] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    json_writer_raw(writer, digits + sizeof(digits) - count, count);
+}
+
+void json_writer_int(json_writer_t *writer, int64_t value)
+{
+    if (value < 0) {
+        JSON_WRITER_LITERAL(writer, "-");
+        json_writer_uint(writer, (uint64_t)0 - (uint64_t)value);
+        return;
+    }
+    json_writer_uint(writer, (uint64_t)value);
+}
+
+void json_writer_bool(json_writer_t *writer, bool value)
+{
+    if (value) {
+        JSON_WRITER_LITERAL(writer, "true");
+    } else {
+        JSON_WRITER_LITERAL(writer, "false");
+    }
+}
+
+bool json_writer_finish(json_writer_t *writer)
+{
+    if (writer->buf == NULL) {
+        return true;
+    }
+    if (writer->cap > 0) {
+        writer->buf[writer->overflow ? writer->cap - 1 : writer->len] = '\0';
+    }
+    return !writer->overflow && writer->cap > 0;
+}
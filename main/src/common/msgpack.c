@@ -0,0 +1,617 @@
+#include "common/msgpack.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "common/json_scan.h"
+
+typedef struct {
+    uint8_t *out;
+    size_t cap;
+    size_t len;
+} mp_writer_t;
+
+static bool write_value(mp_writer_t *writer, const json_token_t *token);
+
+static void put(mp_writer_t *writer, const void *data, size_t len)
+{
+    if (writer->out != NULL && writer->len + len <= writer->cap) {
+        memcpy(writer->out + writer->len, data, len);
+    }
+    writer->len += len;
+}
+
+static void put_byte(mp_writer_t *writer, uint8_t byte)
+{
+    put(writer, &byte, 1);
+}
+
+static void put_be(mp_writer_t *writer, uint8_t tag, uint64_t value, int bytes)
+{
+    uint8_t buf[9] = { tag };
+    for (int i = 0; i < bytes; i++) {
+        buf[bytes - i] = (uint8_t)(value >> (8 * i));
+    }
+    put(writer, buf, (size_t)bytes + 1);
+}
+
+/* fix is the one-byte form for counts below fix_limit; wide16 and wide16 + 1 are the 16/32-bit tags. */
+static void put_header(mp_writer_t *writer, uint8_t fix, size_t fix_limit, uint8_t wide16, size_t count)
+{
+    if (count < fix_limit) {
+        put_byte(writer, (uint8_t)(fix | count));
+    } else if (count <= UINT16_MAX) {
+        put_be(writer, wide16, count, 2);
+    } else {
+        put_be(writer, (uint8_t)(wide16 + 1), count, 4);
+    }
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+}
+
+static uint32_t read_hex4(const char *p)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value = (value << 4) | (uint32_t)hex_value(p[i]);
+    }
+    return value;
+}
+
+static size_t put_utf8(uint8_t *out, uint32_t cp)
+{
+    uint8_t buf[4];
+    size_t len;
+
+    if (cp < 0x80) {
+        buf[0] = (uint8_t)cp;
+        len = 1;
+    } else if (cp < 0x800) {
+        buf[0] = (uint8_t)(0xC0 | (cp >> 6));
+        buf[1] = (uint8_t)(0x80 | (cp & 0x3F));
+        len = 2;
+    } else if (cp < 0x10000) {
+        buf[0] = (uint8_t)(0xE0 | (cp >> 12));
+        buf[1] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+        buf[2] = (uint8_t)(0x80 | (cp & 0x3F));
+        len = 3;
+    } else {
+        buf[0] = (uint8_t)(0xF0 | (cp >> 18));
+        buf[1] = (uint8_t)(0x80 | ((cp >> 12) & 0x3F));
+        buf[2] = (uint8_t)(0x80 | ((cp >> 6) & 0x3F));
+        buf[3] = (uint8_t)(0x80 | (cp & 0x3F));
+        len = 4;
+    }
+    if (out != NULL) {
+        memcpy(out, buf, len);
+    }
+    return len;
+}
+
+/* Decodes the escapes of a scanned string; with out NULL it only measures. Lone surrogates become U+FFFD. */
+static size_t unescape(const json_token_t *token, uint8_t *out)
+{
+    const char *p = token->start;
+    const char *end = token->start + token->len;
+    size_t len = 0;
+
+    while (p < end) {
+        if (*p != '\\') {
+            if (out != NULL) {
+                out[len] = (uint8_t)*p;
+            }
+            len++;
+            p++;
+            continue;
+        }
+
+        char c = p[1];
+        p += 2;
+        if (c != 'u') {
+            static const char from[] = "\"\\/bfnrt";
+            static const char to[] = "\"\\/\b\f\n\r\t";
+            if (out != NULL) {
+                out[len] = (uint8_t)to[strchr(from, c) - from];
+            }
+            len++;
+            continue;
+        }
+
+        uint32_t cp = read_hex4(p);
+        p += 4;
+        if (cp >= 0xD800 && cp <= 0xDBFF && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+            uint32_t low = read_hex4(p + 2);
+            if (low >= 0xDC00 && low <= 0xDFFF) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                p += 6;
+            }
+        }
+        if (cp >= 0xD800 && cp <= 0xDFFF) {
+            cp = 0xFFFD;
+        }
+        len += put_utf8(out != NULL ? out + len : NULL, cp);
+    }
+    return len;
+}
+
+static void write_string(mp_writer_t *writer, const json_token_t *token)
+{
+    size_t len = token->escaped ? unescape(token, NULL) : token->len;
+    if (len < 32) {
+        put_byte(writer, (uint8_t)(0xA0 | len));
+    } else if (len <= UINT8_MAX) {
+        put_be(writer, 0xD9, len, 1);
+    } else {
+        put_header(writer, 0, 0, 0xDA, len);
+    }
+
+    if (!token->escaped) {
+        put(writer, token->start, len);
+    } else if (writer->out != NULL && writer->len + len <= writer->cap) {
+        unescape(token, writer->out + writer->len);
+        writer->len += len;
+    } else {
+        writer->len += len;
+    }
+}
+
+static void write_int(mp_writer_t *writer, int64_t value)
+{
+    if (value >= 0) {
+        uint64_t u = (uint64_t)value;
+        if (u < 0x80) {
+            put_byte(writer, (uint8_t)u);
+        } else if (u <= UINT8_MAX) {
+            put_be(writer, 0xCC, u, 1);
+        } else if (u <= UINT16_MAX) {
+            put_be(writer, 0xCD, u, 2);
+        } else if (u <= UINT32_MAX) {
+            put_be(writer, 0xCE, u, 4);
+        } else {
+            put_be(writer, 0xCF, u, 8);
+        }
+    } else if (value >= -32) {
+        put_byte(writer, (uint8_t)value);
+    } else if (value >= INT8_MIN) {
+        put_be(writer, 0xD0, (uint64_t)value, 1);
+    } else if (value >= INT16_MIN) {
+        put_be(writer, 0xD1, (uint64_t)value, 2);
+    } else if (value >= INT32_MIN) {
+        put_be(writer, 0xD2, (uint64_t)value, 4);
+    } else {
+        put_be(writer, 0xD3, (uint64_t)value, 8);
+    }
+}
+
+static void write_number(mp_writer_t *writer, const json_token_t *token)
+{
+    bool integral = memchr(token->start, '.', token->len) == NULL &&
+        memchr(token->start, 'e', token->len) == NULL && memchr(token->start, 'E', token->len) == NULL;
+    if (integral) {
+        errno = 0;
+        long long value = strtoll(token->start, NULL, 10);
+        if (errno == 0) {
+            write_int(writer, value);
+            return;
+        }
+    }
+
+    double value = json_token_number(token);
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_be(writer, 0xCB, bits, 8);
+}
+
+static bool count_member(const json_token_t *key, const json_token_t *value, void *arg)
+{
+    (*(size_t *)arg)++;
+    return true;
+}
+
+static bool count_item(const json_token_t *item, void *arg)
+{
+    (*(size_t *)arg)++;
+    return true;
+}
+
+static bool write_member(const json_token_t *key, const json_token_t *value, void *arg)
+{
+    mp_writer_t *writer = (mp_writer_t *)arg;
+    write_string(writer, key);
+    return write_value(writer, value);
+}
+
+static bool write_item(const json_token_t *item, void *arg)
+{
+    return write_value((mp_writer_t *)arg, item);
+}
+
+/* Containers are walked twice, once to count for the header; nesting is bounded by the scanner. */
+static bool write_value(mp_writer_t *writer, const json_token_t *token)
+{
+    size_t count = 0;
+
+    switch (token->type) {
+    case JSON_SCAN_STRING:
+        write_string(writer, token);
+        return true;
+    case JSON_SCAN_NUMBER:
+        write_number(writer, token);
+        return true;
+    case JSON_SCAN_TRUE:
+        put_byte(writer, 0xC3);
+        return true;
+    case JSON_SCAN_FALSE:
+        put_byte(writer, 0xC2);
+        return true;
+    case JSON_SCAN_NULL:
+        put_byte(writer, 0xC0);
+        return true;
+    case JSON_SCAN_OBJECT:
+        json_scan_object(token->start, token->len, count_member, &count);
+        put_header(writer, 0x80, 16, 0xDE, count);
+        return json_scan_object(token->start, token->len, write_member, writer);
+    case JSON_SCAN_ARRAY:
+        json_scan_array(token, count_item, &count);
+        put_header(writer, 0x90, 16, 0xDC, count);
+        return json_scan_array(token, write_item, writer);
+    default:
+        return false;
+    }
+}
+
+size_t msgpack_from_json(const char *src, size_t len, uint8_t *out, size_t cap)
+{
+    size_t count = 0;
+    if (src == NULL || !json_scan_object(src, len, count_member, &count)) {
+        return 0;
+    }
+
+    mp_writer_t writer = { .out = out, .cap = cap };
+    put_header(&writer, 0x80, 16, 0xDE, count);
+    if (!json_scan_object(src, len, write_member, &writer)) {
+        return 0;
+    }
+    return writer.len;
+}
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} mp_reader_t;
+
+static bool take(mp_reader_t *reader, size_t len, const uint8_t **data)
+{
+    if ((size_t)(reader->end - reader->p) < len) {
+        return false;
+    }
+    *data = reader->p;
+    reader->p += len;
+    return true;
+}
+
+static bool take_be(mp_reader_t *reader, int bytes, uint64_t *value)
+{
+    const uint8_t *data = NULL;
+    if (!take(reader, (size_t)bytes, &data)) {
+        return false;
+    }
+    *value = 0;
+    for (int i = 0; i < bytes; i++) {
+        *value = (*value << 8) | data[i];
+    }
+    return true;
+}
+
+static bool read_value(mp_reader_t *reader, json_writer_t *writer, int depth);
+
+static bool read_string(mp_reader_t *reader, size_t len, json_writer_t *writer)
+{
+    const uint8_t *data = NULL;
+    if (!take(reader, len, &data)) {
+        return false;
+    }
+    json_writer_string_n(writer, (const char *)data, len);
+    return true;
+}
+
+/* Same shortest round-trip formatting cJSON uses for non-integers. */
+static bool read_double(double value, json_writer_t *writer)
+{
+    char buf[32];
+    if (!isfinite(value)) {
+        return false;
+    }
+    int len = snprintf(buf, sizeof(buf), "%1.15g", value);
+    if (strtod(buf, NULL) != value) {
+        len = snprintf(buf, sizeof(buf), "%1.17g", value);
+    }
+    json_writer_raw(writer, buf, (size_t)len);
+    return true;
+}
+
+static bool read_map(mp_reader_t *reader, size_t count, json_writer_t *writer, int depth)
+{
+    JSON_WRITER_LITERAL(writer, "{");
+    for (size_t i = 0; i < count; i++) {
+        uint64_t len = 0;
+        if (reader->p >= reader->end) {
+            return false;
+        }
+        uint8_t tag = *reader->p++;
+        if ((tag & 0xE0) == 0xA0) {
+            len = tag & 0x1F;
+        } else if (tag < 0xD9 || tag > 0xDB || !take_be(reader, 1 << (tag - 0xD9), &len)) {
+            return false;
+        }
+
+        if (i > 0) {
+            JSON_WRITER_LITERAL(writer, ",");
+        }
+        if (!read_string(reader, (size_t)len, writer)) {
+            return false;
+        }
+        JSON_WRITER_LITERAL(writer, ":");
+        if (!read_value(reader, writer, depth + 1)) {
+            return false;
+        }
+    }
+    JSON_WRITER_LITERAL(writer, "}");
+    return true;
+}
+
+static bool read_array(mp_reader_t *reader, size_t count, json_writer_t *writer, int depth)
+{
+    JSON_WRITER_LITERAL(writer, "[");
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) {
+            JSON_WRITER_LITERAL(writer, ",");
+        }
+        if (!read_value(reader, writer, depth + 1)) {
+            return false;
+        }
+    }
+    JSON_WRITER_LITERAL(writer, "]");
+    return true;
+}
+
+static bool read_value(mp_reader_t *reader, json_writer_t *writer, int depth)
+{
+    uint64_t value = 0;
+
+    if (depth > JSON_SCAN_MAX_DEPTH || reader->p >= reader->end) {
+        return false;
+    }
+
+    uint8_t tag = *reader->p++;
+    if (tag < 0x80) {
+        json_writer_uint(writer, tag);
+        return true;
+    }
+    if (tag >= 0xE0) {
+        json_writer_int(writer, (int8_t)tag);
+        return true;
+    }
+    if (tag <= 0x8F) {
+        return read_map(reader, tag & 0x0F, writer, depth);
+    }
+    if (tag <= 0x9F) {
+        return read_array(reader, tag & 0x0F, writer, depth);
+    }
+    if (tag <= 0xBF) {
+        return read_string(reader, tag & 0x1F, writer);
+    }
+
+    switch (tag) {
+    case 0xC0:
+        JSON_WRITER_LITERAL(writer, "null");
+        return true;
+    case 0xC2:
+        json_writer_bool(writer, false);
+        return true;
+    case 0xC3:
+        json_writer_bool(writer, true);
+        return true;
+    case 0xCA: {
+        float f;
+        uint32_t bits;
+        if (!take_be(reader, 4, &value)) {
+            return false;
+        }
+        bits = (uint32_t)value;
+        memcpy(&f, &bits, sizeof(f));
+        return read_double(f, writer);
+    }
+    case 0xCB: {
+        double d;
+        if (!take_be(reader, 8, &value)) {
+            return false;
+        }
+        memcpy(&d, &value, sizeof(d));
+        return read_double(d, writer);
+    }
+    case 0xCC:
+    case 0xCD:
+    case 0xCE:
+    case 0xCF:
+        if (!take_be(reader, 1 << (tag - 0xCC), &value)) {
+            return false;
+        }
+        json_writer_uint(writer, value);
+        return true;
+    case 0xD0:
+    case 0xD1:
+    case 0xD2:
+    case 0xD3: {
+        int bytes = 1 << (tag - 0xD0);
+        if (!take_be(reader, bytes, &value)) {
+            return false;
+        }
+        int shift = 64 - 8 * bytes;
+        json_writer_int(writer, (int64_t)(value << shift) >> shift);
+        return true;
+    }
+    case 0xD9:
+    case 0xDA:
+    case 0xDB:
+        return take_be(reader, 1 << (tag - 0xD9), &value) && read_string(reader, (size_t)value, writer);
+    case 0xDC:
+    case 0xDD:
+        return take_be(reader, tag == 0xDC ? 2 : 4, &value) && read_array(reader, (size_t)value, writer, depth);
+    case 0xDE:
+    case 0xDF:
+        return take_be(reader, tag == 0xDE ? 2 : 4, &value) && read_map(reader, (size_t)value, writer, depth);
+    default:
+        return false;
+    }
+}
+
+bool msgpack_to_json(const uint8_t *src, size_t len, json_writer_t *writer)
+{
+    if (src == NULL || len == 0 || writer == NULL) {
+        return false;
+    }
+
+    uint8_t tag = src[0];
+    if ((tag & 0xF0) != 0x80 && tag != 0xDE && tag != 0xDF) {
+        return false;
+    }
+
+    mp_reader_t reader = { .p = src, .end = src + len };
+    return read_value(&reader, writer, 0) && reader.p == reader.end;
+}
+
+/* Length of the string that starts at reader, or false when the next value is not a string. */
+static bool take_string(mp_reader_t *reader, const uint8_t **data, size_t *len)
+{
+    uint64_t value = 0;
+    if (reader->p >= reader->end) {
+        return false;
+    }
+
+    uint8_t tag = *reader->p++;
+    if ((tag & 0xE0) == 0xA0) {
+        value = tag & 0x1F;
+    } else if (tag < 0xD9 || tag > 0xDB || !take_be(reader, 1 << (tag - 0xD9), &value)) {
+        return false;
+    }
+    *len = (size_t)value;
+    return take(reader, *len, data);
+}
+
+static bool skip_value(mp_reader_t *reader, int depth)
+{
+    const uint8_t *data = NULL;
+    uint64_t count = 0;
+
+    if (depth > JSON_SCAN_MAX_DEPTH || reader->p >= reader->end) {
+        return false;
+    }
+
+    uint8_t tag = *reader->p;
+    if ((tag & 0xE0) == 0xA0 || (tag >= 0xD9 && tag <= 0xDB)) {
+        size_t len = 0;
+        return take_string(reader, &data, &len);
+    }
+    reader->p++;
+    if (tag < 0x80 || tag >= 0xE0 || tag == 0xC0 || tag == 0xC2 || tag == 0xC3) {
+        return true;
+    }
+
+    bool map = false;
+    if (tag <= 0x8F) {
+        count = tag & 0x0F;
+        map = true;
+    } else if (tag <= 0x9F) {
+        count = tag & 0x0F;
+    } else {
+        switch (tag) {
+        case 0xCA:
+            return take(reader, 4, &data);
+        case 0xCB:
+            return take(reader, 8, &data);
+        case 0xCC:
+        case 0xCD:
+        case 0xCE:
+        case 0xCF:
+            return take(reader, (size_t)1 << (tag - 0xCC), &data);
+        case 0xD0:
+        case 0xD1:
+        case 0xD2:
+        case 0xD3:
+            return take(reader, (size_t)1 << (tag - 0xD0), &data);
+        case 0xDC:
+        case 0xDD:
+            if (!take_be(reader, tag == 0xDC ? 2 : 4, &count)) {
+                return false;
+            }
+            break;
+        case 0xDE:
+        case 0xDF:
+            if (!take_be(reader, tag == 0xDE ? 2 : 4, &count)) {
+                return false;
+            }
+            map = true;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    for (uint64_t i = 0; i < count * (map ? 2 : 1); i++) {
+        if (!skip_value(reader, depth + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool msgpack_map_string(const uint8_t *src, size_t len, const char *key, const char **str, size_t *str_len)
+{
+    uint64_t count = 0;
+
+    if (src == NULL || len == 0 || key == NULL || str == NULL || str_len == NULL) {
+        return false;
+    }
+
+    mp_reader_t reader = { .p = src + 1, .end = src + len };
+    if ((src[0] & 0xF0) == 0x80) {
+        count = src[0] & 0x0F;
+    } else if ((src[0] != 0xDE && src[0] != 0xDF) || !take_be(&reader, src[0] == 0xDE ? 2 : 4, &count)) {
+        return false;
+    }
+
+    size_t key_len = strlen(key);
+    for (uint64_t i = 0; i < count; i++) {
+        const uint8_t *name = NULL;
+        size_t name_len = 0;
+        if (!take_string(&reader, &name, &name_len)) {
+            return false;
+        }
+        if (name_len == key_len && strncasecmp((const char *)name, key, key_len) == 0) {
+            const uint8_t *value = NULL;
+            if (!take_string(&reader, &value, str_len)) {
+                return false;
+            }
+            *str = (const char *)value;
+            return true;
+        }
+        if (!skip_value(&reader, 1)) {
+            return false;
+        }
+    }
+    return false;
+}
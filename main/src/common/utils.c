@@ -42,76 +42,18 @@ bool json_array_contains_string(cJSON *array, const char *value)
     return false;
 }
 
-int64_t device_uptime_s(void)
-{
-    return esp_timer_get_time() / 1000000LL;
-}
-
-static int time_sync_threshold(int count)
+uint32_t hash_string(const char *str, size_t len)
 {
-    if (count <= 0) {
-        return 0;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)str[i]) * 16777619u;
     }
-    return (count * 2 + 2) / 3;
+    return hash != 0 ? hash : 1;
 }
 
-static bool consensus_offset_s(app_context_t *ctx, int64_t *offset_out)
+int64_t device_uptime_s(void)
 {
-    int64_t offsets[MAX_CLIENTS];
-    int count = 0;
-    bool found = false;
-    int64_t selected_total = 0;
-    int selected_count = 0;
-
-    if (ctx == NULL || offset_out == NULL || ctx->client_mutex == NULL) {
-        return false;
-    }
-
-    if (xSemaphoreTake(ctx->client_mutex, pdMS_TO_TICKS(20)) != pdTRUE) {
-        return false;
-    }
-
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (!ctx->client_slots[i].active ||
-            !ctx->client_slots[i].joined ||
-            !ctx->client_slots[i].time_offset_valid) {
-            continue;
-        }
-        offsets[count++] = ctx->client_slots[i].time_offset_s;
-    }
-
-    xSemaphoreGive(ctx->client_mutex);
-
-    int required = time_sync_threshold(count);
-    if (required == 0) {
-        return false;
-    }
-
-    for (int i = 0; i < count; i++) {
-        int64_t total = 0;
-        int cluster_count = 0;
-        int64_t lower = offsets[i];
-        int64_t upper = lower + TIME_SYNC_TOLERANCE_S;
-        for (int j = 0; j < count; j++) {
-            if (offsets[j] >= lower && offsets[j] <= upper) {
-                total += offsets[j];
-                cluster_count++;
-            }
-        }
-
-        if (cluster_count >= required && cluster_count > selected_count) {
-            selected_total = total;
-            selected_count = cluster_count;
-            found = true;
-        }
-    }
-
-    if (!found) {
-        return false;
-    }
-
-    *offset_out = selected_total / selected_count;
-    return true;
+    return esp_timer_get_time() / 1000000LL;
 }
 
 int64_t current_timestamp_s(app_context_t *ctx)
@@ -123,12 +65,10 @@ int64_t current_timestamp_s(app_context_t *ctx)
     }
 
     int64_t uptime = device_uptime_s();
-    int64_t offset = 0;
-    if (consensus_offset_s(ctx, &offset)) {
-        int64_t consensus_now = uptime + offset;
-        if (consensus_now >= VALID_EPOCH_START_S && consensus_now <= VALID_EPOCH_END_S) {
-            return consensus_now;
-        }
+    int64_t offset = ctx ? atomic_load_explicit(&ctx->time_consensus_offset_s, memory_order_relaxed) : 0;
+    int64_t consensus_now = uptime + offset;
+    if (offset != 0 && consensus_now >= VALID_EPOCH_START_S && consensus_now <= VALID_EPOCH_END_S) {
+        return consensus_now;
     }
 
     return uptime;
@@ -9,12 +9,17 @@
 #include "nvs_flash.h"
 
 #include "app_context.h"
+#include "chat/groups.h"
+#include "chat/history.h"
+#include "chat/persist.h"
 #include "chat/sessions.h"
 #include "common/settings.h"
 #include "network/dns_server.h"
 #include "network/softap.h"
 #include "server/http_server.h"
 #include "storage/message_id_store.h"
+#include "storage/message_log.h"
+#include "storage/mount.h"
 
 static const char *TAG = "CHAT_MAIN";
 
@@ -34,7 +39,10 @@ void app_main(void)
 
     g_app_context.client_mutex = xSemaphoreCreateMutex();
     g_app_context.message_mutex = xSemaphoreCreateMutex();
-    assert(g_app_context.client_mutex && g_app_context.message_mutex);
+    g_app_context.message_log_mutex = xSemaphoreCreateMutex();
+    g_app_context.group_mutex = xSemaphoreCreateMutex();
+    assert(g_app_context.client_mutex && g_app_context.message_mutex && g_app_context.message_log_mutex &&
+           g_app_context.group_mutex);
 
     chat_message_id_state_t id_state = { 0 };
     esp_err_t id_ret = chat_message_ids_load(&id_state);
@@ -42,12 +50,35 @@ void app_main(void)
         ESP_LOGW(TAG, "Message ids may not persist until NVS recovers: %s", esp_err_to_name(id_ret));
     }
     g_app_context.message_id_counter = id_state.current_id;
+    g_app_context.message_id_lease = id_state.lease_id;
     g_app_context.boot_start_id = id_state.boot_start_id;
 
+    chat_history_init(&g_app_context);
+
+    esp_err_t storage_ret = example_mount_storage(STORAGE_BASE_PATH);
+    if (storage_ret == ESP_OK) {
+        storage_ret = chat_message_log_open(&g_app_context.message_log, STORAGE_BASE_PATH);
+    }
+    if (storage_ret == ESP_OK) {
+        chat_groups_load(&g_app_context, STORAGE_BASE_PATH);
+        chat_history_restore_from_log(&g_app_context);
+        esp_err_t persist_ret = chat_persist_start(&g_app_context);
+        if (persist_ret != ESP_OK) {
+            ESP_LOGW(TAG, "Storage task unavailable, messages are written inline: %s", esp_err_to_name(persist_ret));
+        }
+    } else {
+        ESP_LOGW(TAG, "Message bodies will not survive a reboot: %s", esp_err_to_name(storage_ret));
+    }
+
     chat_settings_load(&g_app_context);
     chat_softap_start(&g_app_context);
 
     chat_dns_start();
+    esp_err_t presence_ret = chat_sessions_start_presence(&g_app_context);
+    if (presence_ret != ESP_OK) {
+        ESP_LOGW(TAG, "Presence task unavailable, online users are sent on join and on request: %s",
+                 esp_err_to_name(presence_ret));
+    }
     chat_sessions_start_heartbeat(&g_app_context);
     chat_http_start_server(&g_app_context);
 }
@@ -9,21 +9,24 @@
 
 #include "chat/protocol.h"
 #include "chat/sessions.h"
+#include "common/deflate.h"
+#include "common/json_writer.h"
+#include "common/msgpack.h"
 #include "common/utils.h"
 
 static const char *TAG = "CHAT_WS";
 
-esp_err_t chat_ws_send_text(app_context_t *ctx, int fd, const char *payload)
+static esp_err_t send_frame(app_context_t *ctx, int fd, httpd_ws_type_t type, const void *data, size_t len)
 {
-    if (ctx == NULL || ctx->server == NULL || payload == NULL || fd < 0) {
+    if (ctx == NULL || ctx->server == NULL || data == NULL || fd < 0) {
         return ESP_ERR_INVALID_ARG;
     }
 
     httpd_ws_frame_t ws_pkt;
     memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
-    ws_pkt.payload = (uint8_t *)payload;
-    ws_pkt.len = strlen(payload);
+    ws_pkt.type = type;
+    ws_pkt.payload = (uint8_t *)data;
+    ws_pkt.len = len;
 
     if (ctx->httpd_task_handle != NULL && xTaskGetCurrentTaskHandle() != ctx->httpd_task_handle) {
         return httpd_ws_send_data(ctx->server, fd, &ws_pkt);
@@ -32,67 +35,193 @@ esp_err_t chat_ws_send_text(app_context_t *ctx, int fd, const char *payload)
     return httpd_ws_send_frame_async(ctx->server, fd, &ws_pkt);
 }
 
-void chat_ws_broadcast(app_context_t *ctx, const char *payload)
+/*
+ * One outbound JSON payload and the frames made from it so far, indexed by CHAT_WIRE_* flags.
+ * Each variant is built on first use and shared by every recipient that wants it, so a broadcast
+ * is packed and compressed at most once. A variant that cannot be built, or that deflate would
+ * not shrink, falls back to the next simpler one and ultimately to the JSON text.
+ */
+typedef struct {
+    const char *json;
+    size_t json_len;
+    uint8_t *data[CHAT_WIRE_MSGPACK + CHAT_WIRE_DEFLATE + 1];
+    size_t len[CHAT_WIRE_MSGPACK + CHAT_WIRE_DEFLATE + 1];
+    bool built[CHAT_WIRE_MSGPACK + CHAT_WIRE_DEFLATE + 1];
+} outbound_t;
+
+static void outbound_frame(outbound_t *out, uint8_t wire, httpd_ws_type_t *type, const uint8_t **data, size_t *len);
+
+static void pack_variant(outbound_t *out, uint8_t wire)
 {
-    static bool presence_update_in_progress = false;
-    int fds[MAX_CLIENTS];
-    int fd_count = 0;
-    bool closed_client = false;
+    size_t size = msgpack_from_json(out->json, out->json_len, NULL, 0);
+    uint8_t *packed = size > 0 ? malloc(size) : NULL;
+    if (packed != NULL) {
+        out->len[wire] = msgpack_from_json(out->json, out->json_len, packed, size);
+        out->data[wire] = packed;
+    }
+}
+
+/* Compressed frames are binary frames tagged with a byte MessagePack never starts a map with. */
+static void deflate_variant(outbound_t *out, uint8_t wire)
+{
+    httpd_ws_type_t type;
+    const uint8_t *plain = NULL;
+    size_t plain_len = 0;
 
-    if (ctx == NULL || payload == NULL || xSemaphoreTake(ctx->client_mutex, portMAX_DELAY) != pdTRUE) {
+    outbound_frame(out, wire & ~CHAT_WIRE_DEFLATE, &type, &plain, &plain_len);
+    if (plain_len < WS_DEFLATE_MIN_BYTES) {
         return;
     }
 
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (!ctx->client_slots[i].active) {
-            continue;
-        }
+    uint8_t *frame = malloc(plain_len);
+    if (frame == NULL) {
+        return;
+    }
+    size_t len = deflate_raw(plain, plain_len, frame + 1, plain_len - 2, WS_DEFLATE_WINDOW_BITS);
+    if (len == 0) {
+        free(frame);
+        return;
+    }
+    frame[0] = WS_DEFLATE_FRAME_TAG;
+    out->data[wire] = frame;
+    out->len[wire] = len + 1;
+}
 
-        if (fd_count < MAX_CLIENTS) {
-            fds[fd_count++] = ctx->client_slots[i].fd;
+static void outbound_frame(outbound_t *out, uint8_t wire, httpd_ws_type_t *type, const uint8_t **data, size_t *len)
+{
+    wire &= (WS_MSGPACK ? CHAT_WIRE_MSGPACK : 0) | (WS_DEFLATE ? CHAT_WIRE_DEFLATE : 0);
+    while (wire != 0) {
+        if (!out->built[wire]) {
+            out->built[wire] = true;
+            if (wire & CHAT_WIRE_DEFLATE) {
+                deflate_variant(out, wire);
+            } else {
+                pack_variant(out, wire);
+            }
+        }
+        if (out->data[wire] != NULL) {
+            *type = HTTPD_WS_TYPE_BINARY;
+            *data = out->data[wire];
+            *len = out->len[wire];
+            return;
         }
+        wire = (wire & CHAT_WIRE_DEFLATE) ? wire & ~CHAT_WIRE_DEFLATE : 0;
+    }
+
+    *type = HTTPD_WS_TYPE_TEXT;
+    *data = (const uint8_t *)out->json;
+    *len = out->json_len;
+}
+
+static void outbound_free(outbound_t *out)
+{
+    for (size_t i = 0; i < sizeof(out->data) / sizeof(out->data[0]); i++) {
+        free(out->data[i]);
+    }
+}
+
+static esp_err_t send_outbound(app_context_t *ctx, int fd, outbound_t *out, uint8_t wire)
+{
+    httpd_ws_type_t type;
+    const uint8_t *data = NULL;
+    size_t len = 0;
+
+    outbound_frame(out, wire, &type, &data, &len);
+    return send_frame(ctx, fd, type, data, len);
+}
+
+static esp_err_t send_text_frame(app_context_t *ctx, int fd, const char *data, size_t len)
+{
+    if (data == NULL) {
+        return ESP_ERR_INVALID_ARG;
     }
 
-    xSemaphoreGive(ctx->client_mutex);
+    outbound_t out = { .json = data, .json_len = len };
+    uint8_t wire = WS_MSGPACK || WS_DEFLATE ? chat_sessions_wire(ctx, fd) : 0;
+    esp_err_t ret = send_outbound(ctx, fd, &out, wire);
+    outbound_free(&out);
+    return ret;
+}
+
+esp_err_t chat_ws_send_text(app_context_t *ctx, int fd, const char *payload)
+{
+    return send_text_frame(ctx, fd, payload, payload ? strlen(payload) : 0);
+}
 
+esp_err_t chat_ws_send_payload(app_context_t *ctx, int fd, const chat_payload_t *payload)
+{
+    if (payload == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return send_text_frame(ctx, fd, payload->data, payload->len);
+}
+
+/* Sends to every active slot, or only to only_fds when given; one outbound_t serves all of them. */
+static bool broadcast_text(app_context_t *ctx, const char *data, size_t len, const int *only_fds, int only_count)
+{
+    int fds[MAX_CLIENTS];
+    uint8_t wires[MAX_CLIENTS];
+    bool closed_client = false;
+
+    if (ctx == NULL || data == NULL) {
+        return false;
+    }
+
+    int fd_count = chat_sessions_active_fds(ctx, only_fds, only_count, fds, wires);
+
+    outbound_t out = { .json = data, .json_len = len };
     for (int i = 0; i < fd_count; i++) {
-        esp_err_t ret = chat_ws_send_text(ctx, fds[i], payload);
+        esp_err_t ret = send_outbound(ctx, fds[i], &out, wires[i]);
         if (ret != ESP_OK) {
             ESP_LOGW(TAG, "Failed to send to fd=%d: %s", fds[i], esp_err_to_name(ret));
             chat_ws_close_client(ctx, fds[i]);
             closed_client = true;
         }
     }
+    outbound_free(&out);
 
-    if (closed_client && !presence_update_in_progress) {
-        presence_update_in_progress = true;
-        chat_sessions_broadcast_online_users(ctx);
-        presence_update_in_progress = false;
-    }
+    return closed_client;
 }
 
-esp_err_t chat_ws_send_error(app_context_t *ctx, int fd, const char *code, const char *message)
+bool chat_ws_broadcast(app_context_t *ctx, const char *payload)
 {
-    cJSON *root = cJSON_CreateObject();
-    if (root == NULL) {
-        return ESP_ERR_NO_MEM;
+    return broadcast_text(ctx, payload, payload ? strlen(payload) : 0, NULL, 0);
+}
+
+bool chat_ws_broadcast_payload(app_context_t *ctx, const chat_payload_t *payload)
+{
+    if (payload == NULL) {
+        return false;
     }
+    return broadcast_text(ctx, payload->data, payload->len, NULL, 0);
+}
 
-    cJSON_AddStringToObject(root, "type", "error");
-    cJSON_AddStringToObject(root, "from", "server");
-    cJSON_AddStringToObject(root, "code", code ? code : "error");
-    cJSON_AddStringToObject(root, "data", message ? message : "Request failed");
-    cJSON_AddNumberToObject(root, "timestamp", current_timestamp_s(ctx));
+bool chat_ws_multicast_payload(app_context_t *ctx, const int *fds, int fd_count, const chat_payload_t *payload)
+{
+    if (payload == NULL || fds == NULL) {
+        return false;
+    }
+    return broadcast_text(ctx, payload->data, payload->len, fds, fd_count);
+}
 
-    char *payload = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-    if (payload == NULL) {
-        return ESP_ERR_NO_MEM;
+esp_err_t chat_ws_send_error(app_context_t *ctx, int fd, const char *code, const char *message)
+{
+    char payload[WS_ERROR_PAYLOAD_BYTES];
+    json_writer_t writer;
+
+    json_writer_init(&writer, payload, sizeof(payload));
+    JSON_WRITER_LITERAL(&writer, "{\"type\":\"error\",\"from\":\"server\",\"code\":");
+    json_writer_string(&writer, code ? code : "error");
+    JSON_WRITER_LITERAL(&writer, ",\"data\":");
+    json_writer_string(&writer, message ? message : "Request failed");
+    JSON_WRITER_LITERAL(&writer, ",\"timestamp\":");
+    json_writer_int(&writer, current_timestamp_s(ctx));
+    JSON_WRITER_LITERAL(&writer, "}");
+    if (!json_writer_finish(&writer)) {
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    esp_err_t ret = chat_ws_send_text(ctx, fd, payload);
-    free(payload);
-    return ret;
+    return chat_ws_send_text(ctx, fd, payload);
 }
 
 void chat_ws_close_client(app_context_t *ctx, int fd)
@@ -113,7 +242,6 @@ void chat_ws_session_close_handler(httpd_handle_t hd, int sockfd)
 
     if (chat_sessions_remove_by_fd(&g_app_context, sockfd)) {
         ESP_LOGI(TAG, "Closed WebSocket client slot for fd=%d", sockfd);
-        chat_sessions_broadcast_online_users(&g_app_context);
     }
 
     if (sockfd >= 0) {
@@ -121,6 +249,11 @@ void chat_ws_session_close_handler(httpd_handle_t hd, int sockfd)
     }
 }
 
+/* The session context only points into client_slots, which outlive every connection. */
+static void keep_session_slot(void *slot)
+{
+}
+
 esp_err_t chat_ws_handler(httpd_req_t *req)
 {
     app_context_t *ctx = req->user_ctx ? (app_context_t *)req->user_ctx : &g_app_context;
@@ -129,10 +262,15 @@ esp_err_t chat_ws_handler(httpd_req_t *req)
         ctx->httpd_task_handle = xTaskGetCurrentTaskHandle();
     }
 
-    if (!chat_sessions_ensure_slot(ctx, fd)) {
+    chat_session_t session;
+    if (!chat_sessions_ensure_slot(ctx, fd, (client_slot_t *)req->sess_ctx, &session)) {
         ESP_LOGW(TAG, "Max clients reached; rejecting fd=%d", fd);
         return ESP_FAIL;
     }
+    if (req->sess_ctx != session.slot) {
+        req->sess_ctx = session.slot;
+        req->free_ctx = keep_session_slot;
+    }
 
     httpd_ws_frame_t ws_pkt;
     memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
@@ -143,18 +281,14 @@ esp_err_t chat_ws_handler(httpd_req_t *req)
         int err = errno;
         if (err == ECONNRESET || err == ENOTCONN || err == EPIPE || err == ESHUTDOWN) {
             ESP_LOGI(TAG, "Client disconnected, fd=%d", fd);
-            if (chat_sessions_remove_by_fd(ctx, fd)) {
-                chat_sessions_broadcast_online_users(ctx);
-            }
+            chat_sessions_remove_by_fd(ctx, fd);
             return ret;
         }
         if (err == EAGAIN || err == EWOULDBLOCK) {
             return ESP_OK;
         }
 
-        if (chat_sessions_remove_by_fd(ctx, fd)) {
-            chat_sessions_broadcast_online_users(ctx);
-        }
+        chat_sessions_remove_by_fd(ctx, fd);
         ESP_LOGW(TAG, "Frame probe failed for fd=%d ret=%d errno=%d", fd, ret, err);
         return ret;
     }
@@ -166,9 +300,7 @@ esp_err_t chat_ws_handler(httpd_req_t *req)
     if (ws_pkt.len > MAX_WS_PAYLOAD_BYTES) {
         ESP_LOGW(TAG, "Payload too large from fd=%d: %d bytes", fd, (int)ws_pkt.len);
         chat_ws_send_error(ctx, fd, "payload_too_large", "WebSocket payload is too large");
-        if (chat_sessions_remove_by_fd(ctx, fd)) {
-            chat_sessions_broadcast_online_users(ctx);
-        }
+        chat_sessions_remove_by_fd(ctx, fd);
         return ESP_FAIL;
     }
 
@@ -183,34 +315,29 @@ esp_err_t chat_ws_handler(httpd_req_t *req)
     if (ret != ESP_OK) {
         ESP_LOGW(TAG, "Frame receive failed for fd=%d: %s", fd, esp_err_to_name(ret));
         free(buf);
-        if (chat_sessions_remove_by_fd(ctx, fd)) {
-            chat_sessions_broadcast_online_users(ctx);
-        }
+        chat_sessions_remove_by_fd(ctx, fd);
         return ret;
     }
 
     if (ws_pkt.type == HTTPD_WS_TYPE_CLOSE) {
-        if (chat_sessions_remove_by_fd(ctx, fd)) {
-            chat_sessions_broadcast_online_users(ctx);
-        }
+        chat_sessions_remove_by_fd(ctx, fd);
         free(buf);
         return ESP_OK;
     }
 
-    if (ws_pkt.type != HTTPD_WS_TYPE_TEXT) {
-        chat_ws_send_error(ctx, fd, "bad_frame", "Only text WebSocket frames are supported");
+    if (WS_MSGPACK && ws_pkt.type == HTTPD_WS_TYPE_BINARY) {
+        chat_protocol_handle_msgpack(ctx, &session, ws_pkt.payload, ws_pkt.len);
         free(buf);
         return ESP_OK;
     }
 
-    cJSON *root = cJSON_ParseWithLength((const char *)ws_pkt.payload, ws_pkt.len);
-    if (root == NULL || !cJSON_IsObject(root)) {
-        chat_ws_send_error(ctx, fd, "bad_json", "Invalid JSON object");
-    } else {
-        chat_protocol_handle_json(ctx, fd, root);
+    if (ws_pkt.type != HTTPD_WS_TYPE_TEXT) {
+        chat_ws_send_error(ctx, fd, "bad_frame", "Only text and MessagePack WebSocket frames are supported");
+        free(buf);
+        return ESP_OK;
     }
 
-    cJSON_Delete(root);
+    chat_protocol_handle_frame(ctx, &session, (const char *)ws_pkt.payload, ws_pkt.len);
     free(buf);
     return ESP_OK;
 }
@@ -0,0 +1,98 @@
+#include "storage/group_store.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+
+#include "chat_config.h"
+
+static const char *TAG = "GROUP_STORE";
+
+/* 8.3 names, so the store also works on an SD card mounted without long file names. */
+#define STORE_FILE_NAME     "groups.dat"
+#define STORE_TEMP_NAME     "groups.tmp"
+#define STORE_MAX_BYTES     (MAX_GROUPS * (GROUP_MAX_MEMBERS + 1) * (MAX_USER_ID_LEN * 6 + 16) + 64)
+
+static void store_path(const char *base_path, const char *name, char *path, size_t path_size)
+{
+    snprintf(path, path_size, "%s/%s", base_path, name);
+}
+
+static char *read_file(const char *path, size_t *len_out)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    char *data = NULL;
+    long size = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    if (size > 0 && size <= STORE_MAX_BYTES && fseek(file, 0, SEEK_SET) == 0) {
+        data = malloc((size_t)size + 1);
+        if (data != NULL && fread(data, 1, (size_t)size, file) != (size_t)size) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+
+    if (data != NULL) {
+        data[size] = '\0';
+        *len_out = (size_t)size;
+    }
+    return data;
+}
+
+esp_err_t chat_group_store_save(const char *base_path, const char *data, size_t len)
+{
+    char path[MESSAGE_LOG_PATH_BYTES + 16];
+    char temp_path[MESSAGE_LOG_PATH_BYTES + 16];
+
+    if (base_path == NULL || data == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    store_path(base_path, STORE_FILE_NAME, path, sizeof(path));
+    store_path(base_path, STORE_TEMP_NAME, temp_path, sizeof(temp_path));
+
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Failed to create %s", temp_path);
+        return ESP_FAIL;
+    }
+    bool written = fwrite(data, 1, len, file) == len;
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        remove(temp_path);
+        return ESP_FAIL;
+    }
+
+    /* Neither SPIFFS nor FAT renames over an existing file; load() falls back to the temporary copy. */
+    remove(path);
+    if (rename(temp_path, path) != 0) {
+        ESP_LOGW(TAG, "Rename of %s failed; the registry stays in the temporary file", temp_path);
+    }
+    return ESP_OK;
+}
+
+char *chat_group_store_load(const char *base_path, size_t *len_out)
+{
+    char path[MESSAGE_LOG_PATH_BYTES + 16];
+    size_t len = 0;
+
+    if (base_path == NULL) {
+        return NULL;
+    }
+
+    store_path(base_path, STORE_FILE_NAME, path, sizeof(path));
+    char *data = read_file(path, &len);
+    if (data == NULL) {
+        store_path(base_path, STORE_TEMP_NAME, path, sizeof(path));
+        data = read_file(path, &len);
+    }
+    if (data != NULL && len_out != NULL) {
+        *len_out = len;
+    }
+    return data;
+}
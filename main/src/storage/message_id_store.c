@@ -5,10 +5,17 @@
 #include "esp_log.h"
 #include "nvs.h"
 
+#include "chat_config.h"
+
 static const char *TAG = "MSG_ID_STORE";
 static const char *MESSAGE_ID_NAMESPACE = "chatmsg";
 
-esp_err_t chat_message_ids_persist(uint64_t current_id, uint64_t boot_start_id)
+/*
+ * "current" holds the highest id that may have been handed out, i.e. the end of the
+ * reserved lease rather than the last id actually used. Older firmware reads the same
+ * key and resumes after it, so the format stays compatible in both directions.
+ */
+esp_err_t chat_message_ids_reserve(uint64_t lease_id, uint64_t boot_start_id)
 {
     nvs_handle_t nvs;
     esp_err_t ret = nvs_open(MESSAGE_ID_NAMESPACE, NVS_READWRITE, &nvs);
@@ -16,7 +23,7 @@ esp_err_t chat_message_ids_persist(uint64_t current_id, uint64_t boot_start_id)
         return ret;
     }
 
-    ret = nvs_set_u64(nvs, "current", current_id);
+    ret = nvs_set_u64(nvs, "current", lease_id);
     if (ret == ESP_OK) {
         ret = nvs_set_u64(nvs, "boot_start", boot_start_id);
     }
@@ -28,6 +35,14 @@ esp_err_t chat_message_ids_persist(uint64_t current_id, uint64_t boot_start_id)
     return ret;
 }
 
+uint64_t chat_message_ids_next_lease(uint64_t id)
+{
+    if (id >= CHAT_MESSAGE_MAX_SAFE_ID - (MESSAGE_ID_LEASE_SIZE - 1)) {
+        return CHAT_MESSAGE_MAX_SAFE_ID;
+    }
+    return id + (MESSAGE_ID_LEASE_SIZE - 1);
+}
+
 esp_err_t chat_message_ids_load(chat_message_id_state_t *state)
 {
     if (state == NULL) {
@@ -53,12 +68,15 @@ esp_err_t chat_message_ids_load(chat_message_id_state_t *state)
         ? current_id + 1
         : CHAT_MESSAGE_MAX_SAFE_ID;
 
-    esp_err_t persist_ret = chat_message_ids_persist(state->current_id, state->boot_start_id);
+    state->lease_id = chat_message_ids_next_lease(state->boot_start_id);
+
+    esp_err_t persist_ret = chat_message_ids_reserve(state->lease_id, state->boot_start_id);
     if (persist_ret != ESP_OK) {
         ESP_LOGW(TAG, "Failed to persist boot message id state: %s", esp_err_to_name(persist_ret));
+        state->lease_id = state->current_id;
     }
 
-    ESP_LOGI(TAG, "Message id state: current=%" PRIu64 " boot_start=%" PRIu64,
-             state->current_id, state->boot_start_id);
+    ESP_LOGI(TAG, "Message id state: current=%" PRIu64 " boot_start=%" PRIu64 " lease=%" PRIu64,
+             state->current_id, state->boot_start_id, state->lease_id);
     return persist_ret == ESP_OK ? ESP_OK : persist_ret;
 }
@@ -0,0 +1,499 @@
+#include "storage/message_log.h"
+
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "MSG_LOG";
+
+#define RECORD_MAGIC        0x474c4d43u
+#define RECORD_HEADER_BYTES 20
+#define SEGMENT_NAME_PREFIX "msg"
+#define SEGMENT_NAME_SUFFIX ".log"
+
+/* Records are little-endian: magic, payload length, id, then CRC-32 over the id bytes and payload. */
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ data[i]) & 0x0f] ^ (crc >> 4);
+        crc = table[(crc ^ (data[i] >> 4)) & 0x0f] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+static void put_u32(uint8_t *dst, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        dst[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static void put_u64(uint8_t *dst, uint64_t value)
+{
+    for (int i = 0; i < 8; i++) {
+        dst[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint32_t get_u32(const uint8_t *src)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t)src[i] << (8 * i);
+    }
+    return value;
+}
+
+static uint64_t get_u64(const uint8_t *src)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)src[i] << (8 * i);
+    }
+    return value;
+}
+
+static void segment_path(const chat_message_log_t *log, uint32_t seq, char *path, size_t path_size)
+{
+    snprintf(path, path_size, "%s/" SEGMENT_NAME_PREFIX "%05" PRIu32 SEGMENT_NAME_SUFFIX, log->base_path, seq);
+}
+
+static bool parse_segment_name(const char *name, uint32_t *seq_out)
+{
+    size_t prefix_len = strlen(SEGMENT_NAME_PREFIX);
+    size_t suffix_len = strlen(SEGMENT_NAME_SUFFIX);
+    size_t len = strlen(name);
+    if (len <= prefix_len + suffix_len ||
+        strncmp(name, SEGMENT_NAME_PREFIX, prefix_len) != 0 ||
+        strcmp(name + len - suffix_len, SEGMENT_NAME_SUFFIX) != 0) {
+        return false;
+    }
+
+    uint32_t seq = 0;
+    for (size_t i = prefix_len; i < len - suffix_len; i++) {
+        if (name[i] < '0' || name[i] > '9') {
+            return false;
+        }
+        seq = seq * 10 + (uint32_t)(name[i] - '0');
+    }
+
+    *seq_out = seq;
+    return true;
+}
+
+static bool ensure_read_buf(chat_message_log_t *log, size_t len)
+{
+    if (log->read_buf_size > len) {
+        return true;
+    }
+
+    char *grown = realloc(log->read_buf, len + 1);
+    if (grown == NULL) {
+        return false;
+    }
+    log->read_buf = grown;
+    log->read_buf_size = len + 1;
+    return true;
+}
+
+static void segment_reset(chat_message_log_segment_t *segment, uint32_t seq)
+{
+    free(segment->index);
+    memset(segment, 0, sizeof(*segment));
+    segment->seq = seq;
+}
+
+static bool segment_note_record(chat_message_log_segment_t *segment, uint64_t id, uint32_t offset)
+{
+    if (segment->record_count % MESSAGE_LOG_INDEX_STRIDE == 0) {
+        if (segment->index_count == segment->index_capacity) {
+            int capacity = segment->index_capacity ? segment->index_capacity * 2 : 8;
+            chat_message_log_index_entry_t *grown = realloc(segment->index, capacity * sizeof(*grown));
+            if (grown == NULL) {
+                return false;
+            }
+            segment->index = grown;
+            segment->index_capacity = capacity;
+        }
+        segment->index[segment->index_count].id = id;
+        segment->index[segment->index_count].offset = offset;
+        segment->index_count++;
+    }
+
+    if (segment->record_count == 0) {
+        segment->first_id = id;
+    }
+    segment->last_id = id;
+    segment->record_count++;
+    return true;
+}
+
+/* Reads one record at the current position. Returns false at end of data or on any damage. */
+static bool read_record(chat_message_log_t *log, FILE *file, uint64_t *id_out, size_t *len_out)
+{
+    uint8_t header[RECORD_HEADER_BYTES];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) || get_u32(header) != RECORD_MAGIC) {
+        return false;
+    }
+
+    uint32_t len = get_u32(header + 4);
+    if (len == 0 || len > MAX_LOG_RECORD_BYTES || !ensure_read_buf(log, len)) {
+        return false;
+    }
+    if (fread(log->read_buf, 1, len, file) != len) {
+        return false;
+    }
+
+    uint32_t crc = crc32_update(0, header + 8, 8);
+    crc = crc32_update(crc, (const uint8_t *)log->read_buf, len);
+    if (crc != get_u32(header + 16)) {
+        return false;
+    }
+
+    log->read_buf[len] = '\0';
+    *id_out = get_u64(header + 8);
+    *len_out = len;
+    return true;
+}
+
+static esp_err_t scan_segment(chat_message_log_t *log, chat_message_log_segment_t *segment, uint64_t min_id,
+                              bool *damaged_out)
+{
+    char path[MESSAGE_LOG_PATH_BYTES + 16];
+    segment_path(log, segment->seq, path, sizeof(path));
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t offset = 0;
+    uint64_t previous_id = min_id;
+    uint64_t id = 0;
+    size_t len = 0;
+    while (read_record(log, file, &id, &len)) {
+        if (id <= previous_id || !segment_note_record(segment, id, offset)) {
+            break;
+        }
+        previous_id = id;
+        offset += RECORD_HEADER_BYTES + (uint32_t)len;
+    }
+
+    *damaged_out = fseek(file, 0, SEEK_END) != 0 || ftell(file) != (long)offset;
+    segment->size = offset;
+    fclose(file);
+    return ESP_OK;
+}
+
+static void drop_oldest_segment(chat_message_log_t *log)
+{
+    char path[MESSAGE_LOG_PATH_BYTES + 16];
+    segment_path(log, log->segments[0].seq, path, sizeof(path));
+    remove(path);
+
+    free(log->segments[0].index);
+    memmove(&log->segments[0], &log->segments[1], (log->segment_count - 1) * sizeof(log->segments[0]));
+    log->segment_count--;
+    memset(&log->segments[log->segment_count], 0, sizeof(log->segments[0]));
+}
+
+static esp_err_t start_segment(chat_message_log_t *log)
+{
+    uint32_t seq = log->segment_count > 0 ? log->segments[log->segment_count - 1].seq + 1 : 1;
+
+    if (log->active != NULL) {
+        fclose(log->active);
+        log->active = NULL;
+    }
+    while (log->segment_count >= MESSAGE_LOG_MAX_SEGMENTS) {
+        drop_oldest_segment(log);
+    }
+
+    char path[MESSAGE_LOG_PATH_BYTES + 16];
+    segment_path(log, seq, path, sizeof(path));
+    log->active = fopen(path, "wb");
+    if (log->active == NULL) {
+        ESP_LOGE(TAG, "Failed to create %s", path);
+        return ESP_FAIL;
+    }
+
+    segment_reset(&log->segments[log->segment_count], seq);
+    log->segment_count++;
+    return ESP_OK;
+}
+
+static int compare_seq(const void *a, const void *b)
+{
+    uint32_t lhs = *(const uint32_t *)a;
+    uint32_t rhs = *(const uint32_t *)b;
+    return lhs < rhs ? -1 : (lhs > rhs ? 1 : 0);
+}
+
+esp_err_t chat_message_log_open(chat_message_log_t *log, const char *base_path)
+{
+    if (log == NULL || base_path == NULL || strlen(base_path) >= sizeof(log->base_path)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(log, 0, sizeof(*log));
+    snprintf(log->base_path, sizeof(log->base_path), "%s", base_path);
+
+    uint32_t seqs[MESSAGE_LOG_MAX_SEGMENTS * 2];
+    int seq_count = 0;
+    DIR *dir = opendir(base_path);
+    if (dir == NULL) {
+        ESP_LOGE(TAG, "Unable to open %s", base_path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    struct dirent *entry = NULL;
+    while ((entry = readdir(dir)) != NULL) {
+        uint32_t seq = 0;
+        if (!parse_segment_name(entry->d_name, &seq)) {
+            continue;
+        }
+        if (seq_count == (int)(sizeof(seqs) / sizeof(seqs[0]))) {
+            qsort(seqs, seq_count, sizeof(seqs[0]), compare_seq);
+            memmove(&seqs[0], &seqs[1], (seq_count - 1) * sizeof(seqs[0]));
+            seq_count--;
+        }
+        seqs[seq_count++] = seq;
+    }
+    closedir(dir);
+    qsort(seqs, seq_count, sizeof(seqs[0]), compare_seq);
+
+    int first = seq_count > MESSAGE_LOG_MAX_SEGMENTS ? seq_count - MESSAGE_LOG_MAX_SEGMENTS : 0;
+    for (int i = 0; i < first; i++) {
+        char path[MESSAGE_LOG_PATH_BYTES + 16];
+        segment_path(log, seqs[i], path, sizeof(path));
+        remove(path);
+    }
+
+    bool damaged = false;
+    bool last_damaged = false;
+    for (int i = first; i < seq_count; i++) {
+        chat_message_log_segment_t *segment = &log->segments[log->segment_count];
+        uint64_t min_id = log->segment_count > 0 ? log->segments[log->segment_count - 1].last_id : 0;
+
+        segment_reset(segment, seqs[i]);
+        if (scan_segment(log, segment, min_id, &damaged) != ESP_OK) {
+            continue;
+        }
+        if (damaged) {
+            ESP_LOGW(TAG, "Segment %" PRIu32 " is damaged after %" PRIu32 " bytes; keeping the valid prefix",
+                     segment->seq, segment->size);
+        }
+        if (segment->record_count == 0) {
+            char path[MESSAGE_LOG_PATH_BYTES + 16];
+            segment_path(log, segment->seq, path, sizeof(path));
+            remove(path);
+            segment_reset(segment, 0);
+            continue;
+        }
+        last_damaged = damaged;
+        log->segment_count++;
+    }
+
+    /* Never append behind a torn tail: a damaged last segment stays sealed at its valid prefix. */
+    esp_err_t ret = ESP_OK;
+    chat_message_log_segment_t *last = log->segment_count > 0 ? &log->segments[log->segment_count - 1] : NULL;
+    if (last != NULL && !last_damaged && last->size < MESSAGE_LOG_SEGMENT_BYTES) {
+        char path[MESSAGE_LOG_PATH_BYTES + 16];
+        segment_path(log, last->seq, path, sizeof(path));
+        log->active = fopen(path, "ab");
+    }
+    if (log->active == NULL) {
+        ret = start_segment(log);
+    }
+
+    log->ready = ret == ESP_OK;
+    if (log->ready) {
+        uint64_t earliest = 0;
+        uint64_t latest = 0;
+        chat_message_log_bounds(log, &earliest, &latest);
+        ESP_LOGI(TAG, "Message log ready: segments=%d earliest=%" PRIu64 " latest=%" PRIu64,
+                 log->segment_count, earliest, latest);
+    }
+    return ret;
+}
+
+void chat_message_log_close(chat_message_log_t *log)
+{
+    if (log == NULL) {
+        return;
+    }
+
+    if (log->active != NULL) {
+        fclose(log->active);
+    }
+    for (int i = 0; i < log->segment_count; i++) {
+        free(log->segments[i].index);
+    }
+    free(log->read_buf);
+    memset(log, 0, sizeof(*log));
+}
+
+esp_err_t chat_message_log_append(chat_message_log_t *log, uint64_t id, const char *payload, size_t len)
+{
+    if (log == NULL || !log->ready || payload == NULL || len == 0 || len > MAX_LOG_RECORD_BYTES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint64_t latest_id = 0;
+    chat_message_log_bounds(log, NULL, &latest_id);
+    if (id <= latest_id) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    chat_message_log_segment_t *segment = &log->segments[log->segment_count - 1];
+    if (log->active == NULL ||
+        (segment->record_count > 0 && segment->size + RECORD_HEADER_BYTES + len > MESSAGE_LOG_SEGMENT_BYTES)) {
+        esp_err_t ret = start_segment(log);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        segment = &log->segments[log->segment_count - 1];
+    }
+
+    uint8_t header[RECORD_HEADER_BYTES];
+    put_u32(header, RECORD_MAGIC);
+    put_u32(header + 4, (uint32_t)len);
+    put_u64(header + 8, id);
+    uint32_t crc = crc32_update(0, header + 8, 8);
+    put_u32(header + 16, crc32_update(crc, (const uint8_t *)payload, len));
+
+    if (fwrite(header, 1, sizeof(header), log->active) != sizeof(header) ||
+        fwrite(payload, 1, len, log->active) != len) {
+        /* The segment now ends in a partial record; seal it so the next append starts clean. */
+        ESP_LOGW(TAG, "Append failed for id=%" PRIu64 "; rotating segment", id);
+        fclose(log->active);
+        log->active = NULL;
+        return ESP_FAIL;
+    }
+
+    if (!segment_note_record(segment, id, segment->size)) {
+        ESP_LOGW(TAG, "Index allocation failed at id=%" PRIu64, id);
+    }
+    segment->size += RECORD_HEADER_BYTES + (uint32_t)len;
+    return ESP_OK;
+}
+
+esp_err_t chat_message_log_flush(chat_message_log_t *log)
+{
+    if (log == NULL || !log->ready) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (log->active == NULL || fflush(log->active) == 0) {
+        return ESP_OK;
+    }
+
+    /* Whatever was buffered is now a torn tail; readers stop at the first bad record. */
+    ESP_LOGW(TAG, "Flush failed; rotating segment");
+    fclose(log->active);
+    log->active = NULL;
+    return ESP_FAIL;
+}
+
+bool chat_message_log_bounds(const chat_message_log_t *log, uint64_t *earliest_id, uint64_t *latest_id)
+{
+    uint64_t earliest = 0;
+    uint64_t latest = 0;
+
+    if (log != NULL && log->ready) {
+        for (int i = 0; i < log->segment_count; i++) {
+            if (log->segments[i].record_count == 0) {
+                continue;
+            }
+            if (earliest == 0) {
+                earliest = log->segments[i].first_id;
+            }
+            latest = log->segments[i].last_id;
+        }
+    }
+
+    if (earliest_id != NULL) {
+        *earliest_id = earliest;
+    }
+    if (latest_id != NULL) {
+        *latest_id = latest;
+    }
+    return latest != 0;
+}
+
+static uint32_t segment_seek_offset(const chat_message_log_segment_t *segment, uint64_t since_id)
+{
+    int lo = 0;
+    int hi = segment->index_count - 1;
+    uint32_t offset = 0;
+
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (segment->index[mid].id <= since_id + 1) {
+            offset = segment->index[mid].offset;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return offset;
+}
+
+esp_err_t chat_message_log_read_after(chat_message_log_t *log, uint64_t since_id, int max_records,
+                                      chat_message_log_visit_fn visit, void *arg)
+{
+    if (log == NULL || !log->ready || visit == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (log->active != NULL) {
+        fflush(log->active);
+    }
+
+    int visited = 0;
+    for (int i = 0; i < log->segment_count && visited < max_records; i++) {
+        chat_message_log_segment_t *segment = &log->segments[i];
+        if (segment->record_count == 0 || segment->last_id <= since_id) {
+            continue;
+        }
+
+        char path[MESSAGE_LOG_PATH_BYTES + 16];
+        segment_path(log, segment->seq, path, sizeof(path));
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) {
+            return ESP_ERR_NOT_FOUND;
+        }
+
+        uint32_t offset = segment_seek_offset(segment, since_id);
+        if (fseek(file, (long)offset, SEEK_SET) != 0) {
+            fclose(file);
+            return ESP_FAIL;
+        }
+
+        uint64_t id = 0;
+        size_t len = 0;
+        while (visited < max_records && offset < segment->size && read_record(log, file, &id, &len)) {
+            offset += RECORD_HEADER_BYTES + (uint32_t)len;
+            if (id <= since_id) {
+                continue;
+            }
+            visited++;
+            if (!visit(id, log->read_buf, len, arg)) {
+                fclose(file);
+                return ESP_OK;
+            }
+        }
+        fclose(file);
+    }
+
+    return ESP_OK;
+}
@@ -36,6 +36,8 @@ const conversationList = document.getElementById('conversation-list');
 const userSelectList = document.getElementById('user-select-list');
 const recoverHistoryBtn = document.getElementById('recover-history-btn');
 const historyRecoveryStatus = document.getElementById('history-recovery-status');
+const messageSearchBar = document.getElementById('message-search-bar');
+const messageSearchInput = document.getElementById('message-search-input');
 
 const STORAGE = {
     userId: 'esp-chat-uuid',
@@ -44,6 +46,8 @@ const STORAGE = {
     conversations: 'esp-chat-conversations',
     lastSeenId: 'esp-chat-last-seen-id',
     outbox: 'esp-chat-outbox',
+    historyGaps: 'esp-chat-history-gaps',
+    wire: 'esp-chat-wire',
     theme: 'theme'
 };
 
@@ -51,8 +55,18 @@ const MAX_LOCAL_MESSAGES = 2000;
 const MAX_OUTBOX_MESSAGES = 30;
 const MAX_SAFE_MESSAGE_ID = Number.MAX_SAFE_INTEGER;
 const HISTORY_RECOVERY_WINDOW_MS = 4000;
+const HISTORY_RANGE_LIMIT = 8;
+const HISTORY_RESPONSE_MAX_MESSAGES = 32;
+const DEFAULT_MAX_FRAME_BYTES = 1024;
+const HISTORY_RESPONSE_INTERVAL_MS = 60;
 const DEFAULT_AP_HOST = '192.168.4.1';
 const WS_FALLBACK_DELAY_MS = 250;
+const JOIN_REPLAY_LIMIT = 50;
+const HISTORY_PAGE_SIZE = 30;
+const MAX_HISTORY_GAPS = 8;
+const HISTORY_GAP_RETRY_MS = 1000;
+const HISTORY_SCROLL_THRESHOLD_PX = 40;
+const DEFLATE_FRAME_TAG = 0xc1;
 
 let ws = null;
 let hasJoined = false;
@@ -62,10 +76,20 @@ let wsUrlAttempt = 0;
 let allMessages = [];
 let conversations = {};
 let onlineUsers = new Map();
+let presenceVersion = null;
 let outbox = [];
 let lastSeenId = 0;
 let historyInfo = null;
 let activeRecovery = null;
+let historyCursors = {};
+let historyGaps = [];
+let gapRequestId = null;
+let searchResults = null;
+let activeSearchId = null;
+let wireBinary = false;
+let registeredGroups = new Set();
+let groupSendAwaitingServer = null;
+let inboundQueue = Promise.resolve();
 
 function generateUUID() {
     let d = new Date().getTime();
@@ -126,6 +150,8 @@ function loadState() {
     conversations = readJSON(STORAGE.conversations, {});
     conversations.global = { ...defaultConversation(), ...(conversations.global || {}) };
     outbox = readJSON(STORAGE.outbox, []);
+    historyGaps = readJSON(STORAGE.historyGaps, []).filter((gap) => gap && isSafeMessageId(gap.sinceId) &&
+        isSafeMessageId(gap.beforeId) && gap.beforeId > gap.sinceId + 1);
     lastSeenId = Number(localStorage.getItem(STORAGE.lastSeenId) || 0);
 
     const localMaxId = allMessages
@@ -189,6 +215,11 @@ function targetUsers(msg) {
     return msg && msg.to && Array.isArray(msg.to.users) ? msg.to.users : [];
 }
 
+// Group messages name a server-registered group instead of listing its members.
+function targetGroup(msg) {
+    return msg && msg.to && typeof msg.to.group === 'string' ? msg.to.group : '';
+}
+
 function isMessageForMe(msg) {
     if (!msg || msg.from === 'server') {
         return true;
@@ -196,6 +227,10 @@ function isMessageForMe(msg) {
     if (msg.from === userId || (msg.to && msg.to.all)) {
         return true;
     }
+    if (targetGroup(msg)) {
+        // The server only delivers group messages to members.
+        return true;
+    }
     return targetUsers(msg).includes(userId);
 }
 
@@ -206,6 +241,9 @@ function isMessageVisibleToUser(msg, targetUserId) {
     if (msg.from === targetUserId || (msg.to && msg.to.all)) {
         return true;
     }
+    if (targetGroup(msg)) {
+        return (conversations[targetGroup(msg)]?.members || []).includes(targetUserId);
+    }
     return targetUsers(msg).includes(targetUserId);
 }
 
@@ -219,6 +257,9 @@ function validUserId(value) {
 }
 
 function validMessageTarget(to) {
+    if (to && to.group !== undefined) {
+        return validUserId(to.group) && to.all === false && Array.isArray(to.users) && to.users.length === 0;
+    }
     return to &&
         typeof to === 'object' &&
         typeof to.all === 'boolean' &&
@@ -262,7 +303,8 @@ function comparableMessage(msg) {
         name: msg.name,
         to: {
             all: Boolean(msg.to && msg.to.all),
-            users: targetUsers(msg).slice().sort()
+            users: targetUsers(msg).slice().sort(),
+            group: targetGroup(msg)
         },
         data: msg.data || '',
         timestamp: Number(msg.timestamp) || 0,
@@ -306,7 +348,8 @@ function updateConversationFromMessage(msg) {
     }
 
     if (msg.type === 'newGroup' || msg.groupId) {
-        const members = Array.from(new Set([msg.from, ...targetUsers(msg)].filter(Boolean)));
+        const listed = targetGroup(msg) ? [...(existingConversation?.members || []), ...targetUsers(msg)] : targetUsers(msg);
+        const members = Array.from(new Set([msg.from, ...listed].filter(Boolean)));
         conversations[conversationId] = {
             id: conversationId,
             name: msg.groupName || conversations[conversationId]?.name || 'Group Chat',
@@ -333,7 +376,7 @@ function updateConversationFromMessage(msg) {
     };
 }
 
-function saveIncomingMessage(msg) {
+function saveIncomingMessage(msg, persist = true) {
     rememberSeenId(msg.id);
     if (!isMessageForMe(msg)) {
         return false;
@@ -346,8 +389,10 @@ function saveIncomingMessage(msg) {
 
     allMessages.push(msg);
     updateConversationFromMessage(msg);
-    saveMessages();
-    saveConversations();
+    if (persist) {
+        saveMessages();
+        saveConversations();
+    }
     return true;
 }
 
@@ -427,7 +472,9 @@ function createMessageElement(msg) {
     return item;
 }
 
-function renderMessages() {
+function renderMessages(keepScrollPosition = false) {
+    const previousScrollHeight = messages.scrollHeight;
+    const previousScrollTop = messages.scrollTop;
     messages.innerHTML = '';
     chatTitle.textContent = currentConversation.name;
 
@@ -437,11 +484,20 @@ function renderMessages() {
 
     if (visibleMessages.length === 0) {
         messages.appendChild(createSystemElement('No messages yet.'));
+        loadHistoryIfNeeded();
         return;
     }
 
     visibleMessages.forEach((msg) => messages.appendChild(createMessageElement(msg)));
-    messages.scrollTop = messages.scrollHeight;
+    messages.scrollTop = keepScrollPosition
+        ? previousScrollTop + messages.scrollHeight - previousScrollHeight
+        : messages.scrollHeight;
+}
+
+function loadHistoryIfNeeded() {
+    if (messages.scrollTop <= HISTORY_SCROLL_THRESHOLD_PX) {
+        requestOlderHistory();
+    }
 }
 
 function showSystemMessage(text) {
@@ -501,9 +557,49 @@ function addConversationItem(conversation) {
     conversationList.appendChild(item);
 }
 
+function addSearchResultItem(msg) {
+    const conversation = conversations[conversationForMessage(msg)] || conversations.global;
+    const item = document.createElement('button');
+    item.type = 'button';
+    item.className = 'conversation-item';
+
+    const title = document.createElement('strong');
+    title.textContent = msg.name || shortUserId(msg.from);
+
+    const meta = document.createElement('span');
+    meta.textContent = msg.data;
+
+    const subtitle = document.createElement('small');
+    subtitle.textContent = `${conversation.name} · ${formatTime(msg.timestamp)}`;
+
+    item.appendChild(title);
+    item.appendChild(meta);
+    item.appendChild(subtitle);
+    item.addEventListener('click', () => {
+        currentConversation = conversation;
+        chatContainer.classList.add('visible');
+        conversationListContainer.classList.remove('visible');
+        renderMessages();
+        renderConversationList();
+    });
+
+    conversationList.appendChild(item);
+}
+
 function renderConversationList() {
     conversationList.innerHTML = '';
 
+    if (searchResults) {
+        addConversationSection(`Search results (${searchResults.length})`);
+        if (searchResults.length === 0) {
+            const empty = document.createElement('div');
+            empty.className = 'conversation-empty';
+            empty.textContent = 'No stored messages match.';
+            conversationList.appendChild(empty);
+        }
+        [...searchResults].reverse().forEach(addSearchResultItem);
+    }
+
     addConversationSection(`Me: ${getNickname()} (${userId.slice(0, 8)})`);
     addConversationItem(conversations.global);
 
@@ -543,18 +639,41 @@ function renderConversationList() {
     saveConversations();
 }
 
-function updateOnlineUsers(data) {
-    onlineUsers = new Map();
-    if (Array.isArray(data)) {
-        data.forEach((user) => {
-            if (user && user.id) {
-                onlineUsers.set(user.id, {
-                    id: user.id,
-                    name: user.name || user.id.slice(0, 8)
-                });
+function setOnlineUser(user) {
+    if (user && user.id) {
+        onlineUsers.set(user.id, {
+            id: user.id,
+            name: user.name || user.id.slice(0, 8)
+        });
+    }
+}
+
+// onlineUsers replaces the list; presence carries the changes from version base to version.
+// A delta that does not start at our version means frames were missed, so ask for a snapshot.
+function updateOnlineUsers(msg) {
+    if (msg.type === 'presence') {
+        if (msg.version === presenceVersion) {
+            return;
+        }
+        if (presenceVersion === null || msg.base !== presenceVersion || !Array.isArray(msg.events)) {
+            presenceVersion = null;
+            sendControl('getOnlineUser');
+            return;
+        }
+        msg.events.forEach((event) => {
+            if (event && event.type === 'userLeft') {
+                onlineUsers.delete(event.id);
+            } else if (event && (event.type === 'userJoined' || event.type === 'userRenamed')) {
+                setOnlineUser(event);
             }
         });
+    } else {
+        onlineUsers = new Map();
+        if (Array.isArray(msg.data)) {
+            msg.data.forEach(setOnlineUser);
+        }
     }
+    presenceVersion = Number.isSafeInteger(msg.version) ? msg.version : null;
 
     if (!onlineUsers.has(userId)) {
         onlineUsers.set(userId, { id: userId, name: getNickname() });
@@ -564,9 +683,182 @@ function updateOnlineUsers(data) {
     updateRecoveryControls();
 }
 
+// MessagePack covers the JSON data model only: nil, booleans, numbers, strings, arrays and maps.
+function msgpackEncode(value) {
+    const encoder = new TextEncoder();
+    let buf = new Uint8Array(256);
+    let view = new DataView(buf.buffer);
+    let len = 0;
+
+    function reserve(n) {
+        if (len + n <= buf.length) {
+            return;
+        }
+        const next = new Uint8Array(Math.max(buf.length * 2, len + n));
+        next.set(buf);
+        buf = next;
+        view = new DataView(buf.buffer);
+    }
+
+    function header(fix, fixLimit, tag16, count) {
+        reserve(5);
+        if (count < fixLimit) {
+            view.setUint8(len++, fix | count);
+        } else if (count <= 0xffff) {
+            view.setUint8(len++, tag16);
+            view.setUint16(len, count);
+            len += 2;
+        } else {
+            view.setUint8(len++, tag16 + 1);
+            view.setUint32(len, count);
+            len += 4;
+        }
+    }
+
+    function writeInt(n) {
+        reserve(9);
+        if (n >= 0 && n < 0x80) {
+            view.setUint8(len++, n);
+        } else if (n < 0 && n >= -32) {
+            view.setInt8(len++, n);
+        } else if (n >= 0 && n <= 0xffffffff) {
+            view.setUint8(len++, 0xce);
+            view.setUint32(len, n);
+            len += 4;
+        } else if (n < 0 && n >= -0x80000000) {
+            view.setUint8(len++, 0xd2);
+            view.setInt32(len, n);
+            len += 4;
+        } else {
+            view.setUint8(len++, n >= 0 ? 0xcf : 0xd3);
+            view.setBigInt64(len, BigInt(n));
+            len += 8;
+        }
+    }
+
+    function write(item) {
+        if (item === null || item === undefined) {
+            reserve(1);
+            view.setUint8(len++, 0xc0);
+        } else if (typeof item === 'boolean') {
+            reserve(1);
+            view.setUint8(len++, item ? 0xc3 : 0xc2);
+        } else if (typeof item === 'number') {
+            if (Number.isSafeInteger(item)) {
+                writeInt(item);
+            } else {
+                reserve(9);
+                view.setUint8(len++, 0xcb);
+                view.setFloat64(len, Number.isFinite(item) ? item : 0);
+                len += 8;
+            }
+        } else if (typeof item === 'string') {
+            const bytes = encoder.encode(item);
+            if (bytes.length < 32) {
+                reserve(1);
+                view.setUint8(len++, 0xa0 | bytes.length);
+            } else if (bytes.length <= 0xff) {
+                reserve(2);
+                view.setUint8(len++, 0xd9);
+                view.setUint8(len++, bytes.length);
+            } else {
+                header(0, 0, 0xda, bytes.length);
+            }
+            reserve(bytes.length);
+            buf.set(bytes, len);
+            len += bytes.length;
+        } else if (Array.isArray(item)) {
+            header(0x90, 16, 0xdc, item.length);
+            item.forEach(write);
+        } else {
+            const entries = Object.entries(item).filter(([, v]) => v !== undefined && typeof v !== 'function');
+            header(0x80, 16, 0xde, entries.length);
+            entries.forEach(([key, v]) => {
+                write(key);
+                write(v);
+            });
+        }
+    }
+
+    write(value);
+    return buf.slice(0, len);
+}
+
+function msgpackDecode(buffer) {
+    const view = new DataView(buffer);
+    const bytes = new Uint8Array(buffer);
+    const decoder = new TextDecoder();
+    let pos = 0;
+
+    function take(n) {
+        if (pos + n > bytes.length) {
+            throw new Error('Truncated MessagePack frame');
+        }
+        const at = pos;
+        pos += n;
+        return at;
+    }
+
+    function str(n) {
+        const at = take(n);
+        return decoder.decode(bytes.subarray(at, at + n));
+    }
+
+    function array(n) {
+        const out = [];
+        for (let i = 0; i < n; i++) {
+            out.push(read());
+        }
+        return out;
+    }
+
+    function map(n) {
+        const out = {};
+        for (let i = 0; i < n; i++) {
+            const key = read();
+            out[key] = read();
+        }
+        return out;
+    }
+
+    function read() {
+        const tag = view.getUint8(take(1));
+        if (tag < 0x80) return tag;
+        if (tag >= 0xe0) return tag - 0x100;
+        if (tag <= 0x8f) return map(tag & 0x0f);
+        if (tag <= 0x9f) return array(tag & 0x0f);
+        if (tag <= 0xbf) return str(tag & 0x1f);
+        switch (tag) {
+        case 0xc0: return null;
+        case 0xc2: return false;
+        case 0xc3: return true;
+        case 0xca: return view.getFloat32(take(4));
+        case 0xcb: return view.getFloat64(take(8));
+        case 0xcc: return view.getUint8(take(1));
+        case 0xcd: return view.getUint16(take(2));
+        case 0xce: return view.getUint32(take(4));
+        case 0xcf: return Number(view.getBigUint64(take(8)));
+        case 0xd0: return view.getInt8(take(1));
+        case 0xd1: return view.getInt16(take(2));
+        case 0xd2: return view.getInt32(take(4));
+        case 0xd3: return Number(view.getBigInt64(take(8)));
+        case 0xd9: return str(view.getUint8(take(1)));
+        case 0xda: return str(view.getUint16(take(2)));
+        case 0xdb: return str(view.getUint32(take(4)));
+        case 0xdc: return array(view.getUint16(take(2)));
+        case 0xdd: return array(view.getUint32(take(4)));
+        case 0xde: return map(view.getUint16(take(2)));
+        case 0xdf: return map(view.getUint32(take(4)));
+        default: throw new Error(`Unsupported MessagePack type 0x${tag.toString(16)}`);
+        }
+    }
+
+    return read();
+}
+
 function sendRaw(payload) {
     if (ws && ws.readyState === WebSocket.OPEN) {
-        ws.send(JSON.stringify(payload));
+        ws.send(wireBinary ? msgpackEncode(payload) : JSON.stringify(payload));
         return true;
     }
     return false;
@@ -598,6 +890,9 @@ function flushOutbox() {
     saveOutbox();
     pending.forEach((message) => {
         message.timestamp = Math.floor(Date.now() / 1000);
+        if (targetGroup(message) && !registeredGroups.has(targetGroup(message))) {
+            message.to = { group: targetGroup(message), users: groupMembersExceptSelf(targetGroup(message)) };
+        }
         sendRaw(message);
     });
     showSystemMessage(`Sent ${pending.length} queued message${pending.length > 1 ? 's' : ''}.`);
@@ -661,7 +956,10 @@ function historyMessagePayload(msg) {
         timestamp: Number(msg.timestamp) || 0
     };
 
-    if (msg.type === 'newGroup') {
+    if (targetGroup(msg)) {
+        payload.to.group = targetGroup(msg);
+    }
+    if (msg.type === 'newGroup' || targetGroup(msg)) {
         payload.groupId = msg.groupId;
         payload.groupName = msg.groupName;
     }
@@ -781,9 +1079,40 @@ function handleHistoryInfo(msg) {
         restore_before_id: restoreBeforeId,
         count: Number(msg.count) || 0,
         capacity: Number(msg.capacity) || 0,
-        has_more_before: Boolean(msg.has_more_before)
+        has_more_before: Boolean(msg.has_more_before),
+        max_frame_bytes: Number(msg.max_frame_bytes) || DEFAULT_MAX_FRAME_BYTES
     };
     updateRecoveryControls();
+    loadHistoryIfNeeded();
+}
+
+// Compact summary of the ids this device can serve to peers, e.g. "1-120,150-300". Beyond
+// HISTORY_RANGE_LIMIT runs the smallest gaps are bridged, so the summary may overstate a little.
+function historyRanges() {
+    const ids = allMessages
+        .filter((stored) => !stored.recovered && validHistoryMessage(stored))
+        .map((stored) => Number(stored.id))
+        .sort((a, b) => a - b);
+    const runs = [];
+    ids.forEach((id) => {
+        const last = runs[runs.length - 1];
+        if (last && id <= last[1] + 1) {
+            last[1] = Math.max(last[1], id);
+        } else {
+            runs.push([id, id]);
+        }
+    });
+    while (runs.length > HISTORY_RANGE_LIMIT) {
+        let narrowest = 0;
+        for (let i = 1; i < runs.length - 1; i++) {
+            if (runs[i + 1][0] - runs[i][1] < runs[narrowest + 1][0] - runs[narrowest][1]) {
+                narrowest = i;
+            }
+        }
+        runs[narrowest][1] = runs[narrowest + 1][1];
+        runs.splice(narrowest + 1, 1);
+    }
+    return runs.map(([first, last]) => (first === last ? `${first}` : `${first}-${last}`)).join(',');
 }
 
 function handleHistoryRequest(msg) {
@@ -800,6 +1129,29 @@ function handleHistoryRequest(msg) {
         return;
     }
 
+    // Pack as many messages per frame as the server accepts; a message too large to share a
+    // frame still goes out on its own. Frames are spaced to stay inside the server's history
+    // rate budget.
+    const requestId = msg.requestId.slice(0, 63);
+    const maxFrameBytes = historyInfo?.max_frame_bytes || DEFAULT_MAX_FRAME_BYTES;
+    const frameBytes = (messages) => new TextEncoder().encode(JSON.stringify({
+        type: 'historyResponse',
+        from: userId,
+        name: getNickname(),
+        timestamp: Math.floor(Date.now() / 1000),
+        requestId,
+        to: { all: false, users: [msg.from] },
+        messages
+    })).length;
+    const frames = [];
+    let batch = [];
+    const flush = () => {
+        if (batch.length > 0) {
+            frames.push({ requestId, to: { all: false, users: [msg.from] }, messages: batch });
+            batch = [];
+        }
+    };
+
     allMessages
         .filter((stored) => !stored.recovered)
         .filter((stored) => validHistoryMessage(stored))
@@ -807,12 +1159,16 @@ function handleHistoryRequest(msg) {
         .filter((stored) => isMessageVisibleToUser(stored, msg.from))
         .sort((a, b) => Number(a.id) - Number(b.id))
         .forEach((stored) => {
-            sendControl('historyResponse', {
-                requestId: msg.requestId.slice(0, 63),
-                to: { all: false, users: [msg.from] },
-                message: historyMessagePayload(stored)
-            });
+            const payload = historyMessagePayload(stored);
+            if (batch.length === HISTORY_RESPONSE_MAX_MESSAGES || (batch.length > 0 && frameBytes([...batch, payload]) > maxFrameBytes)) {
+                flush();
+            }
+            batch.push(payload);
         });
+    flush();
+    frames.forEach((frame, index) => {
+        setTimeout(() => sendControl('historyResponse', frame), index * HISTORY_RESPONSE_INTERVAL_MS);
+    });
 }
 
 function handleHistoryResponse(msg) {
@@ -827,22 +1183,251 @@ function handleHistoryResponse(msg) {
         return;
     }
 
-    const result = importRecoveredMessage(msg.message, msg);
-    if (result === 'imported') {
-        activeRecovery.imported++;
-        activeRecovery.changed = true;
-    } else if (result === 'conflict') {
-        activeRecovery.conflicts++;
-    } else if (result === 'duplicate') {
-        activeRecovery.duplicates++;
-    } else {
-        activeRecovery.ignored++;
+    const messages = Array.isArray(msg.messages) ? msg.messages : [msg.message];
+    messages.forEach((message) => {
+        const result = importRecoveredMessage(message, msg);
+        if (result === 'imported') {
+            activeRecovery.imported++;
+            activeRecovery.changed = true;
+        } else if (result === 'conflict') {
+            activeRecovery.conflicts++;
+        } else if (result === 'duplicate') {
+            activeRecovery.duplicates++;
+        } else {
+            activeRecovery.ignored++;
+        }
+    });
+}
+
+function startMessageSearch(event) {
+    event.preventDefault();
+    const query = messageSearchInput.value.trim();
+    if (!query) {
+        searchResults = null;
+        activeSearchId = null;
+        renderConversationList();
+        return;
+    }
+
+    activeSearchId = generateUUID();
+    if (!sendControl('search', { requestId: activeSearchId, query })) {
+        activeSearchId = null;
+        showSystemMessage('Search needs a connection to the ESP32.');
     }
 }
 
+function handleSearchResults(msg) {
+    if (msg.requestId !== activeSearchId) {
+        return;
+    }
+
+    searchResults = (Array.isArray(msg.messages) ? msg.messages : []).filter((stored) => stored && stored.type === 'text');
+    let saved = false;
+    searchResults.forEach((stored) => {
+        saved = saveIncomingMessage(stored, false) || saved;
+    });
+    if (saved) {
+        saveMessages();
+        saveConversations();
+    }
+    renderConversationList();
+}
+
+function handleHistoryBatch(msg) {
+    if (!Array.isArray(msg.messages)) {
+        return;
+    }
+
+    let saved = false;
+    msg.messages.forEach((stored) => {
+        if (stored && (stored.type === 'text' || stored.type === 'newGroup')) {
+            saved = saveIncomingMessage(stored, false) || saved;
+        }
+    });
+
+    if (saved) {
+        saveMessages();
+        saveConversations();
+        renderMessages();
+        renderConversationList();
+    }
+}
+
+function requestOlderHistory() {
+    const conversationId = currentConversation.id;
+    const cursor = historyCursors[conversationId] || { nextBeforeId: 0, hasMore: true };
+    if (!cursor.hasMore || cursor.loading || !ws || ws.readyState !== WebSocket.OPEN) {
+        return;
+    }
+
+    cursor.loading = true;
+    historyCursors[conversationId] = cursor;
+    const sent = sendControl('historyQuery', {
+        requestId: generateUUID(),
+        conversation: conversationId,
+        before_id: cursor.nextBeforeId,
+        limit: HISTORY_PAGE_SIZE
+    });
+    if (!sent) {
+        cursor.loading = false;
+    }
+}
+
+function saveHistoryGaps() {
+    historyGaps = historyGaps.slice(-MAX_HISTORY_GAPS);
+    writeJSON(STORAGE.historyGaps, historyGaps);
+}
+
+// The server left ids in (since_id, before_id) out of the join replay. lastSeenId moves past them
+// with the replay, so the gap is kept until historyQuery pages have covered it.
+function handleHistoryGap(msg) {
+    const sinceId = Number(msg.since_id);
+    const beforeId = Number(msg.before_id);
+    // A first visit has nothing to catch up on; older pages load when the list is scrolled.
+    if (!isSafeMessageId(sinceId) || !isSafeMessageId(beforeId) || sinceId === 0 || beforeId <= sinceId + 1) {
+        return;
+    }
+
+    const merged = { sinceId, beforeId };
+    historyGaps = historyGaps.filter((gap) => {
+        const overlaps = gap.beforeId > merged.sinceId && gap.sinceId < merged.beforeId;
+        if (overlaps) {
+            merged.sinceId = Math.min(merged.sinceId, gap.sinceId);
+            merged.beforeId = Math.max(merged.beforeId, gap.beforeId);
+        }
+        return !overlaps;
+    });
+    historyGaps.push(merged);
+    historyGaps.sort((a, b) => a.beforeId - b.beforeId);
+    saveHistoryGaps();
+    fillHistoryGap();
+}
+
+function fillHistoryGap() {
+    const gap = historyGaps[historyGaps.length - 1];
+    if (!gap || gapRequestId || !ws || ws.readyState !== WebSocket.OPEN) {
+        return;
+    }
+
+    gapRequestId = generateUUID();
+    const sent = sendControl('historyQuery', {
+        requestId: gapRequestId,
+        before_id: gap.beforeId,
+        limit: HISTORY_PAGE_SIZE
+    });
+    if (!sent) {
+        gapRequestId = null;
+    }
+}
+
+function handleGapPage(msg) {
+    gapRequestId = null;
+    const gap = historyGaps[historyGaps.length - 1];
+    let saved = false;
+    (Array.isArray(msg.messages) ? msg.messages : []).forEach((stored) => {
+        if (stored && (stored.type === 'text' || stored.type === 'newGroup')) {
+            saved = saveIncomingMessage(stored, false) || saved;
+        }
+    });
+
+    const nextBeforeId = Number(msg.next_before_id);
+    if (gap) {
+        if (msg.has_more === true && isSafeMessageId(nextBeforeId) && nextBeforeId > gap.sinceId + 1 &&
+            nextBeforeId < gap.beforeId) {
+            gap.beforeId = nextBeforeId;
+        } else {
+            historyGaps.pop();
+        }
+        saveHistoryGaps();
+    }
+
+    if (saved) {
+        saveMessages();
+        saveConversations();
+        renderMessages(true);
+        renderConversationList();
+    }
+    fillHistoryGap();
+}
+
+function handleHistoryPage(msg) {
+    if (gapRequestId && msg.requestId === gapRequestId) {
+        handleGapPage(msg);
+        return;
+    }
+
+    const conversationId = typeof msg.conversation === 'string' ? msg.conversation : currentConversation.id;
+    const nextBeforeId = Number(msg.next_before_id);
+    historyCursors[conversationId] = {
+        nextBeforeId: isSafeMessageId(nextBeforeId) ? nextBeforeId : 0,
+        hasMore: msg.has_more === true && isSafeMessageId(nextBeforeId),
+        loading: false
+    };
+
+    let saved = false;
+    (Array.isArray(msg.messages) ? msg.messages : []).forEach((stored) => {
+        if (stored && (stored.type === 'text' || stored.type === 'newGroup')) {
+            saved = saveIncomingMessage(stored, false) || saved;
+        }
+    });
+
+    if (saved) {
+        saveMessages();
+        saveConversations();
+        renderConversationList();
+        if (conversationId === currentConversation.id) {
+            renderMessages(true);
+        }
+    }
+
+    if (conversationId === currentConversation.id) {
+        loadHistoryIfNeeded();
+    }
+}
+
+function deflateSupported() {
+    try {
+        new DecompressionStream('deflate-raw');
+        return true;
+    } catch (error) {
+        return false;
+    }
+}
+
+async function inflateRaw(bytes) {
+    const stream = new Blob([bytes]).stream().pipeThrough(new DecompressionStream('deflate-raw'));
+    return new Uint8Array(await new Response(stream).arrayBuffer());
+}
+
+// The server answers a join that asked for MessagePack in binary frames; reply in kind from then on.
+// Compressed frames hold whatever the connection would otherwise get, JSON text or MessagePack.
+async function decodeFrame(data) {
+    if (!(data instanceof ArrayBuffer)) {
+        wireBinary = false;
+        return JSON.parse(data);
+    }
+
+    let bytes = new Uint8Array(data);
+    if (bytes[0] === DEFLATE_FRAME_TAG) {
+        bytes = await inflateRaw(bytes.subarray(1));
+        if (bytes[0] === 0x7b) {
+            return JSON.parse(new TextDecoder().decode(bytes));
+        }
+    }
+    wireBinary = true;
+    return msgpackDecode(bytes.buffer.slice(bytes.byteOffset, bytes.byteOffset + bytes.byteLength));
+}
+
+// Inflating is asynchronous, so frames are decoded one after another to keep their order.
 function handleIncoming(event) {
+    inboundQueue = inboundQueue
+        .then(() => decodeFrame(event.data))
+        .then(handleMessage)
+        .catch((error) => console.error('Error parsing WebSocket message:', error));
+}
+
+function handleMessage(msg) {
     try {
-        const msg = JSON.parse(event.data);
 
         if (msg.type === 'ping') {
             sendRaw({ type: 'pong', from: userId, timestamp: Math.floor(Date.now() / 1000) });
@@ -853,6 +1438,26 @@ function handleIncoming(event) {
             rememberSeenId(msg.id);
         }
 
+        if (msg.type === 'searchResults') {
+            handleSearchResults(msg);
+            return;
+        }
+
+        if (msg.type === 'historyPage') {
+            handleHistoryPage(msg);
+            return;
+        }
+
+        if (msg.type === 'historyBatch') {
+            handleHistoryBatch(msg);
+            return;
+        }
+
+        if (msg.type === 'historyGap') {
+            handleHistoryGap(msg);
+            return;
+        }
+
         if (msg.type === 'historyInfo') {
             handleHistoryInfo(msg);
             return;
@@ -868,8 +1473,25 @@ function handleIncoming(event) {
             return;
         }
 
-        if (msg.type === 'onlineUsers') {
-            updateOnlineUsers(msg.data);
+        if (msg.type === 'onlineUsers' || msg.type === 'presence') {
+            updateOnlineUsers(msg);
+            return;
+        }
+
+        if (msg.type === 'error' && msg.code === 'no_history_peers' && activeRecovery) {
+            clearTimeout(activeRecovery.timer);
+            finishHistoryRecovery();
+            setRecoveryStatus('No online device holds the missing history.');
+            return;
+        }
+
+        if (msg.type === 'error' && gapRequestId && (msg.code === 'rate_limited' || msg.code === 'server_busy')) {
+            gapRequestId = null;
+            setTimeout(fillHistoryGap, HISTORY_GAP_RETRY_MS);
+        }
+
+        if (msg.type === 'error' && msg.code === 'unknown_group' && groupSendAwaitingServer) {
+            resendWithGroupMembers(groupSendAwaitingServer);
             return;
         }
 
@@ -882,6 +1504,14 @@ function handleIncoming(event) {
             return;
         }
 
+        const confirmedGroup = targetGroup(msg) || (msg.type === 'newGroup' ? msg.groupId : '');
+        if (confirmedGroup) {
+            registeredGroups.add(confirmedGroup);
+            if (msg.from === userId && groupSendAwaitingServer?.to.group === confirmedGroup) {
+                groupSendAwaitingServer = null;
+            }
+        }
+
         const saved = saveIncomingMessage(msg);
         if (saved) {
             if (msg.type === 'newGroup' && msg.groupId && (msg.from === userId || targetUsers(msg).includes(userId))) {
@@ -891,7 +1521,7 @@ function handleIncoming(event) {
             renderConversationList();
         }
     } catch (error) {
-        console.error('Error parsing WebSocket message:', error);
+        console.error('Error handling WebSocket message:', error);
     }
 }
 
@@ -935,6 +1565,7 @@ function connect() {
 
     try {
         ws = new WebSocket(url);
+        ws.binaryType = 'arraybuffer';
     } catch (error) {
         ws = null;
         if (wsUrlAttempt < urls.length - 1) {
@@ -956,9 +1587,22 @@ function connect() {
         reconnectDelayMs = 1000;
         setStatus('online', 'Connected');
         updateRecoveryControls();
-        sendControl('join', { since_id: lastSeenId });
-        sendControl('getOnlineUser');
+        historyCursors = {};
+        gapRequestId = null;
+        wireBinary = false;
+        registeredGroups = new Set();
+        groupSendAwaitingServer = null;
+        sendControl('join', {
+            since_id: lastSeenId,
+            history_batch: true,
+            history_ranges: historyRanges(),
+            replay_limit: JOIN_REPLAY_LIMIT,
+            encoding: localStorage.getItem(STORAGE.wire) === 'json' ? 'json' : 'msgpack',
+            compression: deflateSupported() ? 'deflate' : 'none',
+            ...(presenceVersion !== null ? { presence_version: presenceVersion } : {})
+        });
         flushOutbox();
+        fillHistoryGap();
     };
 
     ws.onmessage = handleIncoming;
@@ -992,12 +1636,30 @@ function messageTargetForCurrentConversation() {
         return { all: true, users: [] };
     }
     if (currentConversation.type === 'group') {
-        const members = Array.from(new Set([userId, ...(currentConversation.members || [])]));
-        return { all: false, users: members };
+        // Until the server relays the group on this connection, list the members so it can register them.
+        return registeredGroups.has(currentConversation.id)
+            ? { group: currentConversation.id }
+            : { group: currentConversation.id, users: groupMembersExceptSelf(currentConversation.id) };
     }
     return { all: false, users: [currentConversation.id] };
 }
 
+function groupMembersExceptSelf(groupId) {
+    return (conversations[groupId]?.members || []).filter((id) => id !== userId);
+}
+
+// The server evicted or never knew the group: send the message again with its members.
+function resendWithGroupMembers(message) {
+    groupSendAwaitingServer = null;
+    registeredGroups.delete(message.to.group);
+    const users = groupMembersExceptSelf(message.to.group);
+    if (users.length === 0) {
+        showSystemMessage('Server error: Message targets a group the server does not know');
+        return;
+    }
+    sendRaw({ ...message, to: { group: message.to.group, users }, timestamp: Math.floor(Date.now() / 1000) });
+}
+
 function buildOutgoingMessage(text) {
     const message = {
         type: 'text',
@@ -1028,6 +1690,8 @@ function sendMessage(event) {
 
     if (!sendRaw(message)) {
         queueMessage(message);
+    } else if (message.to.group && !message.to.users) {
+        groupSendAwaitingServer = message;
     }
 }
 
@@ -1252,6 +1916,7 @@ backBtn.addEventListener('click', () => {
 });
 
 createGroupBtn.addEventListener('click', openGroupModal);
+messageSearchBar.addEventListener('submit', startMessageSearch);
 createGroupCancel.addEventListener('click', closeGroupModal);
 createGroupConfirm.addEventListener('click', createGroup);
 if (recoverHistoryBtn) {
@@ -1278,6 +1943,8 @@ settingsModal.addEventListener('click', (event) => {
     }
 });
 
+messages.addEventListener('scroll', loadHistoryIfNeeded);
+
 themeSwitch.addEventListener('change', (event) => {
     setTheme(event.target.checked);
 });